@@ -51,6 +51,29 @@ void SwappyGL_setAutoSwapInterval(bool enabled);
 // Swappy will not do any pacing and just submit the frame as soon as possible.
 void SwappyGL_setMaxAutoSwapIntervalNS(uint64_t max_swap_ns);
 
+// Sets the number of frames over which auto-swap interval averages the frame duration.
+// A longer window reacts more slowly to changes in rendering time but is less swayed by
+// occasional long frames. The default is 300 frames (5 seconds at 60Hz). Setting it restarts
+// the averaging.
+void SwappyGL_setAutoSwapIntervalWindow(uint32_t num_frames);
+
+// Chooses how auto-swap interval estimates the frame time, and its margins, e.g. to tune
+// them for a particular title. Setting it restarts the estimation.
+void SwappyGL_setAutoSwapIntervalConfig(const SwappyAutoSwapIntervalConfig* config);
+
+// Toggle low latency mode on/off
+// By default, Swappy only paces when frames are presented, and the app starts each frame as soon
+// as the swap returns. In low latency mode, the swap returns as late as it can while still leaving
+// time for the next frame to make its target vsync, going by the CPU and GPU time predicted from
+// recent frames. This cuts the time from input to display, at the risk of missing the vsync when
+// a frame takes longer than predicted.
+void SwappyGL_setLowLatencyMode(bool enabled);
+
+// Returns the time by which the current frame should be swapped to make its target vsync, in
+// nanoseconds of CLOCK_MONOTONIC, or 0 if there is no prediction yet. The prediction is updated
+// each time SwappyGL_swap returns.
+uint64_t SwappyGL_getFrameDeadlineNS();
+
 // Toggle auto-pipeline mode on/off
 // By default, if auto-swap interval is on, auto-pipelining is on and Swappy will try to reduce
 // latency by scheduling cpu and gpu work in the same pipeline stage, if it fits.
@@ -100,6 +123,19 @@ void SwappyGL_recordFrameStart(EGLDisplay display, EGLSurface surface);
 
 void SwappyGL_getStats(SwappyStats *);
 
+// Toggle per-frame records on/off
+// By default, records are off. While they are on, a SwappyFrameRecord is kept for each swapped
+// frame, in a buffer of a few hundred records that the app drains with SwappyGL_getFrameRecords.
+// Records that don't fit because they are not read quickly enough are dropped. On devices with
+// EGL_ANDROID_get_frame_timestamps, a record is held back for up to 10 swaps until its latch and
+// present times are known.
+void SwappyGL_enableFrameRecords(bool enabled);
+
+// Copy up to max_records of the oldest frame records into records, removing them from the
+// buffer, and return how many were copied. Can be called from any thread, but not from more
+// than one at a time.
+uint32_t SwappyGL_getFrameRecords(SwappyFrameRecord* records, uint32_t max_records);
+
 #ifdef __cplusplus
 };
 #endif
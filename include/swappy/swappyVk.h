@@ -253,6 +253,90 @@ void SwappyVk_setAutoPipelineMode(bool enabled);
  */
 void SwappyVk_setMaxAutoSwapIntervalNS(uint64_t max_swap_ns);
 
+/**
+ * Sets the Auto-Swap-Interval averaging window for all instances.
+ *
+ * Auto-Swap-Interval decides on the swap interval from the average frame
+ * duration over this many frames. The default is 300 frames (5 seconds at
+ * 60Hz). Setting it restarts the averaging.
+ *
+ * Parameters:
+ *
+ *  (IN)  num_frames - length of the window in frames.
+ */
+void SwappyVk_setAutoSwapIntervalWindow(uint32_t num_frames);
+
+/**
+ * Configures Auto-Swap-Interval for all instances.
+ *
+ * Chooses how the frame time is estimated, and the margins used when
+ * fitting the swap interval to it, e.g. to tune them for a particular title.
+ * Setting it restarts the estimation.
+ *
+ * Parameters:
+ *
+ *  (IN)  config - the configuration. Fields left at zero keep their defaults.
+ */
+void SwappyVk_setAutoSwapIntervalConfig(const SwappyAutoSwapIntervalConfig* config);
+
+/**
+ * Enables low latency mode for all instances.
+ *
+ * By default, SwappyVk only paces when frames are presented, and the app
+ * starts each frame as soon as the present returns. In low latency mode, the
+ * present returns as late as it can while still leaving time for the next
+ * frame to make its target vsync, going by the CPU and GPU time predicted
+ * from recent frames. This cuts the time from input to display, at the risk
+ * of missing the vsync when a frame takes longer than predicted.
+ *
+ * Parameters:
+ *
+ *  (IN)  enabled - True means enable, false means disable
+ */
+void SwappyVk_setLowLatencyMode(bool enabled);
+
+/**
+ * Returns the time by which the current frame of a swapchain should be
+ * presented to make its target vsync, in nanoseconds of CLOCK_MONOTONIC, or 0
+ * if there is no prediction yet. The prediction is updated each time
+ * SwappyVk_queuePresent returns.
+ *
+ * Parameters:
+ *
+ *  (IN)  swapchain - The VkSwapchainKHR to query.
+ */
+uint64_t SwappyVk_getFrameDeadlineNS(VkSwapchainKHR swapchain);
+
+/**
+ * Enables per-frame records for all instances.
+ *
+ * While records are enabled, a SwappyFrameRecord is kept for each frame
+ * presented on a swapchain, in a buffer of a few hundred records that the app
+ * drains with SwappyVk_getFrameRecords. Records that don't fit because they
+ * are not read quickly enough are dropped. The latch and present times of
+ * the records are always 0 with Vulkan.
+ *
+ * Parameters:
+ *
+ *  (IN)  enabled - True means enable, false means disable
+ */
+void SwappyVk_enableFrameRecords(bool enabled);
+
+/**
+ * Copies up to max_records of the oldest frame records of a swapchain into
+ * records, removing them from its buffer, and returns how many were copied.
+ * Can be called from any thread, but not from more than one at a time.
+ *
+ * Parameters:
+ *
+ *  (IN)  swapchain - The VkSwapchainKHR to read the records of.
+ *  (OUT) records - Array of at least max_records records.
+ *  (IN)  max_records - The most records to copy.
+ */
+uint32_t SwappyVk_getFrameRecords(VkSwapchainKHR swapchain,
+                                  SwappyFrameRecord* records,
+                                  uint32_t max_records);
+
 /**
  * The fence timeout parameter can be set for devices with faulty
  * drivers. Its default value is 50,000,000.
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // swap interval constant helpers
 #define SWAPPY_SWAP_60FPS (16666667L)
 #define SWAPPY_SWAP_30FPS (33333333L)
@@ -58,4 +60,62 @@ typedef struct SwappyTracer {
     void (*startFrame)(void*, int currentFrame, long currentFrameTimeStampMillis);
     void* userData;
     void (*swapIntervalChanged)(void*);
-} SwappyTracer;
\ No newline at end of file
+} SwappyTracer;
+
+// How auto-swap interval estimates the frame time that it fits the swap interval to.
+typedef enum SwappyFrameTimeEstimate {
+    // Mean over a full window of frames. This is the default.
+    SWAPPY_FRAME_TIME_MEAN = 0,
+    // A percentile over the window, which ignores occasional long frames.
+    SWAPPY_FRAME_TIME_PERCENTILE = 1,
+    // Exponentially weighted mean plus a multiple of the deviation of the frames above it.
+    SWAPPY_FRAME_TIME_EWMA = 2,
+} SwappyFrameTimeEstimate;
+
+// Tuning for auto-swap interval. Fields left at zero keep their defaults.
+typedef struct SwappyAutoSwapIntervalConfig {
+    SwappyFrameTimeEstimate estimate;
+    // Length of the window for MEAN and PERCENTILE, in frames. Default 300.
+    uint32_t window_frames;
+    // Frames needed before PERCENTILE or EWMA make a decision. Default 120.
+    uint32_t min_frames;
+    // The percentile for PERCENTILE, in (0, 1]. Default 0.9.
+    float percentile;
+    // The weight of each new frame for EWMA, in (0, 1]. Default 0.05.
+    float ewma_alpha;
+    // Standard deviations added to the mean for EWMA. Default 2.
+    float ewma_deviations;
+    // Added to the estimated frame time before fitting it to a swap interval. Default 3ms.
+    uint64_t frame_margin_ns;
+    // Taken off the bound for a shorter swap interval, so that frames right at the edge don't
+    // flip the swap interval back and forth. Default 4ms.
+    uint64_t edge_hysteresis_ns;
+} SwappyAutoSwapIntervalConfig;
+
+// Timing of one swapped frame, as recorded for SwappyGL_getFrameRecords and
+// SwappyVk_getFrameRecords. Times are in nanoseconds, and points in time are in CLOCK_MONOTONIC.
+typedef struct SwappyFrameRecord {
+    // Counts every swap, so gaps show records that were dropped because the buffer was full
+    uint64_t frame_number;
+    // When the CPU work for the frame started, i.e. when the previous swap returned
+    uint64_t start_time_ns;
+    // From the start of the frame until Swappy began to wait for it
+    uint64_t cpu_time_ns;
+    // GPU time of the latest frame to finish before this one was paced, from its fence
+    uint64_t gpu_time_ns;
+    // Time Swappy held the frame back: waiting for the target vsync or the previous frame, and
+    // any delay of its start in low latency mode
+    uint64_t wait_time_ns;
+    // Time spent in eglSwapBuffers or vkQueuePresentKHR
+    uint64_t swap_duration_ns;
+    // The swap interval the frame was paced to
+    uint64_t swap_interval_ns;
+    // The presentation time Swappy asked for, or 0 if it didn't ask for one
+    uint64_t desired_present_time_ns;
+    // When the compositor latched the frame and when the display showed it, or 0 if not known.
+    // These are only known with OpenGL on devices with EGL_ANDROID_get_frame_timestamps.
+    uint64_t latch_time_ns;
+    uint64_t present_time_ns;
+    // 1 if the CPU and GPU work of the frame were pipelined over two swap intervals, else 0
+    int32_t pipeline_mode;
+} SwappyFrameRecord;
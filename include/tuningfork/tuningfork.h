@@ -48,6 +48,9 @@ typedef uint16_t TFInstrumentKey;
 typedef uint64_t TFTraceHandle;
 typedef uint64_t TFTimePoint;
 typedef uint64_t TFDuration;
+// An annotation that has been decoded in advance by TuningFork_registerAnnotations
+typedef uint64_t TFAnnotationHandle;
+#define TFANNOTATION_HANDLE_NONE UINT64_MAX
 
 enum TFErrorCode {
     TFERROR_OK = 0, // No error
@@ -72,7 +75,18 @@ enum TFErrorCode {
                                            //  in assets/tuningfork.
     TFERROR_COULDNT_SAVE_OR_DELETE_FPS = 19,
     TFERROR_PREVIOUS_UPLOAD_PENDING = 20,
-    TFERROR_UPLOAD_TOO_FREQUENT = 21
+    TFERROR_UPLOAD_TOO_FREQUENT = 21,
+    TFERROR_DOWNLOAD_CANCELLED = 22
+};
+
+// How the n_buckets between bucket_min and bucket_max are spaced. In all layouts there is also
+//  an underflow bucket for values below bucket_min and an overflow bucket for values at or
+//  above bucket_max.
+enum TFBucketLayout {
+    TFBUCKETS_LINEAR = 0, // Equal widths
+    TFBUCKETS_LOG = 1, // Widths grow geometrically. bucket_min must be greater than zero.
+    TFBUCKETS_HDR = 2 // Equal widths for the first 16 buckets, then each doubling of the
+                      //  distance from bucket_min is split into 8 buckets.
 };
 
 struct TFHistogram {
@@ -80,17 +94,28 @@ struct TFHistogram {
     float bucket_min;
     float bucket_max;
     int32_t n_buckets;
+    TFBucketLayout bucket_layout;
+    float frame_budget_ms; // Frames longer than this are counted as over budget. 0 for none.
 };
 struct TFAggregationStrategy {
     enum TFSubmissionPolicy {
       TIME_BASED = 1,
       TICK_BASED = 2
     };
+    // What to do when a window closes while all the others are still waiting to be uploaded
+    enum TFFullWindowPolicy {
+      MERGE_WINDOW = 0, // Keep recording into the current window
+      DROP_WINDOW = 1 // Discard the current window's data and start a new one on schedule
+    };
     TFSubmissionPolicy method;
     uint32_t intervalms_or_count;
     uint32_t max_instrumentation_keys;
     uint32_t n_annotation_enum_size;
     uint32_t* annotation_enum_size;
+    // Number of aggregation windows: one being recorded plus those waiting to be uploaded.
+    // 0 means the default of 2.
+    uint32_t n_windows;
+    TFFullWindowPolicy full_window_policy;
 };
 struct TFSettings {
   TFAggregationStrategy aggregation_strategy;
@@ -99,6 +124,23 @@ struct TFSettings {
   void (*dealloc)(TFSettings*);
 };
 
+// The counts for one instrument key and annotation, summed over the session.
+// All pointers are into TuningFork's own storage.
+struct TFSessionHistogram {
+    TFInstrumentKey instrument_key;
+    const uint8_t* annotation; // Serialized annotation
+    size_t annotation_size;
+    uint32_t n_buckets; // Including the underflow and overflow buckets
+    const float* bucket_upper_bounds; // n_buckets - 1 of them: the last bucket is unbounded
+    const uint32_t* counts; // n_buckets of them
+    uint32_t count; // Sum of the counts
+};
+struct TFSessionHistograms {
+    uint32_t n_histograms;
+    const TFSessionHistogram* histograms;
+    uint64_t n_windows; // Aggregation windows closed so far
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -152,6 +194,31 @@ TFErrorCode TuningFork_getFidelityParameters(JNIEnv* env, jobject context,
 // Returns TFERROR_OK on success.
 TFErrorCode TuningFork_setCurrentAnnotation(const CProtobufSerialization *annotation);
 
+// Decode annotations once, so that they can then be made current cheaply with
+//  TuningFork_setCurrentAnnotationHandle or TuningFork_setThreadAnnotationHandle.
+// 'handles' is filled with n_annotations handles, in the same order as 'annotations'. An
+//  annotation that is inconsistent with the settings gets TFANNOTATION_HANDLE_NONE.
+// Handles stay valid until TuningFork is initialized again.
+// Returns TFERROR_INVALID_ANNOTATION if any annotation is inconsistent with the settings.
+// Returns TFERROR_OK on success.
+TFErrorCode TuningFork_registerAnnotations(const CProtobufSerialization* annotations,
+                                           uint32_t n_annotations, TFAnnotationHandle* handles);
+
+// Make a registered annotation current, without decoding it again. This is a single atomic
+//  store, so it is cheap enough to call several times per frame from any thread.
+// Returns TFERROR_INVALID_ANNOTATION if the handle wasn't returned by
+//  TuningFork_registerAnnotations.
+// Returns TFERROR_OK on success.
+TFErrorCode TuningFork_setCurrentAnnotationHandle(TFAnnotationHandle handle);
+
+// Use a registered annotation for ticks and traces recorded on the calling thread only,
+//  instead of the current annotation. Pass TFANNOTATION_HANDLE_NONE to go back to using the
+//  current annotation.
+// Returns TFERROR_INVALID_ANNOTATION if the handle wasn't returned by
+//  TuningFork_registerAnnotations.
+// Returns TFERROR_OK on success.
+TFErrorCode TuningFork_setThreadAnnotationHandle(TFAnnotationHandle handle);
+
 // Record a frame tick that will be associated with the instrumentation key and the current
 //   annotation.
 // NB: calling the tick or trace functions from different threads is allowed, but a given
@@ -178,11 +245,27 @@ TFErrorCode TuningFork_endTrace(TFTraceHandle h);
 
 // Force upload of the current histograms.
 // Returns TFERROR_OK if the upload could be initiated.
-// Returns TFERROR_PREVIOUS_UPLOAD_PENDING if there is a previous upload blocking this
-//  one.
+// Returns TFERROR_PREVIOUS_UPLOAD_PENDING if all the aggregation windows are still waiting to be
+//  uploaded. The current window is then merged or dropped according to the full_window_policy.
 // Returns TFERROR_UPLOAD_TOO_FREQUENT if less than a minute has elapsed since the previous upload.
 TFErrorCode TuningFork_flush();
 
+// Get the histograms for the whole session so far: every aggregation window that has been
+//  closed, whether or not it was uploaded, is added in when it closes. Nothing is copied:
+//  'histograms' points into TuningFork's storage, which stays unchanged until the matching
+//  call to TuningFork_releaseSessionHistograms. Windows that close in the meantime are held
+//  back and added when the last view is released, so keep the view only briefly, e.g. for
+//  one frame of an overlay.
+// Returns TFERROR_BAD_PARAMETER if histograms is null.
+// Returns TFERROR_OK on success.
+TFErrorCode TuningFork_getSessionHistograms(TFSessionHistograms* histograms);
+
+// Release a view obtained with TuningFork_getSessionHistograms. 'histograms' must be the same
+//  struct that was filled in, not a copy of it, and is zeroed.
+// Returns TFERROR_BAD_PARAMETER if histograms is null or not a view that is still held.
+// Returns TFERROR_OK on success.
+TFErrorCode TuningFork_releaseSessionHistograms(TFSessionHistograms* histograms);
+
 #ifdef __cplusplus
 }
 #endif
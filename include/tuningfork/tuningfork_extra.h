@@ -70,8 +70,9 @@ TFErrorCode TuningFork_setUploadCallback(ProtoCallback cbk);
 //  saved params.
 // initialTimeoutMs is the time to wait for an initial download. The fidelity_params_callback
 //  will be called after this time with the default / saved params if no params
-//  could be downloaded..
+//  could be downloaded. Each retry waits twice as long as the one before.
 // ultimateTimeoutMs is the time after which to stop retrying the download.
+// The thread can be started again once it has stopped.
 void TuningFork_startFidelityParamDownloadThread(JNIEnv* env, jobject context,
                                       const char* url_base,
                                       const char* api_key,
@@ -79,20 +80,28 @@ void TuningFork_startFidelityParamDownloadThread(JNIEnv* env, jobject context,
                                       ProtoCallback fidelity_params_callback,
                                       int initialTimeoutMs, int ultimateTimeoutMs);
 
+// Stop the download thread without waiting for it. Any download in progress is abandoned and,
+//  if fidelity_params_callback hasn't yet been called, it is called with the default / saved
+//  params.
+void TuningFork_stopFidelityParamDownloadThread();
+
 // This function calls initWithSwappy and also performs the following:
 // 1) Settings and default fidelity params are retrieved from the APK.
 // 2) A download thread is activated to retrieve fidelity params and retries are
 //    performed until a download is successful or a timeout occurs.
 // 3) Downloaded params are stored locally and used in preference of default
 //    params when the app is started in future.
+// Saved params are valid for a day. If there are saved params, fidelity_params_callback is
+//  called with them before this function returns and, if they are more than a day old, the
+//  download thread refreshes them in the background.
 // fp_default_file_name is the name of the binary fidelity params file that
 //  will be used if there is no download connection and there are no saved params.
 //  This file must be in assets/tuningfork (but only use the file name here).
 // fidelity_params_callback is called with any downloaded params or with default /
 //  saved params.
-// initialTimeoutMs is the time to wait for an initial download. The fidelity_params_callback
-//  will be called after this time with the default / saved params if no params
-//  could be downloaded..
+// initialTimeoutMs is the time to wait for an initial download. If there are no saved params,
+//  the fidelity_params_callback will be called after this time with the default params if no
+//  params could be downloaded.
 // ultimateTimeoutMs is the time after which to stop retrying the download.
 TFErrorCode TuningFork_initFromAssetsWithSwappy(JNIEnv* env, jobject context,
                              SwappyTracerFn swappy_tracer_fn,
@@ -107,6 +116,9 @@ TFErrorCode TuningFork_initFromAssetsWithSwappy(JNIEnv* env, jobject context,
 // The initFromAssetsWithSwappy function will save fidelity params to a file
 //  for use when a download connection is not available. With this function,
 //  you can replace or delete any saved file. To delete the file, pass fps=NULL.
+// Params saved here are used until new ones are downloaded: they don't stop
+//  initFromAssetsWithSwappy from downloading params. The experiment id of any
+//  previously downloaded params is kept.
 TFErrorCode TuningFork_saveOrDeleteFidelityParamsFile(JNIEnv* env, jobject context,
                                                       CProtobufSerialization* fps);
 
@@ -25,6 +25,15 @@ tflogcat_regex = r"(\S+ \S+).*TuningFork.*\(TCL(.+)/(.+)\)(.*)"
 def flatten(s):
   return ', '.join(s.strip().split('\n'))
 
+def denseCounts(h):
+  if len(h.sparse_counts)==0:
+    return h.counts
+  counts = []
+  for i in range(0, len(h.sparse_counts) - 1, 2):
+    counts += [0] * h.sparse_counts[i]
+    counts.append(h.sparse_counts[i+1])
+  return counts + [0] * (h.num_buckets - len(counts))
+
 def prettyPrint(tclevent):
   fp =tf.FidelityParams()
   fp.ParseFromString(tclevent.fidelityparams)
@@ -35,7 +44,7 @@ def prettyPrint(tclevent):
     a = tf.Annotation()
     a.ParseFromString(h.annotation)
     print "  annotation: ", flatten(str(a))
-    for c in h.counts:
+    for c in denseCounts(h):
       print "  counts: ", c
     print "}"
 
@@ -85,13 +85,22 @@ std::string PrettyPrintTuningForkLogEvent(const TuningForkLogEvent& evt) {
         eventStr << "    instrument_id : " << h.instrument_id() << "\n";
         eventStr << "    annotation : " << ReplaceReturns(ann.DebugString()) << "\n    counts : ";
         eventStr << "[";
-        for (int j=0; j<h.counts_size(); ++j) {
+        std::vector<int> counts(h.counts().begin(), h.counts().end());
+        if (h.sparse_counts_size() > 0) {
+            // Pairs of (zero buckets skipped, count)
+            for (int j=0; j+1<h.sparse_counts_size(); j+=2) {
+                counts.insert(counts.end(), h.sparse_counts(j), 0);
+                counts.push_back(h.sparse_counts(j+1));
+            }
+            counts.resize(h.num_buckets(), 0);
+        }
+        for (auto c: counts) {
             if (first) {
                 first = false;
             } else {
                 eventStr << ",";
             }
-            eventStr << h.counts(j);
+            eventStr << c;
         }
         eventStr << "]\n  }\n";
     }
@@ -33,13 +33,18 @@
 using namespace std::chrono_literals;
 using time_point = std::chrono::steady_clock::time_point;
 
-namespace {
+namespace swappy {
 
-class Timer {
+class ChoreographerFilter::Timer {
   public:
-    Timer(std::chrono::nanoseconds refreshPeriod, std::chrono::nanoseconds appToSfDelay)
-        : mRefreshPeriod(refreshPeriod),
-          mAppToSfDelay(appToSfDelay) {}
+    Timer(const Clock& clock,
+          std::chrono::nanoseconds refreshPeriod,
+          std::chrono::nanoseconds appToSfDelay)
+        : mClock(clock),
+          mRefreshPeriod(refreshPeriod),
+          mAppToSfDelay(appToSfDelay),
+          mBaseTime(clock.now()),
+          mLastTimestamp(clock.now()) {}
 
     // Returns false if we have detected that we have received the same timestamp multiple times
     // so that the caller can wait for fresh timestamps
@@ -74,37 +79,36 @@ class Timer {
         return true;
     }
 
-    void sleep(std::chrono::nanoseconds offset) {
+    // The next time, offset from the predicted vsync, that hasn't passed yet
+    time_point wakeupTime(std::chrono::nanoseconds offset) const {
         if (offset < -(mRefreshPeriod / 2) || offset > mRefreshPeriod / 2) {
             offset = 0ms;
         }
 
-        const auto now = std::chrono::steady_clock::now();
+        const auto now = mClock.now();
         auto targetTime = mBaseTime + mRefreshPeriod + offset;
         while (targetTime < now) {
             targetTime += mRefreshPeriod;
         }
-
-        std::this_thread::sleep_until(targetTime);
+        return targetTime;
     }
 
   private:
+    const Clock& mClock;
     std::chrono::nanoseconds mRefreshPeriod;
     const std::chrono::nanoseconds mAppToSfDelay;
-    time_point mBaseTime = std::chrono::steady_clock::now();
+    time_point mBaseTime;
 
-    time_point mLastTimestamp = std::chrono::steady_clock::now();
+    time_point mLastTimestamp;
     int32_t mRepeatCount = 0;
 };
 
-} // anonymous namespace
-
-namespace swappy {
-
 ChoreographerFilter::ChoreographerFilter(std::chrono::nanoseconds refreshPeriod,
                                          std::chrono::nanoseconds appToSfDelay,
-                                         Worker doWork)
-    : mRefreshPeriod(refreshPeriod),
+                                         Worker doWork,
+                                         std::shared_ptr<Clock> clock)
+    : mClock(std::move(clock)),
+      mRefreshPeriod(refreshPeriod),
       mAppToSfDelay(appToSfDelay),
       mDoWork(doWork) {
     Settings::getInstance()->addListener([this]() { onSettingsChanged(); });
@@ -121,8 +125,12 @@ ChoreographerFilter::~ChoreographerFilter() {
 
 void ChoreographerFilter::onChoreographer() {
     std::lock_guard<std::mutex> lock(mMutex);
-    mLastTimestamp = std::chrono::steady_clock::now();
+    mLastTimestamp = mClock->now();
     ++mSequenceNumber;
+    if (mEventTimer) {
+        postWorkLocked();
+        return;
+    }
     mCondition.notify_all();
 }
 
@@ -130,6 +138,10 @@ void ChoreographerFilter::launchThreadsLocked() {
     {
         std::lock_guard<std::mutex> lock(mMutex);
         mIsRunning = true;
+        if (mClock->hasEventLoop()) {
+            mEventTimer = std::make_unique<Timer>(*mClock, mRefreshPeriod, mAppToSfDelay);
+            return;
+        }
     }
 
     const int32_t numThreads = getNumCpus() > 2 ? 2 : 1;
@@ -142,6 +154,7 @@ void ChoreographerFilter::terminateThreadsLocked() {
     {
         std::lock_guard<std::mutex> lock(mMutex);
         mIsRunning = false;
+        mEventTimer.reset();
         mCondition.notify_all();
     }
 
@@ -171,7 +184,7 @@ void ChoreographerFilter::onSettingsChanged() {
 }
 
 void ChoreographerFilter::threadMain(bool useAffinity, int32_t thread) {
-    Timer timer(mRefreshPeriod, mAppToSfDelay);
+    Timer timer(*mClock, mRefreshPeriod, mAppToSfDelay);
 
     {
         int cpu = getNumCpus() - 1 - thread;
@@ -204,19 +217,27 @@ void ChoreographerFilter::threadMain(bool useAffinity, int32_t thread) {
 
         if (!mIsRunning) break;
 
-        timer.sleep(-workDuration);
-        {
-            std::unique_lock<std::mutex> workLock(mWorkMutex);
-            const auto now = std::chrono::steady_clock::now();
-            if (now - mLastWorkRun > mRefreshPeriod / 2) {
-                // Assume we got here first and there's work to do
-                gamesdk::ScopedTrace trace("doWork");
-                mWorkDuration = mDoWork();
-                mLastWorkRun = now;
-            }
-        }
+        mClock->sleepUntil(timer.wakeupTime(-workDuration));
+        runWork();
         lock.lock();
     }
 }
 
+void ChoreographerFilter::postWorkLocked() {
+    // Repeated timestamps can't happen here, as each tick is posted with a fresh one
+    mEventTimer->addTimestamp(mLastTimestamp);
+    mClock->post(mEventTimer->wakeupTime(-mWorkDuration), [this]() { runWork(); });
+}
+
+void ChoreographerFilter::runWork() {
+    std::unique_lock<std::mutex> workLock(mWorkMutex);
+    const auto now = mClock->now();
+    if (now - mLastWorkRun > mRefreshPeriod / 2) {
+        // Assume we got here first and there's work to do
+        gamesdk::ScopedTrace trace("doWork");
+        mWorkDuration = mDoWork();
+        mLastWorkRun = now;
+    }
+}
+
 } // namespace swappy
@@ -21,6 +21,7 @@
 #include <vector>
 #include <mutex>
 #include <condition_variable>
+#include "Clock.h"
 #include "Settings.h"
 
 namespace swappy {
@@ -31,12 +32,15 @@ class ChoreographerFilter {
 
     explicit ChoreographerFilter(std::chrono::nanoseconds refreshPeriod,
                                  std::chrono::nanoseconds appToSfDelay,
-                                 Worker doWork);
+                                 Worker doWork,
+                                 std::shared_ptr<Clock> clock = Clock::steady());
     ~ChoreographerFilter();
 
     void onChoreographer();
 
   private:
+    class Timer;
+
     void launchThreadsLocked();
     void terminateThreadsLocked();
 
@@ -44,6 +48,13 @@ class ChoreographerFilter {
 
     void threadMain(bool useAffinity, int32_t thread);
 
+    // With a clock that has an event loop there are no threads: each Choreographer tick posts
+    // the work to the clock instead.
+    void postWorkLocked();
+    void runWork();
+
+    const std::shared_ptr<Clock> mClock;
+
     std::mutex mThreadPoolMutex;
     bool mUseAffinity = true;
     std::vector<std::thread> mThreadPool;
@@ -61,6 +72,8 @@ class ChoreographerFilter {
     std::chrono::nanoseconds mRefreshPeriod;
     std::chrono::nanoseconds mAppToSfDelay;
     const Worker mDoWork;
+
+    std::unique_ptr<Timer> mEventTimer;
 };
 
 } // namespace swappy
@@ -19,6 +19,8 @@
 
 #include "Thread.h"
 
+#include <functional>
+#include <memory>
 #include <thread>
 #include <mutex>
 
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Clock.h"
+
+#include <thread>
+
+namespace swappy {
+
+namespace {
+
+class SteadyClock : public Clock {
+public:
+    time_point now() const override {
+        return std::chrono::steady_clock::now();
+    }
+
+    void sleepUntil(time_point t) override {
+        std::this_thread::sleep_until(t);
+    }
+
+    void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+              const std::function<bool()>& pred) override {
+        cond.wait(lock, pred);
+    }
+};
+
+} // anonymous namespace
+
+std::shared_ptr<Clock> Clock::steady() {
+    static std::shared_ptr<Clock> clock = std::make_shared<SteadyClock>();
+    return clock;
+}
+
+} // namespace swappy
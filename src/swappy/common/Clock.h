@@ -0,0 +1,57 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace swappy {
+
+// Source of time for the pacing logic.
+// Everything in SwappyCommon that reads the time or blocks goes through a Clock, so that the
+// whole of it can be driven by a virtual clock on a host, where a run is deterministic and takes
+// no real time.
+class Clock {
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    virtual ~Clock() = default;
+
+    virtual time_point now() const = 0;
+
+    virtual void sleepUntil(time_point t) = 0;
+
+    // Wait on cond until pred holds. lock must be held and is held again on return.
+    virtual void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                      const std::function<bool()>& pred) = 0;
+
+    // Whether the clock runs work posted to it, in which case callers should post their periodic
+    // work rather than start threads that sleep on it.
+    virtual bool hasEventLoop() const { return false; }
+
+    // Run f at time t, from within sleepUntil or wait. Only used if hasEventLoop() is true.
+    virtual void post(time_point t, std::function<void()> f) {}
+
+    // The shared std::chrono::steady_clock
+    static std::shared_ptr<Clock> steady();
+};
+
+} // namespace swappy
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameDurations.h"
+
+namespace swappy {
+
+// NB These are only needed for C++14
+constexpr std::chrono::nanoseconds FrameDuration::MAX_DURATION;
+constexpr size_t FrameDurations::DEFAULT_WINDOW;
+
+FrameDurations::FrameDurations(size_t window) {
+    setWindow(window);
+}
+
+void FrameDurations::setWindow(size_t window) {
+    mWindow = std::max<size_t>(window, 1);
+    // Shrink as well as grow, so a window that was once large doesn't keep its memory
+    std::vector<FrameDuration>(mWindow).swap(mDurations);
+    clear();
+}
+
+} // namespace swappy
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace swappy {
+
+enum class PipelineMode { Off, On };
+
+class FrameDuration {
+public:
+    FrameDuration() = default;
+
+    FrameDuration(std::chrono::nanoseconds cpuTime, std::chrono::nanoseconds gpuTime) :
+            mCpuTime(cpuTime), mGpuTime(gpuTime) {
+        mCpuTime = std::min(mCpuTime, MAX_DURATION);
+        mGpuTime = std::min(mGpuTime, MAX_DURATION);
+    }
+
+    std::chrono::nanoseconds getCpuTime() const { return mCpuTime; }
+    std::chrono::nanoseconds getGpuTime() const { return mGpuTime; }
+
+    std::chrono::nanoseconds getTime(PipelineMode pipeline) const {
+        if (pipeline == PipelineMode::On) {
+            return std::max(mCpuTime, mGpuTime);
+        }
+
+        return mCpuTime + mGpuTime;
+    }
+
+    FrameDuration& operator+=(const FrameDuration& other) {
+        mCpuTime += other.mCpuTime;
+        mGpuTime += other.mGpuTime;
+        return *this;
+    }
+
+    FrameDuration& operator-=(const FrameDuration& other) {
+        mCpuTime -= other.mCpuTime;
+        mGpuTime -= other.mGpuTime;
+        return *this;
+    }
+
+    friend FrameDuration operator/(FrameDuration lhs, int rhs) {
+        lhs.mCpuTime /= rhs;
+        lhs.mGpuTime /= rhs;
+        return lhs;
+    }
+
+    static constexpr std::chrono::nanoseconds MAX_DURATION =
+            std::chrono::milliseconds(100);
+
+private:
+    std::chrono::nanoseconds mCpuTime = std::chrono::nanoseconds(0);
+    std::chrono::nanoseconds mGpuTime = std::chrono::nanoseconds(0);
+};
+
+// Sliding window over the most recent frame durations.
+// The durations are kept in a ring buffer that is allocated once, along with their running sum,
+// so adding a frame and taking the average are O(1) and clearing the window frees nothing.
+// The sums are integer nanoseconds, so they don't drift however many frames pass through.
+// Not thread-safe.
+class FrameDurations {
+public:
+    static constexpr size_t DEFAULT_WINDOW = 300; // 5 Seconds in 60Hz
+
+    explicit FrameDurations(size_t window = DEFAULT_WINDOW);
+
+    // Add a frame, dropping the oldest one if the window is full
+    void add(const FrameDuration& duration) {
+        if (mCount == mWindow) {
+            mSum -= mDurations[mNext];
+        } else {
+            ++mCount;
+        }
+        mDurations[mNext] = duration;
+        mSum += duration;
+        if (++mNext == mWindow) {
+            mNext = 0;
+        }
+    }
+
+    void clear() {
+        mNext = 0;
+        mCount = 0;
+        mSum = {};
+    }
+
+    // Change the window length, in frames. This clears the window and is the only call that
+    // allocates. A window of 0 is treated as 1.
+    void setWindow(size_t window);
+    size_t window() const { return mWindow; }
+
+    size_t size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+    bool full() const { return mCount == mWindow; }
+
+    FrameDuration sum() const { return mSum; }
+    FrameDuration average() const {
+        return mCount == 0 ? FrameDuration() : mSum / static_cast<int>(mCount);
+    }
+
+    // The i'th oldest frame in the window, for i < size()
+    const FrameDuration& operator[](size_t i) const {
+        size_t first = mCount == mWindow ? mNext : 0;
+        size_t j = first + i;
+        return mDurations[j < mWindow ? j : j - mWindow];
+    }
+
+private:
+    std::vector<FrameDuration> mDurations;
+    size_t mWindow;
+    // Where the next frame is written
+    size_t mNext = 0;
+    size_t mCount = 0;
+    FrameDuration mSum;
+};
+
+} // namespace swappy
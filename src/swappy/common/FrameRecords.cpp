@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameRecords.h"
+
+#include <algorithm>
+
+namespace swappy {
+
+// NB This is only needed for C++14
+constexpr size_t FrameRecords::CAPACITY;
+constexpr size_t FrameRecords::MAX_PENDING;
+
+void FrameRecords::add(const SwappyFrameRecord& record, bool awaitTimestamps) {
+    if (!awaitTimestamps) {
+        flushPendingBefore(record.frame_number);
+        push(record);
+        return;
+    }
+
+    mPending.push_back(record);
+    // Give up on timestamps that are taking too long
+    while (mPending.size() > MAX_PENDING) {
+        push(mPending.front());
+        mPending.pop_front();
+    }
+}
+
+void FrameRecords::setTimestamps(uint64_t frameNumber,
+                                 uint64_t latchTimeNS,
+                                 uint64_t presentTimeNS) {
+    flushPendingBefore(frameNumber);
+    if (mPending.empty() || mPending.front().frame_number != frameNumber) {
+        return;
+    }
+    SwappyFrameRecord& record = mPending.front();
+    record.latch_time_ns = latchTimeNS;
+    record.present_time_ns = presentTimeNS;
+    push(record);
+    mPending.pop_front();
+}
+
+void FrameRecords::flushPendingBefore(uint64_t frameNumber) {
+    while (!mPending.empty() && mPending.front().frame_number < frameNumber) {
+        push(mPending.front());
+        mPending.pop_front();
+    }
+}
+
+void FrameRecords::push(const SwappyFrameRecord& record) {
+    const size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHead.load(std::memory_order_acquire) == CAPACITY) {
+        mNumDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    mRing[tail % CAPACITY] = record;
+    // Publish the record to the consumer
+    mTail.store(tail + 1, std::memory_order_release);
+}
+
+size_t FrameRecords::read(SwappyFrameRecord* records, size_t maxRecords) {
+    const size_t head = mHead.load(std::memory_order_relaxed);
+    const size_t n = std::min(maxRecords, mTail.load(std::memory_order_acquire) - head);
+    for (size_t i = 0; i < n; ++i) {
+        records[i] = mRing[(head + i) % CAPACITY];
+    }
+    // Hand the slots back to the producer
+    mHead.store(head + n, std::memory_order_release);
+    return n;
+}
+
+} // namespace swappy
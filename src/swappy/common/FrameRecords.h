@@ -0,0 +1,66 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+#include "swappy/swappy_common.h"
+
+namespace swappy {
+
+// Per-frame records, passed from the thread that swaps to a reader without locks.
+// The records are kept in a fixed-size single-producer, single-consumer ring. Records that don't
+// fit because the reader is behind are dropped, which shows as a gap in the frame numbers.
+// A record can be held back, for up to MAX_PENDING frames, until the compositor's timestamps for
+// it are known. Records always come out in the order they were added.
+class FrameRecords {
+public:
+    static constexpr size_t CAPACITY = 256;
+    static constexpr size_t MAX_PENDING = 10;
+
+    // Producer side: only called from the thread that swaps
+
+    void add(const SwappyFrameRecord& record, bool awaitTimestamps);
+    void setTimestamps(uint64_t frameNumber, uint64_t latchTimeNS, uint64_t presentTimeNS);
+
+    // Consumer side: only called from one thread at a time.
+    // Copies up to maxRecords of the oldest records and returns how many were copied.
+    size_t read(SwappyFrameRecord* records, size_t maxRecords);
+
+    uint64_t numDropped() const { return mNumDropped; }
+
+private:
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+    void push(const SwappyFrameRecord& record);
+    void flushPendingBefore(uint64_t frameNumber);
+
+    std::array<SwappyFrameRecord, CAPACITY> mRing;
+    // Only ever increase, and are taken modulo CAPACITY to index the ring
+    std::atomic<size_t> mHead = {0}; // Next to read, written by the consumer
+    std::atomic<size_t> mTail = {0}; // Next to write, written by the producer
+    std::atomic<uint64_t> mNumDropped = {0};
+
+    std::deque<SwappyFrameRecord> mPending;
+};
+
+} // namespace swappy
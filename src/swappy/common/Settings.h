@@ -19,6 +19,7 @@
 #include "Thread.h"
 
 #include <cstdint>
+#include <functional>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SwapIntervalController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace swappy {
+
+using std::chrono::nanoseconds;
+
+namespace {
+
+constexpr nanoseconds REFRESH_RATE_MARGIN = std::chrono::nanoseconds(500);
+
+// The original controller: the mean over a full window
+class MeanController : public SwapIntervalController {
+public:
+    explicit MeanController(const SwapIntervalConfig& config) : mFrames(config.windowFrames) {}
+
+    void addFrame(const FrameDuration& duration) override { mFrames.add(duration); }
+    void reset() override { mFrames.clear(); }
+
+    bool estimate(FrameDuration& estimate) const override {
+        if (!mFrames.full())
+            return false;
+        estimate = mFrames.average();
+        return true;
+    }
+
+private:
+    FrameDurations mFrames;
+};
+
+// CPU and GPU times are ranked separately, so the estimate is at least as long as the given
+// percentile of either.
+class PercentileController : public SwapIntervalController {
+public:
+    explicit PercentileController(const SwapIntervalConfig& config)
+        : mFrames(config.windowFrames),
+          mMinFrames(std::max<size_t>(1, std::min(config.minFrames, mFrames.window()))),
+          mPercentile(std::min(std::max(config.percentile, 0.0), 1.0)) {
+        mScratch.reserve(mFrames.window());
+    }
+
+    void addFrame(const FrameDuration& duration) override { mFrames.add(duration); }
+    void reset() override { mFrames.clear(); }
+
+    bool estimate(FrameDuration& estimate) const override {
+        const size_t n = mFrames.size();
+        if (n < mMinFrames)
+            return false;
+        const size_t k = std::min(n - 1, static_cast<size_t>(mPercentile * n));
+        auto select = [&](nanoseconds (FrameDuration::*get)() const) {
+            mScratch.resize(n);
+            for (size_t i = 0; i < n; ++i)
+                mScratch[i] = (mFrames[i].*get)();
+            std::nth_element(mScratch.begin(), mScratch.begin() + k, mScratch.end());
+            return mScratch[k];
+        };
+        const nanoseconds cpuTime = select(&FrameDuration::getCpuTime);
+        estimate = FrameDuration(cpuTime, select(&FrameDuration::getGpuTime));
+        return true;
+    }
+
+private:
+    FrameDurations mFrames;
+    const size_t mMinFrames;
+    const double mPercentile;
+    mutable std::vector<nanoseconds> mScratch;
+};
+
+class EwmaController : public SwapIntervalController {
+public:
+    explicit EwmaController(const SwapIntervalConfig& config)
+        : mAlpha(std::min(std::max(config.ewmaAlpha, 0.001), 1.0)),
+          mDeviations(config.ewmaDeviations),
+          mMinFrames(std::max<size_t>(1, config.minFrames)) {}
+
+    void addFrame(const FrameDuration& duration) override {
+        ++mCount;
+        // Until there are enough frames for the weights to settle, weigh them all equally
+        const double alpha = std::max(mAlpha, 1.0 / mCount);
+        mCpu.add(duration.getCpuTime(), alpha);
+        mGpu.add(duration.getGpuTime(), alpha);
+    }
+
+    void reset() override {
+        mCount = 0;
+        mCpu = {};
+        mGpu = {};
+    }
+
+    bool estimate(FrameDuration& estimate) const override {
+        if (mCount < mMinFrames)
+            return false;
+        estimate = FrameDuration(mCpu.upperBound(mDeviations), mGpu.upperBound(mDeviations));
+        return true;
+    }
+
+private:
+    struct Moments {
+        // Samples are clipped to this many deviations above the mean, or a tenth of the mean
+        // if the deviation is tiny, so that a hitch moves the estimate only a little while a
+        // lasting change still comes through within a few dozen frames.
+        static constexpr double OUTLIER_DEVIATIONS = 3;
+        static constexpr double MIN_OUTLIER_FRACTION = 0.1;
+
+        double mean = 0;
+        // Of the frames above the mean
+        double variance = 0;
+        bool empty = true;
+
+        void add(nanoseconds time, double alpha) {
+            double x = time.count();
+            if (empty) {
+                mean = x;
+                empty = false;
+                return;
+            }
+            x = std::min(x, mean + std::max(OUTLIER_DEVIATIONS * std::sqrt(variance),
+                                            MIN_OUTLIER_FRACTION * mean));
+            const double delta = x - mean;
+            mean += alpha * delta;
+            // Only frames longer than the mean count towards the deviation, so that frames
+            // getting faster don't make the estimate jump up.
+            const double above = std::max(delta, 0.0);
+            variance = (1 - alpha) * (variance + alpha * above * above);
+        }
+
+        nanoseconds upperBound(double deviations) const {
+            return nanoseconds(static_cast<int64_t>(mean + deviations * std::sqrt(variance)));
+        }
+    };
+
+    const double mAlpha;
+    const double mDeviations;
+    const size_t mMinFrames;
+    size_t mCount = 0;
+    Moments mCpu;
+    Moments mGpu;
+};
+
+constexpr double EwmaController::Moments::OUTLIER_DEVIATIONS;
+constexpr double EwmaController::Moments::MIN_OUTLIER_FRACTION;
+
+bool pipelineModeNotNeeded(const SwapIntervalState& state, nanoseconds frameTime,
+                           nanoseconds upperBound) {
+    return state.pipelineModeAutoMode && frameTime < upperBound;
+}
+
+// Pick the pipeline mode for a swap interval that has just been changed
+void updatePipelineMode(const FrameDuration& estimate, const SwapIntervalMargins& margins,
+                        SwapIntervalState& state) {
+    const nanoseconds newUpperBound = state.refreshPeriod * state.autoSwapInterval;
+    if (pipelineModeNotNeeded(state, estimate.getTime(PipelineMode::Off) + margins.frameMargin,
+                              newUpperBound)) {
+        state.pipelineMode = PipelineMode::Off;
+    } else {
+        state.pipelineMode = PipelineMode::On;
+    }
+}
+
+} // anonymous namespace
+
+SwapIntervalConfig SwapIntervalConfig::from(const SwappyAutoSwapIntervalConfig& config) {
+    SwapIntervalConfig c;
+    switch (config.estimate) {
+        case SWAPPY_FRAME_TIME_PERCENTILE: c.estimate = Estimate::Percentile; break;
+        case SWAPPY_FRAME_TIME_EWMA: c.estimate = Estimate::Ewma; break;
+        default: c.estimate = Estimate::Mean; break;
+    }
+    if (config.window_frames > 0) c.windowFrames = config.window_frames;
+    if (config.min_frames > 0) c.minFrames = config.min_frames;
+    if (config.percentile > 0) c.percentile = config.percentile;
+    if (config.ewma_alpha > 0) c.ewmaAlpha = config.ewma_alpha;
+    if (config.ewma_deviations > 0) c.ewmaDeviations = config.ewma_deviations;
+    if (config.frame_margin_ns > 0) c.margins.frameMargin = nanoseconds(config.frame_margin_ns);
+    if (config.edge_hysteresis_ns > 0)
+        c.margins.edgeHysteresis = nanoseconds(config.edge_hysteresis_ns);
+    return c;
+}
+
+std::unique_ptr<SwapIntervalController> SwapIntervalController::create(
+        const SwapIntervalConfig& config) {
+    switch (config.estimate) {
+        case SwapIntervalConfig::Estimate::Percentile:
+            return std::make_unique<PercentileController>(config);
+        case SwapIntervalConfig::Estimate::Ewma:
+            return std::make_unique<EwmaController>(config);
+        case SwapIntervalConfig::Estimate::Mean:
+        default:
+            return std::make_unique<MeanController>(config);
+    }
+}
+
+bool updateSwapInterval(const FrameDuration& estimate, const SwapIntervalMargins& margins,
+                        SwapIntervalState& state) {
+    const auto pipelineFrameTime = estimate.getTime(PipelineMode::On) + margins.frameMargin;
+    const auto nonPipelineFrameTime = estimate.getTime(PipelineMode::Off) + margins.frameMargin;
+    const auto currentConfigFrameTime = state.pipelineMode == PipelineMode::On ?
+                                        pipelineFrameTime :
+                                        nonPipelineFrameTime;
+
+    // calculate the new swap interval based on the estimated frame time assuming we are in
+    // pipeline mode (prefer higher swap interval rather than turning off pipeline mode)
+    const int newSwapInterval = calculateSwapInterval(pipelineFrameTime, state.refreshPeriod);
+
+    // Define upper and lower bounds based on the swap duration
+    const nanoseconds upperBound = state.refreshPeriod * state.autoSwapInterval;
+    // add the hysteresis to one of the bounds to avoid going back and forth when frames
+    // are exactly at the edge.
+    const nanoseconds lowerBound =
+            state.refreshPeriod * (state.autoSwapInterval - 1) - margins.edgeHysteresis;
+
+    // Make sure the frame time fits in the current config to avoid missing frames
+    if (currentConfigFrameTime > upperBound) {
+        if (state.pipelineMode == PipelineMode::Off &&
+                estimate.getTime(PipelineMode::On) <= upperBound) {
+            state.pipelineMode = PipelineMode::On;
+        } else {
+            state.autoSwapInterval = newSwapInterval;
+            updatePipelineMode(estimate, margins, state);
+        }
+        return true;
+    }
+
+    // So we shouldn't miss any frames with this config but maybe we can go faster ?
+    // we check the pipeline frame time here as we prefer lower swap interval than no pipelining
+    if (state.swapIntervalNS <= state.refreshPeriod * (state.autoSwapInterval - 1) &&
+            pipelineFrameTime < lowerBound) {
+        state.autoSwapInterval = newSwapInterval;
+        updatePipelineMode(estimate, margins, state);
+        return true;
+    }
+
+    // If we reached to this condition it means that we fit into the boundaries.
+    // However we might be in pipeline mode and we could turn it off if we still fit.
+    if (state.pipelineMode == PipelineMode::On &&
+            pipelineModeNotNeeded(state, nonPipelineFrameTime, upperBound)) {
+        state.pipelineMode = PipelineMode::Off;
+        return true;
+    }
+
+    return false;
+}
+
+int calculateSwapInterval(nanoseconds frameTime, nanoseconds refreshPeriod) {
+
+    if (frameTime < refreshPeriod) {
+        return 1;
+    }
+
+    auto div_result = div(frameTime.count(), refreshPeriod.count());
+    auto framesPerRefresh = div_result.quot;
+    auto framesPerRefreshRemainder = div_result.rem;
+
+    return (framesPerRefresh + (framesPerRefreshRemainder > REFRESH_RATE_MARGIN.count() ? 1 : 0));
+}
+
+} // namespace swappy
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "swappy/swappy_common.h"
+
+#include "FrameDurations.h"
+
+namespace swappy {
+
+struct SwapIntervalMargins {
+    // Added to the estimated frame time before fitting it to a swap interval
+    std::chrono::nanoseconds frameMargin = std::chrono::milliseconds(3);
+    // Taken off the bound for a shorter swap interval, so that frames right at the edge don't
+    // flip the interval back and forth
+    std::chrono::nanoseconds edgeHysteresis = std::chrono::milliseconds(4);
+};
+
+struct SwapIntervalConfig {
+    enum class Estimate {
+        // Mean over a full window: the original behaviour
+        Mean,
+        // Percentile over the window, so that occasional long frames are ignored
+        Percentile,
+        // Exponentially weighted mean plus a multiple of the weighted deviation of the frames
+        // above it, with outliers clipped before they are added
+        Ewma,
+    };
+
+    Estimate estimate = Estimate::Mean;
+    size_t windowFrames = FrameDurations::DEFAULT_WINDOW;
+    // Frames needed before Percentile or Ewma give an estimate
+    size_t minFrames = 120;
+    double percentile = 0.9;
+    double ewmaAlpha = 0.05;
+    double ewmaDeviations = 2;
+    SwapIntervalMargins margins;
+
+    // Zero fields in the public config keep their defaults
+    static SwapIntervalConfig from(const SwappyAutoSwapIntervalConfig& config);
+};
+
+// What the swap interval decision reads and updates
+struct SwapIntervalState {
+    std::chrono::nanoseconds refreshPeriod;
+    // The shortest swap interval the app allows
+    std::chrono::nanoseconds swapIntervalNS;
+    int32_t autoSwapInterval;
+    PipelineMode pipelineMode;
+    bool pipelineModeAutoMode;
+};
+
+// Estimates the frame duration that auto swap interval paces to, from the frames seen since the
+// last reset. Implementations are not thread-safe.
+class SwapIntervalController {
+public:
+    static std::unique_ptr<SwapIntervalController> create(const SwapIntervalConfig& config);
+
+    virtual ~SwapIntervalController() = default;
+
+    virtual void addFrame(const FrameDuration& duration) = 0;
+
+    // Forget all frames, e.g. after the swap interval or refresh rate changed
+    virtual void reset() = 0;
+
+    // Returns false if there are too few frames to decide on yet
+    virtual bool estimate(FrameDuration& estimate) const = 0;
+};
+
+// Fit the swap interval and pipeline mode to the estimated frame duration: move to a longer
+// interval, or turn on pipelining, if frames don't fit, and to a shorter one if they fit it
+// with room to spare. Returns true if the state changed.
+bool updateSwapInterval(const FrameDuration& estimate, const SwapIntervalMargins& margins,
+                        SwapIntervalState& state);
+
+// The number of refresh periods needed for a frame of the given duration
+int calculateSwapInterval(std::chrono::nanoseconds frameTime,
+                          std::chrono::nanoseconds refreshPeriod);
+
+} // namespace swappy
@@ -32,86 +32,39 @@ namespace swappy {
 using std::chrono::milliseconds;
 using std::chrono::nanoseconds;
 
-// NB These are only needed for C++14
-constexpr nanoseconds SwappyCommon::FrameDuration::MAX_DURATION;
-constexpr nanoseconds SwappyCommon::FRAME_MARGIN;
-constexpr nanoseconds SwappyCommon::EDGE_HYSTERESIS;
-constexpr nanoseconds SwappyCommon::REFRESH_RATE_MARGIN;
-
-SwappyCommon::SwappyCommon(JNIEnv *env, jobject jactivity)
-        : mSdkVersion(getSDKVersion(env)),
-          mSwapDuration(nanoseconds(0)),
-          mAutoSwapInterval(1),
-          mValid(false) {
-    jclass activityClass = env->FindClass("android/app/NativeActivity");
-    jclass windowManagerClass = env->FindClass("android/view/WindowManager");
-    jclass displayClass = env->FindClass("android/view/Display");
-
-    jmethodID getWindowManager = env->GetMethodID(
-            activityClass,
-            "getWindowManager",
-            "()Landroid/view/WindowManager;");
-
-    jmethodID getDefaultDisplay = env->GetMethodID(
-            windowManagerClass,
-            "getDefaultDisplay",
-            "()Landroid/view/Display;");
-
-    jobject wm = env->CallObjectMethod(jactivity, getWindowManager);
-    jobject display = env->CallObjectMethod(wm, getDefaultDisplay);
-
-    jmethodID getRefreshRate = env->GetMethodID(
-            displayClass,
-            "getRefreshRate",
-            "()F");
-
-    const float refreshRateHz = env->CallFloatMethod(display, getRefreshRate);
-
-    jmethodID getAppVsyncOffsetNanos = env->GetMethodID(
-            displayClass,
-            "getAppVsyncOffsetNanos", "()J");
-
-    // getAppVsyncOffsetNanos was only added in API 21.
-    // Return gracefully if this device doesn't support it.
-    if (getAppVsyncOffsetNanos == 0 || env->ExceptionOccurred()) {
-        ALOGE("Error while getting method: getAppVsyncOffsetNanos");
-        env->ExceptionClear();
-        return;
-    }
-    const long appVsyncOffsetNanos = env->CallLongMethod(display, getAppVsyncOffsetNanos);
-
-    jmethodID getPresentationDeadlineNanos = env->GetMethodID(
-        displayClass,
-        "getPresentationDeadlineNanos",
-        "()J");
-
+namespace {
 
-    if (getPresentationDeadlineNanos == 0 || env->ExceptionOccurred()) {
-        ALOGE("Error while getting method: getPresentationDeadlineNanos");
-        return;
-    }
-
-    const long vsyncPresentationDeadlineNanos = env->CallLongMethod(
-        display, getPresentationDeadlineNanos);
+uint64_t toNS(std::chrono::steady_clock::time_point t) {
+    return static_cast<uint64_t>(t.time_since_epoch().count());
+}
 
-    const long ONE_MS_IN_NS = 1000 * 1000;
-    const long ONE_S_IN_NS = ONE_MS_IN_NS * 1000;
+} // anonymous namespace
 
-    const long vsyncPeriodNanos = static_cast<long>(ONE_S_IN_NS / refreshRateHz);
-    const long sfVsyncOffsetNanos =
-        vsyncPeriodNanos - (vsyncPresentationDeadlineNanos - ONE_MS_IN_NS);
+SwappyCommon::SwappyCommon(std::shared_ptr<Clock> clock)
+        : mClock(std::move(clock)),
+          mSwapDuration(nanoseconds(0)),
+          mSwapIntervalController(SwapIntervalController::create(mSwapIntervalConfig)),
+          mAutoSwapInterval(1),
+          mValid(false) {}
 
-    JavaVM* vm;
-    env->GetJavaVM(&vm);
+SwappyCommon::SwappyCommon(const SwappyCommonSettings& settings,
+                           std::shared_ptr<Clock> clock,
+                           std::unique_ptr<SwappyDisplayManager> displayManager)
+        : SwappyCommon(std::move(clock)) {
+    init(settings, nullptr, std::move(displayManager));
+}
 
-    using std::chrono::nanoseconds;
-    mRefreshPeriod = nanoseconds(vsyncPeriodNanos);
-    nanoseconds appVsyncOffset = nanoseconds(appVsyncOffsetNanos);
-    nanoseconds sfVsyncOffset  = nanoseconds(sfVsyncOffsetNanos);
+void SwappyCommon::init(const SwappyCommonSettings& settings,
+                        JavaVM* vm,
+                        std::unique_ptr<SwappyDisplayManager> displayManager) {
+    mSdkVersion = settings.sdkVersion;
+    mRefreshPeriod = settings.refreshPeriod;
 
-    mChoreographerFilter = std::make_unique<ChoreographerFilter>(mRefreshPeriod,
-                                                                 sfVsyncOffset - appVsyncOffset,
-                                                                 [this]() { return wakeClient(); });
+    mChoreographerFilter = std::make_unique<ChoreographerFilter>(
+            mRefreshPeriod,
+            settings.sfVsyncOffset - settings.appVsyncOffset,
+            [this]() { return wakeClient(); },
+            mClock);
 
     mChoreographerThread = ChoreographerThread::createChoreographerThread(
                                    ChoreographerThread::Type::Swappy,
@@ -123,24 +76,17 @@ SwappyCommon::SwappyCommon(JNIEnv *env, jobject jactivity)
         return;
     }
 
-    if (USE_DISPLAY_MANAGER && mSdkVersion >= SwappyDisplayManager::MIN_SDK_VERSION) {
-        mDisplayManager = std::make_unique<SwappyDisplayManager>(vm, jactivity);
-        if (!mDisplayManager->isInitialized()) {
-            ALOGE("failed to initialize DisplayManager");
-            return;
-        }
-    }
+    mDisplayManager = std::move(displayManager);
 
     Settings::getInstance()->addListener([this]() { onSettingsChanged(); });
-    Settings::getInstance()->setDisplayTimings({mRefreshPeriod, appVsyncOffset, sfVsyncOffset});
-
-    std::lock_guard<std::mutex> lock(mFrameDurationsMutex);
-    mFrameDurations.reserve(mFrameDurationSamples);
+    Settings::getInstance()->setDisplayTimings({mRefreshPeriod,
+                                                settings.appVsyncOffset,
+                                                settings.sfVsyncOffset});
 
     ALOGI("Initialized Swappy with vsyncPeriod=%lld, appOffset=%lld, sfOffset=%lld",
-          (long long)vsyncPeriodNanos,
-          (long long)appVsyncOffset.count(),
-          (long long)sfVsyncOffset.count()
+          (long long)mRefreshPeriod.count(),
+          (long long)settings.appVsyncOffset.count(),
+          (long long)settings.sfVsyncOffset.count()
     );
 
     mValid = true;
@@ -161,7 +107,8 @@ nanoseconds SwappyCommon::wakeClient() {
     // We're attempting to align with SurfaceFlinger's vsync, but it's always better to be a little
     // late than a little early (since a little early could cause our frame to be picked up
     // prematurely), so we pad by an additional millisecond.
-    mCurrentFrameTimestamp = std::chrono::steady_clock::now() + mSwapDuration.load() + 1ms;
+    mCurrentFrameWakeTime = mClock->now();
+    mCurrentFrameTimestamp = mCurrentFrameWakeTime + mSwapDuration.load() + 1ms;
     mWaitingCondition.notify_all();
     return mSwapDuration;
 }
@@ -186,7 +133,8 @@ bool SwappyCommon::waitForNextFrame(const SwapHandlers& h) {
     int lateFrames = 0;
     bool presentationTimeIsNeeded;
 
-    const nanoseconds cpuTime = std::chrono::steady_clock::now() - mStartFrameTime;
+    const auto waitStart = mClock->now();
+    const nanoseconds cpuTime = waitStart - mStartFrameTime;
     mCPUTracer.endTrace();
 
     preWaitCallbacks();
@@ -210,6 +158,9 @@ bool SwappyCommon::waitForNextFrame(const SwapHandlers& h) {
 
     const nanoseconds gpuTime = h.getPrevFrameGpuTime();
     addFrameDuration({cpuTime, gpuTime});
+    mCurrentRecord.cpu_time_ns = cpuTime.count();
+    mCurrentRecord.gpu_time_ns = gpuTime.count();
+    mCurrentRecord.wait_time_ns += (mClock->now() - waitStart).count();
     postWaitCallbacks();
 
     return presentationTimeIsNeeded;
@@ -255,8 +206,7 @@ void SwappyCommon::updateDisplayTimings() {
         setPreferredRefreshRate(mSwapIntervalNS);
     }
 
-    mFrameDurations.clear();
-    mFrameDurationsSum = {};
+    mSwapIntervalController->reset();
 
     TRACE_INT("mSwapIntervalNS", int(mSwapIntervalNS.count()));
     TRACE_INT("mAutoSwapInterval", mAutoSwapInterval);
@@ -277,8 +227,10 @@ void SwappyCommon::onPreSwap(const SwapHandlers& h) {
         mPresentationTimeNeeded =
                 (mRefreshPeriod * mAutoSwapInterval <= mAutoSwapIntervalThresholdNS.load());
     }
+    mCurrentRecord.desired_present_time_ns =
+            mPresentationTimeNeeded ? toNS(mPresentationTime) : 0;
 
-    mSwapTime = std::chrono::steady_clock::now();
+    mSwapTime = mClock->now();
     preSwapBuffersCallbacks();
 }
 
@@ -286,12 +238,16 @@ void SwappyCommon::onPostSwap(const SwapHandlers& h) {
     postSwapBuffersCallbacks();
 
 
-    updateSwapDuration(std::chrono::steady_clock::now() - mSwapTime);
+    const nanoseconds swapDuration = mClock->now() - mSwapTime;
+    updateSwapDuration(swapDuration);
 
     if (mPipelineMode == PipelineMode::Off) {
         waitForNextFrame(h);
     }
 
+    // Before the swap interval is updated, so that the record has the one the frame was paced to
+    recordFrame(h, swapDuration);
+
     if (updateSwapInterval()) {
         swapIntervalChangedCallbacks();
         TRACE_INT("mPipelineMode", static_cast<int>(mPipelineMode));
@@ -325,66 +281,20 @@ void SwappyCommon::addFrameDuration(FrameDuration duration) {
     ALOGV("gpuTime = %.2f", duration.getGpuTime().count() / 1e6f);
 
     std::lock_guard<std::mutex> lock(mFrameDurationsMutex);
-    // keep a sliding window of mFrameDurationSamples
-    if (mFrameDurations.size() == mFrameDurationSamples) {
-        mFrameDurationsSum -= mFrameDurations.front();
-        mFrameDurations.erase(mFrameDurations.begin());
-    }
-
-    mFrameDurations.push_back(duration);
-    mFrameDurationsSum += duration;
-}
-
-bool SwappyCommon::pipelineModeNotNeeded(const nanoseconds& averageFrameTime,
-                                         const nanoseconds& upperBound) {
-    return (mPipelineModeAutoMode && averageFrameTime < upperBound);
+    mSwapIntervalController->addFrame(duration);
+    mRecentFrameDurations.add(duration);
 }
 
-void SwappyCommon::swapSlower(const FrameDuration& averageFrameTime,
-                        const nanoseconds& upperBound,
-                        const int32_t& newSwapInterval) {
-    ALOGV("Rendering takes too much time for the given config");
-
-    if (mPipelineMode == PipelineMode::Off &&
-            averageFrameTime.getTime(PipelineMode::On) <= upperBound) {
-        ALOGV("turning on pipelining");
-        mPipelineMode = PipelineMode::On;
-    } else {
-        mAutoSwapInterval = newSwapInterval;
-        ALOGV("Changing Swap interval to %d", mAutoSwapInterval);
-
-        // since we changed the swap interval, we may be able to turn off pipeline mode
-        const nanoseconds newUpperBound = mRefreshPeriod * mAutoSwapInterval;
-        if (pipelineModeNotNeeded(averageFrameTime.getTime(PipelineMode::Off) + FRAME_MARGIN,
-                                  newUpperBound)) {
-            ALOGV("Turning off pipelining");
-            mPipelineMode = PipelineMode::Off;
-        } else {
-            ALOGV("Turning on pipelining");
-            mPipelineMode = PipelineMode::On;
-        }
-    }
+void SwappyCommon::setAutoSwapIntervalWindow(size_t numFrames) {
+    std::lock_guard<std::mutex> lock(mFrameDurationsMutex);
+    mSwapIntervalConfig.windowFrames = numFrames;
+    mSwapIntervalController = SwapIntervalController::create(mSwapIntervalConfig);
 }
 
-void SwappyCommon::swapFaster(const FrameDuration& averageFrameTime,
-                        const nanoseconds& lowerBound,
-                        const int32_t& newSwapInterval) {
-
-
-    ALOGV("Rendering is much shorter for the given config");
-    mAutoSwapInterval = newSwapInterval;
-    ALOGV("Changing Swap interval to %d", mAutoSwapInterval);
-
-    // since we changed the swap interval, we may need to turn on pipeline mode
-    const nanoseconds newUpperBound = mRefreshPeriod * mAutoSwapInterval;
-    if (pipelineModeNotNeeded(averageFrameTime.getTime(PipelineMode::Off) + FRAME_MARGIN,
-                              newUpperBound)) {
-        ALOGV("Turning off pipelining");
-        mPipelineMode = PipelineMode::Off;
-    } else {
-        ALOGV("Turning on pipelining");
-        mPipelineMode = PipelineMode::On;
-    }
+void SwappyCommon::setAutoSwapIntervalConfig(const SwapIntervalConfig& config) {
+    std::lock_guard<std::mutex> lock(mFrameDurationsMutex);
+    mSwapIntervalConfig = config;
+    mSwapIntervalController = SwapIntervalController::create(mSwapIntervalConfig);
 }
 
 bool SwappyCommon::isSameDuration(std::chrono::nanoseconds period1, int interval1,
@@ -405,64 +315,30 @@ bool SwappyCommon::updateSwapInterval() {
     if (!mAutoSwapIntervalEnabled)
         return false;
 
-    if (mFrameDurations.size() < mFrameDurationSamples)
+    FrameDuration estimatedFrameTime;
+    if (!mSwapIntervalController->estimate(estimatedFrameTime))
         return false;
 
-    const auto averageFrameTime = mFrameDurationsSum / mFrameDurations.size();
-
-    const auto pipelineFrameTime = averageFrameTime.getTime(PipelineMode::On) + FRAME_MARGIN;
-    const auto nonPipelineFrameTime = averageFrameTime.getTime(PipelineMode::Off) + FRAME_MARGIN;
-    const auto currentConfigFrameTime = mPipelineMode == PipelineMode::On ?
-                                        pipelineFrameTime :
-                                        nonPipelineFrameTime;
-
-    // calculate the new swap interval based on average frame time assume we are in pipeline mode
-    // (prefer higher swap interval rather than turning off pipeline mode)
-    const int newSwapInterval = calculateSwapInterval(pipelineFrameTime, mRefreshPeriod);
-
-    // Define upper and lower bounds based on the swap duration
-    nanoseconds upperBoundForThisRefresh = mRefreshPeriod * mAutoSwapInterval;
-    nanoseconds lowerBoundForThisRefresh = mRefreshPeriod * (mAutoSwapInterval - 1);
-
-    // add the hysteresis to one of the bounds to avoid going back and forth when frames
-    // are exactly at the edge.
-    lowerBoundForThisRefresh -= EDGE_HYSTERESIS;
-
+    const auto& margins = mSwapIntervalConfig.margins;
+    const auto pipelineFrameTime =
+            estimatedFrameTime.getTime(PipelineMode::On) + margins.frameMargin;
+    const auto nonPipelineFrameTime =
+            estimatedFrameTime.getTime(PipelineMode::Off) + margins.frameMargin;
 
     ALOGV("mPipelineMode = %d", static_cast<int>(mPipelineMode));
-    ALOGV("Average cpu frame time = %.2f", (averageFrameTime.getCpuTime().count()) / 1e6f);
-    ALOGV("Average gpu frame time = %.2f", (averageFrameTime.getGpuTime().count()) / 1e6f);
-    ALOGV("upperBound = %.2f", upperBoundForThisRefresh.count() / 1e6f);
-    ALOGV("lowerBound = %.2f", lowerBoundForThisRefresh.count() / 1e6f);
-
-    bool configChanged = false;
-
-    // Make sure the frame time fits in the current config to avoid missing frames
-    if (currentConfigFrameTime > upperBoundForThisRefresh) {
-        swapSlower(averageFrameTime, upperBoundForThisRefresh, newSwapInterval);
-        configChanged = true;
-    }
+    ALOGV("Estimated cpu frame time = %.2f", (estimatedFrameTime.getCpuTime().count()) / 1e6f);
+    ALOGV("Estimated gpu frame time = %.2f", (estimatedFrameTime.getGpuTime().count()) / 1e6f);
 
-    // So we shouldn't miss any frames with this config but maybe we can go faster ?
-    // we check the pipeline frame time here as we prefer lower swap interval than no pipelining
-    else if (mSwapIntervalNS <= mRefreshPeriod * (mAutoSwapInterval - 1) &&
-            pipelineFrameTime < lowerBoundForThisRefresh) {
-        swapFaster(averageFrameTime, lowerBoundForThisRefresh, newSwapInterval);
-        configChanged = true;
-    }
-
-    // If we reached to this condition it means that we fit into the boundaries.
-    // However we might be in pipeline mode and we could turn it off if we still fit.
-    else if (mPipelineMode == PipelineMode::On &&
-             pipelineModeNotNeeded(nonPipelineFrameTime, upperBoundForThisRefresh)) {
-        ALOGV("Rendering time fits the current swap interval without pipelining");
-        mPipelineMode = PipelineMode::Off;
-        configChanged = true;
-    }
+    SwapIntervalState state = {mRefreshPeriod, mSwapIntervalNS, mAutoSwapInterval,
+                               mPipelineMode, mPipelineModeAutoMode};
+    const bool configChanged = swappy::updateSwapInterval(estimatedFrameTime, margins, state);
 
     if (configChanged) {
-        mFrameDurationsSum = {};
-        mFrameDurations.clear();
+        ALOGV("Changing swap interval from %d to %d, pipelining %s", mAutoSwapInterval,
+              state.autoSwapInterval, state.pipelineMode == PipelineMode::On ? "on" : "off");
+        mAutoSwapInterval = state.autoSwapInterval;
+        mPipelineMode = state.pipelineMode;
+        mSwapIntervalController->reset();
     }
 
     // Loop across all supported refresh rate to see if we can find a better refresh rate.
@@ -480,7 +356,7 @@ bool SwappyCommon::updateSwapInterval() {
             const auto period = i.first;
             const int swapIntervalForPeriod = calculateSwapInterval(pipelineFrameTime, period);
             const nanoseconds duration = period * swapIntervalForPeriod;
-            const nanoseconds lowerBound = duration - EDGE_HYSTERESIS;
+            const nanoseconds lowerBound = duration - margins.edgeHysteresis;
             if (pipelineFrameTime < lowerBound && duration < minSwapPeriod && duration >= mSwapIntervalNS) {
                 minSwapPeriod = duration;
                 betterRefreshConfig = i;
@@ -515,7 +391,7 @@ bool SwappyCommon::updateSwapInterval() {
 
         nanoseconds upperBoundForNewRefresh = betterRefreshConfig.first * betterRefreshSwapInterval;
         mPipelineModeForNewRefresh =
-                pipelineModeNotNeeded(nonPipelineFrameTime, upperBoundForNewRefresh) ?
+                (mPipelineModeAutoMode && nonPipelineFrameTime < upperBoundForNewRefresh) ?
                                       PipelineMode::Off :  PipelineMode::On;
     }
 
@@ -602,19 +478,6 @@ void SwappyCommon::setPreferredRefreshRate(int modeId) {
     mDisplayManager->setPreferredRefreshRate(modeId);
 }
 
-int SwappyCommon::calculateSwapInterval(nanoseconds frameTime, nanoseconds refreshPeriod) {
-
-    if (frameTime < refreshPeriod) {
-        return 1;
-    }
-
-    auto div_result = div(frameTime.count(), refreshPeriod.count());
-    auto framesPerRefresh = div_result.quot;
-    auto framesPerRefreshRemainder = div_result.rem;
-
-    return (framesPerRefresh + (framesPerRefreshRemainder > REFRESH_RATE_MARGIN.count() ? 1 : 0));
-}
-
 void SwappyCommon::setPreferredRefreshRate(nanoseconds frameTime) {
     if (!mDisplayManager) {
         return;
@@ -663,10 +526,12 @@ void SwappyCommon::startFrame() {
 
     int32_t currentFrame;
     std::chrono::steady_clock::time_point currentFrameTimestamp;
+    std::chrono::steady_clock::time_point currentFrameWakeTime;
     {
         std::unique_lock<std::mutex> lock(mWaitingMutex);
         currentFrame = mCurrentFrame;
         currentFrameTimestamp = mCurrentFrameTimestamp;
+        currentFrameWakeTime = mCurrentFrameWakeTime;
     }
 
     startFrameCallbacks();
@@ -679,48 +544,102 @@ void SwappyCommon::startFrame() {
     //   + the time the buffer will be on the GPU and in the queue to the compositor (1 swap period)
     mPresentationTime = currentFrameTimestamp + (mAutoSwapInterval * intervals) * mRefreshPeriod;
 
-    mStartFrameTime = std::chrono::steady_clock::now();
+    mCurrentRecord = {};
+    updateFrameDeadline(currentFrameWakeTime + mAutoSwapInterval * mRefreshPeriod);
+
+    mStartFrameTime = mClock->now();
+    mCurrentRecord.start_time_ns = toNS(mStartFrameTime);
     mCPUTracer.startTrace();
 }
 
-void SwappyCommon::waitUntilTargetFrame() {
-    TRACE_CALL();
-    std::unique_lock<std::mutex> lock(mWaitingMutex);
-    mWaitingCondition.wait(lock, [&]() { return mCurrentFrame >= mTargetFrame; });
+void SwappyCommon::recordFrame(const SwapHandlers& h, nanoseconds swapDuration) {
+    const uint64_t frameNumber = mFrameNumber++;
+    if (!mFrameRecordsEnabled) {
+        return;
+    }
+
+    mCurrentRecord.frame_number = frameNumber;
+    mCurrentRecord.swap_duration_ns = swapDuration.count();
+    mCurrentRecord.swap_interval_ns = (mAutoSwapInterval * mRefreshPeriod).count();
+    mCurrentRecord.pipeline_mode = (mPipelineMode == PipelineMode::On) ? 1 : 0;
+
+    const bool awaitTimestamps = h.trackFrameTimestamps && h.trackFrameTimestamps(frameNumber);
+    mFrameRecords.add(mCurrentRecord, awaitTimestamps);
 }
 
-void SwappyCommon::waitOneFrame() {
-    TRACE_CALL();
-    std::unique_lock<std::mutex> lock(mWaitingMutex);
-    const int32_t target = mCurrentFrame + 1;
-    mWaitingCondition.wait(lock, [&]() { return mCurrentFrame >= target; });
+void SwappyCommon::setFrameTimestamps(uint64_t frameNumber,
+                                      std::chrono::steady_clock::time_point latchTime,
+                                      std::chrono::steady_clock::time_point presentTime) {
+    mFrameRecords.setTimestamps(frameNumber, toNS(latchTime), toNS(presentTime));
 }
 
-int SwappyCommon::getSDKVersion(JNIEnv *env)
-{
-    const jclass buildClass = env->FindClass("android/os/Build$VERSION");
-    if (env->ExceptionCheck()) {
-        env->ExceptionClear();
-        ALOGE("Failed to get Build.VERSION class");
-        return 0;
+size_t SwappyCommon::getFrameRecords(SwappyFrameRecord* records, size_t maxRecords) {
+    return mFrameRecords.read(records, maxRecords);
+}
+
+bool SwappyCommon::predictFrameDuration(FrameDuration* predicted, nanoseconds* margin) {
+    std::lock_guard<std::mutex> lock(mFrameDurationsMutex);
+    FrameDuration estimate;
+    if (!mSwapIntervalController->estimate(estimate)) {
+        return false;
     }
 
-    const jfieldID sdk_int = env->GetStaticFieldID(buildClass, "SDK_INT", "I");
-    if (env->ExceptionCheck()) {
-        env->ExceptionClear();
-        ALOGE("Failed to get Build.VERSION.SDK_INT field");
-        return 0;
+    // The estimate is slow to follow frames getting longer, and leaves out the occasional long
+    // frame on purpose, so don't predict less than the longest recent frame took
+    nanoseconds cpuTime = estimate.getCpuTime();
+    nanoseconds gpuTime = estimate.getGpuTime();
+    for (size_t i = 0; i < mRecentFrameDurations.size(); ++i) {
+        cpuTime = std::max(cpuTime, mRecentFrameDurations[i].getCpuTime());
+        gpuTime = std::max(gpuTime, mRecentFrameDurations[i].getGpuTime());
     }
+    *predicted = FrameDuration(cpuTime, gpuTime);
+    *margin = mSwapIntervalConfig.margins.frameMargin;
+    return true;
+}
 
-    const jint sdk = env->GetStaticIntField(buildClass, sdk_int);
-    if (env->ExceptionCheck()) {
-        env->ExceptionClear();
-        ALOGE("Failed to get SDK version");
-        return 0;
+void SwappyCommon::updateFrameDeadline(std::chrono::steady_clock::time_point targetWakeTime) {
+    FrameDuration predicted;
+    nanoseconds margin;
+    const nanoseconds swapPeriod = mAutoSwapInterval * mRefreshPeriod;
+    if (swapPeriod > mAutoSwapIntervalThresholdNS.load() ||
+        !predictFrameDuration(&predicted, &margin)) {
+        mFrameDeadline = std::chrono::steady_clock::time_point();
+        return;
     }
 
-    ALOGI("SDK version = %d", sdk);
-    return sdk;
+    // The wait for the target frame ends when the filter wakes for it, which already allows for
+    // the swap duration before the vsync. In pipeline mode the frame is swapped at the end of
+    // that wait, in onPreSwap, and its GPU work goes in the next swap period. Otherwise the frame
+    // is swapped before the wait, and its GPU work has to be done by the end of it too.
+    const nanoseconds gpuStage = (mPipelineMode == PipelineMode::On) ?
+                                 0ns : predicted.getGpuTime();
+    const auto deadline = targetWakeTime - gpuStage;
+    mFrameDeadline = deadline;
+
+    if (!mLowLatencyMode) {
+        return;
+    }
+
+    const auto startTime = deadline - predicted.getCpuTime() - margin;
+    const auto now = mClock->now();
+    if (startTime > now) {
+        gamesdk::ScopedTrace trace("lowLatencyWait");
+        mClock->sleepUntil(std::min(startTime, now + swapPeriod));
+        mCurrentRecord.wait_time_ns = (mClock->now() - now).count();
+    }
+}
+
+void SwappyCommon::waitUntilTargetFrame() {
+    TRACE_CALL();
+    std::unique_lock<std::mutex> lock(mWaitingMutex);
+    mClock->wait(lock, mWaitingCondition, [&]() { return mCurrentFrame >= mTargetFrame; });
+}
+
+void SwappyCommon::waitOneFrame() {
+    TRACE_CALL();
+    std::unique_lock<std::mutex> lock(mWaitingMutex);
+    const int32_t target = mCurrentFrame + 1;
+    mClock->wait(lock, mWaitingCondition, [&]() { return mCurrentFrame >= target; });
 }
 
 } // namespace swappy
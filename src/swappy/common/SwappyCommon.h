@@ -24,30 +24,57 @@
 #include <list>
 #include <atomic>
 
-#include "swappy/swappyGL.h"
-#include "swappy/swappyGL_extra.h"
+#include "swappy/swappy_common.h"
 #include "Thread.h"
+#include "Clock.h"
 #include "ChoreographerFilter.h"
 #include "ChoreographerThread.h"
 #include "SwappyDisplayManager.h"
 #include "CPUTracer.h"
+#include "FrameDurations.h"
+#include "FrameRecords.h"
+#include "SwapIntervalController.h"
 
 namespace swappy {
 
 using namespace std::chrono_literals;
 
+// What SwappyCommon needs to know about the device it runs on
+struct SwappyCommonSettings {
+    int sdkVersion = 0;
+    std::chrono::nanoseconds refreshPeriod = {};
+    std::chrono::nanoseconds appVsyncOffset = {};
+    std::chrono::nanoseconds sfVsyncOffset = {};
+
+    // Query the SDK version and the default display of the activity through JNI.
+    // Returns false if the display can't be queried.
+    static bool getFromApp(JNIEnv *env, jobject jactivity, SwappyCommonSettings* out);
+};
+
 // Common part between OpenGL and Vulkan implementations.
 class SwappyCommon final {
 public:
-    enum class PipelineMode { Off, On };
+    using PipelineMode = swappy::PipelineMode;
 
     // callbacks to be called during pre/post swap
     struct SwapHandlers {
         std::function<bool()> lastFrameIsComplete;
         std::function<std::chrono::nanoseconds()> getPrevFrameGpuTime;
+        // Optional. Called with the number of each recorded frame, before onPostSwap returns.
+        // Returns true if the compositor's timestamps for the frame will be passed to
+        // setFrameTimestamps later.
+        std::function<bool(uint64_t frameNumber)> trackFrameTimestamps;
     };
 
     SwappyCommon(JNIEnv *env, jobject jactivity);
+
+    // Construct without JNI, for instance on a host with a virtual clock.
+    // Choreographer ticks come from ChoreographerThread::Type::Swappy and the display manager,
+    // which may be null, is used to switch refresh rates.
+    SwappyCommon(const SwappyCommonSettings& settings,
+                 std::shared_ptr<Clock> clock,
+                 std::unique_ptr<SwappyDisplayManager> displayManager);
+
     ~SwappyCommon();
 
     uint64_t getSwapIntervalNS();
@@ -73,70 +100,51 @@ public:
         mAutoSwapIntervalThresholdNS = swapIntervalNS;
     }
 
-    std::chrono::steady_clock::time_point getPresentationTime() { return mPresentationTime; }
-    std::chrono::nanoseconds getRefreshPeriod() const { return mRefreshPeriod; }
+    // Number of frames whose average duration drives the auto swap interval
+    void setAutoSwapIntervalWindow(size_t numFrames);
 
-    bool isValid() { return mValid; }
+    // Replaces the controller, and so forgets the frames seen so far
+    void setAutoSwapIntervalConfig(const SwapIntervalConfig& config);
 
-    std::chrono::nanoseconds getFenceTimeout() const { return mFenceTimeout; }
-    void setFenceTimeout(std::chrono::nanoseconds t) { mFenceTimeout = t; }
-private:
-    class FrameDuration {
-    public:
-        FrameDuration() = default;
-
-        FrameDuration(std::chrono::nanoseconds cpuTime, std::chrono::nanoseconds gpuTime) :
-                mCpuTime(cpuTime), mGpuTime(gpuTime) {
-            mCpuTime = std::min(mCpuTime, MAX_DURATION);
-            mGpuTime = std::min(mGpuTime, MAX_DURATION);
-        }
+    // In low latency mode, onPostSwap holds the app back so that the next frame starts as late as
+    // it can while still making its target vsync, going by its predicted CPU and GPU time.
+    void setLowLatencyMode(bool enabled) { mLowLatencyMode = enabled; }
 
-        std::chrono::nanoseconds getCpuTime() const { return mCpuTime; }
-        std::chrono::nanoseconds getGpuTime() const { return mGpuTime; }
+    // The time by which the current frame should be swapped to make its target vsync, or zero if
+    // there is no prediction yet.
+    std::chrono::steady_clock::time_point getFrameDeadline() const { return mFrameDeadline; }
 
-        std::chrono::nanoseconds getTime(PipelineMode pipeline) const {
-            if (pipeline == PipelineMode::On) {
-                return std::max(mCpuTime, mGpuTime);
-            }
+    // While enabled, a record of each swapped frame is kept for getFrameRecords.
+    void enableFrameRecords(bool enabled) { mFrameRecordsEnabled = enabled; }
+    bool frameRecordsEnabled() const { return mFrameRecordsEnabled; }
 
-            return mCpuTime + mGpuTime;
-        }
+    // Fill in the compositor's timestamps for a frame, from the thread that swaps
+    void setFrameTimestamps(uint64_t frameNumber,
+                            std::chrono::steady_clock::time_point latchTime,
+                            std::chrono::steady_clock::time_point presentTime);
 
-        FrameDuration& operator+=(const FrameDuration& other) {
-            mCpuTime += other.mCpuTime;
-            mGpuTime += other.mGpuTime;
-            return *this;
-        }
+    // Copy up to maxRecords of the oldest frame records, removing them, and return how many were
+    // copied. Can be called from any thread, but only one at a time.
+    size_t getFrameRecords(SwappyFrameRecord* records, size_t maxRecords);
 
-        FrameDuration& operator-=(const FrameDuration& other) {
-            mCpuTime -= other.mCpuTime;
-            mGpuTime -= other.mGpuTime;
-            return *this;
-        }
+    std::chrono::steady_clock::time_point getPresentationTime() { return mPresentationTime; }
+    std::chrono::nanoseconds getRefreshPeriod() const { return mRefreshPeriod; }
 
-        friend FrameDuration operator/(FrameDuration lhs, int rhs) {
-            lhs.mCpuTime /= rhs;
-            lhs.mGpuTime /= rhs;
-            return lhs;
-        }
-    private:
-        std::chrono::nanoseconds mCpuTime = std::chrono::nanoseconds(0);
-        std::chrono::nanoseconds mGpuTime = std::chrono::nanoseconds(0);
+    bool isValid() { return mValid; }
 
-        static constexpr std::chrono::nanoseconds MAX_DURATION =
-                std::chrono::milliseconds(100);
-    };
+    std::chrono::nanoseconds getFenceTimeout() const { return mFenceTimeout; }
+    void setFenceTimeout(std::chrono::nanoseconds t) { mFenceTimeout = t; }
+private:
+    explicit SwappyCommon(std::shared_ptr<Clock> clock);
+
+    // Set up the filter, Choreographer thread and display timings. Sets mValid on success.
+    void init(const SwappyCommonSettings& settings,
+              JavaVM* vm,
+              std::unique_ptr<SwappyDisplayManager> displayManager);
 
     void addFrameDuration(FrameDuration duration);
     std::chrono::nanoseconds wakeClient();
 
-    void swapFaster(const FrameDuration& averageFrameTime,
-                    const std::chrono::nanoseconds& lowerBound,
-                    const int32_t& newSwapInterval) REQUIRES(mFrameDurationsMutex);
-
-    void swapSlower(const FrameDuration& averageFrameTime,
-                    const std::chrono::nanoseconds& upperBound,
-                    const int32_t& newSwapInterval) REQUIRES(mFrameDurationsMutex);
     bool updateSwapInterval();
     void preSwapBuffersCallbacks();
     void postSwapBuffersCallbacks();
@@ -147,15 +155,18 @@ private:
     void onSettingsChanged();
     void updateSwapDuration(std::chrono::nanoseconds duration);
     void startFrame();
+    // Predict the next frame from the estimate the swap interval is fitted to, and the longest
+    // recent frame.
+    // Returns false while there is no estimate.
+    bool predictFrameDuration(FrameDuration* predicted, std::chrono::nanoseconds* margin);
+    // Set the deadline for the frame being started, which is paced to the filter waking the client
+    // at targetWakeTime, and in low latency mode sleep until the frame needs to start.
+    void updateFrameDeadline(std::chrono::steady_clock::time_point targetWakeTime);
+    void recordFrame(const SwapHandlers& h, std::chrono::nanoseconds swapDuration);
     void waitUntilTargetFrame();
     void waitOneFrame();
     void setPreferredRefreshRate(int index);
     void setPreferredRefreshRate(std::chrono::nanoseconds frameTime);
-    int calculateSwapInterval(std::chrono::nanoseconds frameTime,
-                              std::chrono::nanoseconds refreshPeriod);
-    bool pipelineModeNotNeeded(const std::chrono::nanoseconds& averageFrameTime,
-                               const std::chrono::nanoseconds& upperBound)
-                               REQUIRES(mFrameDurationsMutex);
     void updateDisplayTimings();
 
     // Waits for the next frame, considering both Choreographer and the prior frame's completion
@@ -166,9 +177,10 @@ private:
                         std::chrono::nanoseconds period2,
                         int interval2);
 
-    int getSDKVersion(JNIEnv *env);
+    // Declared first, as other members are initialized with the time
+    const std::shared_ptr<Clock> mClock;
 
-    const int mSdkVersion;
+    int mSdkVersion = 0;
 
     std::unique_ptr<ChoreographerFilter> mChoreographerFilter;
 
@@ -177,7 +189,9 @@ private:
 
     std::mutex mWaitingMutex;
     std::condition_variable mWaitingCondition;
-    std::chrono::steady_clock::time_point mCurrentFrameTimestamp = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point mCurrentFrameTimestamp = mClock->now();
+    // When the filter last woke the client, without the padding in mCurrentFrameTimestamp
+    std::chrono::steady_clock::time_point mCurrentFrameWakeTime = mClock->now();
     int32_t mCurrentFrame = 0;
     std::atomic<std::chrono::nanoseconds> mSwapDuration;
 
@@ -186,21 +200,21 @@ private:
     std::chrono::nanoseconds mRefreshPeriod;
 
     std::mutex mFrameDurationsMutex;
-    std::vector<FrameDuration> mFrameDurations GUARDED_BY(mFrameDurationsMutex);
-    FrameDuration mFrameDurationsSum GUARDED_BY(mFrameDurationsMutex);
-    static constexpr int mFrameDurationSamples = 300; // 5 Seconds in 60Hz
+    SwapIntervalConfig mSwapIntervalConfig GUARDED_BY(mFrameDurationsMutex);
+    std::unique_ptr<SwapIntervalController> mSwapIntervalController
+            GUARDED_BY(mFrameDurationsMutex);
     bool mAutoSwapIntervalEnabled GUARDED_BY(mFrameDurationsMutex) = true;
     bool mPipelineModeAutoMode GUARDED_BY(mFrameDurationsMutex) = true;
-
-    static constexpr std::chrono::nanoseconds FRAME_MARGIN = 3ms;
-    static constexpr std::chrono::nanoseconds EDGE_HYSTERESIS = 4ms;
+    // The frames the low latency prediction is bounded by
+    static constexpr size_t RECENT_FRAMES_WINDOW = 60;
+    FrameDurations mRecentFrameDurations GUARDED_BY(mFrameDurationsMutex) =
+            FrameDurations(RECENT_FRAMES_WINDOW);
 
     std::chrono::nanoseconds mSwapIntervalNS;
     int32_t mAutoSwapInterval;
     std::atomic<std::chrono::nanoseconds> mAutoSwapIntervalThresholdNS = {50ms}; // 20FPS
     int mSwapIntervalForNewRefresh = 0;
     PipelineMode mPipelineModeForNewRefresh;
-    static constexpr std::chrono::nanoseconds REFRESH_RATE_MARGIN = 500ns;
 
     std::chrono::steady_clock::time_point mStartFrameTime;
 
@@ -216,10 +230,20 @@ private:
     SwappyTracerCallbacks mInjectedTracers;
 
     int32_t mTargetFrame = 0;
-    std::chrono::steady_clock::time_point mPresentationTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point mPresentationTime = mClock->now();
     bool mPresentationTimeNeeded;
     PipelineMode mPipelineMode = PipelineMode::Off;
 
+    std::atomic<bool> mLowLatencyMode = {false};
+    std::atomic<std::chrono::steady_clock::time_point> mFrameDeadline =
+            {std::chrono::steady_clock::time_point()};
+
+    std::atomic<bool> mFrameRecordsEnabled = {false};
+    FrameRecords mFrameRecords;
+    uint64_t mFrameNumber = 0;
+    // Filled in over the course of the current frame
+    SwappyFrameRecord mCurrentRecord = {};
+
     bool mValid;
 
     std::chrono::nanoseconds mFenceTimeout = std::chrono::nanoseconds(50ms);
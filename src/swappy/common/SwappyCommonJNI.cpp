@@ -0,0 +1,152 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// The parts of SwappyCommon that need JNI, kept apart so that the rest can be built without it.
+
+#include "SwappyCommon.h"
+
+#include "Log.h"
+
+#define LOG_TAG "SwappyCommon"
+
+namespace swappy {
+
+namespace {
+
+int getSDKVersion(JNIEnv *env)
+{
+    const jclass buildClass = env->FindClass("android/os/Build$VERSION");
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        ALOGE("Failed to get Build.VERSION class");
+        return 0;
+    }
+
+    const jfieldID sdk_int = env->GetStaticFieldID(buildClass, "SDK_INT", "I");
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        ALOGE("Failed to get Build.VERSION.SDK_INT field");
+        return 0;
+    }
+
+    const jint sdk = env->GetStaticIntField(buildClass, sdk_int);
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        ALOGE("Failed to get SDK version");
+        return 0;
+    }
+
+    ALOGI("SDK version = %d", sdk);
+    return sdk;
+}
+
+} // anonymous namespace
+
+bool SwappyCommonSettings::getFromApp(JNIEnv *env, jobject jactivity,
+                                      SwappyCommonSettings* out) {
+    out->sdkVersion = getSDKVersion(env);
+
+    jclass activityClass = env->FindClass("android/app/NativeActivity");
+    jclass windowManagerClass = env->FindClass("android/view/WindowManager");
+    jclass displayClass = env->FindClass("android/view/Display");
+
+    jmethodID getWindowManager = env->GetMethodID(
+            activityClass,
+            "getWindowManager",
+            "()Landroid/view/WindowManager;");
+
+    jmethodID getDefaultDisplay = env->GetMethodID(
+            windowManagerClass,
+            "getDefaultDisplay",
+            "()Landroid/view/Display;");
+
+    jobject wm = env->CallObjectMethod(jactivity, getWindowManager);
+    jobject display = env->CallObjectMethod(wm, getDefaultDisplay);
+
+    jmethodID getRefreshRate = env->GetMethodID(
+            displayClass,
+            "getRefreshRate",
+            "()F");
+
+    const float refreshRateHz = env->CallFloatMethod(display, getRefreshRate);
+
+    jmethodID getAppVsyncOffsetNanos = env->GetMethodID(
+            displayClass,
+            "getAppVsyncOffsetNanos", "()J");
+
+    // getAppVsyncOffsetNanos was only added in API 21.
+    // Return gracefully if this device doesn't support it.
+    if (getAppVsyncOffsetNanos == 0 || env->ExceptionOccurred()) {
+        ALOGE("Error while getting method: getAppVsyncOffsetNanos");
+        env->ExceptionClear();
+        return false;
+    }
+    const long appVsyncOffsetNanos = env->CallLongMethod(display, getAppVsyncOffsetNanos);
+
+    jmethodID getPresentationDeadlineNanos = env->GetMethodID(
+        displayClass,
+        "getPresentationDeadlineNanos",
+        "()J");
+
+
+    if (getPresentationDeadlineNanos == 0 || env->ExceptionOccurred()) {
+        ALOGE("Error while getting method: getPresentationDeadlineNanos");
+        return false;
+    }
+
+    const long vsyncPresentationDeadlineNanos = env->CallLongMethod(
+        display, getPresentationDeadlineNanos);
+
+    const long ONE_MS_IN_NS = 1000 * 1000;
+    const long ONE_S_IN_NS = ONE_MS_IN_NS * 1000;
+
+    const long vsyncPeriodNanos = static_cast<long>(ONE_S_IN_NS / refreshRateHz);
+    const long sfVsyncOffsetNanos =
+        vsyncPeriodNanos - (vsyncPresentationDeadlineNanos - ONE_MS_IN_NS);
+
+    using std::chrono::nanoseconds;
+    out->refreshPeriod = nanoseconds(vsyncPeriodNanos);
+    out->appVsyncOffset = nanoseconds(appVsyncOffsetNanos);
+    out->sfVsyncOffset = nanoseconds(sfVsyncOffsetNanos);
+    return true;
+}
+
+SwappyCommon::SwappyCommon(JNIEnv *env, jobject jactivity)
+        : SwappyCommon(Clock::steady()) {
+    SwappyCommonSettings settings;
+    const bool haveSettings = SwappyCommonSettings::getFromApp(env, jactivity, &settings);
+    mSdkVersion = settings.sdkVersion;
+    if (!haveSettings) {
+        return;
+    }
+
+    JavaVM* vm;
+    env->GetJavaVM(&vm);
+
+    std::unique_ptr<SwappyDisplayManager> displayManager;
+    if (USE_DISPLAY_MANAGER && mSdkVersion >= SwappyDisplayManager::MIN_SDK_VERSION) {
+        displayManager = std::make_unique<SwappyDisplayManager>(vm, jactivity);
+        if (!displayManager->isInitialized()) {
+            ALOGE("failed to initialize DisplayManager");
+            return;
+        }
+    }
+
+    init(settings, vm, std::move(displayManager));
+}
+
+} // namespace swappy
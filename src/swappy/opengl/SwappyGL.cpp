@@ -16,6 +16,7 @@
 
 #include "SwappyGL.h"
 
+#include <algorithm>
 #include <cmath>
 #include <thread>
 #include <cstdlib>
@@ -93,9 +94,15 @@ bool SwappyGL::lastFrameIsComplete(EGLDisplay display) {
 }
 
 bool SwappyGL::swapInternal(EGLDisplay display, EGLSurface surface) {
+    std::pair<bool,EGLuint64KHR> frameId = {false, 0};
     const SwappyCommon::SwapHandlers handlers = {
             .lastFrameIsComplete = [&]() { return lastFrameIsComplete(display); },
             .getPrevFrameGpuTime = [&]() { return getEgl()->getFencePendingTime(); },
+            .trackFrameTimestamps = [&](uint64_t frameNumber) {
+                if (!frameId.first) return false;
+                mPendingTimestamps.push_back({display, surface, frameId.second, frameNumber});
+                return true;
+            },
     };
 
     mCommonBase.onPreSwap(handlers);
@@ -109,10 +116,16 @@ bool SwappyGL::swapInternal(EGLDisplay display, EGLSurface surface) {
 
     resetSyncFence(display);
 
+    if (mCommonBase.frameRecordsEnabled() && getEgl()->statsSupported()) {
+        frameId = getEgl()->getNextFrameId(display, surface);
+    }
+
     bool swapBuffersResult = (eglSwapBuffers(display, surface) == EGL_TRUE);
 
     mCommonBase.onPostSwap(handlers);
 
+    pollFrameTimestamps();
+
     return swapBuffersResult;
 }
 
@@ -161,6 +174,46 @@ void SwappyGL::setMaxAutoSwapIntervalNS(std::chrono::nanoseconds maxSwapNS) {
     swappy->mCommonBase.setMaxAutoSwapIntervalNS(maxSwapNS);
 }
 
+void SwappyGL::setAutoSwapIntervalWindow(size_t numFrames) {
+    SwappyGL *swappy = getInstance();
+    if (!swappy) {
+        ALOGE("Failed to get SwappyGL instance in setAutoSwapIntervalWindow");
+        return;
+    }
+    swappy->mCommonBase.setAutoSwapIntervalWindow(numFrames);
+}
+
+void SwappyGL::setAutoSwapIntervalConfig(const SwappyAutoSwapIntervalConfig* config) {
+    SwappyGL *swappy = getInstance();
+    if (!swappy) {
+        ALOGE("Failed to get SwappyGL instance in setAutoSwapIntervalConfig");
+        return;
+    }
+    if (config == nullptr) {
+        ALOGE("Null config passed to setAutoSwapIntervalConfig");
+        return;
+    }
+    swappy->mCommonBase.setAutoSwapIntervalConfig(SwapIntervalConfig::from(*config));
+}
+
+void SwappyGL::setLowLatencyMode(bool enabled) {
+    SwappyGL *swappy = getInstance();
+    if (!swappy) {
+        ALOGE("Failed to get SwappyGL instance in setLowLatencyMode");
+        return;
+    }
+    swappy->mCommonBase.setLowLatencyMode(enabled);
+}
+
+std::chrono::steady_clock::time_point SwappyGL::getFrameDeadline() {
+    SwappyGL *swappy = getInstance();
+    if (!swappy) {
+        ALOGE("Failed to get SwappyGL instance in getFrameDeadline");
+        return std::chrono::steady_clock::time_point();
+    }
+    return swappy->mCommonBase.getFrameDeadline();
+}
+
 void SwappyGL::enableStats(bool enabled) {
     SwappyGL *swappy = getInstance();
     if (!swappy) {
@@ -210,6 +263,24 @@ void SwappyGL::getStats(SwappyStats *stats) {
         *stats = swappy->mFrameStatistics->getStats();
 }
 
+void SwappyGL::enableFrameRecords(bool enabled) {
+    SwappyGL *swappy = getInstance();
+    if (!swappy) {
+        ALOGE("Failed to get SwappyGL instance in enableFrameRecords");
+        return;
+    }
+    swappy->mCommonBase.enableFrameRecords(enabled);
+}
+
+size_t SwappyGL::getFrameRecords(SwappyFrameRecord* records, size_t maxRecords) {
+    SwappyGL *swappy = getInstance();
+    if (!swappy) {
+        ALOGE("Failed to get SwappyGL instance in getFrameRecords");
+        return 0;
+    }
+    return swappy->mCommonBase.getFrameRecords(records, maxRecords);
+}
+
 SwappyGL *SwappyGL::getInstance() {
     std::lock_guard<std::mutex> lock(sInstanceMutex);
     return sInstance.get();
@@ -285,6 +356,32 @@ SwappyGL::SwappyGL(JNIEnv *env, jobject jactivity, ConstructorTag)
     ALOGI("SwappyGL initialized successfully");
 }
 
+void SwappyGL::pollFrameTimestamps() {
+    // The frame records stop waiting for timestamps after this many frames, so don't ask for them
+    while (mPendingTimestamps.size() > FrameRecords::MAX_PENDING) {
+        mPendingTimestamps.pop_front();
+    }
+
+    while (!mPendingTimestamps.empty()) {
+        const PendingTimestamps& frame = mPendingTimestamps.front();
+        std::unique_ptr<EGL::FrameTimestamps> timestamps =
+                getEgl()->getFrameTimestamps(frame.dpy, frame.surface, frame.id);
+        if (!timestamps) {
+            return;
+        }
+
+        // Invalid timestamps are negative, and are recorded as unknown
+        auto toTimePoint = [](EGLnsecsANDROID t) {
+            return std::chrono::steady_clock::time_point(
+                    std::chrono::nanoseconds(std::max<EGLnsecsANDROID>(t, 0)));
+        };
+        mCommonBase.setFrameTimestamps(frame.frameNumber,
+                                       toTimePoint(timestamps->compositionLatched),
+                                       toTimePoint(timestamps->presented));
+        mPendingTimestamps.pop_front();
+    }
+}
+
 void SwappyGL::resetSyncFence(EGLDisplay display) {
     getEgl()->resetSyncFence(display);
 }
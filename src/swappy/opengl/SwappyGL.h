@@ -18,6 +18,7 @@
 
 #include <jni.h>
 #include <chrono>
+#include <deque>
 #include <mutex>
 
 #include "swappy/swappyGL.h"
@@ -58,9 +59,19 @@ class SwappyGL {
 
     static void setMaxAutoSwapIntervalNS(std::chrono::nanoseconds maxSwapNS);
 
+    static void setAutoSwapIntervalWindow(size_t numFrames);
+
+    static void setAutoSwapIntervalConfig(const SwappyAutoSwapIntervalConfig* config);
+
+    static void setLowLatencyMode(bool enabled);
+
+    static std::chrono::steady_clock::time_point getFrameDeadline();
+
     static void enableStats(bool enabled);
     static void recordFrameStart(EGLDisplay display, EGLSurface surface);
     static void getStats(SwappyStats *stats);
+    static void enableFrameRecords(bool enabled);
+    static size_t getFrameRecords(SwappyFrameRecord* records, size_t maxRecords);
     static bool isEnabled();
     static void destroyInstance();
 
@@ -85,6 +96,9 @@ private:
     // using eglPresentationTimeANDROID
     bool setPresentationTime(EGLDisplay display, EGLSurface surface);
 
+    // Pass the compositor's timestamps for the frames that have them on to the frame records
+    void pollFrameTimestamps();
+
     bool mEnableSwappy = true;
 
     static std::mutex sInstanceMutex;
@@ -95,6 +109,15 @@ private:
 
     std::unique_ptr<FrameStatistics> mFrameStatistics;
 
+    // Frames whose records wait for their EGL timestamps, oldest first
+    struct PendingTimestamps {
+        EGLDisplay dpy;
+        EGLSurface surface;
+        EGLuint64KHR id;
+        uint64_t frameNumber;
+    };
+    std::deque<PendingTimestamps> mPendingTimestamps;
+
     SwappyCommon mCommonBase;
 };
 
@@ -76,6 +76,22 @@ void SwappyGL_setMaxAutoSwapIntervalNS(uint64_t max_swap_ns) {
     SwappyGL::setMaxAutoSwapIntervalNS(std::chrono::nanoseconds(max_swap_ns));
 }
 
+void SwappyGL_setAutoSwapIntervalWindow(uint32_t num_frames) {
+    SwappyGL::setAutoSwapIntervalWindow(num_frames);
+}
+
+void SwappyGL_setAutoSwapIntervalConfig(const SwappyAutoSwapIntervalConfig* config) {
+    SwappyGL::setAutoSwapIntervalConfig(config);
+}
+
+void SwappyGL_setLowLatencyMode(bool enabled) {
+    SwappyGL::setLowLatencyMode(enabled);
+}
+
+uint64_t SwappyGL_getFrameDeadlineNS() {
+    return SwappyGL::getFrameDeadline().time_since_epoch().count();
+}
+
 void SwappyGL_setAutoPipelineMode(bool enabled) {
     SwappyGL::setAutoPipelineMode(enabled);
 }
@@ -88,6 +104,14 @@ void SwappyGL_recordFrameStart(EGLDisplay display, EGLSurface surface) {
     SwappyGL::recordFrameStart(display, surface);
 }
 
+void SwappyGL_enableFrameRecords(bool enabled) {
+    SwappyGL::enableFrameRecords(enabled);
+}
+
+uint32_t SwappyGL_getFrameRecords(SwappyFrameRecord* records, uint32_t max_records) {
+    return SwappyGL::getFrameRecords(records, max_records);
+}
+
 void SwappyGL_getStats(SwappyStats *stats) {
     SwappyGL::getStats(stats);
 }
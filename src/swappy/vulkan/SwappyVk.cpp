@@ -190,6 +190,46 @@ void SwappyVk::SetMaxAutoSwapIntervalNS(std::chrono::nanoseconds maxSwapNS) {
     }
 }
 
+void SwappyVk::SetAutoSwapIntervalWindow(size_t numFrames) {
+    for (auto i : perSwapchainImplementation) {
+        i.second->setAutoSwapIntervalWindow(numFrames);
+    }
+}
+
+void SwappyVk::SetAutoSwapIntervalConfig(const SwapIntervalConfig& config) {
+    for (auto i : perSwapchainImplementation) {
+        i.second->setAutoSwapIntervalConfig(config);
+    }
+}
+
+void SwappyVk::SetLowLatencyMode(bool enabled) {
+    for (auto i : perSwapchainImplementation) {
+        i.second->setLowLatencyMode(enabled);
+    }
+}
+
+std::chrono::steady_clock::time_point SwappyVk::GetFrameDeadline(VkSwapchainKHR swapchain) const {
+    auto it = perSwapchainImplementation.find(swapchain);
+    if (it != perSwapchainImplementation.end())
+        return it->second->getFrameDeadline();
+    return std::chrono::steady_clock::time_point();
+}
+
+void SwappyVk::EnableFrameRecords(bool enabled) {
+    for (auto i : perSwapchainImplementation) {
+        i.second->enableFrameRecords(enabled);
+    }
+}
+
+size_t SwappyVk::GetFrameRecords(VkSwapchainKHR swapchain,
+                                 SwappyFrameRecord* records,
+                                 size_t maxRecords) {
+    auto it = perSwapchainImplementation.find(swapchain);
+    if (it != perSwapchainImplementation.end())
+        return it->second->getFrameRecords(records, maxRecords);
+    return 0;
+}
+
 void SwappyVk::SetFenceTimeout(std::chrono::nanoseconds t) {
     for(auto i : perDeviceImplementation) {
         i.second->setFenceTimeout(t);
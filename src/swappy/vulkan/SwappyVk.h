@@ -78,6 +78,14 @@ public:
     void SetAutoSwapInterval(bool enabled);
     void SetAutoPipelineMode(bool enabled);
     void SetMaxAutoSwapIntervalNS(std::chrono::nanoseconds maxSwapNS);
+    void SetAutoSwapIntervalWindow(size_t numFrames);
+    void SetAutoSwapIntervalConfig(const SwapIntervalConfig& config);
+    void SetLowLatencyMode(bool enabled);
+    std::chrono::steady_clock::time_point GetFrameDeadline(VkSwapchainKHR swapchain) const;
+    void EnableFrameRecords(bool enabled);
+    size_t GetFrameRecords(VkSwapchainKHR swapchain,
+                           SwappyFrameRecord* records,
+                           size_t maxRecords);
     void SetFenceTimeout(std::chrono::nanoseconds duration);
     std::chrono::nanoseconds GetFenceTimeout() const;
 
@@ -284,6 +284,30 @@ void SwappyVkBase::setMaxAutoSwapIntervalNS(std::chrono::nanoseconds swapMaxNS)
     mCommonBase.setMaxAutoSwapIntervalNS(swapMaxNS);
 }
 
+void SwappyVkBase::setAutoSwapIntervalWindow(size_t numFrames) {
+    mCommonBase.setAutoSwapIntervalWindow(numFrames);
+}
+
+void SwappyVkBase::setAutoSwapIntervalConfig(const SwapIntervalConfig& config) {
+    mCommonBase.setAutoSwapIntervalConfig(config);
+}
+
+void SwappyVkBase::setLowLatencyMode(bool enabled) {
+    mCommonBase.setLowLatencyMode(enabled);
+}
+
+std::chrono::steady_clock::time_point SwappyVkBase::getFrameDeadline() const {
+    return mCommonBase.getFrameDeadline();
+}
+
+void SwappyVkBase::enableFrameRecords(bool enabled) {
+    mCommonBase.enableFrameRecords(enabled);
+}
+
+size_t SwappyVkBase::getFrameRecords(SwappyFrameRecord* records, size_t maxRecords) {
+    return mCommonBase.getFrameRecords(records, maxRecords);
+}
+
 void SwappyVkBase::setAutoPipelineMode(bool enabled) {
     mCommonBase.setAutoPipelineMode(enabled);
 }
@@ -120,6 +120,12 @@ public:
     void setAutoPipelineMode(bool enabled);
 
     void setMaxAutoSwapIntervalNS(std::chrono::nanoseconds swapMaxNS);
+    void setAutoSwapIntervalWindow(size_t numFrames);
+    void setAutoSwapIntervalConfig(const SwapIntervalConfig& config);
+    void setLowLatencyMode(bool enabled);
+    std::chrono::steady_clock::time_point getFrameDeadline() const;
+    void enableFrameRecords(bool enabled);
+    size_t getFrameRecords(SwappyFrameRecord* records, size_t maxRecords);
 
     void setFenceTimeout(std::chrono::nanoseconds duration);
     std::chrono::nanoseconds getFenceTimeout() const;
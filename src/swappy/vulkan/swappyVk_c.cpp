@@ -113,6 +113,47 @@ void SwappyVk_setMaxAutoSwapIntervalNS(uint64_t max_swap_ns) {
     swappy.SetMaxAutoSwapIntervalNS(std::chrono::nanoseconds(max_swap_ns));
 }
 
+void SwappyVk_setAutoSwapIntervalWindow(uint32_t num_frames) {
+    TRACE_CALL();
+    swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
+    swappy.SetAutoSwapIntervalWindow(num_frames);
+}
+
+void SwappyVk_setAutoSwapIntervalConfig(const SwappyAutoSwapIntervalConfig* config) {
+    TRACE_CALL();
+    if (config == nullptr) {
+        return;
+    }
+    swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
+    swappy.SetAutoSwapIntervalConfig(swappy::SwapIntervalConfig::from(*config));
+}
+
+void SwappyVk_setLowLatencyMode(bool enabled) {
+    TRACE_CALL();
+    swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
+    swappy.SetLowLatencyMode(enabled);
+}
+
+uint64_t SwappyVk_getFrameDeadlineNS(VkSwapchainKHR swapchain) {
+    TRACE_CALL();
+    swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
+    return swappy.GetFrameDeadline(swapchain).time_since_epoch().count();
+}
+
+void SwappyVk_enableFrameRecords(bool enabled) {
+    TRACE_CALL();
+    swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
+    swappy.EnableFrameRecords(enabled);
+}
+
+uint32_t SwappyVk_getFrameRecords(VkSwapchainKHR swapchain,
+                                  SwappyFrameRecord* records,
+                                  uint32_t max_records) {
+    TRACE_CALL();
+    swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
+    return swappy.GetFrameRecords(swapchain, records, max_records);
+}
+
 uint64_t SwappyVk_getFenceTimeoutNS() {
     TRACE_CALL();
     swappy::SwappyVk& swappy = swappy::SwappyVk::getInstance();
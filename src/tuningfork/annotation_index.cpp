@@ -0,0 +1,208 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "annotation_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define LOG_TAG "TuningFork"
+#include "Log.h"
+
+namespace tuningfork {
+
+constexpr size_t AnnotationIndex::kDefaultMaxAnnotations;
+
+namespace {
+
+constexpr size_t kInitialTableSize = 64; // Must be a power of 2
+
+enum WireType {
+    VARINT = 0,
+    FIXED64 = 1,
+    LENGTH_DELIMITED = 2,
+    FIXED32 = 5
+};
+
+bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    if (p >= end) return false;
+    p = annotation_util::DecodeVarint(p, end, v);
+    return p != nullptr;
+}
+
+void WriteVarint(uint64_t v, std::vector<uint8_t>& out) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+struct Field {
+    uint32_t number;
+    WireType type;
+    uint64_t value; // For varints
+    const uint8_t* begin; // For other types, the payload
+    size_t size;
+};
+
+// FNV-1a
+uint64_t Hash(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+} // anonymous namespace
+
+AnnotationIndex::AnnotationIndex(const std::vector<uint32_t>& enum_sizes, uint32_t max_ikeys,
+                                 size_t max_annotations)
+    : enum_sizes_(enum_sizes), max_annotations_(max_annotations),
+      table_(kInitialTableSize, 0), num_ids_(0) {
+    // Slots hold id + 1 in 32 bits
+    size_t limit = UINT32_MAX - 1;
+    if (max_ikeys > 0)
+        limit = std::min<uint64_t>(limit, UINT64_MAX / max_ikeys);
+    if (max_annotations_ > limit) {
+        ALOGW("Too many annotations for %u instrument keys: limiting to %zu", max_ikeys, limit);
+        max_annotations_ = limit;
+    }
+    if (max_annotations_ == 0)
+        max_annotations_ = 1;
+    // The empty annotation is id 0
+    offsets_.push_back(0);
+    GetOrCreate({});
+}
+
+bool AnnotationIndex::Canonicalize(const SerializedAnnotation& ser,
+                                   SerializedAnnotation& canonical) const {
+    std::vector<Field> fields;
+    const uint8_t* p = ser.data();
+    const uint8_t* end = p + ser.size();
+    while (p < end) {
+        uint64_t tag;
+        if (!ReadVarint(p, end, tag) || (tag >> 3) == 0 || (tag >> 3) > UINT32_MAX)
+            return false;
+        Field f {static_cast<uint32_t>(tag >> 3), static_cast<WireType>(tag & 7), 0, p, 0};
+        switch (f.type) {
+            case VARINT:
+                if (!ReadVarint(p, end, f.value)) return false;
+                break;
+            case FIXED64:
+            case FIXED32:
+                f.size = f.type == FIXED64 ? 8 : 4;
+                break;
+            case LENGTH_DELIMITED: {
+                uint64_t n;
+                if (!ReadVarint(p, end, n)) return false;
+                f.begin = p;
+                f.size = n;
+                break;
+            }
+            default:
+                return false;
+        }
+        if (f.size > size_t(end - p)) return false;
+        p += f.size;
+        if (f.number <= enum_sizes_.size() && enum_sizes_[f.number - 1] > 0) {
+            if (f.type != VARINT || f.value == 0 || f.value > enum_sizes_[f.number - 1])
+                return false;
+        }
+        fields.push_back(f);
+    }
+    // Stable, so repeated fields keep their order
+    std::stable_sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) {
+        return a.number < b.number;
+    });
+    canonical.clear();
+    for (auto& f: fields) {
+        WriteVarint((uint64_t(f.number) << 3) | f.type, canonical);
+        if (f.type == VARINT) {
+            WriteVarint(f.value, canonical);
+        } else {
+            if (f.type == LENGTH_DELIMITED)
+                WriteVarint(f.size, canonical);
+            canonical.insert(canonical.end(), f.begin, f.begin + f.size);
+        }
+    }
+    return true;
+}
+
+AnnotationIndex::AnnotationId AnnotationIndex::GetOrCreate(const SerializedAnnotation& ser) {
+    SerializedAnnotation canonical;
+    if (!Canonicalize(ser, canonical))
+        return annotation_util::kAnnotationError;
+    uint64_t hash = Hash(canonical.data(), canonical.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto id = Find(canonical, hash);
+    if (id != annotation_util::kAnnotationError)
+        return id;
+    id = hashes_.size();
+    if (id >= max_annotations_) {
+        ALOGW("Limit of %zu distinct annotations reached", max_annotations_);
+        return annotation_util::kAnnotationError;
+    }
+    // Keep the load factor at or below 1/2
+    if (2 * (id + 1) > table_.size())
+        Grow();
+    data_.insert(data_.end(), canonical.begin(), canonical.end());
+    offsets_.push_back(static_cast<uint32_t>(data_.size()));
+    hashes_.push_back(hash);
+    Insert(id, hash);
+    num_ids_.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+AnnotationIndex::AnnotationId AnnotationIndex::Find(const SerializedAnnotation& canonical,
+                                                    uint64_t hash) const {
+    size_t mask = table_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t slot = table_[i];
+        if (slot == 0) return annotation_util::kAnnotationError;
+        AnnotationId id = slot - 1;
+        if (hashes_[id] != hash) continue;
+        size_t n = offsets_[id + 1] - offsets_[id];
+        if (n == canonical.size()
+            && (n == 0 || memcmp(&data_[offsets_[id]], canonical.data(), n) == 0))
+            return id;
+    }
+}
+
+void AnnotationIndex::Insert(AnnotationId id, uint64_t hash) {
+    size_t mask = table_.size() - 1;
+    size_t i = hash & mask;
+    while (table_[i] != 0)
+        i = (i + 1) & mask;
+    table_[i] = id + 1;
+}
+
+void AnnotationIndex::Grow() {
+    table_.assign(table_.size() * 2, 0);
+    for (AnnotationId id = 0; id < hashes_.size(); ++id)
+        Insert(id, hashes_[id]);
+}
+
+AnnotationIndex::SerializedAnnotation AnnotationIndex::Serialize(AnnotationId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id >= hashes_.size())
+        return {};
+    return SerializedAnnotation(data_.begin() + offsets_[id], data_.begin() + offsets_[id + 1]);
+}
+
+} // namespace tuningfork
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "annotation_util.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace tuningfork {
+
+// Interns annotations, giving each distinct one a compact id in order of first use.
+// A serialization is parsed into its fields, which are put in field-number order to give a
+//  canonical tuple, so differently ordered serializations of an annotation share an id. Each
+//  distinct tuple is stored once and found through an open-addressing hash table, so memory
+//  scales with the number of distinct annotations seen rather than the product of the enum
+//  sizes.
+// Fields numbered within enum_sizes that have a non-zero size are enums and their values must
+//  be in [1, size]. Any other field is accepted as it is, whatever its type or value.
+// Id 0 is always the empty annotation. Ids are limited to max_annotations, which is also
+//  clamped so that an id times max_ikeys, the compound id, can't overflow.
+class AnnotationIndex {
+public:
+    typedef annotation_util::AnnotationId AnnotationId;
+    typedef annotation_util::SerializedAnnotation SerializedAnnotation;
+
+    static constexpr size_t kDefaultMaxAnnotations = 1 << 16;
+
+    AnnotationIndex(const std::vector<uint32_t>& enum_sizes, uint32_t max_ikeys,
+                    size_t max_annotations = kDefaultMaxAnnotations);
+
+    AnnotationIndex(const AnnotationIndex&) = delete;
+    AnnotationIndex& operator=(const AnnotationIndex&) = delete;
+
+    // Returns annotation_util::kAnnotationError if the serialization is malformed, has an
+    //  enum value out of range or if the index is full.
+    AnnotationId GetOrCreate(const SerializedAnnotation& ser);
+
+    // The canonical serialization of an id returned by GetOrCreate
+    SerializedAnnotation Serialize(AnnotationId id) const;
+
+    // The number of ids given out so far. Lock-free, so it can be used to validate ids.
+    size_t Size() const { return num_ids_.load(std::memory_order_acquire); }
+
+    size_t MaxSize() const { return max_annotations_; }
+
+private:
+    // Put the fields in ser into canonical order. Returns false if ser is invalid.
+    bool Canonicalize(const SerializedAnnotation& ser, SerializedAnnotation& canonical) const;
+    // Must be called with the mutex held
+    AnnotationId Find(const SerializedAnnotation& canonical, uint64_t hash) const;
+    void Insert(AnnotationId id, uint64_t hash);
+    void Grow();
+
+    std::vector<uint32_t> enum_sizes_;
+    size_t max_annotations_;
+    mutable std::mutex mutex_;
+    // The canonical serializations, back to back, and where each id's starts. The last entry
+    //  of offsets_ is the end of the data.
+    std::vector<uint8_t> data_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint64_t> hashes_;
+    // id + 1 for each slot, or 0 if empty
+    std::vector<uint32_t> table_;
+    std::atomic<size_t> num_ids_;
+};
+
+} // namespace tuningfork
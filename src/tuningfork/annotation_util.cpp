@@ -16,7 +16,9 @@
 
 #include "annotation_util.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 #define LOG_TAG "TuningFork"
 #include "Log.h"
@@ -25,6 +27,68 @@ namespace annotation_util {
 
 typedef uint64_t AnnotationId;
 
+namespace {
+
+constexpr size_t kMaxVarintSize = 10;
+constexpr uint64_t kContinuationBits = 0x8080808080808080ull;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TF_WORD_VARINTS 1
+// The 7-bit groups of the first n bytes of w, where 1 <= n <= 8, packed together
+inline uint64_t CompactVarintWord(uint64_t w, int n) {
+    if (n < 8)
+        w &= (uint64_t(1) << (8 * n)) - 1;
+    w &= ~kContinuationBits;
+    // Merge pairs of groups, then pairs of pairs, then the two halves
+    w = ((w & 0x7f007f007f007f00ull) >> 1) | (w & 0x007f007f007f007full);
+    w = ((w & 0x3fff00003fff0000ull) >> 2) | (w & 0x00003fff00003fffull);
+    w = ((w & 0x0fffffff00000000ull) >> 4) | (w & 0x000000000fffffffull);
+    return w;
+}
+#endif
+
+} // anonymous namespace
+
+const uint8_t* DecodeVarintScalar(const uint8_t* p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (size_t i = 0; i < kMaxVarintSize && p < end; ++i) {
+        uint8_t b = *p++;
+        value |= uint64_t(b & 0x7f) << (7 * i);
+        if ((b & 0x80) == 0)
+            return p;
+    }
+    return nullptr;
+}
+
+const uint8_t* DecodeVarint(const uint8_t* p, const uint8_t* end, uint64_t& value) {
+    // Most varints are a single byte
+    if (p < end && *p < 0x80) {
+        value = *p;
+        return p + 1;
+    }
+#ifdef TF_WORD_VARINTS
+    if (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        uint64_t stops = ~w & kContinuationBits;
+        if (stops != 0) {
+            // The lowest clear top bit ends the varint
+            int n = (__builtin_ctzll(stops) >> 3) + 1;
+            value = CompactVarintWord(w, n);
+            return p + n;
+        }
+        // 9 or 10 bytes: only large or negative values get here
+        uint64_t high;
+        auto next = DecodeVarintScalar(p + 8, std::min(end, p + kMaxVarintSize), high);
+        if (next == nullptr)
+            return nullptr;
+        value = CompactVarintWord(w, 8) | (high << 56);
+        return next;
+    }
+#endif
+    return DecodeVarintScalar(p, end, value);
+}
+
 // This is a protobuf 1-based index
 int GetKeyIndex(uint8_t b) {
     int type = b & 0x7;
@@ -32,23 +96,23 @@ int GetKeyIndex(uint8_t b) {
     return b >> 3;
 }
 
+// index is that of the first byte of the varint and is left at its last byte
 uint64_t GetBase128IntegerFromByteStream(const std::vector<uint8_t> &bytes, int &index) {
-    uint64_t m = 0;
-    uint64_t r = 0;
-    while (index < bytes.size() && m <= (64 - 7)) {
-        auto b = bytes[index];
-        r |= (((uint64_t) b) & 0x7f) << m;
-        if ((b & 0x80) != 0) m += 7;
-        else return r;
-        ++index;
-    }
-    return kStreamError;
+    if (index >= bytes.size())
+        return kStreamError;
+    uint64_t value;
+    auto p = bytes.data() + index;
+    auto next = DecodeVarint(p, bytes.data() + bytes.size(), value);
+    if (next == nullptr)
+        return kStreamError;
+    index += next - p - 1;
+    return value;
 }
 
 void WriteBase128IntToStream(uint64_t x, std::vector<uint8_t> &bytes) {
     do {
         uint8_t a = x & 0x7f;
-        int b = x & 0xffffffffffffff80;
+        uint64_t b = x & 0xffffffffffffff80;
         if (b) {
             bytes.push_back(a | 0x80);
             x >>= 7;
@@ -76,11 +140,9 @@ AnnotationId DecodeAnnotationSerialization(const SerializedAnnotation &ser,
         uint64_t value = GetBase128IntegerFromByteStream(ser, i);
         if (value == kStreamError)
             return kAnnotationError;
-        // Check the range of the value
-        if (value == 0 || value >= radix_mult[key])
-            return kAnnotationError;
-        // We don't allow enums with more that 255 values
-        if (value > 0xff)
+        // Check the range of the value against this field's radix
+        uint32_t radix = key > 0 ? radix_mult[key] / radix_mult[key - 1] : radix_mult[0];
+        if (value == 0 || value >= radix)
             return kAnnotationError;
         if (key > 0)
             result += radix_mult[key - 1] * value;
@@ -107,8 +169,8 @@ ErrorCode SerializeAnnotationId(uint64_t id, SerializedAnnotation& ser,
     return NO_ERROR;
 }
 
-void SetUpAnnotationRadixes( std::vector<uint32_t>& radix_mult,
-                             const std::vector<uint32_t>& enum_sizes) {
+ErrorCode SetUpAnnotationRadixes( std::vector<uint32_t>& radix_mult,
+                                  const std::vector<uint32_t>& enum_sizes) {
     ALOGV("Settings::annotation_enum_size");
     for(int i=0; i< enum_sizes.size();++i) {
         ALOGV("%d", enum_sizes[i]);
@@ -120,12 +182,18 @@ void SetUpAnnotationRadixes( std::vector<uint32_t>& radix_mult,
         radix_mult[0] = 1;
     } else {
         radix_mult.resize(n);
-        int r = 1;
+        uint64_t r = 1;
         for (int i = 0; i < n; ++i) {
-            r *= enum_sizes[i] + 1;
+            r *= uint64_t(enum_sizes[i]) + 1;
+            if (r > UINT32_MAX) {
+                ALOGE("Too many annotation combinations to number them by mixed radix");
+                radix_mult.clear();
+                return RADIX_OVERFLOW;
+            }
             radix_mult[i] = r;
         }
     }
+    return NO_ERROR;
 }
 
 } // namespace annotation_util
@@ -29,9 +29,19 @@ constexpr uint64_t kStreamError = -1;
 
 enum ErrorCode {
     NO_ERROR = 0,
-    BAD_SERIALIZATION = 1
+    BAD_SERIALIZATION = 1,
+    RADIX_OVERFLOW = 2
 };
 
+// Decode the varint starting at p, which must be before end.
+// Returns the byte after the varint, or nullptr if it is truncated or longer than 10 bytes.
+// When 8 bytes are available, the length is found and the 7-bit groups are combined a word at
+//  a time rather than a byte at a time.
+const uint8_t* DecodeVarint(const uint8_t* p, const uint8_t* end, uint64_t& value);
+
+// Byte-at-a-time version of DecodeVarint
+const uint8_t* DecodeVarintScalar(const uint8_t* p, const uint8_t* end, uint64_t& value);
+
 // Returns kAnnotationError if unsuccessful
 AnnotationId DecodeAnnotationSerialization(const SerializedAnnotation &ser,
                                            const std::vector<uint32_t>& radix_mult);
@@ -39,7 +49,9 @@ AnnotationId DecodeAnnotationSerialization(const SerializedAnnotation &ser,
 ErrorCode SerializeAnnotationId(uint64_t id, SerializedAnnotation& ser,
                           const std::vector<uint32_t>& radix_mult);
 
-void SetUpAnnotationRadixes( std::vector<uint32_t>& radix_mult,
-                             const std::vector<uint32_t>& enum_sizes);
+// Returns RADIX_OVERFLOW, leaving radix_mult empty, if the product of the radixes doesn't fit
+//  in 32 bits
+ErrorCode SetUpAnnotationRadixes( std::vector<uint32_t>& radix_mult,
+                                  const std::vector<uint32_t>& enum_sizes);
 
 } // namespace annotation_util
@@ -19,6 +19,9 @@
 #include "tuningfork/protobuf_nano_util.h"
 #include "nano/tuningfork_clearcut_log.pb.h"
 
+#define LOG_TAG "TuningFork"
+#include "Log.h"
+
 namespace tuningfork {
 
 bool ClearcutSerializer::writeCountArray(pb_ostream_t *stream, const pb_field_t *field,
@@ -28,18 +31,69 @@ bool ClearcutSerializer::writeCountArray(pb_ostream_t *stream, const pb_field_t
         return false;
     // Get the length of the data
     pb_ostream_t sizing_stream = PB_OSTREAM_SIZING;
+    auto buckets = h->Buckets();
     for (int i = 0; i < h->num_buckets_; ++i)
-        pb_encode_varint(&sizing_stream, h->buckets_[i]);
+        pb_encode_varint(&sizing_stream, buckets[i]);
     // Encode the length of the packed array in bytes
     if (!pb_encode_varint(stream, sizing_stream.bytes_written))
         return false;
     // Encode each item, without the type, since it's packed
     for (int i = 0; i < h->num_buckets_; ++i) {
-        if(!pb_encode_varint(stream, h->buckets_[i]))
+        if(!pb_encode_varint(stream, buckets[i]))
             return false;
     }
     return true;
 }
+bool ClearcutSerializer::writeSparseCountArray(pb_ostream_t *stream, const pb_field_t *field,
+                                               void *const *arg) {
+    const Histogram* h = static_cast<Histogram*>(*arg);
+    size_t size;
+    UseSparseCounts(*h, size);
+    if (!pb_encode_tag_for_field(stream, field))
+        return false;
+    if (!pb_encode_varint(stream, size))
+        return false;
+    auto buckets = h->Buckets();
+    uint32_t gap = 0;
+    for (uint32_t i = 0; i < h->num_buckets_; ++i) {
+        if (buckets[i] == 0) {
+            ++gap;
+        } else {
+            if (!pb_encode_varint(stream, gap) || !pb_encode_varint(stream, buckets[i]))
+                return false;
+            gap = 0;
+        }
+    }
+    return true;
+}
+bool ClearcutSerializer::UseSparseCounts(const Histogram& h, size_t& counts_size) {
+    typedef ProtoWriter W;
+    size_t dense = 0;
+    size_t sparse = 0;
+    auto buckets = h.Buckets();
+    uint32_t gap = 0;
+    for (uint32_t i = 0; i < h.num_buckets_; ++i) {
+        dense += W::VarintSize(buckets[i]);
+        if (buckets[i] == 0) {
+            ++gap;
+        } else {
+            sparse += W::VarintSize(gap) + W::VarintSize(buckets[i]);
+            gap = 0;
+        }
+    }
+    size_t dense_field = W::LengthDelimitedFieldSize(
+        logs_proto_tuningfork_TuningForkHistogram_counts_tag, dense);
+    size_t sparse_fields = W::LengthDelimitedFieldSize(
+        logs_proto_tuningfork_TuningForkHistogram_sparse_counts_tag, sparse)
+        + W::Int32FieldSize(logs_proto_tuningfork_TuningForkHistogram_num_buckets_tag,
+                            h.num_buckets_);
+    if (sparse_fields < dense_field) {
+        counts_size = sparse;
+        return true;
+    }
+    counts_size = dense;
+    return false;
+}
 bool ClearcutSerializer::writeCpuFreqs(pb_ostream_t *stream, const pb_field_t *field,
                                          void *const *arg) {
     std::vector<uint64_t>* v = static_cast<std::vector<uint64_t>*>(*arg);
@@ -52,8 +106,23 @@ bool ClearcutSerializer::writeCpuFreqs(pb_ostream_t *stream, const pb_field_t *f
 }
 
 void ClearcutSerializer::Fill(const Histogram& h, ClearcutHistogram& ch) {
-     ch.counts.funcs.encode = writeCountArray;
-     ch.counts.arg = (void*)(&h);
+     size_t counts_size;
+     if (UseSparseCounts(h, counts_size)) {
+         ch.sparse_counts.funcs.encode = writeSparseCountArray;
+         ch.sparse_counts.arg = (void*)(&h);
+         ch.has_num_buckets = true;
+         ch.num_buckets = h.num_buckets_;
+     } else {
+         ch.counts.funcs.encode = writeCountArray;
+         ch.counts.arg = (void*)(&h);
+     }
+     ch.has_bucket_layout = true;
+     ch.bucket_layout =
+         static_cast<com_google_tuningfork_Settings_Histogram_BucketLayout>(h.Layout());
+     ch.has_bucket_min = true;
+     ch.bucket_min = h.StartMs();
+     ch.has_bucket_max = true;
+     ch.bucket_max = h.EndMs();
 }
 
 bool ClearcutSerializer::writeAnnotation(pb_ostream_t* stream, const pb_field_t *field,
@@ -71,6 +140,26 @@ void ClearcutSerializer::Fill(const Prong& p, ClearcutHistogram& h) {
     h.annotation.funcs.encode = writeAnnotation;
     h.annotation.arg = (void*)(&p);
     Fill(p.histogram_, h);
+    Fill(p.stats_, h);
+}
+void ClearcutSerializer::Fill(const FrameStats& s, ClearcutHistogram& h) {
+    if (s.Count() == 0) return;
+    h.has_p50_ms = true;
+    h.p50_ms = s.Percentile(FrameStats::P50);
+    h.has_p90_ms = true;
+    h.p90_ms = s.Percentile(FrameStats::P90);
+    h.has_p99_ms = true;
+    h.p99_ms = s.Percentile(FrameStats::P99);
+    h.has_p999_ms = true;
+    h.p999_ms = s.Percentile(FrameStats::P999);
+    h.has_mean_ms = true;
+    h.mean_ms = s.Mean();
+    h.has_max_ms = true;
+    h.max_ms = s.Max();
+    if (s.BudgetMs() > 0) {
+        h.has_over_budget_count = true;
+        h.over_budget_count = s.OverBudgetCount();
+    }
 }
 void ClearcutSerializer::Fill(const ExtraUploadInfo& tdi, DeviceInfo& di) {
     di.has_total_memory_bytes = true;
@@ -87,7 +176,7 @@ void ClearcutSerializer::Fill(const ExtraUploadInfo& tdi, DeviceInfo& di) {
 bool ClearcutSerializer::writeHistograms(pb_ostream_t* stream, const pb_field_t *field,
                                          void *const *arg) {
     const ProngCache* pc =static_cast<const ProngCache*>(*arg);
-    for (auto &p: pc->prongs_) {
+    for (auto p: pc->prongs_) {
         if (p->histogram_.Count() > 0) {
             ClearcutHistogram h;
             Fill(*p, h);
@@ -151,7 +240,7 @@ bool ClearcutSerializer::writeFidelityParams(pb_ostream_t* stream, const pb_fiel
     }
     return true;
 }
-void ClearcutSerializer::SerializeEvent(const ProngCache& pc,
+void ClearcutSerializer::SerializeEventWithNanopb(const ProngCache& pc,
                                         const ProtobufSerialization& fidelity_params,
                                         const ExtraUploadInfo& device_info,
                                         ProtobufSerialization& evt_ser) {
@@ -162,9 +251,224 @@ void ClearcutSerializer::SerializeEvent(const ProngCache& pc,
     evt.has_device_info = true;
     Fill(device_info, evt.device_info);
     FillExtras(device_info, evt);
+    if (pc.dropped_windows_ > 0) {
+        evt.has_dropped_windows = true;
+        evt.dropped_windows = pc.dropped_windows_;
+    }
+    if (pc.merged_windows_ > 0) {
+        evt.has_merged_windows = true;
+        evt.merged_windows = pc.merged_windows_;
+    }
     VectorStream str {&evt_ser, 0};
     pb_ostream_t stream = {VectorStream::Write, &str, SIZE_MAX, 0};
     pb_encode(&stream, logs_proto_tuningfork_TuningForkLogEvent_fields, &evt);
 }
 
+// Single-pass encoding. The fields written, and their order, must match what nanopb produces
+//  from the Fill functions above.
+
+size_t ClearcutSerializer::MessageSize(const Prong& p, const HistogramSize& size) {
+    typedef ProtoWriter W;
+    auto& h = p.histogram_;
+    size_t n = W::Int32FieldSize(logs_proto_tuningfork_TuningForkHistogram_instrument_id_tag,
+                                 p.instrumentation_key_);
+    if (p.annotation_.size() > 0)
+        n += W::LengthDelimitedFieldSize(logs_proto_tuningfork_TuningForkHistogram_annotation_tag,
+                                         p.annotation_.size());
+    if (size.sparse)
+        n += W::LengthDelimitedFieldSize(
+                 logs_proto_tuningfork_TuningForkHistogram_sparse_counts_tag, size.counts)
+             + W::Int32FieldSize(logs_proto_tuningfork_TuningForkHistogram_num_buckets_tag,
+                                 h.num_buckets_);
+    else
+        n += W::LengthDelimitedFieldSize(logs_proto_tuningfork_TuningForkHistogram_counts_tag,
+                                         size.counts);
+    n += W::Int32FieldSize(logs_proto_tuningfork_TuningForkHistogram_bucket_layout_tag,
+                           h.Layout());
+    n += W::FloatFieldSize(logs_proto_tuningfork_TuningForkHistogram_bucket_min_tag);
+    n += W::FloatFieldSize(logs_proto_tuningfork_TuningForkHistogram_bucket_max_tag);
+    auto& s = p.stats_;
+    if (s.Count() > 0) {
+        // p50_ms to max_ms
+        n += 6 * W::FloatFieldSize(logs_proto_tuningfork_TuningForkHistogram_p50_ms_tag);
+        if (s.BudgetMs() > 0)
+            n += W::Int32FieldSize(
+                logs_proto_tuningfork_TuningForkHistogram_over_budget_count_tag,
+                s.OverBudgetCount());
+    }
+    return n;
+}
+
+void ClearcutSerializer::Write(const Prong& p, const HistogramSize& size, ProtoWriter& w) {
+    auto& h = p.histogram_;
+    w.LengthDelimitedHeader(logs_proto_tuningfork_TuningForkLogEvent_histograms_tag,
+                            size.message);
+    w.Int32Field(logs_proto_tuningfork_TuningForkHistogram_instrument_id_tag,
+                 p.instrumentation_key_);
+    if (p.annotation_.size() > 0)
+        w.BytesField(logs_proto_tuningfork_TuningForkHistogram_annotation_tag,
+                     p.annotation_.data(), p.annotation_.size());
+    auto buckets = h.Buckets();
+    if (!size.sparse) {
+        w.LengthDelimitedHeader(logs_proto_tuningfork_TuningForkHistogram_counts_tag,
+                                size.counts);
+        for (uint32_t i = 0; i < h.num_buckets_; ++i)
+            w.Varint(buckets[i]);
+    }
+    w.Int32Field(logs_proto_tuningfork_TuningForkHistogram_bucket_layout_tag, h.Layout());
+    w.FloatField(logs_proto_tuningfork_TuningForkHistogram_bucket_min_tag, h.StartMs());
+    w.FloatField(logs_proto_tuningfork_TuningForkHistogram_bucket_max_tag, h.EndMs());
+    auto& s = p.stats_;
+    if (s.Count() > 0) {
+        w.FloatField(logs_proto_tuningfork_TuningForkHistogram_p50_ms_tag,
+                     s.Percentile(FrameStats::P50));
+        w.FloatField(logs_proto_tuningfork_TuningForkHistogram_p90_ms_tag,
+                     s.Percentile(FrameStats::P90));
+        w.FloatField(logs_proto_tuningfork_TuningForkHistogram_p99_ms_tag,
+                     s.Percentile(FrameStats::P99));
+        w.FloatField(logs_proto_tuningfork_TuningForkHistogram_p999_ms_tag,
+                     s.Percentile(FrameStats::P999));
+        w.FloatField(logs_proto_tuningfork_TuningForkHistogram_mean_ms_tag, s.Mean());
+        w.FloatField(logs_proto_tuningfork_TuningForkHistogram_max_ms_tag, s.Max());
+        if (s.BudgetMs() > 0)
+            w.Int32Field(logs_proto_tuningfork_TuningForkHistogram_over_budget_count_tag,
+                         s.OverBudgetCount());
+    }
+    // Fields are written in order of tag number, as nanopb does, so this comes last
+    if (size.sparse) {
+        w.LengthDelimitedHeader(logs_proto_tuningfork_TuningForkHistogram_sparse_counts_tag,
+                                size.counts);
+        uint32_t gap = 0;
+        for (uint32_t i = 0; i < h.num_buckets_; ++i) {
+            if (buckets[i] == 0) {
+                ++gap;
+            } else {
+                w.Varint(gap);
+                w.Varint(buckets[i]);
+                gap = 0;
+            }
+        }
+        w.Int32Field(logs_proto_tuningfork_TuningForkHistogram_num_buckets_tag, h.num_buckets_);
+    }
+}
+
+size_t ClearcutSerializer::MessageSize(const ExtraUploadInfo& info) {
+    typedef ProtoWriter W;
+    size_t n = W::UInt64FieldSize(logs_proto_tuningfork_DeviceInfo_total_memory_bytes_tag,
+                                  info.total_memory_bytes);
+    n += W::Int32FieldSize(logs_proto_tuningfork_DeviceInfo_gl_es_version_tag,
+                           info.gl_es_version);
+    n += W::LengthDelimitedFieldSize(logs_proto_tuningfork_DeviceInfo_build_fingerprint_tag,
+                                     info.build_fingerprint.size());
+    n += W::LengthDelimitedFieldSize(logs_proto_tuningfork_DeviceInfo_build_version_sdk_tag,
+                                     info.build_version_sdk.size());
+    for (auto f: info.cpu_max_freq_hz)
+        n += W::UInt64FieldSize(logs_proto_tuningfork_DeviceInfo_cpu_max_freq_hz_tag, f);
+    return n;
+}
+
+void ClearcutSerializer::Write(const ExtraUploadInfo& info, ProtoWriter& w) {
+    w.LengthDelimitedHeader(logs_proto_tuningfork_TuningForkLogEvent_device_info_tag,
+                            MessageSize(info));
+    w.UInt64Field(logs_proto_tuningfork_DeviceInfo_total_memory_bytes_tag,
+                  info.total_memory_bytes);
+    w.Int32Field(logs_proto_tuningfork_DeviceInfo_gl_es_version_tag, info.gl_es_version);
+    w.BytesField(logs_proto_tuningfork_DeviceInfo_build_fingerprint_tag,
+                 info.build_fingerprint.data(), info.build_fingerprint.size());
+    w.BytesField(logs_proto_tuningfork_DeviceInfo_build_version_sdk_tag,
+                 info.build_version_sdk.data(), info.build_version_sdk.size());
+    for (auto f: info.cpu_max_freq_hz)
+        w.UInt64Field(logs_proto_tuningfork_DeviceInfo_cpu_max_freq_hz_tag, f);
+}
+
+bool ClearcutSerializer::SerializeEvent(const ProngCache& pc,
+                                        const ProtobufSerialization& fidelity_params,
+                                        const ExtraUploadInfo& info,
+                                        ProtobufSerialization& evt_ser,
+                                        SizeCache& sizes) {
+    typedef ProtoWriter W;
+    // Work out the total size
+    size_t total = 0;
+    if (fidelity_params.size() > 0)
+        total += W::LengthDelimitedFieldSize(
+            logs_proto_tuningfork_TuningForkLogEvent_fidelityparams_tag, fidelity_params.size());
+    total += W::LengthDelimitedFieldSize(logs_proto_tuningfork_TuningForkLogEvent_experiment_id_tag,
+                                         info.experiment_id.size());
+    sizes.clear();
+    for (auto p: pc.prongs_) {
+        if (p->histogram_.Count() > 0) {
+            HistogramSize size;
+            size.sparse = UseSparseCounts(p->histogram_, size.counts);
+            size.message = MessageSize(*p, size);
+            sizes.push_back(size);
+            total += W::LengthDelimitedFieldSize(
+                logs_proto_tuningfork_TuningForkLogEvent_histograms_tag, size.message);
+        }
+    }
+    total += W::LengthDelimitedFieldSize(logs_proto_tuningfork_TuningForkLogEvent_session_id_tag,
+                                         info.session_id.size());
+    total += W::LengthDelimitedFieldSize(logs_proto_tuningfork_TuningForkLogEvent_device_info_tag,
+                                         MessageSize(info));
+    total += W::LengthDelimitedFieldSize(
+        logs_proto_tuningfork_TuningForkLogEvent_apk_package_name_tag,
+        info.apk_package_name.size());
+    total += W::Int32FieldSize(logs_proto_tuningfork_TuningForkLogEvent_apk_version_code_tag,
+                               info.apk_version_code);
+    total += W::Int32FieldSize(logs_proto_tuningfork_TuningForkLogEvent_tuningfork_version_tag,
+                               info.tuningfork_version);
+    if (pc.dropped_windows_ > 0)
+        total += W::Int32FieldSize(logs_proto_tuningfork_TuningForkLogEvent_dropped_windows_tag,
+                                   pc.dropped_windows_);
+    if (pc.merged_windows_ > 0)
+        total += W::Int32FieldSize(logs_proto_tuningfork_TuningForkLogEvent_merged_windows_tag,
+                                   pc.merged_windows_);
+
+    // Then write it
+    if (evt_ser.size() < total)
+        evt_ser.resize(total);
+    W w(evt_ser.data(), evt_ser.data() + total);
+    if (fidelity_params.size() > 0)
+        w.BytesField(logs_proto_tuningfork_TuningForkLogEvent_fidelityparams_tag,
+                     fidelity_params.data(), fidelity_params.size());
+    w.BytesField(logs_proto_tuningfork_TuningForkLogEvent_experiment_id_tag,
+                 info.experiment_id.data(), info.experiment_id.size());
+    auto size = sizes.begin();
+    for (auto p: pc.prongs_) {
+        if (p->histogram_.Count() > 0)
+            Write(*p, *size++, w);
+    }
+    w.BytesField(logs_proto_tuningfork_TuningForkLogEvent_session_id_tag,
+                 info.session_id.data(), info.session_id.size());
+    Write(info, w);
+    w.BytesField(logs_proto_tuningfork_TuningForkLogEvent_apk_package_name_tag,
+                 info.apk_package_name.data(), info.apk_package_name.size());
+    w.Int32Field(logs_proto_tuningfork_TuningForkLogEvent_apk_version_code_tag,
+                 info.apk_version_code);
+    w.Int32Field(logs_proto_tuningfork_TuningForkLogEvent_tuningfork_version_tag,
+                 info.tuningfork_version);
+    if (pc.dropped_windows_ > 0)
+        w.Int32Field(logs_proto_tuningfork_TuningForkLogEvent_dropped_windows_tag,
+                     pc.dropped_windows_);
+    if (pc.merged_windows_ > 0)
+        w.Int32Field(logs_proto_tuningfork_TuningForkLogEvent_merged_windows_tag,
+                     pc.merged_windows_);
+    // Any difference means a message length written above is wrong too
+    size_t written = w.Position() - evt_ser.data();
+    if (!w.Ok() || written != total) {
+        ALOGE("Serialization doesn't match its computed size of %zu bytes", total);
+        evt_ser.clear();
+        return false;
+    }
+    evt_ser.resize(written);
+    return true;
+}
+
+bool ClearcutSerializer::SerializeEvent(const ProngCache& pc,
+                                        const ProtobufSerialization& fidelity_params,
+                                        const ExtraUploadInfo& info,
+                                        ProtobufSerialization& evt_ser) {
+    SizeCache sizes;
+    return SerializeEvent(pc, fidelity_params, info, evt_ser, sizes);
+}
+
 } // namespace tuningfork
@@ -16,10 +16,12 @@
 
 #pragma once
 
-#include "uploadthread.h"
+#include "tuningfork_internal.h"
 #include "prong.h"
 #include "histogram.h"
 
+#include "proto_writer.h"
+
 #include "pb_encode.h"
 
 #include "nano/tuningfork.pb.h"
@@ -33,16 +35,41 @@ typedef logs_proto_tuningfork_DeviceInfo DeviceInfo;
 
 class ClearcutSerializer {
 public:
-    static void SerializeEvent(const ProngCache& t,
+    // Encoded sizes of one histogram, worked out before it is written
+    struct HistogramSize {
+        bool sparse; // Whether sparse_counts is sent rather than counts
+        size_t counts; // Packed counts or sparse_counts array
+        size_t message;
+    };
+    typedef std::vector<HistogramSize> SizeCache;
+
+    // Encode the event in a single pass: message sizes are computed in closed form, then
+    //  everything is written straight into evt_ser, which is resized only if it is too small.
+    // Pass the same evt_ser and sizes each time to avoid allocating.
+    // Returns false, leaving evt_ser empty, if what was written doesn't match the computed size.
+    static bool SerializeEvent(const ProngCache& t,
+                               const ProtobufSerialization& fidelity_params,
+                               const ExtraUploadInfo& device_info,
+                               ProtobufSerialization& evt_ser,
+                               SizeCache& sizes);
+    static bool SerializeEvent(const ProngCache& t,
                                const ProtobufSerialization& fidelity_params,
                                const ExtraUploadInfo& device_info,
                                ProtobufSerialization& evt_ser);
+    // The same encoding, produced by nanopb using the callbacks below. Each submessage is
+    //  encoded twice, once to find its size.
+    static void SerializeEventWithNanopb(const ProngCache& t,
+                                         const ProtobufSerialization& fidelity_params,
+                                         const ExtraUploadInfo& device_info,
+                                         ProtobufSerialization& evt_ser);
     // Fill in the event histograms
     static void FillHistograms(const ProngCache& pc, TuningForkLogEvent &evt);
     // Fill in the annotation, etc, then the histogram
     static void Fill(const Prong& p, ClearcutHistogram& h);
     // Fill in the histogram data
     static void Fill(const Histogram& h, ClearcutHistogram& ch);
+    // Fill in the summary statistics
+    static void Fill(const FrameStats& s, ClearcutHistogram& ch);
     // Fill in the device info
     static void Fill(const ExtraUploadInfo& p, DeviceInfo& di);
     // Fill in the other experiment, session and apk info
@@ -50,6 +77,8 @@ public:
 
     // Callbacks needed by nanopb
     static bool writeCountArray(pb_ostream_t *stream, const pb_field_t *field, void *const *arg);
+    static bool writeSparseCountArray(pb_ostream_t *stream, const pb_field_t *field,
+                                      void *const *arg);
     static bool writeAnnotation(pb_ostream_t* stream, const pb_field_t *field, void *const *arg);
     static bool writeHistograms(pb_ostream_t* stream, const pb_field_t *field, void *const *arg);
     static bool writeFidelityParams(pb_ostream_t* stream, const pb_field_t *field, void *const *arg);
@@ -57,6 +86,16 @@ public:
     static bool writeDeviceInfo(pb_ostream_t* stream, const pb_field_t *field, void *const *arg);
     static bool writeCpuFreqs(pb_ostream_t *stream, const pb_field_t *field, void *const *arg);
 
+    // Whether the histogram's counts are smaller sent sparsely. Also gives the size of the
+    //  packed array that should be sent.
+    static bool UseSparseCounts(const Histogram& h, size_t& counts_size);
+
+private:
+    static size_t MessageSize(const Prong& p, const HistogramSize& size);
+    static size_t MessageSize(const ExtraUploadInfo& info);
+    static void Write(const Prong& p, const HistogramSize& size, ProtoWriter& w);
+    static void Write(const ExtraUploadInfo& info, ProtoWriter& w);
+
 };
 
 } //namespace tuningfork
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fp_cache.h"
+#include "serialization_view.h"
+#include "tuningfork_utils.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "TuningFork.FPCache"
+#include "Log.h"
+
+namespace tuningfork {
+
+constexpr uint64_t FidelityParamCache::kDefaultTtlMs;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x50464654; // 'TFFP'
+constexpr uint32_t kVersion = 1;
+
+// Followed by the experiment id and then the parameters
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fetch_time_ms;
+    uint64_t ttl_ms;
+    uint32_t experiment_id_size;
+    uint32_t params_size;
+    uint32_t crc; // Of the whole file, with this field zeroed
+    uint32_t reserved;
+};
+static_assert(sizeof(Header) == 40, "Fidelity parameter cache header has padding");
+
+// The suffix mkstemp replaces with a unique name
+constexpr char kTempSuffix[] = ".XXXXXX";
+// A save takes much less than this, so a temporary file older than it was abandoned.
+constexpr time_t kStaleTempAgeS = 60;
+
+uint32_t FileCrc(Header header, const uint8_t* experiment_id, const uint8_t* params) {
+    header.crc = 0;
+    uint32_t crc = Crc32(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    crc = Crc32(experiment_id, header.experiment_id_size, crc);
+    return Crc32(params, header.params_size, crc);
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+    auto p = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+bool FidelityParamCache::Load(CProtobufSerialization& params, Entry& entry) const {
+    CProtobufSerialization file;
+    if (!MakeFileView(path_, file))
+        return false;
+    Header header;
+    bool valid = file.size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file.bytes, sizeof(header));
+        valid = header.magic == kMagic && header.version == kVersion
+            && file.size == sizeof(header) + uint64_t(header.experiment_id_size)
+                            + header.params_size;
+    }
+    const uint8_t* experiment_id = file.bytes + sizeof(header);
+    if (valid) {
+        valid = FileCrc(header, experiment_id, experiment_id + header.experiment_id_size)
+                == header.crc;
+    }
+    if (!valid) {
+        ALOGW("Ignoring invalid fidelity parameter cache %s", path_.c_str());
+        CProtobufSerialization_Free(&file);
+        return false;
+    }
+    entry.experiment_id.assign(reinterpret_cast<const char*>(experiment_id),
+                               header.experiment_id_size);
+    entry.fetch_time_ms = header.fetch_time_ms;
+    entry.ttl_ms = header.ttl_ms;
+    NarrowView(file, sizeof(header) + header.experiment_id_size, header.params_size);
+    params = file;
+    return true;
+}
+
+bool FidelityParamCache::Save(const uint8_t* params, size_t params_size,
+                              const Entry& entry) const {
+    Header header = {};
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.fetch_time_ms = entry.fetch_time_ms;
+    header.ttl_ms = entry.ttl_ms;
+    header.experiment_id_size = entry.experiment_id.size();
+    header.params_size = params_size;
+    auto experiment_id = reinterpret_cast<const uint8_t*>(entry.experiment_id.data());
+    header.crc = FileCrc(header, experiment_id, params);
+    // A unique name, so that saves on different threads don't write the same file
+    std::string tmp_path = path_ + kTempSuffix;
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd == -1) {
+        ALOGW("Couldn't create %s", tmp_path.c_str());
+        return false;
+    }
+    // The data must be on disk before the rename makes it the cache
+    bool ok = WriteAll(fd, &header, sizeof(header))
+              && WriteAll(fd, experiment_id, header.experiment_id_size)
+              && WriteAll(fd, params, params_size)
+              && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(tmp_path.c_str(), path_.c_str()) == 0) {
+        ALOGI("Saved fps to %s (%zu bytes)", path_.c_str(), params_size);
+        return true;
+    }
+    ALOGW("Couldn't save fps to %s", path_.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+}
+
+void FidelityParamCache::Open(const std::string& legacy_path) const {
+    DeleteStaleTempFiles();
+    if (!legacy_path.empty())
+        MigrateLegacy(legacy_path);
+}
+
+void FidelityParamCache::DeleteStaleTempFiles() const {
+    auto slash = path_.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path_.substr(0, slash);
+    std::string prefix = path_.substr(slash == std::string::npos ? 0 : slash + 1) + ".";
+    size_t name_size = prefix.size() + strlen(kTempSuffix) - 1;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr)
+        return;
+    time_t now = time(nullptr);
+    while (dirent* e = readdir(d)) {
+        if (strlen(e->d_name) != name_size || strncmp(e->d_name, prefix.c_str(), prefix.size()))
+            continue;
+        // Leave recent ones alone: another thread may be saving
+        std::string tmp_path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(tmp_path.c_str(), &st) == 0 && S_ISREG(st.st_mode)
+            && now - st.st_mtime >= kStaleTempAgeS) {
+            ALOGI("Deleting abandoned %s", tmp_path.c_str());
+            unlink(tmp_path.c_str());
+        }
+    }
+    closedir(d);
+}
+
+void FidelityParamCache::MigrateLegacy(const std::string& legacy_path) const {
+    if (!file_utils::FileExists(legacy_path))
+        return;
+    if (!Exists()) {
+        CProtobufSerialization legacy;
+        if (!MakeFileView(legacy_path, legacy)) {
+            ALOGW("Couldn't read %s", legacy_path.c_str());
+            return;
+        }
+        // Fetched at time 0, so they are used until new ones are downloaded
+        bool saved = Save(legacy.bytes, legacy.size, {"", 0, kDefaultTtlMs});
+        CProtobufSerialization_Free(&legacy);
+        if (!saved)
+            return;
+        ALOGI("Moved fps from %s to %s", legacy_path.c_str(), path_.c_str());
+    }
+    file_utils::DeleteFile(legacy_path);
+}
+
+bool FidelityParamCache::Delete() const {
+    return file_utils::DeleteFile(path_);
+}
+
+bool FidelityParamCache::Exists() const {
+    return file_utils::FileExists(path_);
+}
+
+uint64_t FidelityParamCache::NowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace tuningfork
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork_internal.h"
+
+#include <string>
+
+namespace tuningfork {
+
+// The most recently fetched fidelity parameters, kept in a single file along with the
+//  experiment they belong to, when they were fetched and how long they stay fresh.
+// The file has a versioned header and a CRC-32 of its whole contents, so a file from another
+//  version of the format, or one that is torn or corrupt, is ignored. It is replaced
+//  atomically, by writing a new file and renaming it over the old one, so views of the old
+//  file stay valid.
+class FidelityParamCache {
+public:
+    static constexpr uint64_t kDefaultTtlMs = 24 * 60 * 60 * 1000;
+
+    struct Entry {
+        std::string experiment_id;
+        uint64_t fetch_time_ms; // Wall clock time, as from NowMs
+        uint64_t ttl_ms;
+        // Entries from the future, because the clock has changed, are also stale
+        bool Stale(uint64_t now_ms) const {
+            return now_ms < fetch_time_ms || now_ms - fetch_time_ms >= ttl_ms;
+        }
+    };
+
+    explicit FidelityParamCache(const std::string& path) : path_(path) {}
+
+    // Call before first use. Deletes temporary files left by saves that didn't finish and, if
+    //  legacy_path isn't empty, moves the raw params that older versions saved there into the
+    //  cache. Their fetch time isn't known, so they are stale. The legacy file is deleted once
+    //  the cache holds params.
+    void Open(const std::string& legacy_path = "") const;
+
+    // If the file is valid, make params a view of the parameters in it, to be freed with
+    //  CProtobufSerialization_Free, and fill in entry.
+    bool Load(CProtobufSerialization& params, Entry& entry) const;
+
+    bool Save(const uint8_t* params, size_t params_size, const Entry& entry) const;
+
+    bool Delete() const;
+
+    bool Exists() const;
+
+    const std::string& Path() const { return path_; }
+
+    // Milliseconds since the epoch
+    static uint64_t NowMs();
+
+private:
+    void DeleteStaleTempFiles() const;
+
+    void MigrateLegacy(const std::string& legacy_path) const;
+
+    std::string path_;
+};
+
+} // namespace tuningfork
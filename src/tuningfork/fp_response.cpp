@@ -0,0 +1,352 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fpdownload.h"
+
+#include <cstring>
+
+#define LOG_TAG "FPDownload"
+#include "Log.h"
+
+namespace tuningfork {
+
+namespace {
+
+// Decodes base 64, standard or URL-safe, a character at a time
+class Base64Decoder {
+public:
+    explicit Base64Decoder(ProtobufSerialization& out) : out_(out), bits_(0), n_bits_(0),
+                                                         n_chars_(0), padding_(0) {}
+    bool Add(char c) {
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+' || c == '-') v = 62;
+        else if (c == '/' || c == '_') v = 63;
+        else if (c == '=') {
+            ++padding_;
+            return padding_ <= 2;
+        }
+        else if (c == '\n' || c == '\r') return true;
+        else return false;
+        if (padding_ > 0)
+            return false; // Data after padding
+        bits_ = (bits_ << 6) | v;
+        n_bits_ += 6;
+        ++n_chars_;
+        if (n_bits_ >= 8) {
+            n_bits_ -= 8;
+            out_.push_back(static_cast<uint8_t>(bits_ >> n_bits_));
+        }
+        return true;
+    }
+    // A single character left over can't encode a whole byte
+    bool Finish() const {
+        return n_chars_ % 4 != 1 && (padding_ == 0 || (n_chars_ + padding_) % 4 == 0);
+    }
+private:
+    ProtobufSerialization& out_;
+    uint32_t bits_;
+    int n_bits_;
+    size_t n_chars_;
+    int padding_;
+};
+
+// Single pass over a generateTuningParameters response, without building a DOM. Only
+//  parameters.experimentId and parameters.serializedFidelityParameters are kept: the
+//  parameters are base 64 decoded straight out of the JSON into the output.
+class ResponseScanner {
+public:
+    ResponseScanner(const std::string& json, ProtobufSerialization& fps,
+                    std::string& experiment_id)
+        : p_(json.data()), end_(json.data() + json.size()), error_(nullptr), fps_(fps),
+          experiment_id_(experiment_id), found_parameters_(false), found_experiment_id_(false),
+          found_fps_(false) {}
+
+    bool Parse() {
+        if (!Value(ROOT, 0))
+            return false;
+        SkipSpace();
+        return p_ == end_ || Fail("Trailing characters");
+    }
+    const char* Error() const { return error_; }
+    bool FoundParameters() const { return found_parameters_; }
+    bool FoundExperimentId() const { return found_experiment_id_; }
+    bool FoundFidelityParams() const { return found_fps_; }
+
+private:
+    // Values we are interested in, by where they are
+    enum Field { OTHER, ROOT, PARAMETERS, EXPERIMENT_ID, SERIALIZED_FPS };
+    static constexpr int kMaxDepth = 64;
+
+    bool Fail(const char* error) {
+        error_ = error;
+        return false;
+    }
+    void SkipSpace() {
+        while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r'))
+            ++p_;
+    }
+    bool Value(Field field, int depth) {
+        if (depth > kMaxDepth)
+            return Fail("Too deeply nested");
+        SkipSpace();
+        if (p_ == end_)
+            return Fail("Unexpected end");
+        if ((field == EXPERIMENT_ID || field == SERIALIZED_FPS) && *p_ != '"')
+            return Fail(field == EXPERIMENT_ID ? "experimentId is not a string"
+                                               : "serializedFidelityParameters is not a string");
+        if ((field == ROOT || field == PARAMETERS) && *p_ != '{')
+            return Fail(field == ROOT ? "Response not object" : "parameters not object");
+        switch (*p_) {
+            case '{': return Object(field, depth);
+            case '[': return Array(depth);
+            case '"':
+                if (field == EXPERIMENT_ID) {
+                    experiment_id_.clear();
+                    found_experiment_id_ = true;
+                    return String([this](char c) {
+                        experiment_id_.push_back(c);
+                        return true;
+                    });
+                }
+                if (field == SERIALIZED_FPS) {
+                    fps_.clear();
+                    fps_.reserve(RawStringLength() / 4 * 3 + 3);
+                    Base64Decoder decoder(fps_);
+                    found_fps_ = true;
+                    if (!String([&decoder](char c) { return decoder.Add(c); }))
+                        return Fail("Can't decode base 64 FPs");
+                    return decoder.Finish() || Fail("Can't decode base 64 FPs");
+                }
+                return String([](char) { return true; });
+            default: return Scalar();
+        }
+    }
+    bool Object(Field field, int depth) {
+        ++p_; // {
+        SkipSpace();
+        if (p_ != end_ && *p_ == '}') {
+            ++p_;
+            return true;
+        }
+        std::string key;
+        while (true) {
+            SkipSpace();
+            if (p_ == end_ || *p_ != '"')
+                return Fail("Expected a key");
+            key.clear();
+            if (!String([&key](char c) {
+                    key.push_back(c);
+                    return true;
+                }))
+                return false;
+            SkipSpace();
+            if (p_ == end_ || *p_++ != ':')
+                return Fail("Expected ':'");
+            Field child = OTHER;
+            if (field == ROOT && key == "parameters")
+                child = PARAMETERS;
+            else if (field == PARAMETERS && key == "experimentId")
+                child = EXPERIMENT_ID;
+            else if (field == PARAMETERS && key == "serializedFidelityParameters")
+                child = SERIALIZED_FPS;
+            if (!Value(child, depth + 1))
+                return false;
+            if (field == ROOT && child == PARAMETERS)
+                found_parameters_ = true;
+            SkipSpace();
+            if (p_ == end_)
+                return Fail("Unexpected end");
+            if (*p_ == '}') {
+                ++p_;
+                return true;
+            }
+            if (*p_++ != ',')
+                return Fail("Expected ',' or '}'");
+        }
+    }
+    bool Array(int depth) {
+        ++p_; // [
+        SkipSpace();
+        if (p_ != end_ && *p_ == ']') {
+            ++p_;
+            return true;
+        }
+        while (true) {
+            if (!Value(OTHER, depth + 1))
+                return false;
+            SkipSpace();
+            if (p_ == end_)
+                return Fail("Unexpected end");
+            if (*p_ == ']') {
+                ++p_;
+                return true;
+            }
+            if (*p_++ != ',')
+                return Fail("Expected ',' or ']'");
+        }
+    }
+    // Numbers, true, false and null, which we only need to skip
+    bool Scalar() {
+        const char* start = p_;
+        while (p_ != end_ && (isalnum(*p_) || *p_ == '-' || *p_ == '+' || *p_ == '.'))
+            ++p_;
+        return p_ != start || Fail("Unexpected character");
+    }
+    // The number of characters up to the closing quote of the string starting at p_, as an
+    //  upper bound on its unescaped length
+    size_t RawStringLength() const {
+        for (const char* q = p_ + 1; q < end_; ++q) {
+            if (*q == '\\')
+                ++q;
+            else if (*q == '"')
+                return q - p_ - 1;
+        }
+        return 0;
+    }
+    // Pass each byte of the unescaped, UTF-8, string starting at p_ to f, which returns false
+    //  to fail
+    template <typename F>
+    bool String(F f) {
+        ++p_; // "
+        while (p_ != end_) {
+            char c = *p_++;
+            if (c == '"')
+                return true;
+            if (static_cast<unsigned char>(c) < 0x20)
+                return Fail("Control character in string");
+            if (c == '\\') {
+                uint32_t code_point;
+                if (!Escape(code_point))
+                    return false;
+                char utf8[4];
+                int n = EncodeUtf8(code_point, utf8);
+                for (int i = 0; i < n; ++i) {
+                    if (!f(utf8[i]))
+                        return false;
+                }
+            } else if (!f(c)) {
+                return false;
+            }
+        }
+        return Fail("Unterminated string");
+    }
+    bool Escape(uint32_t& code_point) {
+        if (p_ == end_)
+            return Fail("Unterminated string");
+        switch (*p_++) {
+            case '"': code_point = '"'; return true;
+            case '\\': code_point = '\\'; return true;
+            case '/': code_point = '/'; return true;
+            case 'b': code_point = '\b'; return true;
+            case 'f': code_point = '\f'; return true;
+            case 'n': code_point = '\n'; return true;
+            case 'r': code_point = '\r'; return true;
+            case 't': code_point = '\t'; return true;
+            case 'u': {
+                if (!Hex4(code_point))
+                    return false;
+                // A surrogate pair
+                if (code_point >= 0xd800 && code_point < 0xdc00 && end_ - p_ >= 6
+                    && p_[0] == '\\' && p_[1] == 'u') {
+                    p_ += 2;
+                    uint32_t low;
+                    if (!Hex4(low))
+                        return false;
+                    if (low < 0xdc00 || low >= 0xe000)
+                        return Fail("Bad surrogate pair");
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                }
+                return true;
+            }
+            default: return Fail("Bad escape");
+        }
+    }
+    bool Hex4(uint32_t& v) {
+        if (end_ - p_ < 4)
+            return Fail("Bad escape");
+        v = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *p_++;
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= c - '0';
+            else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+            else return Fail("Bad escape");
+        }
+        return true;
+    }
+    // Encode an escaped code point as UTF-8
+    static int EncodeUtf8(uint32_t c, char* out) {
+        if (c < 0x80) {
+            out[0] = c;
+            return 1;
+        } else if (c < 0x800) {
+            out[0] = 0xc0 | (c >> 6);
+            out[1] = 0x80 | (c & 0x3f);
+            return 2;
+        } else if (c < 0x10000) {
+            out[0] = 0xe0 | (c >> 12);
+            out[1] = 0x80 | ((c >> 6) & 0x3f);
+            out[2] = 0x80 | (c & 0x3f);
+            return 3;
+        } else {
+            out[0] = 0xf0 | (c >> 18);
+            out[1] = 0x80 | ((c >> 12) & 0x3f);
+            out[2] = 0x80 | ((c >> 6) & 0x3f);
+            out[3] = 0x80 | (c & 0x3f);
+            return 4;
+        }
+    }
+
+    const char* p_;
+    const char* end_;
+    const char* error_;
+    ProtobufSerialization& fps_;
+    std::string& experiment_id_;
+    bool found_parameters_;
+    bool found_experiment_id_;
+    bool found_fps_;
+};
+
+} // anonymous namespace
+
+TFErrorCode DecodeResponse(const std::string& response, ProtobufSerialization& fps,
+                           std::string& experiment_id) {
+    ALOGV("Response: %s", response.c_str());
+    ResponseScanner scanner(response, fps, experiment_id);
+    if (!scanner.Parse()) {
+        ALOGE("Parsing error: %s", scanner.Error());
+        return TFERROR_NO_FIDELITY_PARAMS;
+    }
+    if (!scanner.FoundParameters()) {
+        ALOGE("No parameters");
+        return TFERROR_NO_FIDELITY_PARAMS;
+    }
+    if (!scanner.FoundExperimentId()) {
+        ALOGE("No experimentId");
+        return TFERROR_NO_FIDELITY_PARAMS;
+    }
+    if (!scanner.FoundFidelityParams()) {
+        ALOGE("No serializedFidelityParameters");
+        return TFERROR_NO_FIDELITY_PARAMS;
+    }
+    return TFERROR_OK;
+}
+
+} // namespace tuningfork
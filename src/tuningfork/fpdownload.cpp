@@ -14,8 +14,9 @@
  * limitations under the License.
  */
 
-#include "tuningfork_internal.h"
+#include "fpdownload.h"
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 
@@ -24,7 +25,6 @@
 
 #include "jni_helper.h"
 #include "../../third_party/json11/json11.hpp"
-#include "modp_b64.h"
 
 namespace tuningfork {
 
@@ -37,6 +37,14 @@ std::string GetPartialURL(const ExtraUploadInfo& requestInfo) {
     return str.str();
 }
 
+std::string FidelityParamsUrl(const std::string& url_base, const ExtraUploadInfo& info) {
+    std::stringstream url;
+    url << url_base;
+    url << GetPartialURL(info);
+    url << url_rpcname;
+    return url.str();
+}
+
 std::string RequestJson(const ExtraUploadInfo& requestInfo) {
     using namespace json11;
     Json gles_version = Json::object {
@@ -54,86 +62,22 @@ std::string RequestJson(const ExtraUploadInfo& requestInfo) {
         {"name", GetPartialURL(requestInfo)},
         {"device_spec", device_spec}};
     auto result = request.dump();
-    ALOGI("Request body: %s", result.c_str());
+    ALOGV("Request body: %s", result.c_str());
     return result;
 }
 
-TFErrorCode DecodeResponse(const std::string& response, std::vector<uint8_t>& fps,
-                           std::string& experiment_id) {
-    using namespace json11;
-    ALOGI("Response: %s", response.c_str());
-    std::string err;
-    Json jresponse = Json::parse(response, err);
-    if (!err.empty()) {
-        ALOGE("Parsing error: %s", err.c_str());
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    ALOGI("Response, deserialized: %s", jresponse.dump().c_str());
-    if (!jresponse.is_object()) {
-        ALOGE("Response not object");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    auto& outer = jresponse.object_items();
-    auto iparameters = outer.find("parameters");
-    if (iparameters==outer.end()) {
-        ALOGE("No parameters");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    auto& params = iparameters->second;
-    if (!params.is_object()) {
-        ALOGE("parameters not object");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    auto& inner = params.object_items();
-    auto iexperiment_id = inner.find("experimentId");
-    if (iexperiment_id==inner.end()) {
-        ALOGE("No experimentId");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    if (!iexperiment_id->second.is_string()) {
-        ALOGE("experimentId is not a string");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    experiment_id = iexperiment_id->second.string_value();
-    auto ifps = inner.find("serializedFidelityParameters");
-    if (ifps==inner.end()) {
-        ALOGE("No serializedFidelityParameters");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    if (!ifps->second.is_string()) {
-        ALOGE("serializedFidelityParameters is not a string");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    std::string sfps = ifps->second.string_value();
-    fps.resize(modp_b64_decode_len(sfps.length()));
-    if (modp_b64_decode((char*)fps.data(), sfps.c_str(), sfps.length())==-1) {
-        ALOGE("Can't decode base 64 FPs");
-        return TFERROR_NO_FIDELITY_PARAMS;
-    }
-    return TFERROR_OK;
-}
-
 #define CHECK_FOR_EXCEPTION if (jni.CheckForException(exception_msg)) { \
       ALOGW("%s", exception_msg.c_str()); return TFERROR_JNI_EXCEPTION; }
 
-TFErrorCode DownloadFidelityParams(JNIEnv* env, jobject context, const std::string& uri,
-                                   const std::string& api_key, const ExtraUploadInfo& requestInfo,
-                                   int timeout_ms, std::vector<uint8_t>& fps,
-                                   std::string& experiment_id) {
-    ALOGI("Connecting to: %s", uri.c_str());
-    JNIHelper jni(env, context);
-    std::string exception_msg;
-    // url = new URL(uri)
-    jstring jurlStr = jni.NewString(uri);
-    auto url = jni.NewObject("java/net/URL", "(Ljava/lang/String;)V", jurlStr);
-    CHECK_FOR_EXCEPTION; // Malformed URL
+namespace {
 
-    // Open connection and set properties
-    // connection = url.openConnection()
-    jobject connectionObj = jni.CallObjectMethod(url, "openConnection",
-                                                 "()Ljava/net/URLConnection;");
-    CHECK_FOR_EXCEPTION;// IOException
-    auto connection = jni.Cast(connectionObj, "java/net/HttpURLConnection");
+// Send the request on a connection that has been opened but not yet connected, and read the
+//  whole response. Reading to the end of the body and not disconnecting is what allows the
+//  connection to be reused.
+TFErrorCode Exchange(JNIHelper& jni, JNIEnv* env, const JNIHelper::Object& connection,
+                     const HttpRequest& request, HttpResponse& response) {
+    std::string exception_msg;
+    int timeout_ms = std::min(request.timeout_ms, static_cast<uint32_t>(INT32_MAX));
     // connection.setRequestMethod("POST")
     jni.CallVoidMethod(connection, "setRequestMethod", "(Ljava/lang/String;)V",
                        jni.NewString("POST"));
@@ -147,87 +91,245 @@ TFErrorCode DownloadFidelityParams(JNIEnv* env, jobject context, const std::stri
     jni.CallVoidMethod(connection, "setDoInput", "(Z)V", true);
     // connection.setUseCaches(false)
     jni.CallVoidMethod(connection, "setUseCaches", "(Z)V", false);
+    // connection.setFixedLengthStreamingMode(length), so the body isn't buffered again
+    jni.CallVoidMethod(connection, "setFixedLengthStreamingMode", "(I)V",
+                       static_cast<int>(request.body.size()));
     // connection.setRequestProperty( name, value)
-    if (!api_key.empty()) {
+    if (!request.api_key.empty()) {
         jni.CallVoidMethod(connection, "setRequestProperty",
                            "(Ljava/lang/String;Ljava/lang/String;)V",
-                           jni.NewString("X-Goog-Api-Key"), jni.NewString(api_key));
+                           jni.NewString("X-Goog-Api-Key"), jni.NewString(request.api_key));
     }
     jni.CallVoidMethod(connection, "setRequestProperty", "(Ljava/lang/String;Ljava/lang/String;)V",
                        jni.NewString("Content-Type"), jni.NewString("application/json"));
 
-    // Write json request body
+    // Write the request body in one go
     // os = connection.getOutputStream()
     jobject os = jni.CallObjectMethod(connection, "getOutputStream", "()Ljava/io/OutputStream;");
     CHECK_FOR_EXCEPTION; // IOException
-    // writer = new BufferedWriter(new OutputStreamWriter(os, "UTF-8"))
-    auto osw = jni.NewObject("java/io/OutputStreamWriter",
-                             "(Ljava/io/OutputStream;Ljava/lang/String;)V",
-                             os, jni.NewString("UTF-8"));
-    auto writer = jni.NewObject("java/io/BufferedWriter", "(Ljava/io/Writer;)V", osw.second);
-    // writer.write(json)
-    jni.CallVoidMethod(writer, "write", "(Ljava/lang/String;)V",
-                       jni.NewString(RequestJson(requestInfo)));
-    CHECK_FOR_EXCEPTION;// IOException
-    // writer.flush()
-    jni.CallVoidMethod(writer, "flush", "()V");
-    CHECK_FOR_EXCEPTION;// IOException
-    // writer.close()
-    jni.CallVoidMethod(writer, "close", "()V");
+    jbyteArray body = env->NewByteArray(request.body.size());
+    env->SetByteArrayRegion(body, 0, request.body.size(),
+                            reinterpret_cast<const jbyte*>(request.body.data()));
+    // os.write(body)
+    jni.CallVoidMethod(jni.Cast(os), "write", "([B)V", body);
+    env->DeleteLocalRef(body);
     CHECK_FOR_EXCEPTION;// IOException
     // os.close()
     jni.CallVoidMethod(jni.Cast(os), "close", "()V");
     CHECK_FOR_EXCEPTION;// IOException
 
-    // connection.connect()
-    jni.CallVoidMethod(connection, "connect", "()V");
-    CHECK_FOR_EXCEPTION;// IOException
-
     // connection.getResponseCode()
-    int code = jni.CallIntMethod(connection, "getResponseCode", "()I");
-    ALOGI("Response code: %d", code);
+    response.code = jni.CallIntMethod(connection, "getResponseCode", "()I");
     CHECK_FOR_EXCEPTION;// IOException
+    ALOGI("Response code: %d", response.code);
 
-    // connection.getResponseMessage()
-    jstring jresp = (jstring)jni.CallObjectMethod(connection, "getResponseMessage",
-                                                  "()Ljava/lang/String;");
-    const char* resp = env->GetStringUTFChars(jresp, nullptr);
-    ALOGI("Response message: %s", resp);
+    // Error responses have their body in the error stream, which may be null
+    jobject is = response.code < 400
+        ? jni.CallObjectMethod(connection, "getInputStream", "()Ljava/io/InputStream;")
+        : jni.CallObjectMethod(connection, "getErrorStream", "()Ljava/io/InputStream;");
     CHECK_FOR_EXCEPTION;// IOException
+    response.body.clear();
+    if (is == nullptr)
+        return TFERROR_OK;
+    // Read the body in blocks, rather than line by line
+    constexpr int kBlockSize = 4096;
+    jbyteArray block = env->NewByteArray(kBlockSize);
+    auto input = jni.Cast(is);
+    int n;
+    while ((n = jni.CallIntMethod(input, "read", "([B)I", block)) > 0) {
+        size_t offset = response.body.size();
+        response.body.resize(offset + n);
+        env->GetByteArrayRegion(block, 0, n, reinterpret_cast<jbyte*>(&response.body[offset]));
+    }
+    env->DeleteLocalRef(block);
+    CHECK_FOR_EXCEPTION;// IOException
+    // is.close()
+    jni.CallVoidMethod(input, "close", "()V");
+    CHECK_FOR_EXCEPTION;// IOException
+    return TFERROR_OK;
+}
+
+} // anonymous namespace
+
+JniHttpTransport::JniHttpTransport(JNIEnv* env, jobject context)
+        : vm_(nullptr), connection_(nullptr), cancel_pending_(false) {
+    env->GetJavaVM(&vm_);
+    context_ = env->NewGlobalRef(context);
+}
+
+JniHttpTransport::~JniHttpTransport() {
+    JNIEnv* env;
+    if (vm_->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_OK)
+        env->DeleteGlobalRef(context_);
+}
+
+TFErrorCode JniHttpTransport::Post(const HttpRequest& request, HttpResponse& response) {
+    JNIEnv* env;
+    bool attached = false;
+    if (vm_->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_EDETACHED) {
+        if (vm_->AttachCurrentThread(&env, nullptr) != JNI_OK)
+            return TFERROR_JNI_BAD_THREAD;
+        attached = true;
+    }
+    auto ret = Post(env, request, response);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancel_pending_ = false;
+    }
+    if (attached)
+        vm_->DetachCurrentThread();
+    return ret;
+}
 
-    // Read body from input stream
-    jobject is = jni.CallObjectMethod(connection, "getInputStream", "()Ljava/io/InputStream;");
+TFErrorCode JniHttpTransport::Post(JNIEnv* env, const HttpRequest& request,
+                                   HttpResponse& response) {
+    ALOGI("Connecting to: %s", request.url.c_str());
+    JNIHelper jni(env, context_);
+    std::string exception_msg;
+    // url = new URL(uri)
+    jstring jurlStr = jni.NewString(request.url);
+    auto url = jni.NewObject("java/net/URL", "(Ljava/lang/String;)V", jurlStr);
+    CHECK_FOR_EXCEPTION; // Malformed URL
+
+    // Open connection and set properties
+    // connection = url.openConnection()
+    jobject connectionObj = jni.CallObjectMethod(url, "openConnection",
+                                                 "()Ljava/net/URLConnection;");
     CHECK_FOR_EXCEPTION;// IOException
-    auto isr = jni.NewObject("java/io/InputStreamReader",
-                             "(Ljava/io/InputStream;Ljava/lang/String;)V",
-                             is, jni.NewString("UTF-8"));
-    auto reader = jni.NewObject("java/io/BufferedReader", "(Ljava/io/Reader;)V", isr.second);
-    std::stringstream body;
-    jstring jline;
-    while ((jline=(jstring)jni.CallObjectMethod(reader, "readLine",
-                                                "()Ljava/lang/String;"))!=nullptr) {
-        const char* line = env->GetStringUTFChars(jline, nullptr);
-        body << line << "\n";
-        env->ReleaseStringUTFChars(jline, line);
+    auto connection = jni.Cast(connectionObj, "java/net/HttpURLConnection");
+    {
+        // Make the connection visible to Cancel
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancel_pending_)
+            return TFERROR_DOWNLOAD_CANCELLED;
+        connection_ = env->NewGlobalRef(connectionObj);
     }
+    auto ret = Exchange(jni, env, connection, request, response);
+    std::lock_guard<std::mutex> lock(mutex_);
+    env->DeleteGlobalRef(connection_);
+    connection_ = nullptr;
+    return cancel_pending_ ? TFERROR_DOWNLOAD_CANCELLED : ret;
+}
 
-    // reader.close()
-    jni.CallVoidMethod(reader, "close", "()V");
-    // is.close()
-    jni.CallVoidMethod(jni.Cast(is), "close", "()V");
+void JniHttpTransport::Cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancel_pending_ = true;
+    if (connection_ == nullptr)
+        return;
+    JNIEnv* env;
+    bool attached = false;
+    if (vm_->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_EDETACHED) {
+        if (vm_->AttachCurrentThread(&env, nullptr) != JNI_OK)
+            return;
+        attached = true;
+    }
+    // Disconnecting closes the socket, so a blocked read or write in Post throws
+    jclass clz = env->GetObjectClass(connection_);
+    env->CallVoidMethod(connection_, env->GetMethodID(clz, "disconnect", "()V"));
+    env->ExceptionClear();
+    env->DeleteLocalRef(clz);
+    if (attached)
+        vm_->DetachCurrentThread();
+}
 
-    // connection.disconnect()
-    jni.CallVoidMethod(connection, "disconnect", "()V");
+FidelityParamFetcher::FidelityParamFetcher(std::unique_ptr<HttpTransport> transport)
+        : transport_(std::move(transport)), cancelled_(false), done_(true) {
+}
 
-    TFErrorCode ret;
-    if (code==200)
-        ret = DecodeResponse(body.str(), fps, experiment_id);
+FidelityParamFetcher::~FidelityParamFetcher() {
+    Cancel();
+    if (thread_.joinable() && thread_.get_id() == std::this_thread::get_id())
+        thread_.detach(); // Destroyed from a callback
     else
-        ret = TFERROR_NO_FIDELITY_PARAMS;
+        Join();
+}
 
-    env->ReleaseStringUTFChars(jresp, resp);
+bool FidelityParamFetcher::Start(const HttpRequest& request, const Options& options,
+                                 const CompletionCallback& on_complete,
+                                 const AttemptCallback& on_attempt_failed) {
+    if (thread_.joinable())
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = false;
+        done_ = false;
+    }
+    thread_ = std::thread(&FidelityParamFetcher::Run, this, request, options, on_complete,
+                          on_attempt_failed);
+    return true;
+}
 
-    return ret;
+void FidelityParamFetcher::Cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_ || done_)
+            return;
+        cancelled_ = true;
+    }
+    cv_.notify_all();
+    transport_->Cancel();
+}
+
+void FidelityParamFetcher::Join() {
+    if (thread_.joinable())
+        thread_.join();
+}
+
+bool FidelityParamFetcher::Done() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_;
+}
+
+void FidelityParamFetcher::Run(HttpRequest request, Options options,
+                               CompletionCallback on_complete,
+                               AttemptCallback on_attempt_failed) {
+    using namespace std::chrono;
+    auto deadline = steady_clock::now() + milliseconds(options.deadline_ms);
+    auto timeout = milliseconds(std::max(options.initial_timeout_ms, 1u));
+    TFErrorCode result = TFERROR_TIMEOUT;
+    ProtobufSerialization fps;
+    std::string experiment_id;
+    for (int attempt = 0; ; ++attempt) {
+        auto attempt_start = steady_clock::now();
+        auto remaining = duration_cast<milliseconds>(deadline - attempt_start);
+        if (remaining.count() <= 0)
+            break;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (cancelled_) {
+                result = TFERROR_DOWNLOAD_CANCELLED;
+                break;
+            }
+        }
+        request.timeout_ms = std::min(timeout, remaining).count();
+        HttpResponse response;
+        auto err = transport_->Post(request, response);
+        if (err == TFERROR_OK) {
+            if (response.code == 200) {
+                err = DecodeResponse(response.body, fps, experiment_id);
+            } else {
+                ALOGW("Fidelity parameter request failed with code %d", response.code);
+                err = TFERROR_NO_FIDELITY_PARAMS;
+            }
+        }
+        if (err == TFERROR_OK) {
+            result = TFERROR_OK;
+            break;
+        }
+        if (err != TFERROR_DOWNLOAD_CANCELLED && on_attempt_failed)
+            on_attempt_failed(attempt, err);
+        // Wait for the rest of this attempt's timeout
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (cv_.wait_until(lock, std::min(attempt_start + timeout, deadline),
+                           [this]() { return cancelled_; })) {
+            result = TFERROR_DOWNLOAD_CANCELLED;
+            break;
+        }
+        timeout *= 2;
+    }
+    on_complete(result, fps, experiment_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
 }
 
 TFErrorCode ParamsLoader::GetFidelityParams(JNIEnv* env, jobject context,
@@ -237,12 +339,16 @@ TFErrorCode ParamsLoader::GetFidelityParams(JNIEnv* env, jobject context,
                                             ProtobufSerialization &fidelity_params,
                                             std::string& experiment_id,
                                             uint32_t timeout_ms) {
-    std::stringstream url;
-    url << base_url;
-    url << GetPartialURL(info);
-    url << url_rpcname;
-    return DownloadFidelityParams(env, context, url.str(), api_key, info, timeout_ms,
-                                  fidelity_params, experiment_id);
+    JniHttpTransport transport(env, context);
+    HttpRequest request {FidelityParamsUrl(base_url, info), api_key, RequestJson(info),
+                         timeout_ms};
+    HttpResponse response;
+    auto ret = transport.Post(request, response);
+    if (ret != TFERROR_OK)
+        return ret;
+    if (response.code != 200)
+        return TFERROR_NO_FIDELITY_PARAMS;
+    return DecodeResponse(response.body, fidelity_params, experiment_id);
 }
 
 } // namespace tuningfork
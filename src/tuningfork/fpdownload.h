@@ -0,0 +1,135 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork_internal.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace tuningfork {
+
+struct HttpRequest {
+    std::string url;
+    std::string api_key; // Sent as X-Goog-Api-Key, if not empty
+    std::string body; // JSON
+    uint32_t timeout_ms; // For the whole request
+};
+
+struct HttpResponse {
+    int code;
+    std::string body;
+};
+
+// How the fidelity parameter request is sent, so that it can be pointed at a local stand-in for
+//  the server.
+class HttpTransport {
+public:
+    virtual ~HttpTransport() {};
+    // Blocking POST. Returns TFERROR_OK if there was a response, whatever its status code.
+    virtual TFErrorCode Post(const HttpRequest& request, HttpResponse& response) = 0;
+    // Make a Post in progress on another thread, or the next Post if there is none in progress,
+    //  fail promptly with TFERROR_DOWNLOAD_CANCELLED.
+    virtual void Cancel() = 0;
+};
+
+// HttpURLConnection, through JNI. The platform keeps connections alive between requests, since
+//  the response is always read to the end and the connection isn't disconnected.
+// Post can be called on any thread: threads that aren't attached to the VM are attached for the
+//  duration of the call.
+class JniHttpTransport : public HttpTransport {
+public:
+    JniHttpTransport(JNIEnv* env, jobject context);
+    ~JniHttpTransport() override;
+    TFErrorCode Post(const HttpRequest& request, HttpResponse& response) override;
+    void Cancel() override;
+private:
+    TFErrorCode Post(JNIEnv* env, const HttpRequest& request, HttpResponse& response);
+    JavaVM* vm_;
+    jobject context_; // Global reference
+    std::mutex mutex_;
+    // Global reference to the connection in use, guarded by mutex_
+    jobject connection_;
+    bool cancel_pending_; // Guarded by mutex_
+};
+
+// Fetches fidelity parameters on a background thread, retrying until it succeeds, it is
+//  cancelled or a deadline passes.
+// Attempt n is given a timeout of initial_timeout_ms * 2^n. An attempt that fails sooner is
+//  followed by a wait for the rest of its timeout, so attempts start at most once per timeout.
+// Neither attempts nor waits go beyond the deadline.
+class FidelityParamFetcher {
+public:
+    struct Options {
+        uint32_t initial_timeout_ms;
+        uint32_t deadline_ms; // From Start
+    };
+    // Called on the fetch thread after each failed attempt, numbered from 0
+    typedef std::function<void(int attempt, TFErrorCode err)> AttemptCallback;
+    // Called once, on the fetch thread, when fetching stops. err is TFERROR_OK if parameters
+    //  were fetched, TFERROR_DOWNLOAD_CANCELLED on cancellation and TFERROR_TIMEOUT if the
+    //  deadline passed.
+    typedef std::function<void(TFErrorCode err, const ProtobufSerialization& fidelity_params,
+                               const std::string& experiment_id)> CompletionCallback;
+
+    explicit FidelityParamFetcher(std::unique_ptr<HttpTransport> transport);
+    // Cancels any fetch in progress and waits for its completion callback
+    ~FidelityParamFetcher();
+
+    FidelityParamFetcher(const FidelityParamFetcher&) = delete;
+    FidelityParamFetcher& operator=(const FidelityParamFetcher&) = delete;
+
+    // request.timeout_ms is ignored: the options give the timeouts.
+    // Returns false if a fetch has already been started.
+    bool Start(const HttpRequest& request, const Options& options,
+               const CompletionCallback& on_complete,
+               const AttemptCallback& on_attempt_failed = nullptr);
+
+    // Returns straight away. The completion callback follows once any attempt in progress
+    //  has been abandoned.
+    void Cancel();
+
+    // Wait for the completion callback to have returned
+    void Join();
+
+    // True if no fetch has been started or the completion callback has returned
+    bool Done() const;
+
+private:
+    void Run(HttpRequest request, Options options, CompletionCallback on_complete,
+             AttemptCallback on_attempt_failed);
+
+    std::unique_ptr<HttpTransport> transport_;
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool cancelled_; // Guarded by mutex_
+    bool done_; // Guarded by mutex_
+};
+
+std::string FidelityParamsUrl(const std::string& url_base, const ExtraUploadInfo& info);
+
+std::string RequestJson(const ExtraUploadInfo& info);
+
+TFErrorCode DecodeResponse(const std::string& response, ProtobufSerialization& fps,
+                           std::string& experiment_id);
+
+} // namespace tuningfork
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_stats.h"
+
+#include <algorithm>
+
+namespace tuningfork {
+
+void P2Quantile::Clear() {
+    count_ = 0;
+    for (int i = 0; i < 5; ++i) {
+        heights_[i] = 0;
+        positions_[i] = i + 1;
+    }
+    desired_[0] = 1;
+    desired_[1] = 1 + 2 * p_;
+    desired_[2] = 1 + 4 * p_;
+    desired_[3] = 3 + 2 * p_;
+    desired_[4] = 5;
+}
+
+void P2Quantile::Add(double x) {
+    if (count_ < 5) {
+        heights_[count_++] = x;
+        if (count_ == 5)
+            std::sort(heights_, heights_ + 5);
+        return;
+    }
+    ++count_;
+    // Find the cell containing x, extending the extreme markers if needed
+    int k;
+    if (x < heights_[0]) {
+        heights_[0] = x;
+        k = 0;
+    } else if (x >= heights_[4]) {
+        heights_[4] = x;
+        k = 3;
+    } else {
+        k = 0;
+        while (k < 3 && x >= heights_[k + 1]) ++k;
+    }
+    for (int i = k + 1; i < 5; ++i)
+        positions_[i] += 1;
+    const double increments[5] = {0, p_ / 2, p_, (1 + p_) / 2, 1};
+    for (int i = 0; i < 5; ++i)
+        desired_[i] += increments[i];
+    // Move the middle markers towards their desired positions
+    for (int i = 1; i < 4; ++i) {
+        double d = desired_[i] - positions_[i];
+        if ((d >= 1 && positions_[i + 1] - positions_[i] > 1) ||
+            (d <= -1 && positions_[i - 1] - positions_[i] < -1)) {
+            int di = d > 0 ? 1 : -1;
+            double h = Parabolic(i, di);
+            if (heights_[i - 1] < h && h < heights_[i + 1])
+                heights_[i] = h;
+            else
+                heights_[i] = Linear(i, di);
+            positions_[i] += di;
+        }
+    }
+}
+
+double P2Quantile::Parabolic(int i, int d) const {
+    const double* q = heights_;
+    const double* n = positions_;
+    return q[i] + d / (n[i + 1] - n[i - 1])
+        * ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+           + (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+double P2Quantile::Linear(int i, int d) const {
+    return heights_[i] + d * (heights_[i + d] - heights_[i]) / (positions_[i + d] - positions_[i]);
+}
+
+double P2Quantile::Value() const {
+    if (count_ >= 5)
+        return heights_[2];
+    if (count_ == 0)
+        return 0;
+    double sorted[5];
+    std::copy(heights_, heights_ + count_, sorted);
+    std::sort(sorted, sorted + count_);
+    size_t i = std::min(count_ - 1, static_cast<size_t>(p_ * count_));
+    return sorted[i];
+}
+
+FrameStats::FrameStats(double budget_ms)
+    : percentiles_{P2Quantile(0.5), P2Quantile(0.9), P2Quantile(0.99), P2Quantile(0.999)},
+      budget_ms_(budget_ms) {
+    Clear();
+}
+
+void FrameStats::Add(double ms) {
+    for (auto& p: percentiles_)
+        p.Add(ms);
+    ++count_;
+    sum_ += ms;
+    max_ = std::max(max_, ms);
+    if (budget_ms_ > 0 && ms > budget_ms_)
+        ++over_budget_count_;
+}
+
+void FrameStats::Clear() {
+    for (auto& p: percentiles_)
+        p.Clear();
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+    over_budget_count_ = 0;
+}
+
+} // namespace tuningfork
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tuningfork {
+
+// Streaming quantile estimate using the P-square algorithm (Jain & Chlamtac, 1985).
+// Keeps 5 markers, so memory and time per sample are constant and nothing is allocated.
+class P2Quantile {
+public:
+    explicit P2Quantile(double p = 0.5) : p_(p) { Clear(); }
+
+    void Add(double x);
+
+    // Current estimate. Exact for fewer than 5 samples.
+    double Value() const;
+
+    void Clear();
+
+private:
+    double Parabolic(int i, int d) const;
+    double Linear(int i, int d) const;
+
+    double p_;
+    size_t count_;
+    double heights_[5];
+    double positions_[5];
+    double desired_[5];
+};
+
+// Summary statistics for the frame times of one prong, updated in O(1) per sample.
+class FrameStats {
+public:
+    enum Percentile { P50 = 0, P90, P99, P999, kNumPercentiles };
+
+    explicit FrameStats(double budget_ms = 0);
+
+    void Add(double ms);
+
+    void Clear();
+
+    size_t Count() const { return count_; }
+    double Percentile(Percentile p) const { return percentiles_[p].Value(); }
+    double Mean() const { return count_ > 0 ? sum_ / count_ : 0; }
+    double Max() const { return max_; }
+    // Zero if there is no budget
+    double BudgetMs() const { return budget_ms_; }
+    uint32_t OverBudgetCount() const { return over_budget_count_; }
+
+private:
+    P2Quantile percentiles_[kNumPercentiles];
+    double budget_ms_;
+    size_t count_;
+    double sum_;
+    double max_;
+    uint32_t over_budget_count_;
+};
+
+} // namespace tuningfork
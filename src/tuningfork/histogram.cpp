@@ -18,6 +18,11 @@
 
 #include <sstream>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #define LOG_TAG "TuningFork"
 #include "Log.h"
@@ -26,52 +31,249 @@
 
 namespace tuningfork {
 
-Histogram::Histogram(float start_ms, float end_ms, int num_buckets_between)
+namespace {
+
+typedef uint32_t U32x4 __attribute__((vector_size(16)));
+
+// dst[i] += src[i], four counts at a time. The buckets in an arena region aren't 16-byte
+//  aligned, so the vectors are loaded and stored with memcpy, which becomes an unaligned
+//  load or store on both NEON and SSE2.
+void AddCounts(uint32_t* dst, const uint32_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        U32x4 a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a += b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < n; ++i)
+        dst[i] += src[i];
+}
+
+} // anonymous namespace
+
+constexpr size_t HistogramArena::kCacheLineSize;
+constexpr size_t HistogramArena::kWordsPerCacheLine;
+
+HistogramArena::HistogramArena() : data_(nullptr), size_(0), capacity_(0) {}
+
+HistogramArena::~HistogramArena() {
+    free(data_);
+}
+
+size_t HistogramArena::Allocate(size_t n) {
+    // Round up to whole cache lines so every region starts on one
+    n = (n + kWordsPerCacheLine - 1) / kWordsPerCacheLine * kWordsPerCacheLine;
+    if (size_ + n > capacity_) {
+        size_t new_capacity = std::max(size_ + n, 2 * capacity_);
+        void* p = nullptr;
+        if (posix_memalign(&p, kCacheLineSize, new_capacity * sizeof(uint32_t)) != 0) {
+            ALOGE("Couldn't allocate histogram storage");
+            abort();
+        }
+        uint32_t* new_data = static_cast<uint32_t*>(p);
+        if (data_ != nullptr)
+            memcpy(new_data, data_, size_ * sizeof(uint32_t));
+        free(data_);
+        data_ = new_data;
+        capacity_ = new_capacity;
+    }
+    size_t offset = size_;
+    memset(data_ + offset, 0, n * sizeof(uint32_t));
+    size_ += n;
+    return offset;
+}
+
+void HistogramArena::Clear() {
+    if (size_ > 0)
+        memset(data_, 0, size_ * sizeof(uint32_t));
+}
+
+Histogram::Histogram(float start_ms, float end_ms, int num_buckets_between,
+                     HistogramArena* arena, TFBucketLayout layout)
     : start_ms_(start_ms), end_ms_(end_ms),
       bucket_dt_ms_((end_ms_ - start_ms_) / num_buckets_between),
+      scale_(0), inv_start_(0), layout_(layout),
       num_buckets_(num_buckets_between + 2),
-      buckets_(num_buckets_), auto_range_(start_ms_ == 0 && end_ms_ == 0), count_(0) {
-    std::fill(buckets_.begin(), buckets_.end(), 0);
-    if (auto_range_)
-        samples_.reserve(num_buckets_);
-    else if (bucket_dt_ms_ <= 0)
-        ALOGE("Histogram end needs to be larger than histogram begin");
+      own_arena_(arena == nullptr ? new HistogramArena : nullptr),
+      arena_(arena == nullptr ? own_arena_.get() : arena),
+      auto_range_(start_ms_ == 0 && end_ms_ == 0) {
+    if (auto_range_) {
+        offset_ = arena_->Allocate(kHeaderWords + 2 * num_buckets_);
+        samples_offset_ = offset_ + kHeaderWords + num_buckets_;
+    } else {
+        offset_ = arena_->Allocate(kHeaderWords + num_buckets_);
+        samples_offset_ = kNoSamples;
+        if (bucket_dt_ms_ <= 0)
+            ALOGE("Histogram end needs to be larger than histogram begin");
+    }
+    if (layout_ != TFBUCKETS_LINEAR && auto_range_) {
+        ALOGE("Only linear histograms can auto-range");
+        layout_ = TFBUCKETS_LINEAR;
+    }
+    if (layout_ == TFBUCKETS_LOG && start_ms_ <= 0) {
+        ALOGE("Log histograms need a start greater than zero: using a linear layout");
+        layout_ = TFBUCKETS_LINEAR;
+    }
+    InitLayout();
+}
+
+Histogram::Histogram(const TFHistogram &hs, HistogramArena* arena)
+    : Histogram(hs.bucket_min, hs.bucket_max, hs.n_buckets, arena, hs.bucket_layout) {
+}
+
+void Histogram::InitLayout() {
+    if (auto_range_ || end_ms_ <= start_ms_) return;
+    int n = num_buckets_ - 2;
+    switch (layout_) {
+        case TFBUCKETS_LINEAR:
+            scale_ = 1.0 / bucket_dt_ms_;
+            break;
+        case TFBUCKETS_LOG:
+            scale_ = n / std::log2(end_ms_ / start_ms_);
+            inv_start_ = 1 / start_ms_;
+            log_buckets_ = GetLogBuckets(start_ms_, end_ms_, n, scale_);
+            break;
+        case TFBUCKETS_HDR:
+            scale_ = HdrLowerBound(n) / (end_ms_ - start_ms_);
+            break;
+    }
 }
 
-Histogram::Histogram(const TFHistogram &hs)
-    : Histogram(hs.bucket_min, hs.bucket_max, hs.n_buckets) {
+// A sample x, relative to the start of the range, is indexed by its binary exponent (its
+//  octave) and the top mantissa_bits bits of its mantissa. first gives the bucket holding the
+//  lowest x with that index. There are at least two indices per bucket, so at most one or two
+//  steps up the bounds find x's bucket.
+struct Histogram::LogBuckets {
+    int octaves; // Samples from 2^octaves up overflow
+    int mantissa_bits;
+    std::vector<Sample> bounds; // Lower bound of inner bucket i, for i in [0, n]
+    std::vector<uint32_t> first;
+};
+
+/* static */
+std::shared_ptr<const Histogram::LogBuckets> Histogram::GetLogBuckets(Sample start_ms,
+                                                                      Sample end_ms, uint32_t n,
+                                                                      Sample scale) {
+    static std::mutex mutex;
+    static std::map<std::tuple<Sample, Sample, uint32_t>, std::weak_ptr<const LogBuckets>> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = cache[std::make_tuple(start_ms, end_ms, n)];
+    if (auto lb = entry.lock())
+        return lb;
+    auto lb = std::make_shared<LogBuckets>();
+    Sample ratio = end_ms / start_ms;
+    lb->octaves = std::max(1, int(std::ceil(std::log2(ratio))));
+    lb->mantissa_bits = 0;
+    while ((1 << lb->mantissa_bits) < 2 * scale && lb->mantissa_bits < 12)
+        ++lb->mantissa_bits;
+    lb->bounds.resize(n + 1);
+    for (uint32_t i = 0; i < n; ++i)
+        lb->bounds[i] = std::exp2(i / scale);
+    lb->bounds[n] = ratio;
+    int per_octave = 1 << lb->mantissa_bits;
+    lb->first.resize(lb->octaves * per_octave);
+    for (int e = 0; e < lb->octaves; ++e) {
+        for (int j = 0; j < per_octave; ++j) {
+            Sample x = std::ldexp(1 + Sample(j) / per_octave, e);
+            auto above = std::upper_bound(lb->bounds.begin(), lb->bounds.end(), x);
+            lb->first[e * per_octave + j] = (above - lb->bounds.begin()) - 1;
+        }
+    }
+    entry = lb;
+    return lb;
+}
+
+/* static */
+uint64_t Histogram::HdrLowerBound(int i) {
+    if (i < kHdrSubBuckets) return i;
+    int shift = i / kHdrHalfSubBuckets - 1;
+    return uint64_t(i - shift * kHdrHalfSubBuckets) << shift;
+}
+
+int Histogram::BucketIndex(Sample dt_ms) const {
+    Sample n = num_buckets_ - 2;
+    Sample i;
+    switch (layout_) {
+        case TFBUCKETS_LOG: {
+            Sample x = dt_ms * inv_start_;
+            // Also catches NaN
+            if (!(x >= 1))
+                return 0;
+            // x is at least 1, so it is normal and positive: the top bits are the exponent
+            uint64_t bits;
+            memcpy(&bits, &x, sizeof(bits));
+            int octave = int(bits >> 52) - 1023;
+            auto& lb = *log_buckets_;
+            if (octave >= lb.octaves)
+                return num_buckets_ - 1;
+            uint32_t sub = (bits & ((uint64_t(1) << 52) - 1)) >> (52 - lb.mantissa_bits);
+            uint32_t b = lb.first[(octave << lb.mantissa_bits) | sub];
+            while (b < num_buckets_ - 2 && x >= lb.bounds[b + 1])
+                ++b;
+            return b + 1;
+        }
+        case TFBUCKETS_HDR: {
+            Sample u = (dt_ms - start_ms_) * scale_;
+            // Clamp before converting so the conversion is defined. One more than the number
+            //  of units for the last bucket is enough to land in the overflow bucket.
+            uint64_t units = std::fmin(std::fmax(u, 0.0), Sample(HdrLowerBound(n) + 1));
+            // Within each doubling, the top kHdrSubBucketBits bits give the bucket
+            int top_bit = 63 - __builtin_clzll(units | (kHdrSubBuckets - 1));
+            int shift = top_bit - (kHdrSubBucketBits - 1);
+            i = shift * kHdrHalfSubBuckets + (units >> shift);
+            i = u < 0 ? -1 : i;
+            break;
+        }
+        default:
+            i = std::floor((dt_ms - start_ms_) * scale_);
+            break;
+    }
+    // Clamp to [underflow, overflow]
+    return int(std::fmin(std::fmax(i, -1.0), n)) + 1;
+}
+
+Histogram::Sample Histogram::BucketUpperBound(int i) const {
+    switch (layout_) {
+        case TFBUCKETS_LOG:
+            return start_ms_ * std::exp2(i / scale_);
+        case TFBUCKETS_HDR:
+            return start_ms_ + HdrLowerBound(i) / scale_;
+        default:
+            return start_ms_ + i * bucket_dt_ms_;
+    }
 }
 
 void Histogram::Add(Sample dt_ms) {
     if (auto_range_) {
-        samples_.push_back(dt_ms);
-        if (samples_.size() == samples_.capacity()) {
+        auto& n = arena_->At(offset_)[kNumSamplesWord];
+        float f = dt_ms;
+        memcpy(arena_->At(samples_offset_ + n), &f, sizeof(f));
+        if (++n == num_buckets_) {
             CalcBucketsFromSamples();
         }
     } else {
-        int i = (dt_ms - start_ms_) / bucket_dt_ms_;
-        if (i < 0)
-            buckets_[0]++;
-        else if (i + 1 >= num_buckets_)
-            buckets_[num_buckets_ - 1]++;
-        else
-            buckets_[i + 1]++;
-        ++count_;
+        Buckets()[BucketIndex(dt_ms)]++;
+        ++arena_->At(offset_)[kCountWord];
     }
 }
 
 void Histogram::CalcBucketsFromSamples() {
+    if (!auto_range_) return;
+    uint32_t n = arena_->At(offset_)[kNumSamplesWord];
+    if (n == 0) return;
     Sample min_dt = std::numeric_limits<Sample>::max();
     Sample max_dt = std::numeric_limits<Sample>::min();
     Sample sum = 0;
     Sample sum2 = 0;
-    for (Sample d: samples_) {
+    for (uint32_t i = 0; i < n; ++i) {
+        Sample d = GetSample(i);
         if (d < min_dt) min_dt = d;
         if (d > max_dt) max_dt = d;
         sum += d;
         sum2 += d * d;
     }
-    size_t n = samples_.size();
     Sample mean = sum / n;
     Sample var = sum2 / n - mean * mean;
     if (var < 0) var = 0; // Can be negative due to rounding errors
@@ -86,11 +288,70 @@ void Histogram::CalcBucketsFromSamples() {
         end_ms_ = mean + w / 2;
     }
     auto_range_ = false;
-    for (Sample d: samples_) {
-        Add(d);
+    InitLayout();
+    arena_->At(offset_)[kNumSamplesWord] = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        Add(GetSample(i));
     }
 }
 
+bool Histogram::SameRange(const Histogram& other) const {
+    return num_buckets_ == other.num_buckets_ && layout_ == other.layout_
+        && start_ms_ == other.start_ms_ && end_ms_ == other.end_ms_;
+}
+
+void Histogram::Merge(const Histogram& other) {
+    if (other.Empty()) return;
+    if (other.auto_range_) {
+        // The other histogram still only has samples
+        uint32_t n = other.arena_->At(other.offset_)[kNumSamplesWord];
+        for (uint32_t i = 0; i < n; ++i)
+            Add(other.GetSample(i));
+        return;
+    }
+    if (auto_range_ && num_buckets_ == other.num_buckets_) {
+        // Take the other's range and count any samples we were holding in it
+        std::vector<Sample> samples;
+        uint32_t& n = arena_->At(offset_)[kNumSamplesWord];
+        for (uint32_t i = 0; i < n; ++i)
+            samples.push_back(GetSample(i));
+        n = 0;
+        start_ms_ = other.start_ms_;
+        end_ms_ = other.end_ms_;
+        bucket_dt_ms_ = other.bucket_dt_ms_;
+        layout_ = other.layout_;
+        auto_range_ = false;
+        InitLayout();
+        for (auto s: samples)
+            Add(s);
+    }
+    if (auto_range_) {
+        // Different numbers of buckets: fix our range from the samples we have first
+        CalcBucketsFromSamples();
+        if (auto_range_) {
+            auto_range_ = false;
+            start_ms_ = other.start_ms_;
+            end_ms_ = other.end_ms_;
+            bucket_dt_ms_ = (end_ms_ - start_ms_) / (num_buckets_ - 2);
+            InitLayout();
+        }
+    }
+    if (SameRange(other)) {
+        AddCounts(Buckets(), other.Buckets(), num_buckets_);
+    } else {
+        auto buckets = Buckets();
+        auto other_buckets = other.Buckets();
+        buckets[0] += other_buckets[0];
+        buckets[num_buckets_ - 1] += other_buckets[other.num_buckets_ - 1];
+        for (uint32_t i = 1; i + 1 < other.num_buckets_; ++i) {
+            if (other_buckets[i] == 0) continue;
+            Sample mid = (other.BucketUpperBound(i - 1) + other.BucketUpperBound(i)) / 2;
+            buckets[BucketIndex(mid)] += other_buckets[i];
+        }
+    }
+    arena_->At(offset_)[kCountWord] += other.Count();
+}
+
 std::string Histogram::ToJSON() const {
     std::stringstream str;
     str.precision(2);
@@ -99,27 +360,28 @@ std::string Histogram::ToJSON() const {
         str << "{\"pmax\":[],\"cnts\":[]}";
     } else {
         str << "{\"pmax\":[";
-        Sample x = start_ms_;
         for (int i = 0; i < num_buckets_ - 1; ++i) {
-            str << x << ",";
-            x += bucket_dt_ms_;
+            str << BucketUpperBound(i) << ",";
         }
         str << "99999],\"cnts\":[";
+        auto buckets = Buckets();
         for (int i = 0; i < num_buckets_ - 1; ++i) {
-            str << buckets_[i] << ",";
+            str << buckets[i] << ",";
         }
         if (num_buckets_ > 0)
-            str << buckets_.back();
+            str << buckets[num_buckets_ - 1];
         str << "]}";
     }
     return str.str();
 }
 
 void Histogram::Clear(bool autorange) {
-    std::fill(buckets_.begin(), buckets_.end(), 0);
-    samples_.clear();
+    memset(arena_->At(offset_), 0, (kHeaderWords + num_buckets_) * sizeof(uint32_t));
+    if (autorange && samples_offset_ == kNoSamples) {
+        // Only happens the first time a fixed-range histogram is switched to auto-ranging
+        samples_offset_ = arena_->Allocate(num_buckets_);
+    }
     auto_range_ = autorange;
-    count_ = 0;
 }
 
 } // namespace tuningfork
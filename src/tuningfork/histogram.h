@@ -19,26 +19,87 @@
 #include "tuningfork_internal.h"
 
 #include <inttypes.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <vector>
 #include <string>
 
 namespace tuningfork {
 
+// Contiguous storage for the counts of many histograms.
+// Each histogram gets a region starting on a cache line, holding its sample count followed by
+//  its bucket counts. Regions are addressed by offset since the storage moves when it grows.
+class HistogramArena {
+public:
+    static constexpr size_t kCacheLineSize = 64;
+    static constexpr size_t kWordsPerCacheLine = kCacheLineSize / sizeof(uint32_t);
+
+    HistogramArena();
+    ~HistogramArena();
+
+    HistogramArena(const HistogramArena&) = delete;
+    HistogramArena& operator=(const HistogramArena&) = delete;
+
+    // Returns the offset of a new zeroed region of at least n words
+    size_t Allocate(size_t n);
+
+    uint32_t* At(size_t offset) { return data_ + offset; }
+    const uint32_t* At(size_t offset) const { return data_ + offset; }
+
+    // Zero every region
+    void Clear();
+
+    // Number of words allocated so far
+    size_t Size() const { return size_; }
+
+private:
+    uint32_t* data_;
+    size_t size_;
+    size_t capacity_;
+};
+
+// A histogram whose counts live in a HistogramArena. If no arena is given, the histogram
+//  allocates its own.
+// Its region holds the sample count, the number of samples held for auto-ranging and then
+//  the bucket counts. An auto-ranging histogram also has room for num_buckets_ float samples,
+//  so collecting samples never allocates.
 class Histogram {
     typedef double Sample;
     static constexpr int kAutoSizeNumStdDev = 3;
     static constexpr double kAutoSizeMinBucketSizeMs = 0.1;
+    // HDR layout: 2^kHdrSubBucketBits equal buckets, then half that number per doubling
+    static constexpr int kHdrSubBucketBits = 4;
+    static constexpr int kHdrSubBuckets = 1 << kHdrSubBucketBits;
+    static constexpr int kHdrHalfSubBuckets = kHdrSubBuckets / 2;
     Sample start_ms_, end_ms_, bucket_dt_ms_;
+    // Multiplier taking a sample to a bucket position, so that Add doesn't need to divide:
+    //  linear: 1/bucket_dt_ms_, log: buckets per doubling, HDR: HDR units per ms.
+    Sample scale_;
+    // Log layout only: 1/start_ms_, and the tables that find a bucket without taking a log
+    Sample inv_start_;
+    struct LogBuckets;
+    std::shared_ptr<const LogBuckets> log_buckets_;
+    TFBucketLayout layout_;
     uint32_t num_buckets_;
-    std::vector<uint32_t> buckets_;
-    std::vector<Sample> samples_;
+    std::unique_ptr<HistogramArena> own_arena_;
+    HistogramArena* arena_;
+    size_t offset_; // Of the count, which is followed by the buckets
+    size_t samples_offset_; // kNoSamples if there is no room for auto-ranging samples
     bool auto_range_;
-    size_t count_;
+    static constexpr size_t kNoSamples = SIZE_MAX;
+    enum { kCountWord = 0, kNumSamplesWord = 1, kHeaderWords = 2 };
 public:
     static constexpr int kDefaultNumBuckets = 30;
 
-    explicit Histogram(float start_ms = 0, float end_ms = 0, int num_buckets_between = kDefaultNumBuckets);
-    explicit Histogram(const TFHistogram&);
+    explicit Histogram(float start_ms = 0, float end_ms = 0,
+                       int num_buckets_between = kDefaultNumBuckets,
+                       HistogramArena* arena = nullptr,
+                       TFBucketLayout layout = TFBUCKETS_LINEAR);
+    explicit Histogram(const TFHistogram&, HistogramArena* arena = nullptr);
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
 
     // Add a sample delta time
     void Add(Sample dt_ms);
@@ -47,18 +108,67 @@ public:
     void Clear(bool autorange = false);
 
     // Get the total number of samples added so far
-    size_t Count() const { return count_; }
+    size_t Count() const { return arena_->At(offset_)[kCountWord]; }
+
+    // True if nothing has been added since the last clear, including samples held for
+    //  auto-ranging
+    bool Empty() const {
+        return Count() == 0 && arena_->At(offset_)[kNumSamplesWord] == 0;
+    }
+
+    // Add the other histogram's counts to this one's. If this histogram hasn't been ranged
+    //  yet, it takes the other's range. Histograms with different ranges are merged
+    //  approximately, by moving each of the other's bucket counts to the bucket holding that
+    //  bucket's midpoint.
+    void Merge(const Histogram& other);
 
     // Get the histogram as a JSON object, for testing
     std::string ToJSON() const;
 
+    // The upper bound of bucket i, for i in [0, num_buckets - 1).
+    // Bucket 0 counts samples below the histogram range, so its upper bound is the start.
+    Sample BucketUpperBound(int i) const;
+
+    TFBucketLayout Layout() const { return layout_; }
+    bool AutoRanging() const { return auto_range_; }
+    // Including the underflow and overflow buckets
+    uint32_t NumBuckets() const { return num_buckets_; }
+    const uint32_t* Counts() const { return Buckets(); }
+    Sample StartMs() const { return start_ms_; }
+    Sample EndMs() const { return end_ms_; }
+
     // Use the data we have to construct the bucket ranges. This is called automatically after
     //  sizeAtWhichToRange samples have been collected, if we are auto-ranging.
     void CalcBucketsFromSamples();
 
     // Only to be used for testing
     void SetCounts(const std::vector<uint32_t>& counts) {
-        buckets_ = counts;
+        std::copy(counts.begin(), counts.begin() + std::min<size_t>(counts.size(), num_buckets_),
+                  Buckets());
+    }
+
+private:
+    // Index into the buckets, including the underflow and overflow buckets
+    int BucketIndex(Sample dt_ms) const;
+
+    void InitLayout();
+
+    bool SameRange(const Histogram& other) const;
+
+    // The number of HDR units from the start of the range to the lower bound of inner bucket i
+    static uint64_t HdrLowerBound(int i);
+
+    // Shared by all log histograms with the same range and number of buckets
+    static std::shared_ptr<const LogBuckets> GetLogBuckets(Sample start_ms, Sample end_ms,
+                                                           uint32_t n, Sample scale);
+
+    uint32_t* Buckets() { return arena_->At(offset_ + kHeaderWords); }
+    const uint32_t* Buckets() const { return arena_->At(offset_ + kHeaderWords); }
+
+    Sample GetSample(uint32_t i) const {
+        float f;
+        memcpy(&f, arena_->At(samples_offset_ + i), sizeof(f));
+        return f;
     }
 
     friend class ClearcutSerializer;
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "instrument_key_index.h"
+
+#define LOG_TAG "TuningFork"
+#include "Log.h"
+
+namespace tuningfork {
+
+constexpr size_t InstrumentKeyIndex::kKeySpaceSize;
+
+InstrumentKeyIndex::InstrumentKeyIndex(uint32_t max_keys)
+    : table_(new std::atomic<uint16_t>[kKeySpaceSize]()),
+      keys_(new std::atomic<InstrumentationKey>[max_keys]()),
+      max_keys_(max_keys), num_keys_(0) {
+    // Indices are stored + 1 in 16 bits
+    if (max_keys_ >= kKeySpaceSize) {
+        ALOGW("max_instrumentation_keys too large: limiting to %zu", kKeySpaceSize - 1);
+        max_keys_ = kKeySpaceSize - 1;
+    }
+}
+
+TFErrorCode InstrumentKeyIndex::Create(InstrumentationKey key, int& index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Another thread may have added the key while we waited for the lock
+    auto i = table_[key].load(std::memory_order_relaxed);
+    if (i != 0) {
+        index = i - 1;
+        return TFERROR_OK;
+    }
+    if (num_keys_ >= max_keys_)
+        return TFERROR_INVALID_INSTRUMENT_KEY;
+    index = num_keys_++;
+    keys_[index].store(key, std::memory_order_relaxed);
+    table_[key].store(index + 1, std::memory_order_release);
+    return TFERROR_OK;
+}
+
+std::vector<InstrumentationKey> InstrumentKeyIndex::Keys() const {
+    std::vector<InstrumentationKey> keys(max_keys_);
+    for (uint32_t i = 0; i < max_keys_; ++i)
+        keys[i] = keys_[i].load(std::memory_order_relaxed);
+    return keys;
+}
+
+} // namespace tuningfork
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork_internal.h"
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tuningfork {
+
+// Maps instrument keys to dense indices in [0, max_keys), in order of first use.
+// The table is direct-mapped over the whole 16-bit key space, so a lookup of a key that has
+//  already been seen is a single load. Adding a key takes a lock.
+class InstrumentKeyIndex {
+public:
+    static constexpr size_t kKeySpaceSize =
+        size_t(std::numeric_limits<InstrumentationKey>::max()) + 1;
+
+    explicit InstrumentKeyIndex(uint32_t max_keys);
+
+    TFErrorCode GetOrCreate(InstrumentationKey key, int& index) {
+        // Entries hold index + 1 so that zero means 'not yet seen'
+        auto i = table_[key].load(std::memory_order_acquire);
+        if (i != 0) {
+            index = i - 1;
+            return TFERROR_OK;
+        }
+        return Create(key, index);
+    }
+
+    // The keys in index order. Unused slots hold 0.
+    std::vector<InstrumentationKey> Keys() const;
+
+private:
+    TFErrorCode Create(InstrumentationKey key, int& index);
+
+    std::unique_ptr<std::atomic<uint16_t>[]> table_;
+    std::unique_ptr<std::atomic<InstrumentationKey>[]> keys_;
+    uint32_t max_keys_;
+    std::mutex mutex_;
+    uint32_t num_keys_;
+};
+
+} // namespace tuningfork
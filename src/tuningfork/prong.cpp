@@ -19,54 +19,255 @@
 #define LOG_TAG "TuningFork"
 #include "Log.h"
 
+#include <algorithm>
 #include <string>
 #include <sstream>
 
 namespace tuningfork {
 
-// Allocate all the prongs up front
+constexpr size_t ProngCache::kSlabSize;
+constexpr size_t ProngCache::kInitialTableSize;
+
 ProngCache::ProngCache(size_t size, int max_num_instrumentation_keys,
                        const std::vector<TFHistogram> &histogram_settings,
                        const std::function<SerializedAnnotation(uint64_t)> &seralizeId)
-    : prongs_(size), max_num_instrumentation_keys_(max_num_instrumentation_keys) {
-    // Allocate all the prongs
-    InstrumentationKey ikey = 0;
-    for (int i = 0; i < size; ++i) {
-        auto &p = prongs_[i];
-        SerializedAnnotation annotation = seralizeId(i);
-        auto& h = histogram_settings[ikey<histogram_settings.size()?ikey:0];
-        p = std::make_unique<Prong>(ikey, annotation, h);
-        ++ikey;
-        if (ikey >= max_num_instrumentation_keys)
-            ikey = 0;
-    }
+    : max_size_(size), max_num_instrumentation_keys_(max_num_instrumentation_keys),
+      histogram_settings_(histogram_settings), serialize_id_(seralizeId),
+      table_(kInitialTableSize, Slot {0, nullptr}), table_shift_(64),
+      slab_used_(kSlabSize), epoch_(0), dropped_windows_(0), merged_windows_(0) {
+    for (size_t n = kInitialTableSize; n > 1; n >>= 1)
+        --table_shift_;
+}
+
+ProngCache::~ProngCache() {
+    for (auto p: prongs_)
+        p->~Prong();
 }
 
 Prong *ProngCache::Get(uint64_t compound_id) {
-    if (compound_id >= prongs_.size()) {
+    if (compound_id >= max_size_) {
         ALOGW("You have overrun the number of histograms (are your "
               "Settings correct?)");
         return nullptr;
     }
-    return prongs_[compound_id].get();
+    auto p = Find(compound_id);
+    if (p == nullptr)
+        p = Create(compound_id);
+    return p;
+}
+
+Prong* ProngCache::Find(uint64_t compound_id) const {
+    size_t mask = table_.size() - 1;
+    for (size_t i = Hash(compound_id);; i = (i + 1) & mask) {
+        auto& slot = table_[i];
+        if (slot.prong == nullptr) return nullptr;
+        if (slot.compound_id == compound_id) return slot.prong;
+    }
+}
+
+Prong* ProngCache::Create(uint64_t compound_id) {
+    InstrumentationKey ikey = compound_id % max_num_instrumentation_keys_;
+    TFHistogram h = {};
+    if (!histogram_settings_.empty())
+        h = histogram_settings_[ikey<histogram_settings_.size()?ikey:0];
+    Prong* p = new (AllocateProng()) Prong(ikey, serialize_id_(compound_id), h,
+                                                 &arena_);
+    // Keep the load factor at or below 1/2
+    if (2 * (prongs_.size() + 1) > table_.size())
+        Grow();
+    Insert(compound_id, p);
+    prongs_.push_back(p);
+    compound_ids_.push_back(compound_id);
+    return p;
+}
+
+Prong* ProngCache::AllocateProng() {
+    if (slab_used_ == kSlabSize) {
+        slabs_.push_back(std::unique_ptr<ProngStorage[]>(new ProngStorage[kSlabSize]));
+        slab_used_ = 0;
+    }
+    return reinterpret_cast<Prong*>(&slabs_.back()[slab_used_++]);
+}
+
+void ProngCache::Insert(uint64_t compound_id, Prong* p) {
+    size_t mask = table_.size() - 1;
+    size_t i = Hash(compound_id);
+    while (table_[i].prong != nullptr)
+        i = (i + 1) & mask;
+    table_[i] = {compound_id, p};
+}
+
+void ProngCache::Grow() {
+    table_.assign(table_.size() * 2, Slot {0, nullptr});
+    --table_shift_;
+    for (size_t i = 0; i < prongs_.size(); ++i)
+        Insert(compound_ids_[i], prongs_[i]);
 }
 
 void ProngCache::Clear() {
-    for (auto &p: prongs_) {
-        if (p->histogram_.Count() > 0)
-            p->histogram_.Clear();
+    arena_.Clear();
+    // The arena holds the histogram counts. The frame stats and last tick times are per prong,
+    //  and the first tick of the next window mustn't record the gap since this one.
+    for (auto p: prongs_) {
+        p->last_time_ns_ = std::chrono::steady_clock::time_point::min();
+        p->stats_.Clear();
     }
 }
 
 void ProngCache::SetInstrumentKeys(const std::vector<InstrumentationKey>& instrument_keys) {
-    auto nAnnotations = prongs_.size()/max_num_instrumentation_keys_;
-    for (int j=0; j<nAnnotations; ++j) {
-        for (int i=0; i<instrument_keys.size(); ++i) {
-            auto k = instrument_keys[i];
-            auto& p = prongs_[i + j*max_num_instrumentation_keys_];
-            p->SetInstrumentKey(k);
+    for (size_t i = 0; i < prongs_.size(); ++i) {
+        auto key_index = compound_ids_[i] % max_num_instrumentation_keys_;
+        if (key_index < instrument_keys.size())
+            prongs_[i]->SetInstrumentKey(instrument_keys[key_index]);
+    }
+}
+
+void ProngCache::Merge(const ProngCache& other) {
+    for (size_t i = 0; i < other.prongs_.size(); ++i) {
+        auto q = other.prongs_[i];
+        if (q->histogram_.Empty()) continue;
+        auto p = Get(other.compound_ids_[i]);
+        if (p)
+            p->Merge(*q);
+    }
+}
+
+ProngCacheRing::ProngCacheRing(size_t n, FullWindowPolicy policy,
+                               const std::function<std::unique_ptr<ProngCache>()>& make_cache,
+                               const CloseCallback& on_close)
+    : policy_(policy), on_close_(on_close), current_(0), extending_(false), dropped_(0),
+      merged_(0), total_dropped_(0), total_merged_(0) {
+    if (n < 2) n = 2;
+    pending_.reset(new std::atomic<bool>[n]);
+    for (size_t i = 0; i < n; ++i) {
+        caches_.push_back(make_cache());
+        pending_[i] = false;
+    }
+}
+
+ProngCache* ProngCacheRing::Rotate() {
+    size_t next = (current_ + 1) % caches_.size();
+    ProngCache* closed = caches_[current_].get();
+    uint64_t epoch = closed->epoch_;
+    if (pending_[next].load(std::memory_order_acquire)) {
+        if (policy_ == Settings::AggregationStrategy::DROP_WINDOW) {
+            ALOGW("All %zu aggregation windows are waiting for upload: dropping window %" PRIu64,
+                  caches_.size(), epoch);
+            if (on_close_)
+                on_close_(*closed);
+            closed->Clear();
+            closed->epoch_ = epoch + 1;
+            ++dropped_;
+            ++total_dropped_;
+        } else if (!extending_) {
+            // Counted once per window, however many times it is extended
+            ALOGW("All %zu aggregation windows are waiting for upload: extending window %" PRIu64,
+                  caches_.size(), epoch);
+            extending_ = true;
+            ++merged_;
+            ++total_merged_;
+        }
+        return nullptr;
+    }
+    if (on_close_)
+        on_close_(*closed);
+    closed->dropped_windows_ = dropped_;
+    closed->merged_windows_ = merged_;
+    dropped_ = 0;
+    merged_ = 0;
+    extending_ = false;
+    pending_[current_].store(true, std::memory_order_release);
+    auto opened = caches_[next].get();
+    opened->Clear();
+    opened->epoch_ = epoch + 1;
+    current_ = next;
+    return closed;
+}
+
+void ProngCacheRing::Release(const ProngCache* pc) {
+    for (size_t i = 0; i < caches_.size(); ++i) {
+        if (caches_[i].get() == pc) {
+            pending_[i].store(false, std::memory_order_release);
+            return;
         }
     }
+    ALOGW("Released a cache that is not in the ring");
+}
+
+SessionCache::SessionCache(const std::function<std::unique_ptr<ProngCache>()>& make_cache)
+    : session_(make_cache()), staging_(make_cache()), num_windows_(0),
+      num_staged_windows_(0) {
+}
+
+void SessionCache::Merge(const ProngCache& pc) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!issued_.empty()) {
+        staging_->Merge(pc);
+        ++num_staged_windows_;
+    } else {
+        session_->Merge(pc);
+        ++num_windows_;
+        UpdateView();
+    }
+}
+
+void SessionCache::Acquire(TFSessionHistograms& view) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    view.n_histograms = view_.size();
+    view.histograms = view_.data();
+    view.n_windows = num_windows_;
+    issued_.push_back({&view, view.histograms, view.n_windows});
+}
+
+bool SessionCache::Release(const TFSessionHistograms& view) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(issued_.begin(), issued_.end(), [&view](const IssuedView& v) {
+        return v.view == &view && v.histograms == view.histograms
+            && v.generation == view.n_windows;
+    });
+    if (it == issued_.end())
+        return false;
+    issued_.erase(it);
+    if (issued_.empty() && num_staged_windows_ > 0) {
+        session_->Merge(*staging_);
+        staging_->Clear();
+        num_windows_ += num_staged_windows_;
+        num_staged_windows_ = 0;
+        UpdateView();
+    }
+    return true;
+}
+
+uint64_t SessionCache::NumWindows() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_windows_ + num_staged_windows_;
+}
+
+void SessionCache::UpdateView() {
+    // Merging can grow the arena, so all the count pointers are refreshed
+    view_.clear();
+    upper_bounds_.clear();
+    for (auto p: session_->prongs_) {
+        auto& h = p->histogram_;
+        if (h.AutoRanging()) continue;
+        for (uint32_t i = 0; i + 1 < h.NumBuckets(); ++i)
+            upper_bounds_.push_back(h.BucketUpperBound(i));
+        TFSessionHistogram v;
+        v.instrument_key = p->instrumentation_key_;
+        v.annotation = p->annotation_.data();
+        v.annotation_size = p->annotation_.size();
+        v.n_buckets = h.NumBuckets();
+        v.bucket_upper_bounds = nullptr;
+        v.counts = h.Counts();
+        v.count = h.Count();
+        view_.push_back(v);
+    }
+    // Only now that upper_bounds_ has stopped growing
+    const float* bounds = upper_bounds_.data();
+    for (auto& v: view_) {
+        v.bucket_upper_bounds = bounds;
+        bounds += v.n_buckets - 1;
+    }
 }
 
 }
@@ -18,12 +18,17 @@
 
 #include "tuningfork_internal.h"
 #include "histogram.h"
+#include "frame_stats.h"
 
 #include <inttypes.h>
 #include <vector>
 #include <map>
 #include <string>
 #include <memory>
+#include <functional>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
 
 namespace tuningfork {
 
@@ -35,14 +40,17 @@ public:
     InstrumentationKey instrumentation_key_;
     SerializedAnnotation annotation_;
     Histogram histogram_;
+    FrameStats stats_;
     TimePoint last_time_ns_;
 
     Prong(InstrumentationKey instrumentation_key = 0,
           const SerializedAnnotation &annotation = {},
-          const TFHistogram& histogram_settings = {})
+          const TFHistogram& histogram_settings = {},
+          HistogramArena* arena = nullptr)
         : instrumentation_key_(instrumentation_key), annotation_(annotation),
-          last_time_ns_(std::chrono::steady_clock::time_point::min()),
-          histogram_(histogram_settings) {}
+          histogram_(histogram_settings, arena),
+          stats_(histogram_settings.frame_budget_ms),
+          last_time_ns_(std::chrono::steady_clock::time_point::min()) {}
 
     void Tick(TimePoint t_ns) {
         if (last_time_ns_ != std::chrono::steady_clock::time_point::min())
@@ -52,13 +60,16 @@ public:
 
     void Trace(Duration dt_ns) {
         // The histogram stores millisecond values as doubles
-        histogram_.Add(
-            double(std::chrono::duration_cast<std::chrono::nanoseconds>(dt_ns).count()) / 1000000);
+        double dt_ms =
+            double(std::chrono::duration_cast<std::chrono::nanoseconds>(dt_ns).count()) / 1000000;
+        histogram_.Add(dt_ms);
+        stats_.Add(dt_ms);
     }
 
     void Clear() {
         last_time_ns_ = std::chrono::steady_clock::time_point::min();
         histogram_.Clear();
+        stats_.Clear();
     }
 
     size_t Count() const {
@@ -69,26 +80,191 @@ public:
         instrumentation_key_ = key;
     }
 
+    // Only the histogram is merged: the frame stats can't be combined exactly
+    void Merge(const Prong& other) {
+        instrumentation_key_ = other.instrumentation_key_;
+        histogram_.Merge(other.histogram_);
+    }
+
     friend class ClearcutSerializer;
 };
 
-// Simple fixed-size cache
+// Sparse cache of prongs, keyed on compound id.
+// Prongs are only created when a compound id is first seen, so memory scales with the
+//  annotation/instrument key combinations actually used rather than the maximum possible.
+// Lookup is through an open-addressing hash table with linear probing and prongs are
+//  allocated from slabs. Prongs live until the cache is destroyed: Clear only resets them.
+// All the histogram counts are held in one HistogramArena, so clearing them is a single memset.
 class ProngCache {
-    std::vector<std::unique_ptr<Prong>> prongs_;
+    static constexpr size_t kSlabSize = 64; // Prongs per slab
+    static constexpr size_t kInitialTableSize = 64; // Must be a power of 2
+    typedef typename std::aligned_storage<sizeof(Prong), alignof(Prong)>::type ProngStorage;
+    struct Slot {
+        uint64_t compound_id;
+        Prong* prong; // nullptr if the slot is empty
+    };
+    size_t max_size_;
     int max_num_instrumentation_keys_;
+    std::vector<TFHistogram> histogram_settings_;
+    std::function<SerializedAnnotation(uint64_t)> serialize_id_;
+    std::vector<Slot> table_;
+    size_t table_shift_;
+    // Live prongs in order of creation, with their compound ids
+    std::vector<Prong*> prongs_;
+    std::vector<uint64_t> compound_ids_;
+    std::vector<std::unique_ptr<ProngStorage[]>> slabs_;
+    size_t slab_used_;
+    // Counts for all the prongs' histograms
+    HistogramArena arena_;
+    // Set by ProngCacheRing when the window this cache holds is opened or closed
+    uint64_t epoch_;
+    uint32_t dropped_windows_;
+    uint32_t merged_windows_;
 public:
     ProngCache(size_t size, int max_num_instrumentation_keys,
                const std::vector<TFHistogram>& histogram_settings,
                const std::function<SerializedAnnotation(uint64_t)>& seralizeId);
 
+    ~ProngCache();
+
+    ProngCache(const ProngCache&) = delete;
+    ProngCache& operator=(const ProngCache&) = delete;
+
+    // Get the prong for the compound id, creating it if this is the first use.
+    // Returns nullptr if the id is out of range.
     Prong *Get(uint64_t compound_id);
 
     void Clear();
 
     void SetInstrumentKeys(const std::vector<InstrumentationKey>& instrument_keys);
 
+    // Add the histograms of the other cache, which must have the same settings, to those
+    //  for the same compound ids in this one
+    void Merge(const ProngCache& other);
+
+    // The number of prongs allocated so far
+    size_t NumProngs() const { return prongs_.size(); }
+
+    // The aggregation window this cache holds
+    uint64_t Epoch() const { return epoch_; }
+    // Windows dropped or merged into this one since the previous window was closed
+    uint32_t DroppedWindows() const { return dropped_windows_; }
+    uint32_t MergedWindows() const { return merged_windows_; }
+
+private:
+    Prong* Find(uint64_t compound_id) const;
+    Prong* Create(uint64_t compound_id);
+    Prong* AllocateProng();
+    void Insert(uint64_t compound_id, Prong* p);
+    void Grow();
+    size_t Hash(uint64_t compound_id) const {
+        // Fibonacci hashing: compound ids are small and often sequential
+        return (compound_id * 0x9E3779B97F4A7C15ull) >> table_shift_;
+    }
+
     friend class ClearcutSerializer;
+    friend class ProngCacheRing;
+    friend class SessionCache;
+
+};
+
+// Ring of ProngCaches, one per aggregation window, numbered by epoch.
+// Rotate closes the window being recorded and starts the next one, so windows start on schedule
+//  whether or not uploads are keeping up: closed windows wait in the ring until the upload
+//  thread releases them. Only when every other cache is still waiting to be uploaded does the
+//  full-window policy apply: the current window is either kept open (merged into the next) or
+//  its data is dropped. Either way, the count is reported with the next window that is closed.
+// If given, on_close is called with each window as it is closed, including those about to be
+//  dropped, but not those being merged into the next.
+// Rotate must be called from the thread recording into the current cache; Release may be
+//  called from any thread.
+class ProngCacheRing {
+public:
+    typedef Settings::AggregationStrategy::FullWindowPolicy FullWindowPolicy;
+    typedef std::function<void(const ProngCache&)> CloseCallback;
+
+    // n is clamped to at least 2: one window recording and one being uploaded.
+    ProngCacheRing(size_t n, FullWindowPolicy policy,
+                   const std::function<std::unique_ptr<ProngCache>()>& make_cache,
+                   const CloseCallback& on_close = nullptr);
+
+    ProngCache* Current() const { return caches_[current_].get(); }
+
+    // Close the current window and start the next.
+    // Returns the closed cache, which must be passed to Release once it has been uploaded, or
+    //  nullptr if the ring was full and the full-window policy was applied instead.
+    ProngCache* Rotate();
+
+    void Release(const ProngCache* pc);
+
+    size_t Size() const { return caches_.size(); }
+
+    // Totals since construction. A window counts as merged once, however many times Rotate
+    //  is called while it is extended.
+    uint64_t DroppedWindows() const { return total_dropped_; }
+    uint64_t MergedWindows() const { return total_merged_; }
+
+private:
+    std::vector<std::unique_ptr<ProngCache>> caches_;
+    // True while a closed cache is waiting to be uploaded
+    std::unique_ptr<std::atomic<bool>[]> pending_;
+    FullWindowPolicy policy_;
+    CloseCallback on_close_;
+    size_t current_;
+    // True while the current window is being extended because the ring is full
+    bool extending_;
+    uint32_t dropped_;
+    uint32_t merged_;
+    uint64_t total_dropped_;
+    uint64_t total_merged_;
+};
+
+// The histograms for the whole session: every closed window is merged into one long-lived
+//  cache, which can be read in place through TFSessionHistograms views.
+// While any view is held, the session cache isn't touched: closed windows are merged into a
+//  staging cache instead, which is folded in when the last view is released. So neither the
+//  thread closing windows nor the readers ever wait for each other for longer than a merge.
+// Merge is called from the thread that rotates the ring; Acquire and Release from any thread.
+class SessionCache {
+public:
+    SessionCache(const std::function<std::unique_ptr<ProngCache>()>& make_cache);
+
+    SessionCache(const SessionCache&) = delete;
+    SessionCache& operator=(const SessionCache&) = delete;
+
+    void Merge(const ProngCache& pc);
+
+    // Fill in a view of the session histograms, which stays valid until Release is called.
+    // Histograms that have not been ranged yet are left out.
+    void Acquire(TFSessionHistograms& view);
+
+    // Release a view filled in by Acquire. It must be the same object, as it was filled in.
+    // Returns false if it isn't a view that is still held, e.g. one already released.
+    bool Release(const TFSessionHistograms& view);
+
+    // Windows merged so far, including any that are staged
+    uint64_t NumWindows() const;
+
+private:
+    // Must be called with the mutex held and no views outstanding
+    void UpdateView();
+
+    // A view handed out by Acquire and not yet released
+    struct IssuedView {
+        const TFSessionHistograms* view;
+        const TFSessionHistogram* histograms;
+        uint64_t generation; // The number of windows in the view
+    };
 
+    std::unique_ptr<ProngCache> session_;
+    std::unique_ptr<ProngCache> staging_;
+    mutable std::mutex mutex_;
+    std::vector<IssuedView> issued_;
+    uint64_t num_windows_;
+    uint64_t num_staged_windows_;
+    std::vector<TFSessionHistogram> view_;
+    // All the view's bucket upper bounds, one run per histogram
+    std::vector<float> upper_bounds_;
 };
 
 } // namespace tuningfork {
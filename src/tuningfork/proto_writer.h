@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace tuningfork {
+
+// Writes protobuf wire format straight into memory that the caller has already sized.
+// The *Size functions give the encoded size of each kind of field, so that the length of a
+//  message can be computed in closed form before it is written, rather than by encoding it
+//  twice. Each write is checked against the end of the buffer: one that doesn't fit is dropped,
+//  along with every write after it, and Ok() then returns false.
+class ProtoWriter {
+public:
+    enum WireType {
+        VARINT = 0,
+        LENGTH_DELIMITED = 2,
+        FIXED32 = 5
+    };
+
+    static size_t VarintSize(uint64_t v) {
+        // 7 bits per byte, and at least one byte for zero
+        return (70 - __builtin_clzll(v | 1)) / 7;
+    }
+    static size_t TagSize(uint32_t field) {
+        return VarintSize(field << 3);
+    }
+    // Negative values take 10 bytes, as they are sign-extended to 64 bits
+    static size_t Int32FieldSize(uint32_t field, int32_t v) {
+        return TagSize(field) + VarintSize(static_cast<uint64_t>(static_cast<int64_t>(v)));
+    }
+    static size_t UInt64FieldSize(uint32_t field, uint64_t v) {
+        return TagSize(field) + VarintSize(v);
+    }
+    static size_t FloatFieldSize(uint32_t field) {
+        return TagSize(field) + sizeof(float);
+    }
+    static size_t LengthDelimitedFieldSize(uint32_t field, size_t length) {
+        return TagSize(field) + VarintSize(length) + length;
+    }
+
+    ProtoWriter(uint8_t* p, uint8_t* end) : p_(p), end_(end), ok_(true) {}
+
+    uint8_t* Position() const { return p_; }
+
+    // False if a write didn't fit
+    bool Ok() const { return ok_; }
+
+    void Varint(uint64_t v) {
+        if (!Reserve(VarintSize(v)))
+            return;
+        while (v >= 0x80) {
+            *p_++ = static_cast<uint8_t>(v | 0x80);
+            v >>= 7;
+        }
+        *p_++ = static_cast<uint8_t>(v);
+    }
+    void Tag(uint32_t field, WireType type) {
+        Varint((field << 3) | type);
+    }
+    void Int32Field(uint32_t field, int32_t v) {
+        Tag(field, VARINT);
+        Varint(static_cast<uint64_t>(static_cast<int64_t>(v)));
+    }
+    void UInt64Field(uint32_t field, uint64_t v) {
+        Tag(field, VARINT);
+        Varint(v);
+    }
+    void FloatField(uint32_t field, float v) {
+        Tag(field, FIXED32);
+        if (!Reserve(sizeof(float)))
+            return;
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        // Little-endian, whatever the host
+        for (int i = 0; i < 4; ++i) {
+            *p_++ = static_cast<uint8_t>(bits);
+            bits >>= 8;
+        }
+    }
+    // The tag and length of a string, bytes, packed array or submessage, whose contents must
+    //  be written next
+    void LengthDelimitedHeader(uint32_t field, size_t length) {
+        Tag(field, LENGTH_DELIMITED);
+        Varint(length);
+    }
+    void BytesField(uint32_t field, const void* data, size_t length) {
+        LengthDelimitedHeader(field, length);
+        if (!Reserve(length))
+            return;
+        if (length > 0)
+            memcpy(p_, data, length);
+        p_ += length;
+    }
+
+private:
+    bool Reserve(size_t n) {
+        if (ok_ && static_cast<size_t>(end_ - p_) >= n)
+            return true;
+        ok_ = false;
+        return false;
+    }
+
+    uint8_t* p_;
+    uint8_t* end_;
+    bool ok_;
+};
+
+} // namespace tuningfork
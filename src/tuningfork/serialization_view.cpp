@@ -0,0 +1,165 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "serialization_view.h"
+#include "tuningfork/protobuf_util.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android/asset_manager.h>
+
+#define LOG_TAG "TuningFork"
+#include "Log.h"
+
+namespace tuningfork {
+
+namespace {
+
+// What backs the bytes of a view: either an asset or a mapping of map_size bytes at map_base
+struct ViewSource {
+    AAsset* asset;
+    void* map_base;
+    size_t map_size;
+};
+
+// The dealloc callback only gets the serialization, so the source of each view is looked up
+//  by its bytes. Distinct views can't share bytes, as each has its own asset or mapping.
+class ViewRegistry {
+public:
+    void Add(const uint8_t* bytes, const ViewSource& source) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        views_[bytes] = source;
+    }
+    bool Remove(const uint8_t* bytes, ViewSource& source) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = views_.find(bytes);
+        if (it == views_.end())
+            return false;
+        source = it->second;
+        views_.erase(it);
+        return true;
+    }
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return views_.size();
+    }
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<const uint8_t*, ViewSource> views_;
+};
+
+// Leaked, so that views freed during static destruction still find it
+ViewRegistry& Registry() {
+    static ViewRegistry* registry = new ViewRegistry;
+    return *registry;
+}
+
+void ViewDealloc(CProtobufSerialization* c) {
+    ViewSource source;
+    if (c->bytes && Registry().Remove(c->bytes, source)) {
+        if (source.asset)
+            AAsset_close(source.asset);
+        else
+            munmap(source.map_base, source.map_size);
+    }
+    c->bytes = nullptr;
+    c->size = 0;
+}
+
+void SetEmpty(CProtobufSerialization& ser) {
+    ser.bytes = nullptr;
+    ser.size = 0;
+    ser.dealloc = CProtobufSerialization_Dealloc;
+}
+
+} // anonymous namespace
+
+bool MakeAssetView(AAsset* asset, CProtobufSerialization& ser) {
+    int64_t size = AAsset_getLength64(asset);
+    if (size == 0) {
+        SetEmpty(ser);
+        AAsset_close(asset);
+        return true;
+    }
+    // For an uncompressed asset this is already a mapping of the APK; a compressed one is
+    //  inflated into a buffer that the asset owns. Either way there is nothing for us to copy.
+    auto buffer = static_cast<const uint8_t*>(AAsset_getBuffer(asset));
+    if (buffer == nullptr) {
+        ALOGW("Can't get asset buffer");
+        AAsset_close(asset);
+        return false;
+    }
+    ser.bytes = const_cast<uint8_t*>(buffer);
+    ser.size = size;
+    ser.dealloc = ViewDealloc;
+    Registry().Add(buffer, {asset, nullptr, 0});
+    return true;
+}
+
+bool MakeFileView(const std::string& path, CProtobufSerialization& ser) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return false;
+    }
+    if (sb.st_size == 0) {
+        // Zero-length mappings aren't allowed
+        close(fd);
+        SetEmpty(ser);
+        return true;
+    }
+    size_t size = sb.st_size;
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (p == MAP_FAILED) {
+        ALOGW("Couldn't map %s", path.c_str());
+        return false;
+    }
+    ser.bytes = static_cast<uint8_t*>(p);
+    ser.size = size;
+    ser.dealloc = ViewDealloc;
+    Registry().Add(ser.bytes, {nullptr, p, size});
+    return true;
+}
+
+bool NarrowView(CProtobufSerialization& ser, size_t offset, size_t size) {
+    if (ser.dealloc != ViewDealloc || offset > ser.size || size > ser.size - offset)
+        return false;
+    ViewSource source;
+    if (!Registry().Remove(ser.bytes, source))
+        return false;
+    ser.bytes += offset;
+    ser.size = size;
+    Registry().Add(ser.bytes, source);
+    return true;
+}
+
+size_t NumSerializationViews() {
+    return Registry().Size();
+}
+
+} // namespace tuningfork
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork/tuningfork.h"
+
+#include <string>
+
+class AAsset;
+
+namespace tuningfork {
+
+// Views are CProtobufSerializations whose bytes are not a heap copy but belong to an open
+//  asset or a file mapping. Their dealloc releases whatever backs the bytes, so they are freed
+//  with CProtobufSerialization_Free like any other serialization. As with heap serializations,
+//  a view must be freed exactly once, however many copies of the struct are made.
+// The bytes of a view must not be written to.
+
+// Make ser a view of the buffer of an asset opened with AASSET_MODE_BUFFER. The view takes
+//  ownership of the asset, which is closed when the view is freed.
+// Returns false, and closes the asset, if its buffer can't be had.
+bool MakeAssetView(AAsset* asset, CProtobufSerialization& ser);
+
+// Make ser a read-only mapping of the file at path, unmapped when the view is freed.
+// Returns false if the file can't be opened or mapped.
+bool MakeFileView(const std::string& path, CProtobufSerialization& ser);
+
+// Make a view refer to size bytes starting at offset in what it refers to now. Freeing it
+//  still releases everything that backed the original view.
+// Returns false if ser isn't a view or the range is out of bounds.
+bool NarrowView(CProtobufSerialization& ser, size_t offset, size_t size);
+
+// The number of views that have not yet been freed
+size_t NumSerializationViews();
+
+} // namespace tuningfork
@@ -0,0 +1,301 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "spool.h"
+#include "tuningfork_utils.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define LOG_TAG "TuningFork.Spool"
+#include "Log.h"
+
+namespace tuningfork {
+
+constexpr size_t Spool::kDefaultSize;
+constexpr size_t SpoolingBackend::kReplayBatchSize;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x50534654; // 'TFSP'
+constexpr uint32_t kVersion = 1;
+// The file header is padded to this size and records start after it
+constexpr size_t kHeaderSize = 64;
+constexpr size_t kAlignment = 8;
+
+// Precedes each record
+struct RecordHeader {
+    uint32_t length; // Of the payload
+    uint32_t crc; // Of the length and the payload
+};
+
+size_t AlignUp(size_t n) {
+    return (n + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+uint32_t RecordCrc(uint32_t length, const uint8_t* payload) {
+    uint32_t crc = Crc32(reinterpret_cast<const uint8_t*>(&length), sizeof(length));
+    return Crc32(payload, length, crc);
+}
+
+} // anonymous namespace
+
+struct Spool::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint64_t head; // Offset of the oldest record
+};
+
+Spool::Spool() : fd_(-1), base_(nullptr), size_(0), tail_(0), num_records_(0),
+                 num_evicted_(0), head_seq_(0), generation_(0) {}
+
+Spool::~Spool() {
+    Close();
+}
+
+bool Spool::Open(const std::string& path, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (base_ != nullptr) {
+        ALOGW("Spool is already open");
+        return false;
+    }
+    size = AlignUp(size);
+    if (size <= kHeaderSize + sizeof(RecordHeader)) {
+        ALOGW("Spool size %zu is too small", size);
+        return false;
+    }
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ == -1) {
+        ALOGW("Couldn't open spool file %s", path.c_str());
+        return false;
+    }
+    struct stat sb;
+    if (fstat(fd_, &sb) != 0 || static_cast<size_t>(sb.st_size) != size) {
+        // New file, or one we can't use: start again with zeros
+        if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, size) != 0) {
+            ALOGW("Couldn't size spool file %s", path.c_str());
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        ALOGW("Couldn't map spool file %s", path.c_str());
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    base_ = static_cast<uint8_t*>(p);
+    size_ = size;
+    num_evicted_ = 0;
+    auto header = GetHeader();
+    if (header->magic != kMagic || header->version != kVersion || header->size != size
+        || header->head < kHeaderSize || header->head >= size
+        || header->head % kAlignment != 0) {
+        memset(base_, 0, size_);
+        header->magic = kMagic;
+        header->version = kVersion;
+        header->size = size;
+        header->head = kHeaderSize;
+    }
+    Recover();
+    ALOGI("Opened spool %s with %zu records", path.c_str(), num_records_);
+    return true;
+}
+
+void Spool::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (base_ == nullptr)
+        return;
+    Sync();
+    munmap(base_, size_);
+    close(fd_);
+    base_ = nullptr;
+    fd_ = -1;
+    ++generation_;
+}
+
+Spool::Header* Spool::GetHeader() const {
+    static_assert(sizeof(Header) <= kHeaderSize, "Spool header too large");
+    return reinterpret_cast<Header*>(base_);
+}
+
+size_t Spool::RecordSizeAt(size_t offset) const {
+    if (offset + sizeof(RecordHeader) > size_)
+        return 0;
+    RecordHeader rh;
+    memcpy(&rh, base_ + offset, sizeof(rh));
+    if (rh.length == 0 || rh.length > size_ - offset - sizeof(RecordHeader))
+        return 0;
+    if (RecordCrc(rh.length, base_ + offset + sizeof(RecordHeader)) != rh.crc)
+        return 0;
+    return AlignUp(sizeof(RecordHeader) + rh.length);
+}
+
+void Spool::Recover() {
+    size_t offset = GetHeader()->head;
+    num_records_ = 0;
+    while (true) {
+        size_t n = RecordSizeAt(offset);
+        if (n == 0) break;
+        offset += n;
+        ++num_records_;
+    }
+    tail_ = offset;
+    // Anything after the last good record is a torn write: zero it so that appends can rely on
+    //  there being nothing valid after the tail.
+    memset(base_ + tail_, 0, size_ - tail_);
+    if (num_records_ == 0)
+        Compact();
+}
+
+void Spool::EvictOldest() {
+    auto header = GetHeader();
+    header->head += RecordSizeAt(header->head);
+    --num_records_;
+    ++num_evicted_;
+    ++head_seq_;
+}
+
+void Spool::Compact() {
+    auto header = GetHeader();
+    size_t used = tail_ - header->head;
+    if (header->head != kHeaderSize) {
+        // A crash while moving loses the records being moved but the CRCs make sure we
+        //  don't replay anything corrupt.
+        memmove(base_ + kHeaderSize, base_ + header->head, used);
+        header->head = kHeaderSize;
+        memset(base_ + kHeaderSize + used, 0, tail_ - kHeaderSize - used);
+    }
+    tail_ = kHeaderSize + used;
+}
+
+void Spool::Sync() {
+    // Not needed to survive process death, since the pages are shared, but it limits what is
+    //  lost if the device itself goes down.
+    msync(base_, size_, MS_ASYNC);
+}
+
+bool Spool::Append(const ProtobufSerialization& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (base_ == nullptr)
+        return false;
+    size_t n = AlignUp(sizeof(RecordHeader) + record.size());
+    if (record.empty() || n > size_ - kHeaderSize) {
+        ALOGW("Can't spool a record of %zu bytes", record.size());
+        return false;
+    }
+    auto header = GetHeader();
+    while (tail_ - header->head + n > size_ - kHeaderSize)
+        EvictOldest();
+    if (tail_ + n > size_)
+        Compact();
+    // Write the payload before the header that makes it valid
+    uint8_t* p = base_ + tail_;
+    memcpy(p + sizeof(RecordHeader), record.data(), record.size());
+    RecordHeader rh;
+    rh.length = record.size();
+    rh.crc = RecordCrc(rh.length, record.data());
+    memcpy(p, &rh, sizeof(rh));
+    tail_ += n;
+    ++num_records_;
+    Sync();
+    return true;
+}
+
+size_t Spool::Replay(const std::function<bool(const ProtobufSerialization&)>& f,
+                     size_t max_records) {
+    std::lock_guard<std::mutex> replay_lock(replay_mutex_);
+    // Copy the records out so that appends aren't held up while f runs
+    std::vector<ProtobufSerialization> records;
+    uint64_t first_seq;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (base_ == nullptr)
+            return 0;
+        first_seq = head_seq_;
+        generation = generation_;
+        size_t offset = GetHeader()->head;
+        for (size_t i = 0; i < max_records && i < num_records_; ++i) {
+            RecordHeader rh;
+            memcpy(&rh, base_ + offset, sizeof(rh));
+            const uint8_t* payload = base_ + offset + sizeof(RecordHeader);
+            records.emplace_back(payload, payload + rh.length);
+            offset += AlignUp(sizeof(RecordHeader) + rh.length);
+        }
+    }
+    size_t n_done = 0;
+    for (const auto& record : records) {
+        if (!f(record))
+            break;
+        ++n_done;
+    }
+    if (n_done == 0)
+        return 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (base_ == nullptr || generation != generation_)
+        return 0;
+    // Some of the records passed to f may have been evicted by appends in the meantime
+    size_t n_removed = 0;
+    auto header = GetHeader();
+    while (head_seq_ < first_seq + n_done && num_records_ > 0) {
+        header->head += RecordSizeAt(header->head);
+        --num_records_;
+        ++head_seq_;
+        ++n_removed;
+    }
+    if (num_records_ == 0)
+        Compact();
+    if (n_removed > 0)
+        Sync();
+    return n_removed;
+}
+
+size_t Spool::NumRecords() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_records_;
+}
+
+size_t Spool::NumEvicted() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_evicted_;
+}
+
+SpoolingBackend::~SpoolingBackend() {}
+
+TFErrorCode SpoolingBackend::Process(const ProtobufSerialization &evt_ser) {
+    TFErrorCode ret = backend_ ? backend_->Process(evt_ser) : TFERROR_NO_CLEARCUT;
+    if (ret != TFERROR_OK) {
+        if (spool_->Append(evt_ser))
+            ALOGI("Upload failed (%d): spooled %zu bytes", ret, evt_ser.size());
+        return ret;
+    }
+    size_t n = spool_->Replay([this](const ProtobufSerialization& record) {
+        return backend_->Process(record) == TFERROR_OK;
+    }, kReplayBatchSize);
+    if (n > 0)
+        ALOGI("Replayed %zu spooled uploads", n);
+    return ret;
+}
+
+} // namespace tuningfork
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork_internal.h"
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace tuningfork {
+
+// Persistent queue of serialized log events, kept in a single memory-mapped file of fixed size.
+// Records are appended after the last one and framed with their length and a CRC-32, so a
+//  record that was only partly written when the process died is detected and discarded,
+//  along with anything after it, when the file is next opened.
+// When a new record doesn't fit, the oldest records are evicted to make room.
+// All methods are thread-safe.
+class Spool {
+public:
+    static constexpr size_t kDefaultSize = 256 * 1024;
+
+    Spool();
+    ~Spool();
+
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    // Open or create the spool file. An existing file of a different size is recreated.
+    // Returns false if the file could not be opened or mapped.
+    bool Open(const std::string& path, size_t size = kDefaultSize);
+
+    void Close();
+
+    bool IsOpen() const { return base_ != nullptr; }
+
+    // Append a record, evicting the oldest ones if needed.
+    // Returns false if the spool is not open or the record is larger than the whole spool.
+    bool Append(const ProtobufSerialization& record);
+
+    // Pass up to max_records of the oldest records to f, in order. Each record for which f
+    //  returns true is removed; replay stops at the first one for which it returns false.
+    // f is called without the spool locked, so it can take its time without holding up
+    //  appends. Records evicted while f runs are not removed twice.
+    // Returns the number of records removed.
+    size_t Replay(const std::function<bool(const ProtobufSerialization&)>& f,
+                  size_t max_records);
+
+    size_t NumRecords() const;
+
+    // Records evicted to make room since the spool was opened
+    size_t NumEvicted() const;
+
+private:
+    struct Header;
+
+    Header* GetHeader() const;
+    // Scan forward from the head, validating records, and set the tail and record count
+    void Recover();
+    // Returns the size of the valid record at offset, including framing, or 0 if there is none
+    size_t RecordSizeAt(size_t offset) const;
+    void EvictOldest();
+    // Move the records to the start of the data area and zero what follows them
+    void Compact();
+    void Sync();
+
+    mutable std::mutex mutex_;
+    // Held for the whole of a replay, so that two replays don't pass the same records on
+    std::mutex replay_mutex_;
+    int fd_;
+    uint8_t* base_;
+    size_t size_;
+    size_t tail_;
+    size_t num_records_;
+    size_t num_evicted_;
+    // Count of records removed from the head since the spool was created, which is the
+    //  sequence number of the record at the head
+    uint64_t head_seq_;
+    // Bumped on each close, so that a replay that spans a close and reopen removes nothing
+    uint64_t generation_;
+};
+
+// Backend that passes events on to another backend, spooling those that couldn't be
+//  delivered. After each event that is delivered, a batch of spooled events is replayed.
+// If the wrapped backend is null, all events are spooled.
+class SpoolingBackend : public Backend {
+public:
+    static constexpr size_t kReplayBatchSize = 8;
+
+    SpoolingBackend(Backend* backend, Spool* spool) : backend_(backend), spool_(spool) {}
+    ~SpoolingBackend() override;
+
+    TFErrorCode Process(const ProtobufSerialization &evt_ser) override;
+
+private:
+    Backend* backend_;
+    Spool* spool_;
+};
+
+} // namespace tuningfork
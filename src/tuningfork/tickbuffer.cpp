@@ -0,0 +1,176 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tickbuffer.h"
+
+#define LOG_TAG "TuningFork"
+#include "Log.h"
+#include "Trace.h"
+
+namespace tuningfork {
+
+namespace {
+
+// How long the aggregator waits between drains while records are arriving.
+constexpr auto kDrainPeriod = std::chrono::milliseconds(20);
+// Upper bound on an idle wait, in case a wake-up from a recording thread was missed.
+constexpr auto kIdleTimeout = std::chrono::milliseconds(1000);
+
+std::atomic<uint64_t> s_next_aggregator_id(1);
+
+// Each thread holds the buffer it last registered, tagged with the aggregator that owns it,
+//  so that a re-initialized TuningFork never sees a stale buffer. The buffer is retired when
+//  it is replaced or the thread exits.
+struct ThreadBufferSlot {
+    uint64_t aggregator_id = 0;
+    std::shared_ptr<TickBuffer> buffer;
+    ~ThreadBufferSlot() {
+        if (buffer)
+            buffer->Retire();
+    }
+};
+thread_local ThreadBufferSlot s_thread_buffer;
+
+} // anonymous namespace
+
+constexpr size_t TickBuffer::kCapacity;
+
+TickAggregator::TickAggregator(const Sink& sink) : id_(s_next_aggregator_id++), sink_(sink),
+                                                  idle_(false), wake_(false), do_quit_(false) {
+    thread_ = std::thread([this] { Run(); });
+}
+
+TickAggregator::~TickAggregator() {
+    do_quit_ = true;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_cv_.notify_one();
+    }
+    if (thread_.joinable())
+        thread_.join();
+}
+
+TickBuffer* TickAggregator::GetOrCreateThreadBuffer() {
+    auto& slot = s_thread_buffer;
+    if (slot.aggregator_id != id_) {
+        if (slot.buffer)
+            slot.buffer->Retire();
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(std::make_shared<TickBuffer>());
+        slot.buffer = buffers_.back();
+        slot.aggregator_id = id_;
+    }
+    return slot.buffer.get();
+}
+
+void TickAggregator::Record(const TickRecord& r) {
+    auto buffer = GetOrCreateThreadBuffer();
+    buffer->Push(r);
+    // Pairs with the fence in Run so that either we see idle_ or the aggregator sees our record.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // The flags are set before taking the lock, so the aggregator either sees them when it
+    //  checks its wait predicate or is already waiting when we notify.
+    if (idle_.load(std::memory_order_relaxed) && idle_.exchange(false)) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_cv_.notify_one();
+    } else if (buffer->NeedsDrain() && !wake_.exchange(true)) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_cv_.notify_one();
+    }
+}
+
+void TickAggregator::Drain(const std::function<void()>& after_drain) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DrainLocked();
+    if (after_drain)
+        after_drain();
+}
+
+bool TickAggregator::TryDrain(const std::function<void()>& after_drain) {
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock())
+        return false;
+    DrainLocked();
+    if (after_drain)
+        after_drain();
+    return true;
+}
+
+size_t TickAggregator::DrainLocked() {
+    size_t n = 0;
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+        auto& b = *it;
+        // Checked first: a buffer retired before this drain has nothing more to come after it
+        bool retired = b->Retired();
+        n += b->Drain(sink_);
+        auto dropped = b->TakeDropped();
+        if (dropped > 0)
+            ALOGW("Dropped %zu frame ticks: tick buffer full", dropped);
+        if (retired)
+            it = buffers_.erase(it);
+        else
+            ++it;
+    }
+    return n;
+}
+
+size_t TickAggregator::NumBuffers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffers_.size();
+}
+
+bool TickAggregator::AnyPending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& b: buffers_) {
+        if (!b->Empty()) return true;
+    }
+    return false;
+}
+
+void TickAggregator::Run() {
+    auto trace = gamesdk::Trace::create();
+    while (!do_quit_) {
+        size_t n;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            trace->beginSection("TFAggregate");
+            n = DrainLocked();
+            trace->endSection();
+        }
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        if (n == 0) {
+            // Nothing came in: sleep until a recording thread wakes us.
+            idle_ = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!AnyPending()) {
+                wake_cv_.wait_for(lock, kIdleTimeout, [this] {
+                    return do_quit_ || !idle_;
+                });
+            }
+            idle_ = false;
+        } else {
+            // Batch up records from the next few frames rather than waking for every tick.
+            wake_cv_.wait_for(lock, kDrainPeriod, [this] {
+                return do_quit_ || wake_;
+            });
+            wake_ = false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    DrainLocked();
+}
+
+} // namespace tuningfork
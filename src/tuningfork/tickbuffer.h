@@ -0,0 +1,162 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork_internal.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tuningfork {
+
+// A single timing event recorded on a caller's thread.
+struct TickRecord {
+    enum Type : uint32_t {
+        TICK = 0,  // A frame tick at time_ns
+        DELTA = 1, // A duration of delta_ns, reported at time_ns
+    };
+    uint64_t compound_id;
+    int64_t time_ns; // Since the steady clock epoch
+    int64_t delta_ns;
+    Type type;
+};
+
+// Single-producer, single-consumer ring of TickRecords.
+// The producer is the thread that owns the buffer and the consumer is whoever holds the
+//  TickAggregator's drain lock. Push never blocks: if the ring is full, the record is dropped
+//  and counted.
+class TickBuffer {
+public:
+    static constexpr size_t kCapacity = 1024; // Must be a power of 2
+
+    // Producer side
+    bool Push(const TickRecord& r) {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto tail = tail_.load(std::memory_order_acquire);
+        if (head - tail >= kCapacity) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        records_[head & (kCapacity - 1)] = r;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // True if more than half the ring is in use
+    bool NeedsDrain() const {
+        return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed)
+            > kCapacity / 2;
+    }
+
+    // Consumer side
+    template<typename F>
+    size_t Drain(F&& f) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+        for (auto i = tail; i != head; ++i) {
+            f(records_[i & (kCapacity - 1)]);
+        }
+        tail_.store(head, std::memory_order_release);
+        return head - tail;
+    }
+
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+    }
+
+    size_t TakeDropped() {
+        return dropped_.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Called by the producer when it will push no more, e.g. because its thread is exiting
+    void Retire() {
+        retired_.store(true, std::memory_order_release);
+    }
+
+    // Once true, everything pushed is visible to the consumer
+    bool Retired() const {
+        return retired_.load(std::memory_order_acquire);
+    }
+
+private:
+    // Keep the producer and consumer indices on separate cache lines
+    static constexpr size_t kCacheLineSize = 64;
+    std::atomic<size_t> head_{0};
+    char pad0_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_{0};
+    char pad1_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dropped_{0};
+    std::atomic<bool> retired_{false};
+    TickRecord records_[kCapacity];
+};
+
+// Owns one TickBuffer per recording thread and a thread that folds them into a sink.
+// Record() is wait-free on the caller's thread apart from the first call on each new thread,
+//  which registers that thread's buffer, and the call that wakes the aggregator.
+// A thread's buffer is retired when the thread exits, and freed after it has been drained for
+//  the last time, so short-lived threads don't each leave a buffer behind.
+class TickAggregator {
+public:
+    typedef std::function<void(const TickRecord&)> Sink;
+
+    explicit TickAggregator(const Sink& sink);
+
+    ~TickAggregator();
+
+    // Called on the recording thread.
+    void Record(const TickRecord& r);
+
+    // Drain all buffers into the sink, then call after_drain while the drain lock is still
+    //  held, so that no records are folded in concurrently with it.
+    void Drain(const std::function<void()>& after_drain = nullptr);
+
+    // As Drain, but returns false without draining if another thread holds the drain lock.
+    // For use from a signal handler, which mustn't wait for a lock the interrupted thread may
+    //  hold.
+    bool TryDrain(const std::function<void()>& after_drain = nullptr);
+
+    // Buffers registered and not yet freed
+    size_t NumBuffers();
+
+private:
+    void Run();
+
+    size_t DrainLocked();
+
+    bool AnyPending();
+
+    TickBuffer* GetOrCreateThreadBuffer();
+
+    const uint64_t id_;
+    Sink sink_;
+    std::mutex mutex_; // Guards buffers_ and calls to sink_
+    // Shared with the recording thread, which may outlive the aggregator
+    std::vector<std::shared_ptr<TickBuffer>> buffers_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<bool> idle_;
+    std::atomic<bool> wake_;
+    std::atomic<bool> do_quit_;
+    std::thread thread_;
+};
+
+} // namespace tuningfork
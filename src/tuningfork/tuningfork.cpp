@@ -23,6 +23,8 @@
 #include <chrono>
 #include <sstream>
 #include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 #define LOG_TAG "TuningFork"
 #include "Log.h"
@@ -34,35 +36,39 @@
 #include "clearcutserializer.h"
 #include "clearcut_backend.h"
 #include "annotation_util.h"
+#include "annotation_index.h"
 #include "crash_handler.h"
-
-/* Annotations come into tuning fork as a serialized protobuf. The protobuf can only have
- * enums in it. We form an integer annotation id from the annotation interpreted as a mixed-radix
- * number. E.g. say we have the following in the proto:
+#include "tickbuffer.h"
+#include "instrument_key_index.h"
+#include "spool.h"
+#include "tuningfork_utils.h"
+
+/* Annotations come into tuning fork as a serialized protobuf. Enum fields are checked against
+ * the annotation_enum_size settings; other fields are taken as they are. Each distinct
+ * annotation is given an integer annotation index, in order of first use, by the
+ * AnnotationIndex. E.g. say we have the following in the proto:
  * enum A { A_1 = 1, A_2 = 2, A_3 = 3};
  * enum B { B_1 = 1, B_2 = 2};
- * enum C { C_1 = 1};
- * message Annotation { optional A a = 1; optional B b = 2; optional C c = 3};
+ * message Annotation { optional A a = 1; optional B b = 2; optional int32 c = 3};
  * Then a serialization of 'b : B_1' might be:
- * 0x16 0x01
+ * 0x10 0x01
  * https://developers.google.com/protocol-buffers/docs/encoding
  * Note the shift of 3 bits for the key.
  *
- * Assume we have 2 possible instrumentation keys: NUM_IKEY = 2
+ * The empty annotation always has index 0. If 'b : B_1' is the first annotation set after
+ * that, it gets index 1, and 'a : A_2, c : 1000' set next gets index 2, and so on.
  *
- * The annotation id then is (0 + 1*4 + 0)*NUM_IKEY = 8, where the factor of 4 comes from the radix
- * associated with 'a', i.e. 3 values for enum A + option missing
+ * Assume we have 2 possible instrumentation keys: NUM_IKEY = 2
  *
- * A compound id is formed from the annotation id and the instrument key:
- * compound_id = annotation_id + instrument_key;
+ * The annotation id is the index times NUM_IKEY, so 'b : B_1' has annotation id 2.
  *
- * So for instrument key 1, the compound_id with the above annotation is 9
+ * A compound id is formed from the annotation id and the instrument key index:
+ * compound_id = annotation_id + instrument_key_index;
  *
- * This compound_id is used to look up a histogram in the ProngCache.
+ * So for instrument key index 1, the compound_id with the above annotation is 3
  *
- * annotation_radix_mult_ stores the multiplied radixes, so for the above, it is:
- * [4 4*3 4*3*2] = [4 12 24]
- * and the maximum number of annotations is 24
+ * This compound_id is used to look up a histogram in the ProngCache, which only allocates
+ * prongs for the compound ids that are used.
  *
  * */
 
@@ -77,26 +83,46 @@ public:
     }
 };
 
+inline int64_t ToNs(Duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
 std::unique_ptr<MonoTimeProvider> s_mono_time_provider = std::make_unique<MonoTimeProvider>();
 
+// Bumped each time TuningFork is initialized, which invalidates annotation handles
+std::atomic<uint64_t> s_init_generation(0);
+
+// Set by SetThreadAnnotation, along with the init generation it was set in. It isn't reset when
+//  TuningFork is initialized again, so a handle from an earlier generation is ignored.
+struct ThreadAnnotation {
+    TFAnnotationHandle handle;
+    uint64_t generation;
+};
+thread_local ThreadAnnotation t_thread_annotation = {TFANNOTATION_HANDLE_NONE, 0};
+
 class TuningForkImpl {
 private:
     CrashHandler crash_handler_;
     Settings settings_;
-    std::unique_ptr<ProngCache> prong_caches_[2];
-    ProngCache *current_prong_cache_;
+    std::unique_ptr<SessionCache> session_cache_;
+    std::unique_ptr<ProngCacheRing> prong_caches_;
     TimePoint last_submit_time_ns_;
     std::unique_ptr<gamesdk::Trace> trace_;
-    std::vector<TimePoint> live_traces_;
+    // Start times of traces in progress, keyed on trace handle
+    std::unordered_map<TraceHandle, TimePoint> live_traces_;
+    std::mutex live_traces_mutex_;
     Backend *backend_;
     ParamsLoader *loader_;
     UploadThread upload_thread_;
-    SerializedAnnotation current_annotation_;
-    std::vector<uint32_t> annotation_radix_mult_;
-    AnnotationId current_annotation_id_;
+    std::unique_ptr<AnnotationIndex> annotation_index_;
+    // Written by any thread setting the annotation and read by any thread ticking
+    std::atomic<AnnotationId> current_annotation_id_;
     ITimeProvider *time_provider_;
-    std::vector<InstrumentationKey> ikeys_;
-    std::atomic<int> next_ikey_;
+    InstrumentKeyIndex ikey_index_;
+    // Distinguishes this instance's thread annotations from those set before a re-init
+    const uint64_t generation_;
+    // Declared last so that it is stopped before anything its sink touches is destroyed.
+    std::unique_ptr<TickAggregator> aggregator_;
 public:
     TuningForkImpl(const Settings& settings,
                    const ExtraUploadInfo& extra_upload_info,
@@ -106,38 +132,45 @@ public:
                                 trace_(gamesdk::Trace::create()),
                                 backend_(backend),
                                 loader_(loader),
-                                upload_thread_(backend, extra_upload_info),
+                                upload_thread_(backend, extra_upload_info,
+                                    [this](const ProngCache* pc) {
+                                        prong_caches_->Release(pc); }),
                                 current_annotation_id_(0),
                                 time_provider_(time_provider),
-                                ikeys_(settings.aggregation_strategy.max_instrumentation_keys),
-                                next_ikey_(0) {
+                                ikey_index_(settings.aggregation_strategy.max_instrumentation_keys),
+                                generation_(++s_init_generation) {
         if (time_provider_ == nullptr) {
             time_provider_ = s_mono_time_provider.get();
         }
         last_submit_time_ns_ = time_provider_->NowNs();
 
         InitHistogramSettings();
-        InitAnnotationRadixes();
+        InitAnnotationIndex();
 
         size_t max_num_prongs_ = 0;
         int max_ikeys = settings.aggregation_strategy.max_instrumentation_keys;
 
-        if (annotation_radix_mult_.size() == 0 || max_ikeys == 0)
-            ALOGE("Neither max_annotations nor max_instrumentation_keys can be zero");
+        if (max_ikeys == 0)
+            ALOGE("max_instrumentation_keys can't be zero");
         else
-            max_num_prongs_ = max_ikeys * annotation_radix_mult_.back();
+            max_num_prongs_ = max_ikeys * annotation_index_->MaxSize();
         auto serializeId = [this](uint64_t id) { return SerializeAnnotationId(id); };
-        prong_caches_[0] = std::make_unique<ProngCache>(max_num_prongs_, max_ikeys,
-                                                        settings_.histograms, serializeId);
-        prong_caches_[1] = std::make_unique<ProngCache>(max_num_prongs_, max_ikeys,
-                                                        settings_.histograms, serializeId);
-        current_prong_cache_ = prong_caches_[0].get();
-        live_traces_.resize(max_num_prongs_);
-        for (auto &t: live_traces_) t = TimePoint::min();
+        auto& strategy = settings_.aggregation_strategy;
+        auto make_cache = [&]() {
+            return std::make_unique<ProngCache>(max_num_prongs_, max_ikeys,
+                                                settings_.histograms, serializeId);
+        };
+        session_cache_ = std::make_unique<SessionCache>(make_cache);
+        prong_caches_ = std::make_unique<ProngCacheRing>(
+            strategy.n_windows == 0 ? 2 : strategy.n_windows, strategy.full_window_policy,
+            make_cache,
+            [this](const ProngCache& pc) { session_cache_->Merge(pc); });
+        aggregator_ = std::make_unique<TickAggregator>(
+            [this](const TickRecord& r) { Aggregate(r); });
         auto crash_callback = [this]()->bool {
             std::stringstream ss;
             ss << std::this_thread::get_id();
-            TFErrorCode ret = this->Flush();
+            TFErrorCode ret = this->CrashFlush();
             ALOGI("Flush result : %d", ret);
             return true;
         };
@@ -150,7 +183,7 @@ public:
 
     void InitHistogramSettings();
 
-    void InitAnnotationRadixes();
+    void InitAnnotationIndex();
 
     // Returns true if the fidelity params were retrieved
     TFErrorCode GetFidelityParameters(JNIEnv* env, jobject context,
@@ -159,9 +192,31 @@ public:
                                const ProtobufSerialization& defaultParams,
                                ProtobufSerialization &fidelityParams, uint32_t timeout_ms);
 
+    void SetFidelityParameters(const ProtobufSerialization& params,
+                               const std::string& experiment_id) {
+        upload_thread_.SetCurrentFidelityParams(params, experiment_id);
+    }
+
     // Returns the set annotation id or -1 if it could not be set
     uint64_t SetCurrentAnnotation(const ProtobufSerialization &annotation);
 
+    // Handles are annotation ids, so registering is just decoding
+    TFErrorCode RegisterAnnotation(const ProtobufSerialization &annotation,
+                                   TFAnnotationHandle& handle);
+
+    TFErrorCode SetCurrentAnnotation(TFAnnotationHandle handle) {
+        if (!IsValidAnnotationId(handle)) return TFERROR_INVALID_ANNOTATION;
+        current_annotation_id_.store(handle, std::memory_order_relaxed);
+        return TFERROR_OK;
+    }
+
+    TFErrorCode SetThreadAnnotation(TFAnnotationHandle handle) {
+        if (handle != TFANNOTATION_HANDLE_NONE && !IsValidAnnotationId(handle))
+            return TFERROR_INVALID_ANNOTATION;
+        t_thread_annotation = {handle, generation_};
+        return TFERROR_OK;
+    }
+
     TFErrorCode FrameTick(InstrumentationKey id);
 
     TFErrorCode FrameDeltaTimeNanos(InstrumentationKey id, Duration dt);
@@ -175,9 +230,21 @@ public:
 
     TFErrorCode Flush();
 
-    TFErrorCode Flush(TimePoint t_ns);
+    SessionCache& GetSessionCache() { return *session_cache_; }
 
 private:
+    // Flush from the crash handler, skipped if the aggregator is mid-drain
+    TFErrorCode CrashFlush();
+
+    // Must be called with the aggregator's drain lock held
+    TFErrorCode FlushIfDue(TimePoint t_ns);
+
+    // Must be called with the aggregator's drain lock held
+    TFErrorCode Flush(TimePoint t_ns);
+
+    // Called on the aggregator thread for each record, or under its drain lock in Flush
+    void Aggregate(const TickRecord& r);
+
     Prong *TickNanos(uint64_t compound_id, TimePoint t);
 
     Prong *TraceNanos(uint64_t compound_id, Duration dt);
@@ -188,6 +255,21 @@ private:
 
     AnnotationId DecodeAnnotationSerialization(const SerializedAnnotation &ser);
 
+    bool IsValidAnnotationId(AnnotationId id) const {
+        auto max_ikeys = settings_.aggregation_strategy.max_instrumentation_keys;
+        return max_ikeys > 0 && id % max_ikeys == 0 && id / max_ikeys < annotation_index_->Size();
+    }
+
+    // The calling thread's annotation if it has a valid one from this generation, else the
+    //  current annotation
+    AnnotationId CurrentAnnotationId() const {
+        const ThreadAnnotation& t = t_thread_annotation;
+        if (t.handle != TFANNOTATION_HANDLE_NONE && t.generation == generation_
+            && IsValidAnnotationId(t.handle))
+            return t.handle;
+        return current_annotation_id_.load(std::memory_order_relaxed);
+    }
+
     uint32_t GetInstrumentationKey(uint64_t compoundId) {
         return compoundId % settings_.aggregation_strategy.max_instrumentation_keys;
     }
@@ -204,7 +286,9 @@ private:
 
     bool keyIsValid(InstrumentationKey key) const;
 
-    TFErrorCode GetOrCreateInstrumentKeyIndex(InstrumentationKey key, int& index);
+    TFErrorCode GetOrCreateInstrumentKeyIndex(InstrumentationKey key, int& index) {
+        return ikey_index_.GetOrCreate(key, index);
+    }
 
 };
 
@@ -220,6 +304,10 @@ void CopySettings(const TFSettings &c_settings, Settings &settings) {
                  Settings::AggregationStrategy::TIME_BASED;
     a.annotation_enum_size = std::vector<uint32_t>(ca.annotation_enum_size,
                                         ca.annotation_enum_size + ca.n_annotation_enum_size);
+    a.n_windows = ca.n_windows;
+    a.full_window_policy = ca.full_window_policy==TFAggregationStrategy::DROP_WINDOW?
+                 Settings::AggregationStrategy::DROP_WINDOW:
+                 Settings::AggregationStrategy::MERGE_WINDOW;
     settings.histograms = std::vector<TFHistogram>(c_settings.histograms,
                                         c_settings.histograms + c_settings.n_histograms);
 }
@@ -239,6 +327,18 @@ TFErrorCode Init(const TFSettings &c_settings,
 ClearcutBackend sBackend;
 ProtoPrint sProtoPrint;
 ParamsLoader sLoader;
+Spool sSpool;
+std::unique_ptr<SpoolingBackend> sSpoolingBackend;
+
+// The spool lives alongside the saved fidelity params, but isn't specific to an APK version
+bool OpenSpool(JNIEnv* env, jobject context) {
+    if (sSpool.IsOpen())
+        return true;
+    std::string dir = file_utils::GetAppCacheDir(env, context) + "/tuningfork";
+    if (!file_utils::CheckAndCreateDir(dir))
+        return false;
+    return sSpool.Open(dir + "/upload_spool.bin");
+}
 
 TFErrorCode Init(const TFSettings &c_settings, JNIEnv* env, jobject context) {
     bool backendInited = sBackend.Init(env, context, &sProtoPrint)==TFERROR_OK;
@@ -254,6 +354,16 @@ TFErrorCode Init(const TFSettings &c_settings, JNIEnv* env, jobject context) {
     else {
         ALOGV("TuningFork.Clearcut: FAILED");
     }
+    // The upload thread of any previous instance may still be sending through the spooling
+    //  backend, so stop it before the backend is replaced.
+    s_impl.reset();
+    sSpoolingBackend.reset();
+    // Keep uploads to Clearcut that fail and send them after a later successful upload.
+    // Without Clearcut, the null backend is left for the upload thread to log events instead.
+    if (backend != nullptr && OpenSpool(env, context)) {
+        sSpoolingBackend = std::make_unique<SpoolingBackend>(backend, &sSpool);
+        backend = sSpoolingBackend.get();
+    }
     return Init(c_settings, extra_upload_info, backend, loader);
 }
 
@@ -270,6 +380,16 @@ TFErrorCode GetFidelityParameters(JNIEnv* env, jobject context,
     }
 }
 
+TFErrorCode SetFidelityParameters(const ProtobufSerialization& params,
+                                  const std::string& experiment_id) {
+    if (!s_impl) {
+        return TFERROR_TUNINGFORK_NOT_INITIALIZED;
+    } else {
+        s_impl->SetFidelityParameters(params, experiment_id);
+        return TFERROR_OK;
+    }
+}
+
 TFErrorCode FrameTick(InstrumentationKey id) {
     if (!s_impl) {
         return TFERROR_TUNINGFORK_NOT_INITIALIZED;
@@ -331,9 +451,53 @@ TFErrorCode Flush() {
     }
 }
 
+TFErrorCode GetSessionHistograms(TFSessionHistograms& histograms) {
+    if (!s_impl) {
+        return TFERROR_TUNINGFORK_NOT_INITIALIZED;
+    } else {
+        s_impl->GetSessionCache().Acquire(histograms);
+        return TFERROR_OK;
+    }
+}
+
+TFErrorCode ReleaseSessionHistograms(TFSessionHistograms& histograms) {
+    if (!s_impl) {
+        return TFERROR_TUNINGFORK_NOT_INITIALIZED;
+    } else {
+        if (!s_impl->GetSessionCache().Release(histograms))
+            return TFERROR_BAD_PARAMETER;
+        histograms = {};
+        return TFERROR_OK;
+    }
+}
+
+TFErrorCode RegisterAnnotation(const ProtobufSerialization &annotation,
+                               TFAnnotationHandle& handle) {
+    if (!s_impl) {
+        return TFERROR_TUNINGFORK_NOT_INITIALIZED;
+    } else {
+        return s_impl->RegisterAnnotation(annotation, handle);
+    }
+}
+
+TFErrorCode SetCurrentAnnotation(TFAnnotationHandle handle) {
+    if (!s_impl) {
+        return TFERROR_TUNINGFORK_NOT_INITIALIZED;
+    } else {
+        return s_impl->SetCurrentAnnotation(handle);
+    }
+}
+
+TFErrorCode SetThreadAnnotation(TFAnnotationHandle handle) {
+    if (!s_impl) {
+        return TFERROR_TUNINGFORK_NOT_INITIALIZED;
+    } else {
+        return s_impl->SetThreadAnnotation(handle);
+    }
+}
+
 // Return the set annotation id or -1 if it could not be set
 uint64_t TuningForkImpl::SetCurrentAnnotation(const ProtobufSerialization &annotation) {
-    current_annotation_ = annotation;
     auto id = DecodeAnnotationSerialization(annotation);
     if (id == annotation_util::kAnnotationError) {
         ALOGW("Error setting annotation of size %zu", annotation.size());
@@ -343,21 +507,33 @@ uint64_t TuningForkImpl::SetCurrentAnnotation(const ProtobufSerialization &annot
     else {
         ALOGV("Set annotation id to %" PRIu64, id);
         current_annotation_id_ = id;
-        return current_annotation_id_;
+        return id;
+    }
+}
+
+TFErrorCode TuningForkImpl::RegisterAnnotation(const ProtobufSerialization &annotation,
+                                               TFAnnotationHandle& handle) {
+    auto id = DecodeAnnotationSerialization(annotation);
+    if (id == annotation_util::kAnnotationError) {
+        ALOGW("Can't register annotation of size %zu", annotation.size());
+        handle = TFANNOTATION_HANDLE_NONE;
+        return TFERROR_INVALID_ANNOTATION;
     }
+    handle = id;
+    return TFERROR_OK;
 }
 
 AnnotationId TuningForkImpl::DecodeAnnotationSerialization(const SerializedAnnotation &ser) {
-    auto id = annotation_util::DecodeAnnotationSerialization(ser, annotation_radix_mult_);
+    auto id = annotation_index_->GetOrCreate(ser);
+    if (id == annotation_util::kAnnotationError)
+        return id;
      // Shift over to leave room for the instrument id
     return id * settings_.aggregation_strategy.max_instrumentation_keys;
 }
 
 SerializedAnnotation TuningForkImpl::SerializeAnnotationId(AnnotationId id) {
-    SerializedAnnotation ann;
     AnnotationId a = id / settings_.aggregation_strategy.max_instrumentation_keys;
-    annotation_util::SerializeAnnotationId(a, ann, annotation_radix_mult_);
-    return ann;
+    return annotation_index_->Serialize(a);
 }
 
 TFErrorCode TuningForkImpl::GetFidelityParameters(JNIEnv* env, jobject context,
@@ -376,75 +552,65 @@ TFErrorCode TuningForkImpl::GetFidelityParameters(JNIEnv* env, jobject context,
     else
         return TFERROR_TUNINGFORK_NOT_INITIALIZED;
 }
-TFErrorCode TuningForkImpl::GetOrCreateInstrumentKeyIndex(InstrumentationKey key, int& index) {
-    int nkeys = next_ikey_;
-    for (int i=0; i<nkeys; ++i) {
-        if (ikeys_[i] == key) {
-            index = i;
-            return TFERROR_OK;
-        }
-    }
-    // Another thread could have incremented next_ikey while we were checking, but we
-    //  mandate that different threads not use the same key, so we are OK adding
-    //  our key, if we can.
-    int next = next_ikey_++;
-    if (next<ikeys_.size()) {
-        ikeys_[next] = key;
-        index = next;
-        return TFERROR_OK;
-    }
-    else {
-        next_ikey_--;
-    }
-    return TFERROR_INVALID_INSTRUMENT_KEY;
-}
 TFErrorCode TuningForkImpl::StartTrace(InstrumentationKey key, TraceHandle& handle) {
-    auto err = MakeCompoundId(key, current_annotation_id_, handle);
+    auto err = MakeCompoundId(key, CurrentAnnotationId(), handle);
     if (err!=TFERROR_OK) return err;
     trace_->beginSection("TFTrace");
-    live_traces_[handle] = time_provider_->NowNs();
+    auto t = time_provider_->NowNs();
+    std::lock_guard<std::mutex> lock(live_traces_mutex_);
+    live_traces_[handle] = t;
     return TFERROR_OK;
 }
 
 TFErrorCode TuningForkImpl::EndTrace(TraceHandle h) {
-    if (h>=live_traces_.size()) return TFERROR_INVALID_TRACE_HANDLE;
-    auto i = live_traces_[h];
-    if (i != TimePoint::min()) {
-        trace_->endSection();
-        TraceNanos(h, time_provider_->NowNs() - i);
-        live_traces_[h] = TimePoint::min();
-        return TFERROR_OK;
-    } else {
-        return TFERROR_INVALID_TRACE_HANDLE;
+    TimePoint start;
+    {
+        std::lock_guard<std::mutex> lock(live_traces_mutex_);
+        auto it = live_traces_.find(h);
+        if (it == live_traces_.end())
+            return TFERROR_INVALID_TRACE_HANDLE;
+        start = it->second;
+        live_traces_.erase(it);
     }
+    trace_->endSection();
+    auto t = time_provider_->NowNs();
+    aggregator_->Record({h, ToNs(t.time_since_epoch()), ToNs(t - start), TickRecord::DELTA});
+    return TFERROR_OK;
 }
 
 TFErrorCode TuningForkImpl::FrameTick(InstrumentationKey key) {
     uint64_t compound_id;
-    auto err = MakeCompoundId(key, current_annotation_id_, compound_id);
+    auto err = MakeCompoundId(key, CurrentAnnotationId(), compound_id);
     if (err!=TFERROR_OK) return err;
-    trace_->beginSection("TFTick");
-    auto t = time_provider_->NowNs();
-    auto p = TickNanos(compound_id, t);
-    if (p)
-        CheckForSubmit(t, p);
-    trace_->endSection();
+    aggregator_->Record({compound_id, ToNs(time_provider_->NowNs().time_since_epoch()), 0,
+                         TickRecord::TICK});
     return TFERROR_OK;
 }
 
 TFErrorCode TuningForkImpl::FrameDeltaTimeNanos(InstrumentationKey key, Duration dt) {
     uint64_t compound_id;
-    auto err = MakeCompoundId(key, current_annotation_id_, compound_id);
+    auto err = MakeCompoundId(key, CurrentAnnotationId(), compound_id);
     if (err!=TFERROR_OK) return err;
-    auto p = TraceNanos(compound_id, dt);
-    if (p)
-        CheckForSubmit(time_provider_->NowNs(), p);
+    aggregator_->Record({compound_id, ToNs(time_provider_->NowNs().time_since_epoch()),
+                         ToNs(dt), TickRecord::DELTA});
     return TFERROR_OK;
 }
 
+void TuningForkImpl::Aggregate(const TickRecord& r) {
+    TimePoint t(std::chrono::duration_cast<Duration>(std::chrono::nanoseconds(r.time_ns)));
+    Prong* p;
+    if (r.type == TickRecord::TICK) {
+        p = TickNanos(r.compound_id, t);
+    } else {
+        p = TraceNanos(r.compound_id, std::chrono::nanoseconds(r.delta_ns));
+    }
+    if (p)
+        CheckForSubmit(t, p);
+}
+
 Prong *TuningForkImpl::TickNanos(uint64_t compound_id, TimePoint t) {
     // Find the appropriate histogram and add this time
-    Prong *p = current_prong_cache_->Get(compound_id);
+    Prong *p = prong_caches_->Current()->Get(compound_id);
     if (p)
         p->Tick(t);
     else
@@ -454,7 +620,7 @@ Prong *TuningForkImpl::TickNanos(uint64_t compound_id, TimePoint t) {
 
 Prong *TuningForkImpl::TraceNanos(uint64_t compound_id, Duration dt) {
     // Find the appropriate histogram and add this time
-    Prong *h = current_prong_cache_->Get(compound_id);
+    Prong *h = prong_caches_->Current()->Get(compound_id);
     if (h)
         h->Trace(dt);
     else
@@ -495,6 +661,8 @@ void TuningForkImpl::InitHistogramSettings() {
     default_histogram.bucket_min = 10;
     default_histogram.bucket_max = 40;
     default_histogram.n_buckets = Histogram::kDefaultNumBuckets;
+    default_histogram.bucket_layout = TFBUCKETS_LINEAR;
+    default_histogram.frame_budget_ms = 0;
     for(uint32_t i=0; i<settings_.aggregation_strategy.max_instrumentation_keys; ++i) {
         if(settings_.histograms.size()<=i) {
             ALOGW("Couldn't get histogram for key index %d. Using default histogram", i);
@@ -508,42 +676,62 @@ void TuningForkImpl::InitHistogramSettings() {
     ALOGV("TFHistograms");
     for(uint32_t i=0; i< settings_.histograms.size(); ++i) {
         auto& h = settings_.histograms[i];
-        ALOGV("ikey: %d min: %f max: %f nbkts: %d", h.instrument_key, h.bucket_min, h.bucket_max,
-              h.n_buckets);
+        ALOGV("ikey: %d min: %f max: %f nbkts: %d layout: %d", h.instrument_key, h.bucket_min,
+              h.bucket_max, h.n_buckets, h.bucket_layout);
     }
 }
 
-void TuningForkImpl::InitAnnotationRadixes() {
-    annotation_util::SetUpAnnotationRadixes(annotation_radix_mult_,
-                                            settings_.aggregation_strategy.annotation_enum_size);
+void TuningForkImpl::InitAnnotationIndex() {
+    ALOGV("Settings::annotation_enum_size");
+    for (auto size: settings_.aggregation_strategy.annotation_enum_size)
+        ALOGV("%u", size);
+    annotation_index_ = std::make_unique<AnnotationIndex>(
+        settings_.aggregation_strategy.annotation_enum_size,
+        settings_.aggregation_strategy.max_instrumentation_keys);
 }
 
 TFErrorCode TuningForkImpl::Flush() {
     auto t = time_provider_->NowNs();
+    TFErrorCode ret_code = TFERROR_OK;
+    // Fold in everything recorded so far before deciding whether to submit
+    aggregator_->Drain([&] { ret_code = FlushIfDue(t); });
+    return ret_code;
+}
+
+TFErrorCode TuningForkImpl::CrashFlush() {
+    auto t = time_provider_->NowNs();
+    TFErrorCode ret_code = TFERROR_OK;
+    // The crashing thread may be the one holding the drain lock, so don't wait for it. Losing
+    //  the last window is better than hanging in the signal handler.
+    if (!aggregator_->TryDrain([&] { ret_code = FlushIfDue(t); })) {
+        ALOGW("Skipping flush on crash: tick aggregator busy");
+        return TFERROR_PREVIOUS_UPLOAD_PENDING;
+    }
+    return ret_code;
+}
+
+TFErrorCode TuningForkImpl::FlushIfDue(TimePoint t_ns) {
     // Only allow manual submission a maximum of once per minute
-    auto dt = t - last_submit_time_ns_;
+    auto dt = t_ns - last_submit_time_ns_;
     if (dt > std::chrono::seconds(60))
-        return Flush(t);
-    else
-        return TFERROR_UPLOAD_TOO_FREQUENT;
+        return Flush(t_ns);
+    return TFERROR_UPLOAD_TOO_FREQUENT;
 }
 
 TFErrorCode TuningForkImpl::Flush(TimePoint t_ns) {
-    TFErrorCode ret_code;
-    current_prong_cache_->SetInstrumentKeys(ikeys_);
-    if (upload_thread_.Submit(current_prong_cache_)) {
-        if (current_prong_cache_ == prong_caches_[0].get()) {
-            prong_caches_[1]->Clear();
-            current_prong_cache_ = prong_caches_[1].get();
-        } else {
-            prong_caches_[0]->Clear();
-            current_prong_cache_ = prong_caches_[0].get();
-        }
-        ret_code = TFERROR_OK;
-    } else {
+    TFErrorCode ret_code = TFERROR_OK;
+    prong_caches_->Current()->SetInstrumentKeys(ikey_index_.Keys());
+    auto epoch = prong_caches_->Current()->Epoch();
+    auto closed = prong_caches_->Rotate();
+    if (closed != nullptr) {
+        if (!upload_thread_.Submit(closed))
+            prong_caches_->Release(closed);
+    } else
         ret_code = TFERROR_PREVIOUS_UPLOAD_PENDING;
-    }
-    last_submit_time_ns_ = t_ns;
+    // Unless the ring was full and the current window is being extended, the next window
+    //  starts now, whether the current one was queued or dropped.
+    if (prong_caches_->Current()->Epoch() != epoch)
+        last_submit_time_ns_ = t_ns;
     return ret_code;
 }
 
@@ -80,6 +80,30 @@ TFErrorCode TuningFork_setCurrentAnnotation(const CProtobufSerialization *annota
         return TFERROR_INVALID_ANNOTATION;
 }
 
+TFErrorCode TuningFork_registerAnnotations(const CProtobufSerialization* annotations,
+                                           uint32_t n_annotations, TFAnnotationHandle* handles) {
+    if (n_annotations > 0 && (annotations==nullptr || handles==nullptr))
+        return TFERROR_BAD_PARAMETER;
+    TFErrorCode result = TFERROR_OK;
+    for (uint32_t i=0; i<n_annotations; ++i) {
+        auto err = tuningfork::RegisterAnnotation(ToProtobufSerialization(annotations[i]),
+                                                  handles[i]);
+        if (err==TFERROR_TUNINGFORK_NOT_INITIALIZED)
+            return err;
+        if (err!=TFERROR_OK)
+            result = err;
+    }
+    return result;
+}
+
+TFErrorCode TuningFork_setCurrentAnnotationHandle(TFAnnotationHandle handle) {
+    return tuningfork::SetCurrentAnnotation(handle);
+}
+
+TFErrorCode TuningFork_setThreadAnnotationHandle(TFAnnotationHandle handle) {
+    return tuningfork::SetThreadAnnotation(handle);
+}
+
 // Record a frame tick that will be associated with the instrumentation key and the current
 //   annotation
 TFErrorCode TuningFork_frameTick(TFInstrumentKey id) {
@@ -106,6 +130,16 @@ TFErrorCode TuningFork_flush() {
     return tuningfork::Flush();
 }
 
+TFErrorCode TuningFork_getSessionHistograms(TFSessionHistograms* histograms) {
+    if (histograms==nullptr) return TFERROR_BAD_PARAMETER;
+    return tuningfork::GetSessionHistograms(*histograms);
+}
+
+TFErrorCode TuningFork_releaseSessionHistograms(TFSessionHistograms* histograms) {
+    if (histograms==nullptr) return TFERROR_BAD_PARAMETER;
+    return tuningfork::ReleaseSessionHistograms(*histograms);
+}
+
 void TUNINGFORK_VERSION_SYMBOL() {
     // Intentionally empty: this function is used to ensure that the proper
     // version of the library is linked against the proper headers.
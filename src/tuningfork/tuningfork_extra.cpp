@@ -3,7 +3,13 @@
 #include "tuningfork/protobuf_util.h"
 #include "tuningfork_internal.h"
 #include "tuningfork_utils.h"
+#include "annotation_util.h"
+#include "serialization_view.h"
+#include "fpdownload.h"
+#include "fp_cache.h"
+#include "uploadthread.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <dlfcn.h>
 #include <memory>
@@ -11,7 +17,6 @@
 #include <cstdlib>
 #include <sstream>
 #include <thread>
-#include <fstream>
 #include <mutex>
 #include <chrono>
 
@@ -117,24 +122,9 @@ bool GetSettingsSerialization(JNIEnv* env, jobject context,
     if (asset == nullptr )
         return false;
     ALOGI("Got settings from tuningfork/tuningfork_settings.bin");
-    // Get serialized settings from assets
-    uint64_t size = AAsset_getLength64(asset);
-    settings_ser.bytes = (uint8_t*)::malloc(size);
-    memcpy(settings_ser.bytes, AAsset_getBuffer(asset), size);
-    settings_ser.size = size;
-    settings_ser.dealloc = CProtobufSerialization_Dealloc;
-    AAsset_close(asset);
-    return true;
-}
-
-CProtobufSerialization GetAssetAsSerialization(AAsset* asset) {
-    CProtobufSerialization ser;
-    uint64_t size = AAsset_getLength64(asset);
-    ser.bytes = (uint8_t*)::malloc(size);
-    memcpy(ser.bytes, AAsset_getBuffer(asset), size);
-    ser.size = size;
-    ser.dealloc = CProtobufSerialization_Dealloc;
-    return ser;
+    // A view of the asset itself: the settings are only decoded once, so there's no need
+    //  for a copy.
+    return MakeAssetView(asset, settings_ser);
 }
 
 // Get the name of the tuning fork save file. Returns true if the directory
@@ -151,53 +141,50 @@ bool GetSavedFileName(JNIEnv* env, jobject context, std::string& name) {
     if (!file_utils::CheckAndCreateDir(tf_path_str.str())) {
         return false;
     }
-    tf_path_str << "/saved_fp.bin";
+    tf_path_str << "/fp_cache.bin";
     name = tf_path_str.str();
     return true;
 }
 
-// Get a previously save fidelity param serialization.
-bool GetSavedFidelityParams(JNIEnv* env, jobject context, CProtobufSerialization* params) {
-    std::string save_filename;
-    if (GetSavedFileName(env, context, save_filename)) {
-        std::ifstream save_file(save_filename, std::ios::binary);
-        if (save_file.good()) {
-            save_file.seekg(0, std::ios::end);
-            params->size = save_file.tellg();
-            params->bytes = (uint8_t*)::malloc(params->size);
-            params->dealloc = CProtobufSerialization_Dealloc;
-            save_file.seekg(0, std::ios::beg);
-            save_file.read((char*)params->bytes, params->size);
-            ALOGI("Loaded fps from %s (%zu bytes)", save_filename.c_str(), params->size);
-            return true;
-        }
-        ALOGI("Couldn't load fps from %s", save_filename.c_str());
-    }
-    return false;
+// Where versions before the cache saved the raw params, next to the cache file
+std::string LegacySavedFileName(const std::string& cache_name) {
+    return cache_name.substr(0, cache_name.rfind('/')) + "/saved_fp.bin";
 }
 
-// Save fidelity params to the save file.
-bool SaveFidelityParams(JNIEnv* env, jobject context, const CProtobufSerialization* params) {
-    std::string save_filename;
-    if (GetSavedFileName(env, context, save_filename)) {
-        std::ofstream save_file(save_filename, std::ios::binary);
-        if (save_file.good()) {
-            save_file.write((const char*)params->bytes, params->size);
-            ALOGI("Saved fps to %s (%zu bytes)", save_filename.c_str(), params->size);
-            return true;
-        }
-        ALOGI("Couldn't save fps to %s", save_filename.c_str());
+// Get previously saved fidelity params, mapped rather than read into memory.
+bool GetSavedFidelityParams(const FidelityParamCache& cache, CProtobufSerialization* params,
+                            FidelityParamCache::Entry& entry) {
+    if (cache.Load(*params, entry)) {
+        ALOGI("Loaded fps from %s (%zu bytes)", cache.Path().c_str(), params->size);
+        return true;
     }
+    ALOGI("Couldn't load fps from %s", cache.Path().c_str());
     return false;
 }
 
-// Check if we have saved fidelity params.
-bool SavedFidelityParamsFileExists(JNIEnv* env, jobject context) {
-    std::string save_filename;
-    if (GetSavedFileName(env, context, save_filename)) {
-        return file_utils::FileExists(save_filename);
+// Save fidelity params, fetched now, to the cache.
+bool SaveFidelityParams(const FidelityParamCache& cache, const CProtobufSerialization* params,
+                        const std::string& experiment_id) {
+    FidelityParamCache::Entry entry;
+    entry.experiment_id = experiment_id;
+    entry.fetch_time_ms = FidelityParamCache::NowMs();
+    entry.ttl_ms = FidelityParamCache::kDefaultTtlMs;
+    return cache.Save(params->bytes, params->size, entry);
+}
+
+// Replace the saved params with ones supplied by the app. They weren't fetched from the
+//  server, so they are saved as stale, which means initFromAssetsWithSwappy still downloads
+//  params. The experiment id of any params already saved is kept.
+bool ReplaceSavedFidelityParams(const FidelityParamCache& cache,
+                                const CProtobufSerialization* params) {
+    FidelityParamCache::Entry entry = {"", 0, FidelityParamCache::kDefaultTtlMs};
+    CProtobufSerialization saved;
+    FidelityParamCache::Entry saved_entry;
+    if (cache.Load(saved, saved_entry)) {
+        entry.experiment_id = saved_entry.experiment_id;
+        CProtobufSerialization_Free(&saved);
     }
-    return false;
+    return cache.Save(params->bytes, params->size, entry);
 }
 
 template<typename T>
@@ -210,10 +197,24 @@ void push_back(T*& x, uint32_t& n, const T& val) {
     x[n] = val;
     ++n;
 }
+// When the stream is over memory, decode straight from it rather than a byte at a time
+//  through the stream callback
+bool decodeVarint(pb_istream_t* stream, uint64_t& value) {
+    if (stream->callback != ByteStream::Read)
+        return pb_decode_varint(stream, &value);
+    auto str = static_cast<ByteStream*>(stream->state);
+    size_t n = std::min(stream->bytes_left, str->size - str->it);
+    if (n == 0)
+        return false;
+    const uint8_t* p = str->vec + str->it;
+    auto next = annotation_util::DecodeVarint(p, p + n, value);
+    return next != nullptr && pb_read(stream, nullptr, next - p);
+}
 bool decodeAnnotationEnumSizes(pb_istream_t* stream, const pb_field_t *field, void** arg) {
     TFSettings* settings = static_cast<TFSettings*>(*arg);
     uint64_t a;
-    pb_decode_varint(stream, &a);
+    if (!decodeVarint(stream, a))
+        return false;
     push_back(settings->aggregation_strategy.annotation_enum_size,
               settings->aggregation_strategy.n_annotation_enum_size, (uint32_t)a);
     return true;
@@ -223,13 +224,16 @@ bool decodeHistograms(pb_istream_t* stream, const pb_field_t *field, void** arg)
     com_google_tuningfork_Settings_Histogram hist;
     pb_decode(stream, com_google_tuningfork_Settings_Histogram_fields, &hist);
     push_back(settings->histograms, settings->n_histograms,
-              {hist.instrument_key, hist.bucket_min, hist.bucket_max, hist.n_buckets});
+              {hist.instrument_key, hist.bucket_min, hist.bucket_max, hist.n_buckets,
+               static_cast<TFBucketLayout>(hist.bucket_layout), hist.frame_budget_ms});
     return true;
 }
 
-} // anonymous namespace
+std::mutex s_fetcher_mutex;
+// Replaced, once it is done, by the next download. The last one is never deleted, so that it
+//  isn't torn down while the process exits.
+FidelityParamFetcher* s_fetcher = nullptr; // Guarded by s_fetcher_mutex
 
-extern "C" {
 
 void TFSettings_Dealloc(TFSettings* s) {
     if(s->histograms) {
@@ -244,63 +248,93 @@ void TFSettings_Dealloc(TFSettings* s) {
     }
 }
 
-// Download FPs on a separate thread
-void TuningFork_startFidelityParamDownloadThread(JNIEnv* env, jobject context,
+// Download FPs on a separate thread.
+// If defaults_sent is true, the callback has already been given the default params and is only
+//  called again if new ones are downloaded.
+void StartFidelityParamDownloadThread(JNIEnv* env, jobject context,
                                       const char* url_base,
                                       const char* api_key,
                                       const CProtobufSerialization* defaultParams_in,
                                       ProtoCallback fidelity_params_callback,
-                                      int initialTimeoutMs, int ultimateTimeoutMs) {
-    static std::mutex threadMutex;
-    std::lock_guard<std::mutex> lock(threadMutex);
-    static std::thread fpThread;
-    if (fpThread.joinable()) {
+                                      int initialTimeoutMs, int ultimateTimeoutMs,
+                                      bool defaults_sent) {
+    std::lock_guard<std::mutex> lock(s_fetcher_mutex);
+    if (s_fetcher != nullptr && !s_fetcher->Done()) {
         ALOGW("Fidelity param download thread already started");
         return;
     }
-    JavaVM *vm;
-    env->GetJavaVM(&vm);
-    jobject newContextRef = env->NewGlobalRef(context);
-    fpThread = std::thread([=](CProtobufSerialization defaultParams) {
-        CProtobufSerialization params = {};
-        auto waitTime = std::chrono::milliseconds(initialTimeoutMs);
-        bool first_time = true;
-        JNIEnv *newEnv;
-        if (vm->AttachCurrentThread(&newEnv, NULL) == 0) {
-            while (true) {
-                auto startTime = std::chrono::steady_clock::now();
-                auto err = TuningFork_getFidelityParameters(newEnv, newContextRef,
-                                                            url_base, api_key,
-                                                            &defaultParams,
-                                                            &params, waitTime.count());
-                if (err==TFERROR_OK) {
-                    ALOGI("Got fidelity params from server");
-                    SaveFidelityParams(newEnv, newContextRef, &params);
-                    CProtobufSerialization_Free(&defaultParams);
-                    fidelity_params_callback(&params);
-                    CProtobufSerialization_Free(&params);
-                    break;
-                } else {
-                    ALOGI("Could not get fidelity params from server : err = %d", err);
-                    if (first_time) {
-                        fidelity_params_callback(&defaultParams);
-                        first_time = false;
-                    }
-                    // Wait if the call returned earlier than expected
-                    auto dt = std::chrono::steady_clock::now() - startTime;
-                    if(waitTime>dt) std::this_thread::sleep_for(waitTime - dt);
-                    if (waitTime.count() > ultimateTimeoutMs) {
-                        ALOGW("Not waiting any longer for fidelity params");
-                        CProtobufSerialization_Free(&defaultParams);
-                        break;
-                    }
-                    waitTime *= 2; // back off
-                }
-            }
-            newEnv->DeleteGlobalRef(newContextRef);
-            vm->DetachCurrentThread();
+    delete s_fetcher;
+    s_fetcher = new FidelityParamFetcher(
+        std::unique_ptr<HttpTransport>(new JniHttpTransport(env, context)));
+    // Everything that needs JNI, apart from the request itself, is done here rather than on
+    //  the download thread.
+    auto info = UploadThread::GetExtraUploadInfo(env, context);
+    HttpRequest request {FidelityParamsUrl(url_base ? url_base : "", info),
+                         api_key ? api_key : "", RequestJson(info), 0};
+    struct State {
+        CProtobufSerialization defaultParams;
+        std::unique_ptr<FidelityParamCache> cache;
+        bool defaults_sent;
+    };
+    auto state = std::make_shared<State>();
+    state->defaultParams = *defaultParams_in;
+    state->defaults_sent = defaults_sent;
+    std::string save_filename;
+    if (GetSavedFileName(env, context, save_filename))
+        state->cache.reset(new FidelityParamCache(save_filename));
+    auto send_defaults = [state, fidelity_params_callback]() {
+        if (!state->defaults_sent) {
+            fidelity_params_callback(&state->defaultParams);
+            state->defaults_sent = true;
         }
-    }, *defaultParams_in);
+    };
+    FidelityParamFetcher::Options options;
+    options.initial_timeout_ms = std::max(initialTimeoutMs, 0);
+    options.deadline_ms = std::max(ultimateTimeoutMs, 0);
+    s_fetcher->Start(request, options,
+        [state, send_defaults, fidelity_params_callback](TFErrorCode err,
+                                                         const ProtobufSerialization& fps,
+                                                         const std::string& experiment_id) {
+            if (err==TFERROR_OK) {
+                ALOGI("Got fidelity params from server");
+                tuningfork::SetFidelityParameters(fps, experiment_id);
+                // Only lent to the callback, so there's no need for a copy
+                CProtobufSerialization params {const_cast<uint8_t*>(fps.data()), fps.size(),
+                                               nullptr};
+                if (state->cache)
+                    SaveFidelityParams(*state->cache, &params, experiment_id);
+                fidelity_params_callback(&params);
+            } else {
+                ALOGW("Not waiting any longer for fidelity params : err = %d", err);
+                send_defaults();
+            }
+            CProtobufSerialization_Free(&state->defaultParams);
+        },
+        [send_defaults](int /*attempt*/, TFErrorCode err) {
+            ALOGI("Could not get fidelity params from server : err = %d", err);
+            send_defaults();
+        });
+}
+
+} // anonymous namespace
+
+extern "C" {
+
+void TuningFork_startFidelityParamDownloadThread(JNIEnv* env, jobject context,
+                                      const char* url_base,
+                                      const char* api_key,
+                                      const CProtobufSerialization* defaultParams,
+                                      ProtoCallback fidelity_params_callback,
+                                      int initialTimeoutMs, int ultimateTimeoutMs) {
+    StartFidelityParamDownloadThread(env, context, url_base, api_key, defaultParams,
+                                     fidelity_params_callback, initialTimeoutMs,
+                                     ultimateTimeoutMs, false);
+}
+
+void TuningFork_stopFidelityParamDownloadThread() {
+    std::lock_guard<std::mutex> lock(s_fetcher_mutex);
+    if (s_fetcher != nullptr)
+        s_fetcher->Cancel();
 }
 
 TFErrorCode TuningFork_deserializeSettings(const CProtobufSerialization* settings_ser,
@@ -327,6 +361,12 @@ TFErrorCode TuningFork_deserializeSettings(const CProtobufSerialization* setting
       = pbsettings.aggregation_strategy.intervalms_or_count;
     settings->aggregation_strategy.max_instrumentation_keys
       = pbsettings.aggregation_strategy.max_instrumentation_keys;
+    settings->aggregation_strategy.n_windows = pbsettings.aggregation_strategy.n_windows;
+    if(pbsettings.aggregation_strategy.full_window_policy
+          ==com_google_tuningfork_Settings_AggregationStrategy_FullWindowPolicy_DROP_WINDOW)
+        settings->aggregation_strategy.full_window_policy = TFAggregationStrategy::DROP_WINDOW;
+    else
+        settings->aggregation_strategy.full_window_policy = TFAggregationStrategy::MERGE_WINDOW;
     return TFERROR_OK;
 }
 
@@ -361,8 +401,8 @@ TFErrorCode TuningFork_findFidelityParamsInApk(JNIEnv* env, jobject context,
         return TFERROR_INVALID_DEFAULT_FIDELITY_PARAMS;
     }
     ALOGI("Using file %s for default params", full_filename.str().c_str());
-    *fp = GetAssetAsSerialization(a);
-    AAsset_close(a);
+    if (!MakeAssetView(a, *fp))
+        return TFERROR_INVALID_DEFAULT_FIDELITY_PARAMS;
     return TFERROR_OK;
 }
 
@@ -400,17 +440,36 @@ TFErrorCode TuningFork_initFromAssetsWithSwappy(JNIEnv* env, jobject context,
     if (err!=TFERROR_OK)
         return err;
     CProtobufSerialization defaultParams = {};
-    // Use the saved params as default, if they exist
-    if (SavedFidelityParamsFileExists(env, context)) {
+    // Use the saved params as default, if they are valid. They are handed to the app straight
+    //  away and, if they are still fresh, there's no need to download any.
+    std::string save_filename;
+    FidelityParamCache::Entry entry;
+    bool have_saved = false;
+    if (GetSavedFileName(env, context, save_filename)) {
+        FidelityParamCache cache(save_filename);
+        cache.Open(LegacySavedFileName(save_filename));
+        have_saved = GetSavedFidelityParams(cache, &defaultParams, entry);
+    }
+    if (have_saved) {
         ALOGI("Using saved default params");
-        GetSavedFidelityParams(env, context, &defaultParams);
-    } else {
-        if (fp_file_name==nullptr)
-            return TFERROR_INVALID_DEFAULT_FIDELITY_PARAMS;
-        err = TuningFork_findFidelityParamsInApk(env, context, fp_file_name, &defaultParams);
-        if (err!=TFERROR_OK)
-            return err;
+        tuningfork::SetFidelityParameters(
+            ProtobufSerialization(defaultParams.bytes, defaultParams.bytes + defaultParams.size),
+            entry.experiment_id);
+        fidelity_params_callback(&defaultParams);
+        if (!entry.Stale(FidelityParamCache::NowMs())) {
+            CProtobufSerialization_Free(&defaultParams);
+            return TFERROR_OK;
+        }
+        ALOGI("Saved params are stale: refreshing in the background");
+        StartFidelityParamDownloadThread(env, context, url_base, api_key, &defaultParams,
+            fidelity_params_callback, initialTimeoutMs, ultimateTimeoutMs, true);
+        return TFERROR_OK;
     }
+    if (fp_file_name==nullptr)
+        return TFERROR_INVALID_DEFAULT_FIDELITY_PARAMS;
+    err = TuningFork_findFidelityParamsInApk(env, context, fp_file_name, &defaultParams);
+    if (err!=TFERROR_OK)
+        return err;
     TuningFork_startFidelityParamDownloadThread(env, context, url_base, api_key, &defaultParams,
        fidelity_params_callback, initialTimeoutMs, ultimateTimeoutMs);
     return TFERROR_OK;
@@ -418,15 +477,11 @@ TFErrorCode TuningFork_initFromAssetsWithSwappy(JNIEnv* env, jobject context,
 
 TFErrorCode TuningFork_saveOrDeleteFidelityParamsFile(JNIEnv* env, jobject context,
                                                       CProtobufSerialization* fps) {
-    if(fps) {
-        if (SaveFidelityParams(env, context, fps))
+    std::string save_filename;
+    if (GetSavedFileName(env, context, save_filename)) {
+        FidelityParamCache cache(save_filename);
+        if (fps ? ReplaceSavedFidelityParams(cache, fps) : cache.Delete())
             return TFERROR_OK;
-    } else {
-        std::string save_filename;
-        if (GetSavedFileName(env, context, save_filename)) {
-            if (file_utils::DeleteFile(save_filename))
-                return TFERROR_OK;
-        }
     }
     return TFERROR_COULDNT_SAVE_OR_DELETE_FPS;
 }
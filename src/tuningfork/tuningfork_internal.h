@@ -43,10 +43,16 @@ struct Settings {
             TICK_BASED,
             TIME_BASED
         };
+        enum FullWindowPolicy {
+            MERGE_WINDOW,
+            DROP_WINDOW
+        };
         Submission method;
         uint32_t intervalms_or_count;
         uint32_t max_instrumentation_keys;
         std::vector<uint32_t> annotation_enum_size;
+        uint32_t n_windows;
+        FullWindowPolicy full_window_policy;
     };
     AggregationStrategy aggregation_strategy;
     std::vector<TFHistogram> histograms;
@@ -123,9 +129,23 @@ TFErrorCode GetFidelityParameters(JNIEnv* env, jobject context,
                            const ProtobufSerialization& defaultParams,
                            ProtobufSerialization &params, uint32_t timeout_ms);
 
+// Record fidelity parameters fetched by other means than GetFidelityParameters
+TFErrorCode SetFidelityParameters(const ProtobufSerialization& params,
+                                  const std::string& experiment_id);
+
 // Protobuf serialization of the current annotation
 TFErrorCode SetCurrentAnnotation(const ProtobufSerialization &annotation);
 
+// Decode an annotation once so it can be made current by handle
+TFErrorCode RegisterAnnotation(const ProtobufSerialization &annotation,
+                               TFAnnotationHandle& handle);
+
+TFErrorCode SetCurrentAnnotation(TFAnnotationHandle handle);
+
+// Override the current annotation on the calling thread, or stop doing so if the handle is
+//  TFANNOTATION_HANDLE_NONE
+TFErrorCode SetThreadAnnotation(TFAnnotationHandle handle);
+
 // Record a frame tick that will be associated with the instrumentation key and the current
 //   annotation
 TFErrorCode FrameTick(InstrumentationKey id);
@@ -143,4 +163,9 @@ TFErrorCode SetUploadCallback(ProtoCallback cbk);
 
 TFErrorCode Flush();
 
+// Zero-copy view of the histograms for the whole session, valid until released
+TFErrorCode GetSessionHistograms(TFSessionHistograms& histograms);
+
+TFErrorCode ReleaseSessionHistograms(TFSessionHistograms& histograms);
+
 } // namespace tuningfork
@@ -176,4 +176,28 @@ std::string UniqueId(JNIEnv* env) {
     return temp_uuid;
 }
 
+namespace {
+
+struct Crc32Table {
+    uint32_t entries[256];
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+} // anonymous namespace
+
+uint32_t Crc32(const uint8_t* data, size_t n, uint32_t crc) {
+    static const Crc32Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
 } // namespace tuningfork
@@ -17,6 +17,8 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
+#include <cstdint>
 #include <jni.h>
 
 class AAsset;
@@ -54,4 +56,8 @@ namespace file_utils {
 // Get a unique identifier using java.util.UUID
 std::string UniqueId(JNIEnv* env);
 
+// CRC-32 (IEEE 802.3, as used by zlib). Pass the previous result as crc to continue a
+//  checksum over several buffers.
+uint32_t Crc32(const uint8_t* data, size_t n, uint32_t crc = 0);
+
 } // namespace tuningfork
@@ -22,7 +22,6 @@
 #include <fstream>
 #include <sstream>
 #include <cmath>
-#include "clearcutserializer.h"
 #include "modp_b64.h"
 
 #define LOG_TAG "TuningFork"
@@ -62,8 +61,12 @@ TFErrorCode DebugBackend::Process(const ProtobufSerialization &evt_ser) {
 
 std::unique_ptr<DebugBackend> s_debug_backend = std::make_unique<DebugBackend>();
 
-UploadThread::UploadThread(Backend *backend, const ExtraUploadInfo& extraInfo) : backend_(backend),
+UploadThread::UploadThread(Backend *backend, const ExtraUploadInfo& extraInfo,
+                           const ReleaseCallback& release) : do_quit_(true),
+                                               release_(release), wakeups_(0), waiting_(false),
+                                               backend_(backend),
                                                current_fidelity_params_(0),
+                                               current_experiment_id_(extraInfo.experiment_id),
                                                upload_callback_(nullptr),
                                                extra_info_(extraInfo) {
     if (backend_ == nullptr)
@@ -72,7 +75,8 @@ UploadThread::UploadThread(Backend *backend, const ExtraUploadInfo& extraInfo) :
 }
 
 UploadThread::~UploadThread() {
-    Stop();
+    if (thread_)
+        Stop();
 }
 
 void UploadThread::Start() {
@@ -80,53 +84,81 @@ void UploadThread::Start() {
         ALOGW("Can't start an already running thread");
         return;
     }
-    do_quit_ = false;
-    ready_ = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        do_quit_ = false;
+        ready_.clear();
+    }
     thread_ = std::make_unique<std::thread>([&] { return Run(); });
 }
 
 void UploadThread::Stop() {
-    if (!thread_->joinable()) {
+    if (!thread_ || !thread_->joinable()) {
         ALOGW("Can't stop a thread that's not started");
         return;
     }
-    do_quit_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        do_quit_ = true;
+    }
     cv_.notify_one();
     thread_->join();
+    thread_.reset();
 }
 
 void UploadThread::Run() {
-    while (!do_quit_) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (ready_) {
-            ProtobufSerialization evt_ser;
-            UpdateGLVersion(); // Needs to be done with an active gl context
-            ClearcutSerializer::SerializeEvent(*ready_, current_fidelity_params_,
-                                               extra_info_,
-                                               evt_ser);
-            if(upload_callback_) {
-                CProtobufSerialization cser = { evt_ser.data(),
-                                          static_cast<uint32_t>(evt_ser.size()), nullptr};
-                upload_callback_(&cser);
-            }
-            backend_->Process(evt_ser);
-            ready_ = nullptr;
+    std::deque<const ProngCache*> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        while (ready_.empty() && !do_quit_) {
+            waiting_ = true;
+            cv_.wait(lock);
+            waiting_ = false;
+            ++wakeups_;
         }
-        cv_.wait_for(lock, std::chrono::milliseconds(1000));
+        if (ready_.empty())
+            break; // Quitting with nothing left to upload
+        // Take everything pending in one go so Submit isn't blocked while we upload
+        batch.swap(ready_);
+        lock.unlock();
+        UpdateGLVersion(); // Needs to be done with an active gl context
+        for (auto prongs: batch) {
+            Upload(*prongs);
+            if (release_)
+                release_(prongs);
+        }
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void UploadThread::Upload(const ProngCache& prongs) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        upload_fidelity_params_ = current_fidelity_params_;
+        extra_info_.experiment_id = current_experiment_id_;
+    }
+    if (!ClearcutSerializer::SerializeEvent(prongs, upload_fidelity_params_,
+                                            extra_info_,
+                                            evt_ser_, serializer_sizes_))
+        return;
+    if(upload_callback_) {
+        CProtobufSerialization cser = { evt_ser_.data(),
+                                  static_cast<uint32_t>(evt_ser_.size()), nullptr};
+        upload_callback_(&cser);
     }
+    backend_->Process(evt_ser_);
 }
 
-// Returns true if we submitted, false if we are waiting for a previous submit to complete
 bool UploadThread::Submit(const ProngCache *prongs) {
-    if (ready_ == nullptr) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            ready_ = prongs;
-        }
-        cv_.notify_one();
-        return true;
-    } else
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (do_quit_)
+            return false;
+        ready_.push_back(prongs);
+    }
+    cv_.notify_one();
+    return true;
 }
 
 namespace {
@@ -18,25 +18,52 @@
 
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <map>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include "prong.h"
+#include "clearcutserializer.h"
 
 namespace tuningfork {
 
+// Uploads closed aggregation windows on a background thread.
+// The thread sleeps until a window is submitted: there are no periodic wakeups. Every
+//  submission wakes it straight away. Windows are uploaded one per event, in the order they were
+//  submitted so that the backend sees them in epoch order, and each is passed to the release
+//  callback once uploaded. Stop uploads anything already submitted before joining.
 class UploadThread {
+public:
+    // Called on the upload thread once a submitted cache has been uploaded
+    typedef std::function<void(const ProngCache*)> ReleaseCallback;
 private:
     std::unique_ptr<std::thread> thread_;
     std::mutex mutex_;
     std::condition_variable cv_;
-    bool do_quit_;
-    const ProngCache *ready_;
+    bool do_quit_; // Guarded by mutex_
+    // Windows waiting to be uploaded, in order of submission. Guarded by mutex_.
+    std::deque<const ProngCache*> ready_;
+    ReleaseCallback release_;
+    // Number of times the thread has returned from waiting, for diagnostics
+    std::atomic<uint64_t> wakeups_;
+    // True while the thread is waiting for work
+    std::atomic<bool> waiting_;
     Backend *backend_;
+    // Set from any thread, e.g. when a fidelity params download completes. Guarded by mutex_.
     ProtobufSerialization current_fidelity_params_;
+    std::string current_experiment_id_;
     ProtoCallback upload_callback_;
+    // Only touched on the upload thread once it has started
     ExtraUploadInfo extra_info_;
+    // Copy of current_fidelity_params_ taken for each upload, reused
+    ProtobufSerialization upload_fidelity_params_;
+    // Reused for each upload
+    ProtobufSerialization evt_ser_;
+    ClearcutSerializer::SizeCache serializer_sizes_;
  public:
-    UploadThread(Backend *backend, const ExtraUploadInfo& extraInfo);
+    UploadThread(Backend *backend, const ExtraUploadInfo& extraInfo,
+                 const ReleaseCallback& release = nullptr);
 
     ~UploadThread();
 
@@ -46,13 +73,20 @@ private:
 
     void Run();
 
-    // Returns true if we submitted, false if we are waiting for a previous submit to complete
+    // Queue the cache for upload. It is passed to the release callback once uploaded.
+    // Returns false if the thread has been stopped.
     bool Submit(const ProngCache *prongs);
 
+    uint64_t Wakeups() const { return wakeups_; }
+
+    bool Waiting() const { return waiting_; }
+
+    // Can be called from any thread: the params are copied under the lock for each upload
     void SetCurrentFidelityParams(const ProtobufSerialization &fp,
                                   const std::string& experiment_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
         current_fidelity_params_ = fp;
-        extra_info_.experiment_id = experiment_id;
+        current_experiment_id_ = experiment_id;
     }
 
     void SetUploadCallback(ProtoCallback upload_callback) {
@@ -64,6 +98,8 @@ private:
  private:
     void UpdateGLVersion();
 
+    void Upload(const ProngCache& prongs);
+
     friend class ClearcutSerializer;
 };
 
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "swappy/common/FrameDurations.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+
+namespace frame_durations_test {
+
+using namespace swappy;
+using namespace std::chrono_literals;
+
+TEST(FrameDurationsTest, AverageOfPartialWindow) {
+    FrameDurations d(4);
+    EXPECT_TRUE(d.empty());
+    EXPECT_EQ(d.average().getCpuTime(), 0ns);
+    d.add({10ms, 2ms});
+    d.add({20ms, 4ms});
+    EXPECT_EQ(d.size(), 2);
+    EXPECT_FALSE(d.full());
+    EXPECT_EQ(d.average().getCpuTime(), 15ms);
+    EXPECT_EQ(d.average().getGpuTime(), 3ms);
+}
+
+TEST(FrameDurationsTest, OldestFramesDropOut) {
+    FrameDurations d(3);
+    for (int i = 1; i <= 5; ++i)
+        d.add({std::chrono::milliseconds(i), 0ns});
+    EXPECT_TRUE(d.full());
+    EXPECT_EQ(d.sum().getCpuTime(), 12ms); // 3 + 4 + 5
+    EXPECT_EQ(d[0].getCpuTime(), 3ms);
+    EXPECT_EQ(d[2].getCpuTime(), 5ms);
+}
+
+TEST(FrameDurationsTest, DurationsAreClamped) {
+    FrameDurations d(2);
+    d.add({1s, 1s});
+    EXPECT_EQ(d.sum().getCpuTime(), FrameDuration::MAX_DURATION);
+    EXPECT_EQ(d.sum().getTime(PipelineMode::Off), 2 * FrameDuration::MAX_DURATION);
+}
+
+TEST(FrameDurationsTest, ClearAndResize) {
+    FrameDurations d(3);
+    d.add({5ms, 5ms});
+    d.clear();
+    EXPECT_TRUE(d.empty());
+    EXPECT_EQ(d.sum().getCpuTime(), 0ns);
+    d.add({7ms, 1ms});
+    EXPECT_EQ(d[0].getCpuTime(), 7ms);
+    d.setWindow(0);
+    EXPECT_EQ(d.window(), 1);
+    EXPECT_TRUE(d.empty());
+    d.add({1ms, 1ms});
+    d.add({2ms, 2ms});
+    EXPECT_EQ(d.average().getGpuTime(), 2ms);
+}
+
+TEST(FrameDurationsTest, SumDoesNotDrift) {
+    FrameDurations d;
+    for (int i = 0; i < 100000; ++i)
+        d.add({std::chrono::nanoseconds(16666667 + i % 7), std::chrono::nanoseconds(i % 1000)});
+    FrameDuration sum;
+    for (size_t i = 0; i < d.size(); ++i)
+        sum += d[i];
+    EXPECT_EQ(d.sum().getCpuTime(), sum.getCpuTime());
+    EXPECT_EQ(d.sum().getGpuTime(), sum.getGpuTime());
+}
+
+} // namespace frame_durations_test
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "swappy/common/FrameRecords.h"
+
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+namespace frame_records_test {
+
+using namespace swappy;
+
+SwappyFrameRecord makeRecord(uint64_t frameNumber) {
+    SwappyFrameRecord record = {};
+    record.frame_number = frameNumber;
+    record.cpu_time_ns = frameNumber * 1000;
+    return record;
+}
+
+TEST(FrameRecordsTest, ReadInOrderInBatches) {
+    FrameRecords r;
+    for (uint64_t i = 0; i < 5; ++i)
+        r.add(makeRecord(i), false);
+    SwappyFrameRecord out[3];
+    EXPECT_EQ(r.read(out, 3), 3);
+    EXPECT_EQ(out[0].frame_number, 0);
+    EXPECT_EQ(out[2].frame_number, 2);
+    EXPECT_EQ(out[2].cpu_time_ns, 2000);
+    EXPECT_EQ(r.read(out, 3), 2);
+    EXPECT_EQ(out[1].frame_number, 4);
+    EXPECT_EQ(r.read(out, 3), 0);
+}
+
+TEST(FrameRecordsTest, DropsNewRecordsWhenFull) {
+    FrameRecords r;
+    const size_t n = FrameRecords::CAPACITY + 10;
+    for (uint64_t i = 0; i < n; ++i)
+        r.add(makeRecord(i), false);
+    EXPECT_EQ(r.numDropped(), 10);
+    std::vector<SwappyFrameRecord> out(n);
+    EXPECT_EQ(r.read(out.data(), n), FrameRecords::CAPACITY);
+    EXPECT_EQ(out[FrameRecords::CAPACITY - 1].frame_number, FrameRecords::CAPACITY - 1);
+    // There is room again
+    r.add(makeRecord(n), false);
+    EXPECT_EQ(r.read(out.data(), n), 1);
+    EXPECT_EQ(out[0].frame_number, n);
+}
+
+TEST(FrameRecordsTest, RecordsWaitForTimestamps) {
+    FrameRecords r;
+    SwappyFrameRecord out[4];
+    r.add(makeRecord(0), true);
+    r.add(makeRecord(1), true);
+    EXPECT_EQ(r.read(out, 4), 0);
+
+    r.setTimestamps(0, 10, 20);
+    EXPECT_EQ(r.read(out, 4), 1);
+    EXPECT_EQ(out[0].latch_time_ns, 10);
+    EXPECT_EQ(out[0].present_time_ns, 20);
+
+    // Frame 1 never gets its timestamps, and is passed on without them
+    r.add(makeRecord(2), true);
+    r.setTimestamps(2, 30, 40);
+    EXPECT_EQ(r.read(out, 4), 2);
+    EXPECT_EQ(out[0].frame_number, 1);
+    EXPECT_EQ(out[0].present_time_ns, 0);
+    EXPECT_EQ(out[1].frame_number, 2);
+    EXPECT_EQ(out[1].present_time_ns, 40);
+
+    // A record that doesn't wait flushes the ones that do, to keep the order
+    r.add(makeRecord(3), true);
+    r.add(makeRecord(4), false);
+    EXPECT_EQ(r.read(out, 4), 2);
+    EXPECT_EQ(out[0].frame_number, 3);
+    EXPECT_EQ(out[1].frame_number, 4);
+}
+
+TEST(FrameRecordsTest, GivesUpWaitingAfterMaxPending) {
+    FrameRecords r;
+    std::vector<SwappyFrameRecord> out(FrameRecords::MAX_PENDING + 1);
+    for (uint64_t i = 0; i <= FrameRecords::MAX_PENDING; ++i)
+        r.add(makeRecord(i), true);
+    EXPECT_EQ(r.read(out.data(), out.size()), 1);
+    EXPECT_EQ(out[0].frame_number, 0);
+}
+
+TEST(FrameRecordsTest, ConcurrentReader) {
+    FrameRecords r;
+    constexpr uint64_t N = 100000;
+    std::thread producer([&r]() {
+        for (uint64_t i = 0; i < N; ++i)
+            r.add(makeRecord(i), false);
+    });
+    uint64_t next = 0;
+    uint64_t numRead = 0;
+    bool ordered = true;
+    SwappyFrameRecord out[16];
+    while (numRead + r.numDropped() < N) {
+        size_t n = r.read(out, 16);
+        for (size_t i = 0; i < n; ++i) {
+            ordered &= out[i].frame_number >= next &&
+                       out[i].cpu_time_ns == out[i].frame_number * 1000;
+            next = out[i].frame_number + 1;
+        }
+        numRead += n;
+    }
+    producer.join();
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(numRead + r.numDropped(), N);
+}
+
+} // namespace frame_records_test
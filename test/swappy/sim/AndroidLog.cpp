@@ -0,0 +1,45 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android/log.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Only warnings and errors are shown, unless SWAPPY_SIM_LOG is set in the environment
+int minPriority() {
+    static const int priority = getenv("SWAPPY_SIM_LOG") ? ANDROID_LOG_VERBOSE : ANDROID_LOG_WARN;
+    return priority;
+}
+
+} // anonymous namespace
+
+extern "C" int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+    if (prio < minPriority()) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = fprintf(stderr, "%s: ", tag);
+    n += vfprintf(stderr, fmt, args);
+    n += fprintf(stderr, "\n");
+    va_end(args);
+    return n;
+}
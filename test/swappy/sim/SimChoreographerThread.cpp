@@ -0,0 +1,103 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Stand-in for src/swappy/common/ChoreographerThread.cpp, which needs the Android looper and
+// JNI. Frame callbacks come from the simulated display instead.
+
+#include <jni.h>
+
+#include "ChoreographerThread.h"
+
+#include "SimDisplay.h"
+
+namespace swappy {
+
+namespace {
+
+// Registers with the vsync of the simulated display
+class SimChoreographerThread : public ChoreographerThread {
+public:
+    explicit SimChoreographerThread(Callback onChoreographer)
+            : ChoreographerThread(onChoreographer) {
+        mInitialized = swappy_sim::SimDisplay::instance() != nullptr;
+    }
+
+    ~SimChoreographerThread() override {
+        if (auto display = swappy_sim::SimDisplay::instance()) {
+            display->clearFrameCallbacks();
+        }
+    }
+
+private:
+    void scheduleNextFrameCallback() override REQUIRES(mWaitingMutex) {
+        swappy_sim::SimDisplay::instance()->postFrameCallback([this]() { onChoreographer(); });
+    }
+};
+
+// The application calls SwappyCommon::onChoreographer itself
+class SimAppChoreographerThread : public ChoreographerThread {
+public:
+    explicit SimAppChoreographerThread(Callback onChoreographer)
+            : ChoreographerThread(onChoreographer) {
+        mInitialized = true;
+    }
+
+    void postFrameCallbacks() override { mCallback(); }
+
+private:
+    void scheduleNextFrameCallback() override REQUIRES(mWaitingMutex) {}
+};
+
+} // anonymous namespace
+
+ChoreographerThread::ChoreographerThread(Callback onChoreographer):
+        mCallback(onChoreographer) {}
+
+ChoreographerThread::~ChoreographerThread() = default;
+
+void ChoreographerThread::postFrameCallbacks()
+{
+    std::lock_guard<std::mutex> lock(mWaitingMutex);
+    if (mCallbacksBeforeIdle == 0) {
+        scheduleNextFrameCallback();
+    }
+    mCallbacksBeforeIdle = MAX_CALLBACKS_BEFORE_IDLE;
+}
+
+void ChoreographerThread::onChoreographer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mWaitingMutex);
+        mCallbacksBeforeIdle--;
+
+        if (mCallbacksBeforeIdle > 0) {
+            scheduleNextFrameCallback();
+        }
+    }
+    mCallback();
+}
+
+std::unique_ptr<ChoreographerThread>
+    ChoreographerThread::createChoreographerThread(
+                Type type, JavaVM* /*vm*/, Callback onChoreographer, int /*sdkVersion*/) {
+    if (type == Type::App) {
+        return std::make_unique<SimAppChoreographerThread>(onChoreographer);
+    }
+    return std::make_unique<SimChoreographerThread>(onChoreographer);
+}
+
+} // namespace swappy
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SimClock.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace swappy_sim {
+
+SimClock::SimClock(time_point start) : mNow(start) {}
+
+void SimClock::sleepUntil(time_point t) {
+    while (!mEvents.empty() && mEvents.top().time <= t) {
+        runNext();
+    }
+    mNow = std::max(mNow, t);
+}
+
+void SimClock::wait(std::unique_lock<std::mutex>& lock, std::condition_variable& /*cond*/,
+                    const std::function<bool()>& pred) {
+    // Events take the locks they need, so release ours while they run
+    while (!pred()) {
+        lock.unlock();
+        const bool ran = runNext();
+        lock.lock();
+        if (!ran) {
+            fprintf(stderr, "SimClock: waiting with no events left\n");
+            abort();
+        }
+    }
+}
+
+void SimClock::post(time_point t, std::function<void()> f) {
+    mEvents.push({std::max(t, mNow), mSequence++, std::move(f)});
+}
+
+void SimClock::runUntil(const std::function<bool()>& pred) {
+    while (!pred()) {
+        if (!runNext()) {
+            fprintf(stderr, "SimClock: waiting with no events left\n");
+            abort();
+        }
+    }
+}
+
+bool SimClock::runNext() {
+    if (mEvents.empty()) {
+        return false;
+    }
+    Event event = mEvents.top();
+    mEvents.pop();
+    mNow = std::max(mNow, event.time);
+    event.f();
+    return true;
+}
+
+} // namespace swappy_sim
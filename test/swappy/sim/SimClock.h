@@ -0,0 +1,72 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "Clock.h"
+
+namespace swappy_sim {
+
+// Virtual clock driving a simulation from a single thread.
+// Time only moves when the caller sleeps or waits, at which point the events posted up to then
+// run in time order. Events posted for the same time run in the order they were posted, so a
+// run is fully deterministic.
+class SimClock : public swappy::Clock {
+public:
+    explicit SimClock(time_point start = time_point(std::chrono::seconds(1)));
+
+    time_point now() const override { return mNow; }
+
+    void sleepUntil(time_point t) override;
+
+    void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+              const std::function<bool()>& pred) override;
+
+    bool hasEventLoop() const override { return true; }
+
+    void post(time_point t, std::function<void()> f) override;
+
+    // Run events until pred holds. Aborts if there are none left, as nothing else could make
+    // pred change.
+    void runUntil(const std::function<bool()>& pred);
+
+private:
+    struct Event {
+        time_point time;
+        uint64_t sequence;
+        std::function<void()> f;
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const {
+            return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+        }
+    };
+
+    // Run the earliest event, moving the time up to it. Returns false if there are none.
+    bool runNext();
+
+    time_point mNow;
+    uint64_t mSequence = 0;
+    std::priority_queue<Event, std::vector<Event>, Later> mEvents;
+};
+
+} // namespace swappy_sim
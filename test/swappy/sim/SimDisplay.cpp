@@ -0,0 +1,110 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SimDisplay.h"
+
+#include "Settings.h"
+
+namespace swappy_sim {
+
+namespace {
+
+SimDisplay* sInstance = nullptr;
+
+// How early a frame may be shown relative to its desired present time
+constexpr std::chrono::nanoseconds PRESENT_TOLERANCE = std::chrono::milliseconds(1);
+
+} // anonymous namespace
+
+SimDisplay::SimDisplay(SimClock& clock, const Config& config)
+        : mClock(clock),
+          mConfig(config),
+          mMode(config.initialMode),
+          mNextMode(config.initialMode) {
+    sInstance = this;
+    mClock.post(mClock.now() + refreshPeriod(), [this]() { onVsync(); });
+}
+
+SimDisplay::~SimDisplay() {
+    sInstance = nullptr;
+}
+
+SimDisplay* SimDisplay::instance() {
+    return sInstance;
+}
+
+void SimDisplay::setMode(int modeId) {
+    if (modeId >= 0 && modeId < static_cast<int>(mConfig.refreshPeriods.size())) {
+        mNextMode = modeId;
+    }
+}
+
+void SimDisplay::postFrameCallback(std::function<void()> f) {
+    mFrameCallbacks.push_back(std::move(f));
+}
+
+void SimDisplay::clearFrameCallbacks() {
+    mFrameCallbacks.clear();
+}
+
+void SimDisplay::queueFrame(const Frame& frame) {
+    mQueue.push_back(frame);
+}
+
+void SimDisplay::onVsync() {
+    const auto vsyncTime = mClock.now();
+
+    if (mNextMode != mMode) {
+        mMode = mNextMode;
+        ++mModeSwitches;
+        // What the display manager reports to Swappy once the switch has happened
+        swappy::Settings::getInstance()->setDisplayTimings(
+                {refreshPeriod(), mConfig.appOffset, mConfig.sfOffset});
+    }
+
+    mClock.post(vsyncTime + mConfig.sfOffset, [this, vsyncTime]() { latchFrame(vsyncTime); });
+
+    if (!mFrameCallbacks.empty()) {
+        std::vector<std::function<void()>> callbacks;
+        callbacks.swap(mFrameCallbacks);
+        mClock.post(vsyncTime + mConfig.appOffset, [callbacks]() {
+            for (const auto& callback : callbacks) {
+                callback();
+            }
+        });
+    }
+
+    mClock.post(vsyncTime + refreshPeriod(), [this]() { onVsync(); });
+}
+
+void SimDisplay::latchFrame(time_point vsyncTime) {
+    if (mQueue.empty()) {
+        return;
+    }
+    // Composited now and shown from the next vsync
+    const auto presentTime = vsyncTime + refreshPeriod();
+    const Frame& frame = mQueue.front();
+    if (frame.gpuDone <= mClock.now() &&
+        frame.desiredPresentTime <= presentTime + PRESENT_TOLERANCE) {
+        if (mPresentCallback) {
+            mPresentCallback(frame, presentTime);
+        }
+        mQueue.pop_front();
+    }
+}
+
+} // namespace swappy_sim
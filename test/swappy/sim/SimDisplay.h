@@ -0,0 +1,94 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "SimClock.h"
+
+namespace swappy_sim {
+
+// A display with one or more refresh rates and a compositor in front of it, standing in for
+// the Android display and SurfaceFlinger.
+// At each vsync the display switches to any mode that was asked for. The app vsync offset after
+// it, the frame callbacks that were posted run. The SurfaceFlinger offset after it, the oldest
+// queued frame is latched if its GPU work is done and its desired present time has come, to be
+// shown from the next vsync.
+class SimDisplay {
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    struct Config {
+        // Refresh period of each mode, indexed by mode id
+        std::vector<std::chrono::nanoseconds> refreshPeriods;
+        int initialMode = 0;
+        std::chrono::nanoseconds appOffset = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds sfOffset = std::chrono::nanoseconds(0);
+    };
+
+    struct Frame {
+        int id;
+        time_point gpuDone;
+        // Earliest time the frame should be shown, or zero for as soon as possible
+        time_point desiredPresentTime;
+    };
+
+    // Called as each frame is latched, with the time it is shown
+    using PresentCallback = std::function<void(const Frame& frame, time_point presentTime)>;
+
+    SimDisplay(SimClock& clock, const Config& config);
+    ~SimDisplay();
+
+    // The display the Choreographer and display manager stand-ins are attached to
+    static SimDisplay* instance();
+
+    std::chrono::nanoseconds refreshPeriod() const { return mConfig.refreshPeriods[mMode]; }
+    const Config& config() const { return mConfig; }
+    int modeSwitches() const { return mModeSwitches; }
+
+    // Switch to the mode at the next vsync
+    void setMode(int modeId);
+
+    // Run f once, after the next vsync
+    void postFrameCallback(std::function<void()> f);
+    void clearFrameCallbacks();
+
+    void queueFrame(const Frame& frame);
+    size_t queuedFrames() const { return mQueue.size(); }
+
+    void setPresentCallback(PresentCallback callback) { mPresentCallback = std::move(callback); }
+
+private:
+    void onVsync();
+    // The compositor, which runs sfOffset after the vsync
+    void latchFrame(time_point vsyncTime);
+
+    SimClock& mClock;
+    const Config mConfig;
+    int mMode;
+    int mNextMode;
+    int mModeSwitches = 0;
+    std::vector<std::function<void()>> mFrameCallbacks;
+    std::deque<Frame> mQueue;
+    PresentCallback mPresentCallback;
+};
+
+} // namespace swappy_sim
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Stand-in for src/swappy/common/SwappyDisplayManager.cpp, which talks to the Java display
+// manager. The modes of the simulated display are reported instead, and switching between them
+// is reported back through Settings by the display itself, as onRefreshRateChanged does.
+
+#include <jni.h>
+
+#include "SwappyDisplayManager.h"
+
+#include "SimDisplay.h"
+
+namespace swappy {
+
+SwappyDisplayManager::SwappyDisplayManager(JavaVM* vm, jobject /*mainActivity*/)
+        : mJVM(vm), mJthis(nullptr), mSetPreferredRefreshRate(nullptr), mTerminate(nullptr) {
+    auto display = swappy_sim::SimDisplay::instance();
+    if (!display) {
+        return;
+    }
+
+    auto refreshRates = std::make_shared<RefreshRateMap>();
+    const auto& periods = display->config().refreshPeriods;
+    for (int modeId = 0; modeId < static_cast<int>(periods.size()); ++modeId) {
+        (*refreshRates)[periods[modeId]] = modeId;
+    }
+    mSupportedRefreshRates = refreshRates;
+    mInitialized = true;
+}
+
+SwappyDisplayManager::~SwappyDisplayManager() = default;
+
+std::shared_ptr<SwappyDisplayManager::RefreshRateMap>
+        SwappyDisplayManager::getSupportedRefreshRates() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSupportedRefreshRates;
+}
+
+void SwappyDisplayManager::setPreferredRefreshRate(int index) {
+    if (auto display = swappy_sim::SimDisplay::instance()) {
+        display->setMode(index);
+    }
+}
+
+} // namespace swappy
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "Settings.h"
+#include "SwappyCommon.h"
+
+namespace swappy_sim {
+
+using std::chrono::nanoseconds;
+using time_point = std::chrono::steady_clock::time_point;
+
+namespace {
+
+// Buffers the app can have queued to the compositor before queueing another one blocks
+constexpr size_t MAX_QUEUED_FRAMES = 2;
+
+constexpr int SDK_VERSION = 30;
+
+double toMs(nanoseconds t) {
+    return t.count() / 1e6;
+}
+
+struct FrameRecord {
+    time_point start;
+    // What Swappy was pacing to when the frame was queued
+    nanoseconds swapInterval{0};
+    time_point present;
+    nanoseconds refreshPeriod{0};
+    bool presented = false;
+};
+
+// The GPU runs one frame at a time, in the order they are submitted
+class SimGpu {
+public:
+    explicit SimGpu(const SimClock& clock) : mClock(clock) {}
+
+    time_point submit(nanoseconds gpuTime) {
+        const auto now = mClock.now();
+        const auto start = std::max(now, mBusyUntil);
+        mBusyUntil = start + gpuTime;
+        mPrevious = mLast;
+        mLast = {now, mBusyUntil};
+        return mBusyUntil;
+    }
+
+    // Whether the fence after the last frame submitted has signalled
+    bool lastFrameIsComplete() const {
+        return mLast.done <= mClock.now();
+    }
+
+    // How long the fence of the last frame to finish was pending, as EGL measures it
+    nanoseconds prevFrameGpuTime() const {
+        const auto& frame = lastFrameIsComplete() ? mLast : mPrevious;
+        return frame.done - frame.submitted;
+    }
+
+private:
+    struct Submission {
+        time_point submitted;
+        time_point done;
+    };
+
+    const SimClock& mClock;
+    time_point mBusyUntil;
+    Submission mLast;
+    Submission mPrevious;
+};
+
+Metrics computeMetrics(const std::vector<FrameRecord>& frames, int warmupFrames) {
+    Metrics metrics;
+    metrics.framesSubmitted = frames.size();
+
+    double latencySum = 0;
+    double pacingErrorSum = 0;
+    int intervals = 0;
+    const FrameRecord* previous = nullptr;
+    const FrameRecord* first = nullptr;
+    for (int i = warmupFrames; i < static_cast<int>(frames.size()); ++i) {
+        const FrameRecord& frame = frames[i];
+        if (!frame.presented) {
+            continue;
+        }
+        ++metrics.framesPresented;
+        const double latency = toMs(frame.present - frame.start);
+        latencySum += latency;
+        metrics.maxLatencyMs = std::max(metrics.maxLatencyMs, latency);
+
+        if (previous) {
+            const nanoseconds shownFor = frame.present - previous->present;
+            pacingErrorSum += std::abs(toMs(shownFor - frame.swapInterval));
+            ++intervals;
+            const nanoseconds late = shownFor - frame.swapInterval;
+            if (late >= frame.refreshPeriod / 2) {
+                metrics.droppedFrames += (late + frame.refreshPeriod / 2) / frame.refreshPeriod;
+            }
+        } else {
+            first = &frame;
+        }
+        previous = &frame;
+    }
+
+    if (metrics.framesPresented > 0) {
+        metrics.meanLatencyMs = latencySum / metrics.framesPresented;
+    }
+    if (intervals > 0) {
+        metrics.pacingErrorMs = pacingErrorSum / intervals;
+        metrics.fps = intervals / (toMs(previous->present - first->present) / 1000);
+    }
+    return metrics;
+}
+
+} // anonymous namespace
+
+Metrics runScenario(const Scenario& scenario,
+                    const swappy::SwapIntervalConfig& config,
+                    bool lowLatencyMode,
+                    int warmupFrames) {
+    auto clock = std::make_shared<SimClock>();
+    SimDisplay display(*clock, scenario.display);
+
+    swappy::SwappyCommonSettings settings;
+    settings.sdkVersion = SDK_VERSION;
+    settings.refreshPeriod = display.refreshPeriod();
+    settings.appVsyncOffset = scenario.display.appOffset;
+    settings.sfVsyncOffset = scenario.display.sfOffset;
+
+    std::unique_ptr<swappy::SwappyDisplayManager> displayManager;
+    if (scenario.display.refreshPeriods.size() > 1) {
+        displayManager = std::make_unique<swappy::SwappyDisplayManager>(nullptr, nullptr);
+    }
+
+    swappy::SwappyCommon swappy(settings, clock, std::move(displayManager));
+    if (!swappy.isValid()) {
+        fprintf(stderr, "%s: SwappyCommon failed to initialize\n", scenario.name.c_str());
+        return {};
+    }
+    swappy.setAutoSwapIntervalConfig(config);
+    swappy.setLowLatencyMode(lowLatencyMode);
+    swappy::Settings::getInstance()->setSwapIntervalNS(scenario.swapInterval.count());
+
+    SimGpu gpu(*clock);
+    const swappy::SwappyCommon::SwapHandlers handlers = {
+            .lastFrameIsComplete = [&]() { return gpu.lastFrameIsComplete(); },
+            .getPrevFrameGpuTime = [&]() { return gpu.prevFrameGpuTime(); },
+    };
+
+    std::vector<FrameRecord> frames(scenario.numFrames);
+    display.setPresentCallback([&](const SimDisplay::Frame& frame, time_point presentTime) {
+        FrameRecord& record = frames[frame.id];
+        record.present = presentTime;
+        record.refreshPeriod = display.refreshPeriod();
+        record.presented = true;
+    });
+
+    std::mt19937 rng(1234);
+    int swapIntervalChanges = 0;
+    uint64_t swapInterval = swappy.getSwapIntervalNS();
+    for (int i = 0; i < scenario.numFrames; ++i) {
+        const FrameCost cost = scenario.workload(i, rng);
+        frames[i].start = clock->now();
+        clock->sleepUntil(frames[i].start + cost.cpu);
+
+        swappy.onPreSwap(handlers);
+
+        SimDisplay::Frame frame = {i, {}, {}};
+        // As SwappyGL::setPresentationTime, which leaves it out when too close to the vsync
+        if (swappy.needToSetPresentationTime() &&
+            swappy.getPresentationTime() - clock->now() >=
+                    swappy.getRefreshPeriod() - scenario.display.sfOffset) {
+            frame.desiredPresentTime = swappy.getPresentationTime();
+        }
+
+        // Queueing blocks until the compositor has taken a buffer
+        clock->runUntil([&]() { return display.queuedFrames() < MAX_QUEUED_FRAMES; });
+        frame.gpuDone = gpu.submit(cost.gpu);
+        frames[i].swapInterval = nanoseconds(swappy.getSwapIntervalNS());
+        display.queueFrame(frame);
+
+        swappy.onPostSwap(handlers);
+
+        if (swappy.getSwapIntervalNS() != swapInterval) {
+            swapInterval = swappy.getSwapIntervalNS();
+            ++swapIntervalChanges;
+        }
+    }
+
+    // Let the last frames reach the screen
+    clock->runUntil([&]() { return display.queuedFrames() == 0; });
+
+    Metrics metrics = computeMetrics(frames, warmupFrames);
+    metrics.swapIntervalChanges = swapIntervalChanges;
+    metrics.modeSwitches = display.modeSwitches();
+    return metrics;
+}
+
+} // namespace swappy_sim
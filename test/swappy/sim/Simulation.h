@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "SimDisplay.h"
+#include "SwapIntervalController.h"
+
+namespace swappy_sim {
+
+struct FrameCost {
+    std::chrono::nanoseconds cpu;
+    std::chrono::nanoseconds gpu;
+};
+
+struct Scenario {
+    std::string name;
+    SimDisplay::Config display;
+    // The shortest swap interval the app allows, as set with SwappyGL_setSwapIntervalNS
+    std::chrono::nanoseconds swapInterval;
+    int numFrames;
+    // Whether the work only jitters, without steps or hitches, so low latency mode has no reason
+    // to drop more frames than normal pacing
+    bool steady = false;
+    // Work for each frame. The generator is seeded the same way for every run.
+    std::function<FrameCost(int frame, std::mt19937& rng)> workload;
+};
+
+struct Metrics {
+    int framesSubmitted = 0;
+    int framesPresented = 0;
+    double fps = 0;
+    // From the start of the CPU work for a frame to it being shown
+    double meanLatencyMs = 0;
+    double maxLatencyMs = 0;
+    // Refreshes on which a new frame was due, at the swap interval Swappy was pacing to, but
+    // the previous one was still shown
+    int droppedFrames = 0;
+    // Mean difference between the time each frame was shown for and the swap interval
+    double pacingErrorMs = 0;
+    int swapIntervalChanges = 0;
+    int modeSwitches = 0;
+};
+
+// Run the app loop of a scenario against SwappyCommon on a virtual clock: the CPU work, then
+// onPreSwap, queueing the frame to the display once a buffer is free, and onPostSwap. The GPU
+// works through the frames in order, and stands in for the EGL fence that Swappy waits on.
+// Metrics skip the first warmupFrames, while Swappy settles.
+Metrics runScenario(const Scenario& scenario,
+                    const swappy::SwapIntervalConfig& config,
+                    bool lowLatencyMode = false,
+                    int warmupFrames = 60);
+
+} // namespace swappy_sim
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Host stand-in for the JNI types that the Swappy headers mention. Nothing here can be called:
+// the simulation only builds the parts of Swappy that don't use JNI.
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint8_t jboolean;
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef float jfloat;
+typedef double jdouble;
+
+class _jobject {};
+typedef _jobject* jobject;
+typedef jobject jclass;
+typedef jobject jstring;
+typedef jobject jarray;
+typedef jarray jobjectArray;
+typedef jarray jintArray;
+typedef jarray jlongArray;
+typedef jarray jfloatArray;
+
+struct _jfieldID;
+typedef struct _jfieldID* jfieldID;
+struct _jmethodID;
+typedef struct _jmethodID* jmethodID;
+
+struct _JNIEnv;
+typedef _JNIEnv JNIEnv;
+struct _JavaVM;
+typedef _JavaVM JavaVM;
+
+#define JNIEXPORT __attribute__ ((visibility ("default")))
+#define JNICALL
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Runs Swappy's pacing against simulated displays and workloads, and prints latency, dropped
+// frames and pacing error for each scenario and frame time estimate, with and without low
+// latency mode.
+// Runs are deterministic, so the output can be compared before and after a change. Exits with an
+// error if low latency mode drops more frames than normal pacing on a steady scenario.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Simulation.h"
+
+using namespace swappy_sim;
+using namespace std::chrono_literals;
+using std::chrono::nanoseconds;
+
+namespace {
+
+constexpr nanoseconds PERIOD_60HZ = 16666667ns;
+constexpr nanoseconds PERIOD_90HZ = 11111111ns;
+constexpr nanoseconds PERIOD_120HZ = 8333333ns;
+
+// Normally distributed around mean, and never below a tenth of it
+nanoseconds jitter(nanoseconds mean, nanoseconds stddev, std::mt19937& rng) {
+    std::normal_distribution<double> dist(mean.count(), stddev.count());
+    return std::max(mean / 10, nanoseconds(static_cast<int64_t>(dist(rng))));
+}
+
+SimDisplay::Config display60() {
+    SimDisplay::Config config;
+    config.refreshPeriods = {PERIOD_60HZ};
+    config.appOffset = 1ms;
+    config.sfOffset = 4ms;
+    return config;
+}
+
+std::vector<Scenario> scenarios() {
+    std::vector<Scenario> result;
+
+    // Load that steps through what fits 120, 90 and 60Hz and back, on a display that can switch
+    // between them
+    {
+        Scenario s;
+        s.name = "variable-refresh";
+        s.display = display60();
+        s.display.refreshPeriods = {PERIOD_60HZ, PERIOD_90HZ, PERIOD_120HZ};
+        s.swapInterval = PERIOD_120HZ;
+        s.numFrames = 2400;
+        s.workload = [](int frame, std::mt19937& rng) {
+            static const nanoseconds cpu[] = {3ms, 6ms, 10ms, 3ms};
+            static const nanoseconds gpu[] = {4ms, 7ms, 12ms, 4ms};
+            const int phase = frame / 600;
+            return FrameCost{jitter(cpu[phase], 500us, rng), jitter(gpu[phase], 500us, rng)};
+        };
+        result.push_back(s);
+    }
+
+    // CPU and GPU work that fits in a 60Hz refresh without pipelining
+    {
+        Scenario s;
+        s.name = "steady";
+        s.display = display60();
+        s.swapInterval = PERIOD_60HZ;
+        s.numFrames = 1800;
+        s.steady = true;
+        s.workload = [](int frame, std::mt19937& rng) {
+            return FrameCost{jitter(5ms, 500us, rng), jitter(6ms, 500us, rng)};
+        };
+        result.push_back(s);
+    }
+
+    // GPU work that doesn't fit in a 60Hz refresh
+    {
+        Scenario s;
+        s.name = "gpu-bound";
+        s.display = display60();
+        s.swapInterval = PERIOD_60HZ;
+        s.numFrames = 1800;
+        s.steady = true;
+        s.workload = [](int frame, std::mt19937& rng) {
+            return FrameCost{jitter(4ms, 500us, rng), jitter(19ms, 1500us, rng)};
+        };
+        result.push_back(s);
+    }
+
+    // CPU work that fits 60Hz once pipelined, with a hitch one frame in twenty
+    {
+        Scenario s;
+        s.name = "cpu-bound";
+        s.display = display60();
+        s.swapInterval = PERIOD_60HZ;
+        s.numFrames = 1800;
+        s.workload = [](int frame, std::mt19937& rng) {
+            std::uniform_real_distribution<double> u(0, 1);
+            const nanoseconds cpu = u(rng) < 0.05 ? 25ms : jitter(12ms, 1ms, rng);
+            return FrameCost{cpu, jitter(4ms, 500us, rng)};
+        };
+        result.push_back(s);
+    }
+
+    return result;
+}
+
+std::string estimateName(swappy::SwapIntervalConfig::Estimate estimate) {
+    switch (estimate) {
+        case swappy::SwapIntervalConfig::Estimate::Mean: return "mean";
+        case swappy::SwapIntervalConfig::Estimate::Percentile: return "percentile";
+        case swappy::SwapIntervalConfig::Estimate::Ewma: return "ewma";
+    }
+    return "";
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const swappy::SwapIntervalConfig::Estimate estimates[] = {
+            swappy::SwapIntervalConfig::Estimate::Mean,
+            swappy::SwapIntervalConfig::Estimate::Percentile,
+            swappy::SwapIntervalConfig::Estimate::Ewma,
+    };
+
+    printf("%-18s %-13s %7s %7s %9s %9s %8s %9s %9s %6s\n",
+           "scenario", "estimate", "frames", "fps", "lat(ms)", "max(ms)", "dropped",
+           "pace(ms)", "intervals", "modes");
+    int failures = 0;
+    for (const auto& scenario : scenarios()) {
+        int droppedFrames[sizeof(estimates) / sizeof(estimates[0])] = {};
+        for (bool lowLatencyMode : {false, true}) {
+            for (size_t i = 0; i < sizeof(estimates) / sizeof(estimates[0]); ++i) {
+                swappy::SwapIntervalConfig config;
+                config.estimate = estimates[i];
+                const Metrics m = runScenario(scenario, config, lowLatencyMode);
+                const std::string name = estimateName(estimates[i]) + (lowLatencyMode ? "+ll" : "");
+                printf("%-18s %-13s %7d %7.2f %9.2f %9.2f %8d %9.3f %9d %6d\n",
+                       scenario.name.c_str(), name.c_str(), m.framesPresented, m.fps,
+                       m.meanLatencyMs, m.maxLatencyMs, m.droppedFrames, m.pacingErrorMs,
+                       m.swapIntervalChanges, m.modeSwitches);
+
+                if (!lowLatencyMode) {
+                    droppedFrames[i] = m.droppedFrames;
+                } else if (scenario.steady && m.droppedFrames > droppedFrames[i]) {
+                    fprintf(stderr, "%s/%s: low latency mode dropped %d frames, against %d\n",
+                            scenario.name.c_str(), name.c_str(), m.droppedFrames,
+                            droppedFrames[i]);
+                    ++failures;
+                }
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "swappy/common/SwapIntervalController.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace swap_interval_controller_test {
+
+using namespace swappy;
+using namespace std::chrono_literals;
+using std::chrono::nanoseconds;
+
+constexpr nanoseconds kRefresh60Hz = 16666667ns;
+
+typedef std::vector<FrameDuration> Trace;
+
+struct ReplayResult {
+    // Changes of swap interval
+    int flips = 0;
+    // Frames that took longer than the swap interval in force when they were drawn
+    int missedDeadlines = 0;
+    // Frame at which the swap interval last changed, or -1
+    int lastFlip = -1;
+    int finalSwapInterval = 0;
+};
+
+// Drive a controller with a trace the way SwappyCommon does: add each frame, then update the
+// swap interval from the estimate and forget the frames if it changed.
+ReplayResult Replay(const SwapIntervalConfig& config, const Trace& trace) {
+    SwapIntervalState state = {kRefresh60Hz, kRefresh60Hz, 1, PipelineMode::Off, true};
+    auto controller = SwapIntervalController::create(config);
+    ReplayResult result;
+    for (size_t i = 0; i < trace.size(); ++i) {
+        const FrameDuration& frame = trace[i];
+        if (frame.getTime(state.pipelineMode) > state.refreshPeriod * state.autoSwapInterval)
+            ++result.missedDeadlines;
+        controller->addFrame(frame);
+        FrameDuration estimate;
+        if (!controller->estimate(estimate))
+            continue;
+        const int32_t before = state.autoSwapInterval;
+        if (updateSwapInterval(estimate, config.margins, state)) {
+            controller->reset();
+            if (state.autoSwapInterval != before) {
+                ++result.flips;
+                result.lastFlip = i;
+            }
+        }
+    }
+    result.finalSwapInterval = state.autoSwapInterval;
+    return result;
+}
+
+SwapIntervalConfig Config(SwapIntervalConfig::Estimate estimate) {
+    SwapIntervalConfig config;
+    config.estimate = estimate;
+    return config;
+}
+
+const SwapIntervalConfig kMean = Config(SwapIntervalConfig::Estimate::Mean);
+const SwapIntervalConfig kPercentile = Config(SwapIntervalConfig::Estimate::Percentile);
+const SwapIntervalConfig kEwma = Config(SwapIntervalConfig::Estimate::Ewma);
+
+// Frames of about the given CPU and GPU time, with a little jitter
+void AppendSteady(Trace& trace, int n, nanoseconds cpu, nanoseconds gpu, std::mt19937& gen) {
+    std::normal_distribution<double> jitter(0, 200000);
+    for (int i = 0; i < n; ++i) {
+        trace.push_back({cpu + nanoseconds(static_cast<int64_t>(jitter(gen))),
+                         gpu + nanoseconds(static_cast<int64_t>(jitter(gen)))});
+    }
+}
+
+// Steady frames with a fraction of them replaced by long hitches
+void AppendWithHitches(Trace& trace, int n, nanoseconds cpu, nanoseconds gpu, double hitchRate,
+                       std::mt19937& gen) {
+    std::uniform_real_distribution<double> u(0, 1);
+    for (int i = 0; i < n; ++i) {
+        if (u(gen) < hitchRate)
+            trace.push_back({100ms, gpu});
+        else
+            AppendSteady(trace, 1, cpu, gpu, gen);
+    }
+}
+
+void Print(const char* scenario, const char* estimate, const ReplayResult& r) {
+    printf("%-16s %-10s flips %2d, missed deadlines %5d, last flip at frame %5d, "
+           "final swap interval %d\n", scenario, estimate, r.flips, r.missedDeadlines, r.lastFlip,
+           r.finalSwapInterval);
+}
+
+TEST(SwapIntervalControllerTest, UpdateSwapInterval) {
+    SwapIntervalMargins margins;
+    SwapIntervalState state = {kRefresh60Hz, kRefresh60Hz, 1, PipelineMode::Off, true};
+    // Fits at 60fps only when pipelined
+    EXPECT_TRUE(updateSwapInterval({10ms, 8ms}, margins, state));
+    EXPECT_EQ(state.pipelineMode, PipelineMode::On);
+    EXPECT_EQ(state.autoSwapInterval, 1);
+    EXPECT_FALSE(updateSwapInterval({10ms, 8ms}, margins, state));
+    // Too slow even when pipelined
+    EXPECT_TRUE(updateSwapInterval({20ms, 8ms}, margins, state));
+    EXPECT_EQ(state.autoSwapInterval, 2);
+    EXPECT_EQ(state.pipelineMode, PipelineMode::Off);
+    // Fast again, but only just: the hysteresis keeps us at 30fps
+    EXPECT_FALSE(updateSwapInterval({11ms, 1ms}, margins, state));
+    EXPECT_TRUE(updateSwapInterval({8ms, 1ms}, margins, state));
+    EXPECT_EQ(state.autoSwapInterval, 1);
+    EXPECT_EQ(state.pipelineMode, PipelineMode::Off);
+}
+
+TEST(SwapIntervalControllerTest, ConfigFromPublicStruct) {
+    SwappyAutoSwapIntervalConfig c = {};
+    SwapIntervalConfig config = SwapIntervalConfig::from(c);
+    EXPECT_EQ(config.estimate, SwapIntervalConfig::Estimate::Mean);
+    EXPECT_EQ(config.windowFrames, FrameDurations::DEFAULT_WINDOW);
+    EXPECT_EQ(config.margins.frameMargin, 3ms);
+    c.estimate = SWAPPY_FRAME_TIME_PERCENTILE;
+    c.percentile = 0.75f;
+    c.frame_margin_ns = 1000000;
+    config = SwapIntervalConfig::from(c);
+    EXPECT_EQ(config.estimate, SwapIntervalConfig::Estimate::Percentile);
+    EXPECT_FLOAT_EQ(config.percentile, 0.75);
+    EXPECT_EQ(config.margins.frameMargin, 1ms);
+    EXPECT_EQ(config.margins.edgeHysteresis, 4ms);
+}
+
+TEST(SwapIntervalControllerTest, EstimatesNeedEnoughFrames) {
+    for (auto config: {kMean, kPercentile, kEwma}) {
+        auto controller = SwapIntervalController::create(config);
+        FrameDuration estimate;
+        controller->addFrame({10ms, 5ms});
+        EXPECT_FALSE(controller->estimate(estimate));
+        for (int i = 0; i < 300; ++i)
+            controller->addFrame({10ms, 5ms});
+        ASSERT_TRUE(controller->estimate(estimate));
+        EXPECT_EQ(estimate.getCpuTime(), 10ms);
+        EXPECT_EQ(estimate.getGpuTime(), 5ms);
+        controller->reset();
+        EXPECT_FALSE(controller->estimate(estimate));
+    }
+}
+
+// 60fps content with 2% of frames hitching to 100ms: only the mean is dragged down to 30fps
+TEST(SwapIntervalControllerTest, HitchesDontDropTheFrameRate) {
+    std::mt19937 gen(1);
+    Trace trace;
+    AppendWithHitches(trace, 3000, 12ms, 4ms, 0.02, gen);
+    auto mean = Replay(kMean, trace);
+    auto percentile = Replay(kPercentile, trace);
+    auto ewma = Replay(kEwma, trace);
+    Print("hitches", "mean", mean);
+    Print("hitches", "percentile", percentile);
+    Print("hitches", "ewma", ewma);
+    EXPECT_GT(mean.flips, 0);
+    EXPECT_EQ(percentile.flips, 0);
+    EXPECT_EQ(ewma.flips, 0);
+    EXPECT_EQ(percentile.finalSwapInterval, 1);
+    EXPECT_EQ(ewma.finalSwapInterval, 1);
+}
+
+// Slow frames for a few seconds, then fast ones. The slow frames have to leave a window before
+//  it lets us back to 60fps, so a shorter window, or the EWMA, gets there sooner.
+TEST(SwapIntervalControllerTest, RecoversAfterSlowPatch) {
+    std::mt19937 gen(2);
+    Trace trace;
+    AppendSteady(trace, 300, 25ms, 5ms, gen);
+    AppendSteady(trace, 2000, 8ms, 3ms, gen);
+    SwapIntervalConfig shortWindow = kPercentile;
+    shortWindow.windowFrames = 120;
+    auto mean = Replay(kMean, trace);
+    auto percentile = Replay(kPercentile, trace);
+    auto percentile120 = Replay(shortWindow, trace);
+    auto ewma = Replay(kEwma, trace);
+    Print("slow patch", "mean", mean);
+    Print("slow patch", "percentile", percentile);
+    Print("slow patch", "p/120", percentile120);
+    Print("slow patch", "ewma", ewma);
+    for (auto r: {mean, percentile, percentile120, ewma}) {
+        EXPECT_EQ(r.flips, 2);
+        EXPECT_EQ(r.finalSwapInterval, 1);
+    }
+    EXPECT_LE(percentile.lastFlip, mean.lastFlip);
+    EXPECT_LT(percentile120.lastFlip, mean.lastFlip);
+    EXPECT_LT(ewma.lastFlip, mean.lastFlip);
+}
+
+// A lasting slowdown still moves every estimate to 30fps, without flipping back
+TEST(SwapIntervalControllerTest, FollowsLastingSlowdown) {
+    std::mt19937 gen(3);
+    Trace trace;
+    AppendSteady(trace, 600, 12ms, 4ms, gen);
+    AppendSteady(trace, 2000, 22ms, 6ms, gen);
+    for (auto config: {kMean, kPercentile, kEwma}) {
+        auto r = Replay(config, trace);
+        EXPECT_EQ(r.flips, 1);
+        EXPECT_EQ(r.finalSwapInterval, 2);
+        EXPECT_LT(r.lastFlip, 600 + 400);
+    }
+}
+
+// Frames right at the edge of 60fps don't flip back and forth
+TEST(SwapIntervalControllerTest, NoFlappingAtTheEdge) {
+    std::mt19937 gen(4);
+    Trace trace;
+    AppendSteady(trace, 5000, 13700us, 4ms, gen);
+    for (auto config: {kMean, kPercentile, kEwma}) {
+        auto r = Replay(config, trace);
+        EXPECT_LE(r.flips, 1);
+    }
+}
+
+// Replays a trace recorded on a device, if SWAPPY_TRACE names one. Each line of the file holds
+//  the CPU and GPU time of a frame, in nanoseconds.
+TEST(SwapIntervalControllerTest, RecordedTrace) {
+    const char* path = getenv("SWAPPY_TRACE");
+    if (path == nullptr)
+        return;
+    std::ifstream in(path);
+    ASSERT_TRUE(in.good()) << path;
+    Trace trace;
+    int64_t cpu, gpu;
+    while (in >> cpu >> gpu)
+        trace.push_back({nanoseconds(cpu), nanoseconds(gpu)});
+    Print("recorded", "mean", Replay(kMean, trace));
+    Print("recorded", "percentile", Replay(kPercentile, trace));
+    Print("recorded", "ewma", Replay(kEwma, trace));
+}
+
+} // namespace swap_interval_controller_test
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Host-only: SwappyCommon runs against the simulated display and clock from sim/.
+
+#include "swappy/common/SwappyCommon.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+#include "SimClock.h"
+#include "SimDisplay.h"
+
+namespace swappy_common_test {
+
+using namespace swappy;
+using namespace std::chrono_literals;
+
+constexpr std::chrono::nanoseconds PERIOD_60HZ = 16666667ns;
+
+// The time spent in onPostSwap per frame, with a full auto swap interval window of the given
+// length. Pacing is turned off, so that the frames don't wait for the vsync and what is timed is
+// Swappy's own bookkeeping: adding the frame duration, the swap interval estimate and starting
+// the next frame.
+double postSwapNsPerFrame(size_t window, SwapIntervalConfig::Estimate estimate) {
+    const int kFrames = 200000;
+
+    auto clock = std::make_shared<swappy_sim::SimClock>();
+    swappy_sim::SimDisplay::Config displayConfig;
+    displayConfig.refreshPeriods = {PERIOD_60HZ};
+    swappy_sim::SimDisplay display(*clock, displayConfig);
+
+    SwappyCommonSettings settings;
+    settings.sdkVersion = 30;
+    settings.refreshPeriod = PERIOD_60HZ;
+    settings.appVsyncOffset = 0ns;
+    settings.sfVsyncOffset = 0ns;
+    SwappyCommon swappy(settings, clock, nullptr);
+    EXPECT_TRUE(swappy.isValid());
+
+    SwapIntervalConfig config;
+    config.estimate = estimate;
+    config.windowFrames = window;
+    swappy.setAutoSwapIntervalConfig(config);
+    swappy.setMaxAutoSwapIntervalNS(0ns);
+
+    const SwappyCommon::SwapHandlers handlers = {
+            .lastFrameIsComplete = []() { return true; },
+            .getPrevFrameGpuTime = []() { return 4ms; },
+    };
+
+    std::chrono::nanoseconds total(0);
+    for (int i = 0; i < kFrames; ++i) {
+        clock->sleepUntil(clock->now() + std::chrono::nanoseconds(8000000 + i % 1000));
+        swappy.onPreSwap(handlers);
+        const auto start = std::chrono::steady_clock::now();
+        swappy.onPostSwap(handlers);
+        total += std::chrono::steady_clock::now() - start;
+    }
+    return double(total.count()) / kFrames;
+}
+
+// Not a pass/fail test: prints the per-frame cost for comparison. With the frame durations in a
+// ring, the cost shouldn't grow with the window.
+TEST(SwappyCommonTest, PostSwapBenchmark) {
+    for (size_t window: {60, 300, 1200}) {
+        printf("window %4zu: onPostSwap %.1f ns/frame (mean), %.1f ns/frame (ewma)\n", window,
+               postSwapNsPerFrame(window, SwapIntervalConfig::Estimate::Mean),
+               postSwapNsPerFrame(window, SwapIntervalConfig::Estimate::Ewma));
+    }
+}
+
+} // namespace swappy_common_test
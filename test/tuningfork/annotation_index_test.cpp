@@ -0,0 +1,102 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/annotation_index.h"
+
+#include "gtest/gtest.h"
+
+namespace annotation_index_test {
+
+using namespace tuningfork;
+using annotation_util::kAnnotationError;
+
+TEST(AnnotationIndexTest, IdsInOrderOfFirstUse) {
+    AnnotationIndex index({3, 2}, 1);
+    EXPECT_EQ(index.Size(), 1) << "Empty annotation not pre-registered";
+    EXPECT_EQ(index.GetOrCreate({}), 0);
+    EXPECT_EQ(index.GetOrCreate({2<<3, 1}), 1);
+    EXPECT_EQ(index.GetOrCreate({1<<3, 3}), 2);
+    EXPECT_EQ(index.GetOrCreate({2<<3, 1}), 1);
+    EXPECT_EQ(index.Size(), 3);
+    EXPECT_EQ(index.Serialize(1), (AnnotationIndex::SerializedAnnotation{2<<3, 1}));
+    EXPECT_EQ(index.Serialize(0), AnnotationIndex::SerializedAnnotation{});
+}
+
+TEST(AnnotationIndexTest, FieldOrderDoesNotMatter) {
+    AnnotationIndex index({3, 2}, 1);
+    auto id = index.GetOrCreate({2<<3, 2, 1<<3, 1});
+    EXPECT_EQ(index.GetOrCreate({1<<3, 1, 2<<3, 2}), id);
+    EXPECT_EQ(index.Serialize(id), (AnnotationIndex::SerializedAnnotation{1<<3, 1, 2<<3, 2}));
+    // A padded varint is the same value
+    EXPECT_EQ(index.GetOrCreate({1<<3, 0x81, 0x00, 2<<3, 2}), id);
+}
+
+TEST(AnnotationIndexTest, EnumRanges) {
+    AnnotationIndex index({3, 1000}, 1);
+    EXPECT_EQ(index.GetOrCreate({1<<3, 0}), kAnnotationError);
+    EXPECT_EQ(index.GetOrCreate({1<<3, 4}), kAnnotationError);
+    EXPECT_NE(index.GetOrCreate({2<<3, 0xe8, 0x07}), kAnnotationError) << "Value 1000";
+    EXPECT_EQ(index.GetOrCreate({2<<3, 0xe9, 0x07}), kAnnotationError) << "Value 1001";
+    EXPECT_EQ(index.GetOrCreate({1<<3 | 2, 1, 1}), kAnnotationError) << "Enum as bytes";
+}
+
+TEST(AnnotationIndexTest, NonEnumFields) {
+    // Field 2 has no enum size and field 3 is beyond the sizes given
+    AnnotationIndex index({3, 0}, 1);
+    auto a = index.GetOrCreate({2<<3, 0xff, 0xff, 0xff, 0xff, 0x0f});
+    EXPECT_NE(a, kAnnotationError);
+    auto b = index.GetOrCreate({3<<3 | 2, 2, 'h', 'i'});
+    EXPECT_NE(b, kAnnotationError);
+    EXPECT_NE(a, b);
+    // Field 16 needs a two-byte tag
+    auto c = index.GetOrCreate({0x80, 0x01, 5});
+    EXPECT_NE(c, kAnnotationError);
+    EXPECT_EQ(index.Serialize(c), (AnnotationIndex::SerializedAnnotation{0x80, 0x01, 5}));
+}
+
+TEST(AnnotationIndexTest, Malformed) {
+    AnnotationIndex index({3}, 1);
+    EXPECT_EQ(index.GetOrCreate({1<<3}), kAnnotationError) << "Missing value";
+    EXPECT_EQ(index.GetOrCreate({0<<3, 1}), kAnnotationError) << "Field 0";
+    EXPECT_EQ(index.GetOrCreate({2<<3 | 2, 5, 1}), kAnnotationError) << "Short bytes";
+    EXPECT_EQ(index.GetOrCreate({2<<3 | 3}), kAnnotationError) << "Group";
+    EXPECT_EQ(index.Size(), 1);
+}
+
+TEST(AnnotationIndexTest, ScalesWithDistinctAnnotations) {
+    // 2^32 combinations as a mixed-radix number, which would overflow
+    std::vector<uint32_t> sizes(8, 255);
+    AnnotationIndex index(sizes, 4);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        // Single-byte varints
+        auto id = index.GetOrCreate({1<<3, uint8_t(i % 127 + 1), 8<<3, uint8_t(i / 127 + 1)});
+        ASSERT_EQ(id, i + 1);
+    }
+    EXPECT_EQ(index.Size(), 1001);
+}
+
+TEST(AnnotationIndexTest, Limits) {
+    AnnotationIndex index({}, 1, 3);
+    EXPECT_EQ(index.GetOrCreate({1<<3, 1}), 1);
+    EXPECT_EQ(index.GetOrCreate({1<<3, 2}), 2);
+    EXPECT_EQ(index.GetOrCreate({1<<3, 3}), kAnnotationError) << "Full";
+    EXPECT_EQ(index.GetOrCreate({1<<3, 2}), 2) << "Existing ids still found when full";
+    // Compound ids are the id times the number of keys and must fit in 64 bits
+    AnnotationIndex big({}, 1u << 31, SIZE_MAX);
+    EXPECT_LE(big.MaxSize(), UINT64_MAX / (1u << 31));
+}
+
+} // namespace annotation_index_test
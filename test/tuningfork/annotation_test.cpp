@@ -36,6 +36,13 @@ TEST(Annotation, Setup) {
     TestSetup( { 2, 1, 1 }, { 3, 6, 12 } );
 }
 
+TEST(Annotation, SetupOverflow) {
+    std::vector<uint32_t> radix_mult;
+    EXPECT_EQ(SetUpAnnotationRadixes(radix_mult, {255, 255, 255, 255}), RADIX_OVERFLOW);
+    EXPECT_TRUE(radix_mult.empty());
+    EXPECT_EQ(SetUpAnnotationRadixes(radix_mult, {255, 255, 255}), NO_ERROR);
+}
+
 void CheckEncodeDecode(AnnotationId id,
                        const std::vector<uint32_t>& radix_mult, const std::string& err) {
     SerializedAnnotation ser;
@@ -71,4 +78,11 @@ TEST(Annotation, Decode) {
     CheckGood( {1<<3, 2 }, 2, radix_mult);
     CheckGood( {1<<3, 1, 2<<3, 1}, 4, radix_mult);
     CheckGood( {1<<3, 2, 2<<3, 3, 3<<3, 4}, 59, radix_mult);
+    CheckBad( {2<<3, 4}, radix_mult);
+}
+
+TEST(Annotation, DecodeLargeEnum) {
+    auto radix_mult = TestSetup( {1000} , {1001} );
+    CheckGood( {1<<3, 0xe8, 0x07}, 1000, radix_mult);
+    CheckBad( {1<<3, 0xe9, 0x07}, radix_mult);
 }
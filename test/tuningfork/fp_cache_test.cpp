@@ -0,0 +1,186 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/fp_cache.h"
+#include "tuningfork/serialization_view.h"
+#include "tuningfork/tuningfork_utils.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <utime.h>
+
+namespace fp_cache_test {
+
+using namespace tuningfork;
+
+std::string CachePath() {
+    const char* dir = getenv("TMPDIR");
+    std::string path = dir ? dir : (file_utils::FileExists("/data/local/tmp")
+                                    ? "/data/local/tmp" : "/tmp");
+    path += "/tuningfork_fp_cache_test.bin";
+    file_utils::DeleteFile(path);
+    return path;
+}
+
+std::vector<uint8_t> ReadFile(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(f),
+                                std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string& path, const std::vector<uint8_t>& contents) {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+}
+
+const std::vector<uint8_t> kParams = {8, 1, 16, 2, 24, 3};
+
+FidelityParamCache::Entry TestEntry() {
+    return {"experiment", 1000000, 5000};
+}
+
+TEST(FidelityParamCacheTest, RoundTrip) {
+    FidelityParamCache cache(CachePath());
+    EXPECT_FALSE(cache.Exists());
+    ASSERT_TRUE(cache.Save(kParams.data(), kParams.size(), TestEntry()));
+    EXPECT_TRUE(cache.Exists());
+    size_t n_views = NumSerializationViews();
+    CProtobufSerialization params;
+    FidelityParamCache::Entry entry;
+    ASSERT_TRUE(cache.Load(params, entry));
+    EXPECT_EQ(std::vector<uint8_t>(params.bytes, params.bytes + params.size), kParams);
+    EXPECT_EQ(entry.experiment_id, "experiment");
+    EXPECT_EQ(entry.fetch_time_ms, 1000000);
+    EXPECT_EQ(entry.ttl_ms, 5000);
+    EXPECT_EQ(NumSerializationViews(), n_views + 1);
+    // Replacing the cache leaves the loaded params as they were
+    std::vector<uint8_t> new_params = {8, 7};
+    ASSERT_TRUE(cache.Save(new_params.data(), new_params.size(), TestEntry()));
+    EXPECT_EQ(std::vector<uint8_t>(params.bytes, params.bytes + params.size), kParams);
+    CProtobufSerialization_Free(&params);
+    EXPECT_EQ(NumSerializationViews(), n_views);
+    ASSERT_TRUE(cache.Load(params, entry));
+    EXPECT_EQ(std::vector<uint8_t>(params.bytes, params.bytes + params.size), new_params);
+    CProtobufSerialization_Free(&params);
+    EXPECT_TRUE(cache.Delete());
+    EXPECT_FALSE(cache.Load(params, entry));
+}
+
+TEST(FidelityParamCacheTest, EmptyParams) {
+    FidelityParamCache cache(CachePath());
+    ASSERT_TRUE(cache.Save(nullptr, 0, {"", 1, 1}));
+    CProtobufSerialization params;
+    FidelityParamCache::Entry entry;
+    ASSERT_TRUE(cache.Load(params, entry));
+    EXPECT_EQ(params.size, 0);
+    EXPECT_EQ(entry.experiment_id, "");
+    CProtobufSerialization_Free(&params);
+    cache.Delete();
+}
+
+TEST(FidelityParamCacheTest, RejectsDamagedFiles) {
+    FidelityParamCache cache(CachePath());
+    ASSERT_TRUE(cache.Save(kParams.data(), kParams.size(), TestEntry()));
+    auto good = ReadFile(cache.Path());
+    size_t n_views = NumSerializationViews();
+    CProtobufSerialization params;
+    FidelityParamCache::Entry entry;
+    // Every single bit flip is caught
+    for (size_t i = 0; i < good.size(); ++i) {
+        for (int bit = 0; bit < 8; ++bit) {
+            auto bad = good;
+            bad[i] ^= 1 << bit;
+            WriteFile(cache.Path(), bad);
+            EXPECT_FALSE(cache.Load(params, entry)) << "byte " << i << " bit " << bit;
+        }
+    }
+    // As is every truncation, and trailing garbage
+    for (size_t n = 0; n < good.size(); ++n) {
+        WriteFile(cache.Path(), std::vector<uint8_t>(good.begin(), good.begin() + n));
+        EXPECT_FALSE(cache.Load(params, entry)) << "truncated to " << n;
+    }
+    auto longer = good;
+    longer.push_back(0);
+    WriteFile(cache.Path(), longer);
+    EXPECT_FALSE(cache.Load(params, entry));
+    // The raw params that older versions saved aren't mistaken for a cache
+    WriteFile(cache.Path(), kParams);
+    EXPECT_FALSE(cache.Load(params, entry));
+    EXPECT_EQ(NumSerializationViews(), n_views) << "Rejected files are unmapped";
+    WriteFile(cache.Path(), good);
+    EXPECT_TRUE(cache.Load(params, entry));
+    CProtobufSerialization_Free(&params);
+    cache.Delete();
+}
+
+TEST(FidelityParamCacheTest, MigratesLegacyFile) {
+    FidelityParamCache cache(CachePath());
+    std::string legacy_path = cache.Path() + ".legacy";
+    WriteFile(legacy_path, kParams);
+    cache.Open(legacy_path);
+    EXPECT_FALSE(file_utils::FileExists(legacy_path));
+    CProtobufSerialization params;
+    FidelityParamCache::Entry entry;
+    ASSERT_TRUE(cache.Load(params, entry));
+    EXPECT_EQ(std::vector<uint8_t>(params.bytes, params.bytes + params.size), kParams);
+    EXPECT_EQ(entry.experiment_id, "");
+    EXPECT_TRUE(entry.Stale(FidelityParamCache::NowMs())) << "Refreshed on first use";
+    CProtobufSerialization_Free(&params);
+    // An existing cache wins over a legacy file
+    std::vector<uint8_t> old_params = {8, 7};
+    WriteFile(legacy_path, old_params);
+    cache.Open(legacy_path);
+    EXPECT_FALSE(file_utils::FileExists(legacy_path));
+    ASSERT_TRUE(cache.Load(params, entry));
+    EXPECT_EQ(std::vector<uint8_t>(params.bytes, params.bytes + params.size), kParams);
+    CProtobufSerialization_Free(&params);
+    cache.Delete();
+}
+
+TEST(FidelityParamCacheTest, DeletesAbandonedTempFiles) {
+    FidelityParamCache cache(CachePath());
+    std::string abandoned = cache.Path() + ".abc123";
+    std::string in_progress = cache.Path() + ".def456";
+    std::string other = cache.Path() + ".other.bin";
+    for (auto& path: {abandoned, in_progress, other})
+        WriteFile(path, kParams);
+    time_t old = time(nullptr) - 3600;
+    utimbuf times = {old, old};
+    for (auto& path: {abandoned, other})
+        ASSERT_EQ(utime(path.c_str(), &times), 0);
+    cache.Open();
+    EXPECT_FALSE(file_utils::FileExists(abandoned));
+    EXPECT_TRUE(file_utils::FileExists(in_progress)) << "Recent: may still be being written";
+    EXPECT_TRUE(file_utils::FileExists(other)) << "Not a temporary file";
+    for (auto& path: {in_progress, other})
+        file_utils::DeleteFile(path);
+}
+
+TEST(FidelityParamCacheTest, Staleness) {
+    auto entry = TestEntry();
+    EXPECT_FALSE(entry.Stale(entry.fetch_time_ms));
+    EXPECT_FALSE(entry.Stale(entry.fetch_time_ms + entry.ttl_ms - 1));
+    EXPECT_TRUE(entry.Stale(entry.fetch_time_ms + entry.ttl_ms));
+    EXPECT_TRUE(entry.Stale(entry.fetch_time_ms - 1)) << "Clock went backwards";
+    EXPECT_GT(FidelityParamCache::NowMs(), 1500000000000u) << "Wall clock time";
+}
+
+} // namespace fp_cache_test
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/fpdownload.h"
+#include "socket_http_transport.h"
+
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace fpdownload_test {
+
+using namespace tuningfork;
+using namespace std::chrono;
+
+// A stand-in for the fidelity parameter server on the loopback interface, handling one
+//  connection at a time. Each request is answered by the handler, after an optional delay.
+class LoopbackServer {
+public:
+    struct Response {
+        int code;
+        std::string body;
+        int delay_ms;
+    };
+    typedef std::function<Response(const std::string& headers, const std::string& body)> Handler;
+
+    explicit LoopbackServer(const Handler& handler) : handler_(handler), quit_(false),
+                                                     num_connections_(0), num_requests_(0) {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+        listen(fd_, 4);
+        thread_ = std::thread([this]() { Run(); });
+    }
+    ~LoopbackServer() {
+        quit_ = true;
+        thread_.join();
+        close(fd_);
+    }
+    std::string Url() const {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/v1/applications/x:generate";
+    }
+    int NumConnections() const { return num_connections_; }
+    int NumRequests() const { return num_requests_; }
+
+private:
+    // Wait for fd to be readable, giving up if the server is stopped
+    bool WaitReadable(int fd) {
+        while (!quit_) {
+            pollfd p = {fd, POLLIN, 0};
+            if (poll(&p, 1, 10) > 0)
+                return true;
+        }
+        return false;
+    }
+    void Run() {
+        while (WaitReadable(fd_)) {
+            int conn = accept(fd_, nullptr, nullptr);
+            ++num_connections_;
+            Serve(conn);
+            close(conn);
+        }
+    }
+    void Serve(int conn) {
+        std::string data;
+        char buf[1024];
+        while (WaitReadable(conn)) {
+            ssize_t n = recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return;
+            data.append(buf, n);
+            size_t headers_end = data.find("\r\n\r\n");
+            if (headers_end == std::string::npos)
+                continue;
+            size_t length_start = data.find("Content-Length: ");
+            size_t length = length_start < headers_end ? atoi(data.c_str() + length_start + 16)
+                                                        : 0;
+            if (data.size() < headers_end + 4 + length)
+                continue;
+            ++num_requests_;
+            auto response = handler_(data.substr(0, headers_end),
+                                     data.substr(headers_end + 4, length));
+            data.erase(0, headers_end + 4 + length);
+            for (auto t = steady_clock::now() + milliseconds(response.delay_ms);
+                 steady_clock::now() < t; ) {
+                // Give up early if the client has, as a real server would
+                if (quit_ || recv(conn, buf, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+                    return;
+                std::this_thread::sleep_for(milliseconds(5));
+            }
+            std::string reply = "HTTP/1.1 " + std::to_string(response.code) + " X\r\n"
+                + "Content-Length: " + std::to_string(response.body.size()) + "\r\n\r\n"
+                + response.body;
+            if (send(conn, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+                return;
+        }
+    }
+
+    Handler handler_;
+    int fd_;
+    int port_;
+    std::atomic<bool> quit_;
+    std::atomic<int> num_connections_;
+    std::atomic<int> num_requests_;
+    std::thread thread_;
+};
+
+// {1, 2, 3} in base 64
+const char kParamsResponse[] = R"({"parameters":{"experimentId":"expt",)"
+                               R"("serializedFidelityParameters":"AQID"}})";
+
+HttpRequest Request(const LoopbackServer& server) {
+    return {server.Url(), "key", "{}", 1000};
+}
+
+struct FetchResult {
+    TFErrorCode err;
+    ProtobufSerialization fps;
+    std::string experiment_id;
+    std::vector<steady_clock::time_point> failed_attempts;
+    steady_clock::time_point completed;
+};
+
+// Run a fetch to completion, recording when each attempt failed
+FetchResult Fetch(const LoopbackServer& server, FidelityParamFetcher::Options options,
+                  std::function<void(FidelityParamFetcher&)> while_running = nullptr) {
+    FetchResult result;
+    FidelityParamFetcher fetcher(std::unique_ptr<HttpTransport>(new SocketHttpTransport));
+    EXPECT_TRUE(fetcher.Start(Request(server), options,
+        [&](TFErrorCode err, const ProtobufSerialization& fps, const std::string& id) {
+            result.err = err;
+            result.fps = fps;
+            result.experiment_id = id;
+            result.completed = steady_clock::now();
+        },
+        [&](int attempt, TFErrorCode) {
+            EXPECT_EQ(attempt, result.failed_attempts.size());
+            result.failed_attempts.push_back(steady_clock::now());
+        }));
+    if (while_running)
+        while_running(fetcher);
+    fetcher.Join();
+    EXPECT_TRUE(fetcher.Done());
+    return result;
+}
+
+TEST(FpDownloadTest, SocketTransportReusesConnection) {
+    std::string last_headers, last_body;
+    LoopbackServer server([&](const std::string& headers, const std::string& body) {
+        last_headers = headers;
+        last_body = body;
+        return LoopbackServer::Response{200, kParamsResponse, 0};
+    });
+    SocketHttpTransport transport;
+    for (int i = 0; i < 3; ++i) {
+        HttpResponse response;
+        ASSERT_EQ(transport.Post(Request(server), response), TFERROR_OK);
+        EXPECT_EQ(response.code, 200);
+        EXPECT_EQ(response.body, kParamsResponse);
+    }
+    EXPECT_EQ(last_body, "{}");
+    EXPECT_NE(last_headers.find("POST /v1/applications/x:generate HTTP/1.1"), std::string::npos);
+    EXPECT_NE(last_headers.find("X-Goog-Api-Key: key"), std::string::npos);
+    EXPECT_EQ(server.NumRequests(), 3);
+    EXPECT_EQ(server.NumConnections(), 1);
+    EXPECT_EQ(transport.NumConnections(), 1);
+}
+
+TEST(FpDownloadTest, SocketTransportTimesOut) {
+    LoopbackServer server([](const std::string&, const std::string&) {
+        return LoopbackServer::Response{200, "", 2000};
+    });
+    SocketHttpTransport transport;
+    auto request = Request(server);
+    request.timeout_ms = 50;
+    HttpResponse response;
+    auto start = steady_clock::now();
+    EXPECT_EQ(transport.Post(request, response), TFERROR_TIMEOUT);
+    EXPECT_LT(steady_clock::now() - start, milliseconds(500));
+}
+
+TEST(FpDownloadTest, FetchSucceedsFirstTime) {
+    LoopbackServer server([](const std::string&, const std::string&) {
+        return LoopbackServer::Response{200, kParamsResponse, 0};
+    });
+    auto result = Fetch(server, {100, 1000});
+    EXPECT_EQ(result.err, TFERROR_OK);
+    EXPECT_EQ(result.fps, ProtobufSerialization({1, 2, 3}));
+    EXPECT_EQ(result.experiment_id, "expt");
+    EXPECT_TRUE(result.failed_attempts.empty());
+}
+
+TEST(FpDownloadTest, FetchBacksOff) {
+    // Fail fast twice, then succeed
+    std::atomic<int> n(0);
+    LoopbackServer server([&](const std::string&, const std::string&) {
+        return ++n <= 2 ? LoopbackServer::Response{503, "", 0}
+                        : LoopbackServer::Response{200, kParamsResponse, 0};
+    });
+    auto start = steady_clock::now();
+    auto result = Fetch(server, {50, 5000});
+    EXPECT_EQ(result.err, TFERROR_OK);
+    ASSERT_EQ(result.failed_attempts.size(), 2);
+    EXPECT_EQ(server.NumRequests(), 3);
+    // The second attempt waits out the first one's 50ms timeout and the third the second's
+    //  100ms, so the fetch completes after 150ms.
+    auto elapsed = duration_cast<milliseconds>(result.completed - start).count();
+    EXPECT_GE(elapsed, 150);
+    EXPECT_LT(elapsed, 400);
+    EXPECT_LT(result.failed_attempts[0] - start, milliseconds(40));
+}
+
+TEST(FpDownloadTest, FetchStopsAtDeadline) {
+    LoopbackServer server([&](const std::string&, const std::string&) {
+        return LoopbackServer::Response{500, "", 0};
+    });
+    auto start = steady_clock::now();
+    auto result = Fetch(server, {20, 250});
+    auto elapsed = duration_cast<milliseconds>(result.completed - start).count();
+    EXPECT_EQ(result.err, TFERROR_TIMEOUT);
+    // Attempts start at 0, 20, 60 and 140ms and the next would be at 300
+    EXPECT_EQ(result.failed_attempts.size(), 4);
+    EXPECT_GE(elapsed, 250);
+    EXPECT_LT(elapsed, 450);
+}
+
+TEST(FpDownloadTest, SlowServerIsTimedOutByAttempt) {
+    // The server takes 120ms: too long for the first two attempts but not for the third
+    LoopbackServer server([&](const std::string&, const std::string&) {
+        return LoopbackServer::Response{200, kParamsResponse, 120};
+    });
+    auto result = Fetch(server, {40, 2000});
+    EXPECT_EQ(result.err, TFERROR_OK);
+    EXPECT_EQ(result.failed_attempts.size(), 2);
+}
+
+TEST(FpDownloadTest, CancelIsPrompt) {
+    LoopbackServer server([&](const std::string&, const std::string&) {
+        return LoopbackServer::Response{200, kParamsResponse, 5000};
+    });
+    steady_clock::time_point cancelled;
+    auto result = Fetch(server, {10000, 10000}, [&](FidelityParamFetcher& fetcher) {
+        std::this_thread::sleep_for(milliseconds(50));
+        cancelled = steady_clock::now();
+        fetcher.Cancel();
+    });
+    EXPECT_EQ(result.err, TFERROR_DOWNLOAD_CANCELLED);
+    EXPECT_LT(result.completed - cancelled, milliseconds(200));
+    EXPECT_TRUE(result.failed_attempts.empty());
+}
+
+TEST(FpDownloadTest, CancelDuringBackoff) {
+    LoopbackServer server([&](const std::string&, const std::string&) {
+        return LoopbackServer::Response{500, "", 0};
+    });
+    steady_clock::time_point cancelled;
+    auto result = Fetch(server, {5000, 10000}, [&](FidelityParamFetcher& fetcher) {
+        std::this_thread::sleep_for(milliseconds(50));
+        cancelled = steady_clock::now();
+        fetcher.Cancel();
+    });
+    EXPECT_EQ(result.err, TFERROR_DOWNLOAD_CANCELLED);
+    EXPECT_LT(result.completed - cancelled, milliseconds(200));
+    EXPECT_EQ(result.failed_attempts.size(), 1);
+}
+
+TEST(FpDownloadTest, BadResponse) {
+    LoopbackServer server([](const std::string&, const std::string&) {
+        return LoopbackServer::Response{200, "{\"parameters\":{}}", 0};
+    });
+    auto result = Fetch(server, {10, 100});
+    EXPECT_EQ(result.err, TFERROR_TIMEOUT);
+    EXPECT_GE(result.failed_attempts.size(), 1);
+}
+
+std::string Base64(const ProtobufSerialization& data) {
+    static const char kChars[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string s;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < data.size()) v |= data[i + 1] << 8;
+        if (i + 2 < data.size()) v |= data[i + 2];
+        s += kChars[v >> 18];
+        s += kChars[(v >> 12) & 63];
+        s += i + 1 < data.size() ? kChars[(v >> 6) & 63] : '=';
+        s += i + 2 < data.size() ? kChars[v & 63] : '=';
+    }
+    return s;
+}
+
+TFErrorCode Decode(const std::string& json, ProtobufSerialization& fps, std::string& id) {
+    return DecodeResponse(json, fps, id);
+}
+
+TEST(FpDownloadTest, DecodeLargeParams) {
+    ProtobufSerialization params(100000);
+    for (size_t i = 0; i < params.size(); ++i)
+        params[i] = i * 31 + (i >> 8);
+    for (size_t n : {0, 1, 2, 3, 4, 100000}) {
+        ProtobufSerialization expected(params.begin(), params.begin() + n);
+        std::string json = "{\"parameters\": {\"serializedFidelityParameters\": \""
+                           + Base64(expected) + "\", \"experimentId\": \"e\"}}";
+        ProtobufSerialization fps;
+        std::string id;
+        ASSERT_EQ(Decode(json, fps, id), TFERROR_OK) << n;
+        EXPECT_EQ(fps, expected) << n;
+        EXPECT_EQ(id, "e");
+    }
+}
+
+TEST(FpDownloadTest, DecodeSkipsOtherFields) {
+    // Escaped slashes, line breaks in the base 64, and other fields of every type, including
+    //  ones with the same names elsewhere
+    std::string json = R"({
+      "experimentId": "not this one",
+      "other": [1, -2.5e3, true, false, null, {"parameters": {"experimentId": "nor this"}}],
+      "parameters": {
+        "unknown": {"nested": ["\"quoted\"", "\\"]},
+        "experimentId": "café 😀",
+        "serializedFidelityParameters": "_\/8A\n"
+      },
+      "trailing": "x"
+    })";
+    ProtobufSerialization fps;
+    std::string id;
+    ASSERT_EQ(Decode(json, fps, id), TFERROR_OK);
+    EXPECT_EQ(fps, ProtobufSerialization({0xff, 0xff, 0}));
+    EXPECT_EQ(id, "caf\xc3\xa9 \xf0\x9f\x98\x80");
+}
+
+TEST(FpDownloadTest, DecodeRejectsBadResponses) {
+    const char* bad[] = {
+        "",
+        "[]",
+        R"({"parameters": []})",
+        R"({"parameters": {"experimentId": "e"}})",
+        R"({"parameters": {"serializedFidelityParameters": "AQID"}})",
+        R"({"parameters": {"experimentId": 1, "serializedFidelityParameters": "AQID"}})",
+        R"({"parameters": {"experimentId": "e", "serializedFidelityParameters": "AQI*"}})",
+        R"({"parameters": {"experimentId": "e", "serializedFidelityParameters": "AQIDA"}})",
+        R"({"parameters": {"experimentId": "e", "serializedFidelityParameters": "AQ=D"}})",
+        R"({"parameters": {"experimentId": "e", "serializedFidelityParameters": "AQID"})",
+        R"({"parameters": {"experimentId": "e", "serializedFidelityParameters": "AQID"}} x)",
+        R"({"parameters": {"experimentId": "e\q", "serializedFidelityParameters": "AQID"}})",
+        R"({"parameters": {"experimentId": "e", "serializedFidelityParameters": "AQID})",
+    };
+    for (auto json : bad) {
+        ProtobufSerialization fps;
+        std::string id;
+        EXPECT_EQ(Decode(json, fps, id), TFERROR_NO_FIDELITY_PARAMS) << json;
+    }
+    // Nesting deep enough to overflow the stack isn't followed
+    std::string deep = std::string(100000, '[') + std::string(100000, ']');
+    ProtobufSerialization fps;
+    std::string id;
+    EXPECT_EQ(Decode(deep, fps, id), TFERROR_NO_FIDELITY_PARAMS);
+}
+
+} // namespace fpdownload_test
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/frame_stats.h"
+
+#include "gtest/gtest.h"
+
+#include <random>
+
+namespace frame_stats_test {
+
+using namespace tuningfork;
+
+TEST(FrameStatsTest, Empty) {
+    FrameStats s(16);
+    EXPECT_EQ(s.Count(), 0);
+    EXPECT_EQ(s.Mean(), 0);
+    EXPECT_EQ(s.Percentile(FrameStats::P50), 0);
+}
+
+TEST(FrameStatsTest, FewSamplesAreExact) {
+    FrameStats s(16);
+    s.Add(20);
+    s.Add(10);
+    s.Add(15);
+    EXPECT_EQ(s.Percentile(FrameStats::P50), 15);
+    EXPECT_EQ(s.Percentile(FrameStats::P999), 20);
+    EXPECT_EQ(s.Mean(), 15);
+    EXPECT_EQ(s.Max(), 20);
+    EXPECT_EQ(s.OverBudgetCount(), 1);
+}
+
+TEST(FrameStatsTest, UniformPercentiles) {
+    FrameStats s(30);
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<double> dist(10, 40);
+    for (int i = 0; i < 100000; ++i)
+        s.Add(dist(gen));
+    EXPECT_NEAR(s.Percentile(FrameStats::P50), 25, 0.5);
+    EXPECT_NEAR(s.Percentile(FrameStats::P90), 37, 0.5);
+    EXPECT_NEAR(s.Percentile(FrameStats::P99), 39.7, 0.5);
+    EXPECT_NEAR(s.Mean(), 25, 0.5);
+    EXPECT_LE(s.Max(), 40);
+    EXPECT_NEAR(s.OverBudgetCount(), 100000 / 3, 1000);
+}
+
+TEST(FrameStatsTest, HeavyTail) {
+    // Mostly 16ms frames with 1% jank at 50ms
+    FrameStats s;
+    std::mt19937 gen(42);
+    std::normal_distribution<double> normal(16.6, 0.5);
+    std::uniform_real_distribution<double> u(0, 1);
+    for (int i = 0; i < 100000; ++i)
+        s.Add(u(gen) < 0.01 ? 50 : normal(gen));
+    EXPECT_NEAR(s.Percentile(FrameStats::P50), 16.6, 0.2);
+    EXPECT_LT(s.Percentile(FrameStats::P90), 20);
+    EXPECT_NEAR(s.Percentile(FrameStats::P999), 50, 1);
+    EXPECT_EQ(s.OverBudgetCount(), 0) << "No budget set";
+    s.Clear();
+    EXPECT_EQ(s.Count(), 0);
+    EXPECT_EQ(s.Max(), 0);
+}
+
+} // namespace frame_stats_test
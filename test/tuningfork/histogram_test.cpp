@@ -66,4 +66,146 @@ TEST(HistogramTest, AddOneTo0To10) {
     EXPECT_EQ(h.ToJSON(), kEmpty0To10Json) << "Clear 0-10 histogram bad";
 }
 
+TEST(HistogramTest, SharedArena) {
+    HistogramArena arena;
+    Histogram a(0, 10, 10, &arena);
+    Histogram b(0, 10, 10, &arena);
+    EXPECT_EQ(arena.Size() % HistogramArena::kWordsPerCacheLine, 0) << "Regions not aligned";
+    a.Add(1.0);
+    // Allocating more regions may move the storage
+    for (int i = 0; i < 100; ++i)
+        arena.Allocate(20);
+    EXPECT_EQ(a.ToJSON(), kAdd10To10Json) << "Add 1 0-10 histogram bad after arena growth";
+    EXPECT_EQ(b.ToJSON(), kEmpty0To10Json) << "Histograms in an arena not independent";
+    arena.Clear();
+    EXPECT_EQ(a.Count(), 0) << "Arena clear did not reset count";
+    EXPECT_EQ(a.ToJSON(), kEmpty0To10Json) << "Arena clear did not reset buckets";
+}
+
+TEST(HistogramTest, AutoRangesWhenSampleBufferFull) {
+    HistogramArena arena;
+    Histogram h(0, 0, 8, &arena);
+    auto arena_size = arena.Size();
+    for (int i = 0; i < 9; ++i)
+        h.Add(1.0);
+    EXPECT_EQ(h.Count(), 0) << "Samples counted before auto-ranging";
+    EXPECT_EQ(arena.Size(), arena_size) << "Collecting samples allocated";
+    h.Add(1.0);
+    EXPECT_EQ(h.Count(), 10) << "Auto-ranging did not happen when the sample buffer filled";
+    h.Add(1.0);
+    EXPECT_EQ(h.Count(), 11) << "Sample after auto-ranging not counted";
+}
+
+TEST(HistogramTest, MergeSameRange) {
+    Histogram a(0, 10, 10);
+    Histogram b(0, 10, 10);
+    a.Add(1.5);
+    b.Add(1.5);
+    b.Add(8.5);
+    b.Add(20);
+    a.Merge(b);
+    EXPECT_EQ(a.Count(), 4);
+    EXPECT_EQ(a.Counts()[2], 2);
+    EXPECT_EQ(a.Counts()[9], 1);
+    EXPECT_EQ(a.Counts()[11], 1) << "Overflow not merged";
+    EXPECT_EQ(b.Count(), 3) << "Source changed";
+}
+
+TEST(HistogramTest, MergeIntoAutoRanging) {
+    Histogram a(0, 0, 10);
+    a.Add(1.5);
+    Histogram b(0, 10, 10);
+    b.Add(5.5);
+    a.Merge(b);
+    EXPECT_FALSE(a.AutoRanging()) << "Range not taken from the source";
+    EXPECT_EQ(a.Count(), 2);
+    EXPECT_EQ(a.Counts()[2], 1) << "Held sample not counted";
+    EXPECT_EQ(a.Counts()[6], 1);
+    // And samples held by the source are added as samples
+    Histogram c(0, 0, 10);
+    c.Add(3.5);
+    a.Merge(c);
+    EXPECT_EQ(a.Count(), 3);
+    EXPECT_EQ(a.Counts()[4], 1);
+}
+
+TEST(HistogramTest, MergeDifferentRange) {
+    Histogram a(0, 10, 10);
+    Histogram b(0, 20, 4);
+    b.Add(2); // Bucket [0,5) has its midpoint at 2.5
+    b.Add(-1);
+    a.Merge(b);
+    EXPECT_EQ(a.Count(), 2);
+    EXPECT_EQ(a.Counts()[3], 1);
+    EXPECT_EQ(a.Counts()[0], 1);
+}
+
+// Returns the index of the only non-zero count in the histogram's JSON, or -1
+int OnlyNonZeroBucket(const Histogram& h) {
+    auto json = h.ToJSON();
+    auto cnts = json.substr(json.find("cnts"));
+    int index = -1;
+    int i = 0;
+    for (auto p = cnts.find('['); p != std::string::npos; p = cnts.find(',', p + 1), ++i) {
+        if (cnts[p + 1] != '0') {
+            if (index != -1) return -1;
+            index = i;
+        }
+    }
+    return index;
+}
+
+TEST(HistogramTest, LogLayout) {
+    Histogram h(1, 1024, 10, nullptr, TFBUCKETS_LOG);
+    EXPECT_NEAR(h.BucketUpperBound(0), 1.0, 1e-9);
+    EXPECT_NEAR(h.BucketUpperBound(3), 8.0, 1e-9);
+    EXPECT_NEAR(h.BucketUpperBound(10), 1024.0, 1e-6);
+    h.Add(3.0);
+    EXPECT_EQ(OnlyNonZeroBucket(h), 2) << "3ms should be in [2,4)";
+    h.Clear();
+    h.Add(0.5);
+    EXPECT_EQ(OnlyNonZeroBucket(h), 0) << "Underflow";
+    h.Clear();
+    h.Add(0);
+    EXPECT_EQ(OnlyNonZeroBucket(h), 0) << "Zero should underflow";
+    h.Clear();
+    h.Add(2000);
+    EXPECT_EQ(OnlyNonZeroBucket(h), 11) << "Overflow";
+}
+
+TEST(HistogramTest, LogLayoutMatchesBounds) {
+    // Bucket edges that aren't powers of 2, with several buckets per doubling and fewer than one
+    for (int n: {7, 30, 200}) {
+        Histogram h(0.7, 333, n, nullptr, TFBUCKETS_LOG);
+        for (double ms = 0.5; ms < 400; ms *= 1.0137) {
+            int expected = 0;
+            while (expected <= n && ms >= h.BucketUpperBound(expected))
+                ++expected;
+            // Skip samples within rounding error of an edge
+            if (expected > 0 && ms - h.BucketUpperBound(expected - 1) < 1e-9 * ms) continue;
+            if (expected <= n && h.BucketUpperBound(expected) - ms < 1e-9 * ms) continue;
+            h.Clear();
+            h.Add(ms);
+            EXPECT_EQ(OnlyNonZeroBucket(h), expected) << n << " buckets, " << ms << "ms";
+        }
+    }
+}
+
+TEST(HistogramTest, HdrLayout) {
+    // 32 HDR buckets cover 64 units, so each unit is 1ms
+    Histogram h(10, 74, 32, nullptr, TFBUCKETS_HDR);
+    struct { double ms; int bucket; } cases[] = {
+        {9.9, 0}, {10, 1}, {15.5, 6}, {25.9, 16}, {26, 17}, {30, 19}, {31.9, 19}, {32, 20},
+        {73.9, 32}, {74, 33}, {1e30, 33}};
+    for (auto& c: cases) {
+        h.Clear();
+        h.Add(c.ms);
+        EXPECT_EQ(OnlyNonZeroBucket(h), c.bucket) << c.ms << "ms";
+    }
+    EXPECT_NEAR(h.BucketUpperBound(17), 10 + 18, 1e-9);
+    EXPECT_NEAR(h.BucketUpperBound(32), 74, 1e-9);
+    for (int i = 1; i < 33; ++i)
+        EXPECT_LT(h.BucketUpperBound(i - 1), h.BucketUpperBound(i)) << "Bounds not increasing";
+}
+
 } // namespace histogram_test
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/instrument_key_index.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace instrument_key_index_test {
+
+using namespace tuningfork;
+
+// The linear scan that InstrumentKeyIndex replaced, kept here for comparison
+class LinearKeyScan {
+    std::vector<InstrumentationKey> ikeys_;
+    std::atomic<int> next_ikey_;
+public:
+    LinearKeyScan(uint32_t max_keys) : ikeys_(max_keys), next_ikey_(0) {}
+    TFErrorCode GetOrCreate(InstrumentationKey key, int& index) {
+        int nkeys = next_ikey_;
+        for (int i=0; i<nkeys; ++i) {
+            if (ikeys_[i] == key) {
+                index = i;
+                return TFERROR_OK;
+            }
+        }
+        int next = next_ikey_++;
+        if (next<ikeys_.size()) {
+            ikeys_[next] = key;
+            index = next;
+            return TFERROR_OK;
+        }
+        else {
+            next_ikey_--;
+        }
+        return TFERROR_INVALID_INSTRUMENT_KEY;
+    }
+};
+
+TEST(InstrumentKeyIndexTest, DenseIndicesInOrderOfUse) {
+    InstrumentKeyIndex index(3);
+    int i;
+    EXPECT_EQ(index.GetOrCreate(1000, i), TFERROR_OK);
+    EXPECT_EQ(i, 0);
+    EXPECT_EQ(index.GetOrCreate(7, i), TFERROR_OK);
+    EXPECT_EQ(i, 1);
+    EXPECT_EQ(index.GetOrCreate(1000, i), TFERROR_OK);
+    EXPECT_EQ(i, 0);
+    EXPECT_EQ(index.GetOrCreate(65535, i), TFERROR_OK);
+    EXPECT_EQ(i, 2);
+    EXPECT_EQ(index.GetOrCreate(8, i), TFERROR_INVALID_INSTRUMENT_KEY);
+    std::vector<InstrumentationKey> expected = {1000, 7, 65535};
+    EXPECT_EQ(index.Keys(), expected);
+}
+
+template<typename T>
+double NsPerLookup(T& t, int n_keys) {
+    const int kIterations = 1000000;
+    int index;
+    for (int k = 0; k < n_keys; ++k)
+        t.GetOrCreate(k * 37, index);
+    int sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        // Look up the last key registered: the worst case for the scan
+        t.GetOrCreate((n_keys - 1) * 37, index);
+        sum += index;
+    }
+    auto dt = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(sum, kIterations * (n_keys - 1));
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count())
+        / kIterations;
+}
+
+// Not a pass/fail test: prints timings for comparison
+TEST(InstrumentKeyIndexTest, Benchmark) {
+    for (int n_keys: {1, 8, 64}) {
+        LinearKeyScan scan(n_keys);
+        InstrumentKeyIndex index(n_keys);
+        auto scan_ns = NsPerLookup(scan, n_keys);
+        auto index_ns = NsPerLookup(index, n_keys);
+        std::cout << n_keys << " keys: linear scan " << scan_ns << " ns, direct-mapped "
+                  << index_ns << " ns" << std::endl;
+    }
+}
+
+} // namespace instrument_key_index_test
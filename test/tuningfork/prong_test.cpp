@@ -0,0 +1,231 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/prong.h"
+
+#include "gtest/gtest.h"
+
+namespace prong_test {
+
+using namespace tuningfork;
+
+SerializedAnnotation TestSerializeId(uint64_t id) {
+    return {static_cast<uint8_t>(id / 2)};
+}
+
+TEST(ProngCacheTest, AllocatesOnFirstUse) {
+    const int kMaxKeys = 2;
+    ProngCache pc(1000000, kMaxKeys, {{1, 0, 10, 10}, {2, 0, 20, 10}}, TestSerializeId);
+    EXPECT_EQ(pc.NumProngs(), 0);
+    auto p = pc.Get(101);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(pc.NumProngs(), 1);
+    EXPECT_EQ(p->instrumentation_key_, 1);
+    EXPECT_EQ(p->annotation_, SerializedAnnotation {50});
+    EXPECT_EQ(pc.Get(101), p);
+    EXPECT_EQ(pc.NumProngs(), 1);
+    EXPECT_EQ(pc.Get(1000000), nullptr) << "Out of range id should not be allocated";
+    EXPECT_EQ(pc.NumProngs(), 1);
+}
+
+TEST(ProngCacheTest, LookupSurvivesGrowth) {
+    ProngCache pc(1000000, 1, {}, TestSerializeId);
+    std::vector<Prong*> prongs;
+    for (uint64_t id = 0; id < 5000; id += 7)
+        prongs.push_back(pc.Get(id));
+    EXPECT_EQ(pc.NumProngs(), prongs.size());
+    int i = 0;
+    for (uint64_t id = 0; id < 5000; id += 7)
+        EXPECT_EQ(pc.Get(id), prongs[i++]) << "id " << id;
+    EXPECT_EQ(pc.NumProngs(), prongs.size());
+}
+
+TEST(ProngCacheTest, ClearKeepsProngs) {
+    ProngCache pc(100, 2, {{1, 0, 40, 10}}, TestSerializeId);
+    pc.Get(3)->Trace(std::chrono::milliseconds(20));
+    EXPECT_EQ(pc.Get(3)->Count(), 1);
+    pc.Clear();
+    EXPECT_EQ(pc.Get(3)->Count(), 0);
+    EXPECT_EQ(pc.NumProngs(), 1);
+    pc.SetInstrumentKeys({7, 9});
+    EXPECT_EQ(pc.Get(3)->instrumentation_key_, 9);
+}
+
+std::unique_ptr<ProngCacheRing> TestRing(size_t n,
+                                         ProngCacheRing::FullWindowPolicy policy) {
+    return std::make_unique<ProngCacheRing>(n, policy, [] {
+        return std::make_unique<ProngCache>(100, 2, std::vector<TFHistogram>{{1, 0, 40, 10}},
+                                            TestSerializeId);
+    });
+}
+
+TEST(ProngCacheRingTest, WindowsQueueWhileUploadsPending) {
+    auto ring = TestRing(3, Settings::AggregationStrategy::DROP_WINDOW);
+    EXPECT_EQ(ring->Size(), 3);
+    auto first = ring->Current();
+    first->Get(3)->Trace(std::chrono::milliseconds(20));
+    EXPECT_EQ(ring->Rotate(), first);
+    EXPECT_EQ(first->Epoch(), 0);
+    EXPECT_EQ(first->Get(3)->Count(), 1) << "Closed window is untouched until released";
+    auto second = ring->Current();
+    EXPECT_NE(second, first);
+    EXPECT_EQ(second->Epoch(), 1);
+    EXPECT_EQ(ring->Rotate(), second);
+    EXPECT_EQ(ring->Current()->Epoch(), 2);
+    ring->Release(first);
+    ring->Current()->Get(3)->Trace(std::chrono::milliseconds(20));
+    EXPECT_NE(ring->Rotate(), nullptr);
+    EXPECT_EQ(ring->Current(), first);
+    EXPECT_EQ(first->Get(3)->Count(), 0) << "Reused cache is cleared";
+    EXPECT_EQ(first->Epoch(), 3);
+}
+
+TEST(ProngCacheRingTest, ReusedCacheForgetsLastTick) {
+    auto ring = TestRing(2, Settings::AggregationStrategy::DROP_WINDOW);
+    auto first = ring->Current();
+    TimePoint t(std::chrono::seconds(1));
+    first->Get(3)->Tick(t);
+    first->Get(3)->Tick(t + std::chrono::milliseconds(16));
+    ASSERT_EQ(ring->Rotate(), first);
+    ring->Release(first);
+    auto second = ring->Rotate();
+    ASSERT_NE(second, nullptr);
+    ring->Release(second);
+    ASSERT_EQ(ring->Current(), first);
+    // Two windows later: only the gap between this window's own ticks is recorded
+    t += std::chrono::seconds(100);
+    first->Get(3)->Tick(t);
+    first->Get(3)->Tick(t + std::chrono::milliseconds(20));
+    EXPECT_EQ(first->Get(3)->stats_.Count(), 1);
+    EXPECT_DOUBLE_EQ(first->Get(3)->stats_.Max(), 20);
+    EXPECT_EQ(first->Get(3)->Count(), 1);
+}
+
+TEST(ProngCacheRingTest, DropPolicy) {
+    auto ring = TestRing(2, Settings::AggregationStrategy::DROP_WINDOW);
+    auto first = ring->Rotate();
+    ASSERT_NE(first, nullptr);
+    auto current = ring->Current();
+    current->Get(3)->Trace(std::chrono::milliseconds(20));
+    EXPECT_EQ(ring->Rotate(), nullptr);
+    EXPECT_EQ(ring->Rotate(), nullptr);
+    EXPECT_EQ(ring->Current(), current);
+    EXPECT_EQ(current->Get(3)->Count(), 0);
+    EXPECT_EQ(current->Epoch(), 3);
+    EXPECT_EQ(ring->DroppedWindows(), 2);
+    ring->Release(first);
+    EXPECT_EQ(ring->Rotate(), current);
+    EXPECT_EQ(current->DroppedWindows(), 2);
+    EXPECT_EQ(current->MergedWindows(), 0);
+}
+
+TEST(ProngCacheRingTest, MergePolicy) {
+    auto ring = TestRing(2, Settings::AggregationStrategy::MERGE_WINDOW);
+    auto first = ring->Rotate();
+    ASSERT_NE(first, nullptr);
+    auto current = ring->Current();
+    current->Get(3)->Trace(std::chrono::milliseconds(20));
+    EXPECT_EQ(ring->Rotate(), nullptr);
+    current->Get(3)->Trace(std::chrono::milliseconds(20));
+    EXPECT_EQ(ring->Rotate(), nullptr) << "Retried on the next tick";
+    EXPECT_EQ(current->Get(3)->Count(), 2);
+    EXPECT_EQ(current->Epoch(), 1);
+    ring->Release(first);
+    EXPECT_EQ(ring->Rotate(), current);
+    EXPECT_EQ(current->MergedWindows(), 1) << "Counted once per extended window";
+    EXPECT_EQ(ring->MergedWindows(), 1);
+    // The next full ring is counted again
+    EXPECT_EQ(ring->Rotate(), nullptr);
+    EXPECT_EQ(ring->Rotate(), nullptr);
+    EXPECT_EQ(ring->MergedWindows(), 2);
+}
+
+std::unique_ptr<ProngCache> TestCache() {
+    return std::make_unique<ProngCache>(100, 2, std::vector<TFHistogram>{{1, 0, 40, 10}},
+                                        TestSerializeId);
+}
+
+TEST(SessionCacheTest, WindowsAreMergedAsTheyClose) {
+    SessionCache session(TestCache);
+    auto ring = std::make_unique<ProngCacheRing>(
+        2, Settings::AggregationStrategy::DROP_WINDOW, TestCache,
+        [&](const ProngCache& pc) { session.Merge(pc); });
+    ring->Current()->Get(3)->Trace(std::chrono::milliseconds(20));
+    auto first = ring->Rotate();
+    ring->Current()->Get(3)->Trace(std::chrono::milliseconds(21));
+    ring->Current()->Get(4)->Trace(std::chrono::milliseconds(5));
+    EXPECT_EQ(ring->Rotate(), nullptr) << "Window should be dropped";
+    ring->Release(first);
+    TFSessionHistograms view;
+    session.Acquire(view);
+    EXPECT_EQ(view.n_windows, 2) << "Dropped windows are still part of the session";
+    ASSERT_EQ(view.n_histograms, 2);
+    auto& h = view.histograms[0];
+    EXPECT_EQ(h.count, 2);
+    EXPECT_EQ(h.n_buckets, 12);
+    EXPECT_EQ(h.counts[6], 2);
+    EXPECT_FLOAT_EQ(h.bucket_upper_bounds[6], 24);
+    ASSERT_EQ(h.annotation_size, 1);
+    EXPECT_EQ(h.annotation[0], 1);
+    EXPECT_EQ(view.histograms[1].counts[2], 1);
+    EXPECT_TRUE(session.Release(view));
+    EXPECT_FALSE(session.Release(view));
+}
+
+TEST(SessionCacheTest, MergesAreStagedWhileViewed) {
+    SessionCache session(TestCache);
+    auto window = TestCache();
+    window->Get(3)->Trace(std::chrono::milliseconds(20));
+    session.Merge(*window);
+    TFSessionHistograms view;
+    session.Acquire(view);
+    auto counts = view.histograms[0].counts;
+    // Creates a new prong, which would move the session's counts if it weren't staged
+    window->Get(5)->Trace(std::chrono::milliseconds(20));
+    session.Merge(*window);
+    EXPECT_EQ(session.NumWindows(), 2);
+    EXPECT_EQ(view.n_histograms, 1);
+    EXPECT_EQ(counts[6], 1) << "View changed while held";
+    EXPECT_TRUE(session.Release(view));
+    session.Acquire(view);
+    EXPECT_EQ(view.n_windows, 2);
+    ASSERT_EQ(view.n_histograms, 2);
+    EXPECT_EQ(view.histograms[0].counts[6], 2);
+    EXPECT_EQ(view.histograms[1].counts[6], 1);
+    EXPECT_TRUE(session.Release(view));
+}
+
+TEST(SessionCacheTest, OnlyIssuedViewsAreReleased) {
+    SessionCache session(TestCache);
+    auto window = TestCache();
+    window->Get(3)->Trace(std::chrono::milliseconds(20));
+    session.Merge(*window);
+    TFSessionHistograms view, other;
+    session.Acquire(view);
+    session.Acquire(other);
+    TFSessionHistograms copy = view;
+    EXPECT_FALSE(session.Release(copy)) << "Not the view that was filled in";
+    TFSessionHistograms never_issued = {};
+    EXPECT_FALSE(session.Release(never_issued));
+    EXPECT_TRUE(session.Release(view));
+    EXPECT_FALSE(session.Release(view)) << "Already released";
+    // Released views are zeroed by the caller, and don't match a view still held
+    view = {};
+    EXPECT_FALSE(session.Release(view));
+    EXPECT_TRUE(session.Release(other));
+}
+
+} // namespace prong_test
@@ -7,6 +7,10 @@
 #include "full/dev_tuningfork.pb.h"
 #include "full/tuningfork_clearcut_log.pb.h"
 
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
 namespace serialization_test {
 
 using ::com::google::tuningfork::StringTest;
@@ -156,4 +160,114 @@ TEST(SerializationTest, DeviceInfo) {
     CheckDeviceInfo({"expt", "sess", 2387, 349587, "fing", "version", {1,2,3}, "packname"});
 }
 
+// A cache with n_prongs prongs, each with a few frame times recorded
+std::unique_ptr<ProngCache> TestProngCache(int n_prongs) {
+    std::vector<TFHistogram> settings = {{1, 10, 40, 30, TFBUCKETS_LINEAR, 16.6f}};
+    auto pc = std::make_unique<ProngCache>(2 * n_prongs, 1, settings, [](uint64_t id) {
+        return SerializedAnnotation {8, static_cast<uint8_t>(id % 100)};
+    });
+    for (int i = 0; i < n_prongs; ++i) {
+        auto p = pc->Get(2 * i);
+        for (int j = 0; j < 1 + i % 7; ++j)
+            p->Trace(std::chrono::microseconds(12000 + 1700 * j + 13 * i));
+    }
+    // One that isn't serialized, since it's empty
+    pc->Get(1);
+    return pc;
+}
+
+ExtraUploadInfo TestUploadInfo() {
+    return {"expt", "sess", 2387, 349587, "fing", "version", {1, 2, 3000000000}, "packname",
+            45, 0x10002};
+}
+
+TEST(SerializationTest, SinglePassMatchesNanopb) {
+    auto pc = TestProngCache(50);
+    ProtobufSerialization fps = {1, 2, 3};
+    std::vector<uint8_t> nanopb_ser, ser;
+    ClearcutSerializer::SerializeEventWithNanopb(*pc, fps, TestUploadInfo(), nanopb_ser);
+    ClearcutSerializer::SerializeEvent(*pc, fps, TestUploadInfo(), ser);
+    EXPECT_EQ(ser, nanopb_ser);
+    TuningForkLogEvent evt;
+    ASSERT_TRUE(Deserialize(ser, evt));
+    EXPECT_EQ(evt.histograms_size(), 50);
+    EXPECT_EQ(evt.device_info().cpu_max_freq_hz(2), 3000000000);
+    // Reusing a buffer that is larger than needed
+    ClearcutSerializer::SizeCache sizes;
+    ClearcutSerializer::SerializeEvent(*TestProngCache(3), {}, TestUploadInfo(), ser, sizes);
+    nanopb_ser.clear();
+    ClearcutSerializer::SerializeEventWithNanopb(*TestProngCache(3), {}, TestUploadInfo(),
+                                                 nanopb_ser);
+    EXPECT_EQ(ser, nanopb_ser);
+}
+
+TEST(SerializationTest, WriterStopsAtEnd) {
+    uint8_t buffer[8];
+    memset(buffer, 0xee, sizeof(buffer));
+    ProtoWriter w(buffer, buffer + 4);
+    w.UInt64Field(1, 300); // 3 bytes
+    EXPECT_TRUE(w.Ok());
+    w.FloatField(2, 1.0f); // 5 bytes: only the tag fits
+    EXPECT_FALSE(w.Ok());
+    w.Varint(1);
+    EXPECT_FALSE(w.Ok()) << "Nothing is written after an overrun";
+    EXPECT_LE(w.Position(), buffer + 4);
+    for (int i = 4; i < 8; ++i)
+        EXPECT_EQ(buffer[i], 0xee) << "Wrote past the end at " << i;
+}
+
+TEST(SerializationTest, SparseCounts) {
+    // Mostly empty: sent sparsely
+    auto pc = TestProngCache(1);
+    std::vector<uint8_t> ser;
+    ClearcutSerializer::SerializeEvent(*pc, {}, TestUploadInfo(), ser);
+    TuningForkLogEvent evt;
+    ASSERT_TRUE(Deserialize(ser, evt));
+    ASSERT_EQ(evt.histograms_size(), 1);
+    auto& h = evt.histograms(0);
+    EXPECT_EQ(h.counts_size(), 0);
+    EXPECT_EQ(h.num_buckets(), 32);
+    // One sample at 12ms in the 1ms bucket from 12 to 13ms: 1 underflow bucket + 2 below it
+    std::vector<int> expected = {3, 1};
+    EXPECT_EQ(std::vector<int>(h.sparse_counts().begin(), h.sparse_counts().end()), expected);
+
+    // Every bucket used: sent densely
+    std::vector<TFHistogram> settings = {{1, 0, 10, 10}};
+    ProngCache dense_pc(1, 1, settings, [](uint64_t) { return SerializedAnnotation {}; });
+    for (int i = 0; i < 12; ++i)
+        dense_pc.Get(0)->Trace(std::chrono::microseconds(1000 * i - 500));
+    ClearcutSerializer::SerializeEvent(dense_pc, {}, TestUploadInfo(), ser);
+    ASSERT_TRUE(Deserialize(ser, evt));
+    EXPECT_EQ(evt.histograms(0).counts_size(), 12);
+    EXPECT_EQ(evt.histograms(0).sparse_counts_size(), 0);
+    EXPECT_FALSE(evt.histograms(0).has_num_buckets());
+}
+
+// Not a pass/fail test: prints timings for comparison
+TEST(SerializationTest, Benchmark) {
+    const int kIterations = 20;
+    auto pc = TestProngCache(10000);
+    auto info = TestUploadInfo();
+    ProtobufSerialization fps = {1, 2, 3};
+    std::vector<uint8_t> ser;
+    ClearcutSerializer::SizeCache sizes;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        ser.clear();
+        ClearcutSerializer::SerializeEventWithNanopb(*pc, fps, info, ser);
+    }
+    auto nanopb_dt = std::chrono::steady_clock::now() - start;
+    size_t nanopb_size = ser.size();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i)
+        ClearcutSerializer::SerializeEvent(*pc, fps, info, ser, sizes);
+    auto single_pass_dt = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(ser.size(), nanopb_size);
+    auto us = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / kIterations;
+    };
+    std::cout << "10000 prongs, " << ser.size() << " bytes: nanopb " << us(nanopb_dt)
+              << " us, single pass " << us(single_pass_dt) << " us" << std::endl;
+}
+
 } // namespace serialization_test
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/serialization_view.h"
+#include "tuningfork/tuningfork_utils.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+namespace serialization_view_test {
+
+using namespace tuningfork;
+
+std::string TestPath() {
+    const char* dir = getenv("TMPDIR");
+    std::string path = dir ? dir : (file_utils::FileExists("/data/local/tmp")
+                                    ? "/data/local/tmp" : "/tmp");
+    return path + "/tuningfork_view_test.bin";
+}
+
+void WriteFile(const std::string& path, const std::vector<uint8_t>& contents) {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+}
+
+TEST(SerializationViewTest, MapFile) {
+    auto path = TestPath();
+    std::vector<uint8_t> contents(10000);
+    for (size_t i = 0; i < contents.size(); ++i)
+        contents[i] = i * 7;
+    WriteFile(path, contents);
+    size_t n_views = NumSerializationViews();
+    CProtobufSerialization ser;
+    ASSERT_TRUE(MakeFileView(path, ser));
+    EXPECT_EQ(NumSerializationViews(), n_views + 1);
+    ASSERT_EQ(ser.size, contents.size());
+    EXPECT_EQ(std::vector<uint8_t>(ser.bytes, ser.bytes + ser.size), contents);
+    // Replacing the file doesn't affect the view
+    std::string new_path = path + ".new";
+    WriteFile(new_path, {1, 2, 3});
+    ASSERT_EQ(rename(new_path.c_str(), path.c_str()), 0);
+    EXPECT_EQ(std::vector<uint8_t>(ser.bytes, ser.bytes + ser.size), contents);
+    CProtobufSerialization_Free(&ser);
+    EXPECT_EQ(ser.bytes, nullptr);
+    EXPECT_EQ(ser.size, 0);
+    EXPECT_EQ(NumSerializationViews(), n_views);
+    file_utils::DeleteFile(path);
+}
+
+TEST(SerializationViewTest, EmptyFile) {
+    auto path = TestPath();
+    WriteFile(path, {});
+    CProtobufSerialization ser;
+    ASSERT_TRUE(MakeFileView(path, ser));
+    EXPECT_EQ(ser.size, 0);
+    CProtobufSerialization_Free(&ser);
+    file_utils::DeleteFile(path);
+}
+
+TEST(SerializationViewTest, MissingFile) {
+    auto path = TestPath();
+    file_utils::DeleteFile(path);
+    CProtobufSerialization ser;
+    EXPECT_FALSE(MakeFileView(path, ser));
+}
+
+} // namespace serialization_view_test
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "socket_http_transport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LOG_TAG "FPDownload"
+#include "Log.h"
+
+namespace tuningfork {
+
+namespace {
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+constexpr size_t kMaxResponseSize = 1 << 20;
+
+// Split http://host[:port][/path]
+bool ParseUrl(const std::string& url, std::string& host, std::string& port, std::string& path) {
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0)
+        return false;
+    size_t host_start = scheme.size();
+    size_t path_start = url.find('/', host_start);
+    if (path_start == std::string::npos)
+        path_start = url.size();
+    std::string host_port = url.substr(host_start, path_start - host_start);
+    size_t colon = host_port.rfind(':');
+    if (colon == std::string::npos) {
+        host = host_port;
+        port = "80";
+    } else {
+        host = host_port.substr(0, colon);
+        port = host_port.substr(colon + 1);
+    }
+    path = path_start < url.size() ? url.substr(path_start) : "/";
+    return !host.empty() && !port.empty();
+}
+
+std::string ToLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+} // anonymous namespace
+
+SocketHttpTransport::SocketHttpTransport() : fd_(-1), num_connections_(0) {
+    if (pipe2(cancel_pipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+        ALOGE("Couldn't create cancellation pipe");
+        cancel_pipe_[0] = cancel_pipe_[1] = -1;
+    }
+}
+
+SocketHttpTransport::~SocketHttpTransport() {
+    Close();
+    if (cancel_pipe_[0] != -1) {
+        close(cancel_pipe_[0]);
+        close(cancel_pipe_[1]);
+    }
+}
+
+void SocketHttpTransport::Cancel() {
+    char c = 0;
+    if (write(cancel_pipe_[1], &c, 1) < 0) {
+        // Full, so a cancellation is already pending
+    }
+}
+
+void SocketHttpTransport::Close() {
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+TFErrorCode SocketHttpTransport::Wait(short events, TimePoint deadline) {
+    using namespace std::chrono;
+    while (true) {
+        auto remaining = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+        if (remaining <= 0)
+            return TFERROR_TIMEOUT;
+        pollfd fds[2] = {{fd_, events, 0}, {cancel_pipe_[0], POLLIN, 0}};
+        int n = poll(fds, 2, static_cast<int>(std::min<int64_t>(remaining, INT32_MAX)));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return TFERROR_NO_FIDELITY_PARAMS;
+        if (fds[1].revents & POLLIN)
+            return TFERROR_DOWNLOAD_CANCELLED;
+        if (n > 0)
+            return TFERROR_OK;
+    }
+}
+
+TFErrorCode SocketHttpTransport::Connect(const std::string& host, const std::string& port,
+                                         TimePoint deadline) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addrs;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+        ALOGW("Can't resolve %s", host.c_str());
+        return TFERROR_NO_FIDELITY_PARAMS;
+    }
+    TFErrorCode ret = TFERROR_NO_FIDELITY_PARAMS;
+    for (addrinfo* a = addrs; a != nullptr; a = a->ai_next) {
+        fd_ = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     a->ai_protocol);
+        if (fd_ == -1)
+            continue;
+        if (connect(fd_, a->ai_addr, a->ai_addrlen) == 0) {
+            ret = TFERROR_OK;
+        } else if (errno == EINPROGRESS) {
+            ret = Wait(POLLOUT, deadline);
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (ret == TFERROR_OK
+                && (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0))
+                ret = TFERROR_NO_FIDELITY_PARAMS;
+        }
+        if (ret == TFERROR_OK) {
+            host_ = host;
+            port_ = port;
+            ++num_connections_;
+            break;
+        }
+        Close();
+        if (ret == TFERROR_TIMEOUT || ret == TFERROR_DOWNLOAD_CANCELLED)
+            break;
+    }
+    freeaddrinfo(addrs);
+    return ret;
+}
+
+TFErrorCode SocketHttpTransport::Exchange(const std::string& message, TimePoint deadline,
+                                          HttpResponse& response, bool& nothing_received) {
+    nothing_received = true;
+    for (size_t sent = 0; sent < message.size(); ) {
+        ssize_t n = send(fd_, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            auto ret = Wait(POLLOUT, deadline);
+            if (ret != TFERROR_OK)
+                return ret;
+        } else {
+            return TFERROR_NO_FIDELITY_PARAMS;
+        }
+    }
+    // Read until the headers are complete, then until there's as much body as they say, or
+    //  until the server closes the connection if they don't say.
+    std::string data;
+    size_t body_start = std::string::npos;
+    size_t content_length = std::string::npos;
+    bool keep_alive = false;
+    char buf[4096];
+    while (body_start == std::string::npos || content_length == std::string::npos
+           || data.size() < body_start + content_length) {
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            auto ret = Wait(POLLIN, deadline);
+            if (ret != TFERROR_OK)
+                return ret;
+            continue;
+        }
+        if (n < 0)
+            return TFERROR_NO_FIDELITY_PARAMS;
+        if (n == 0) {
+            // Closed by the server: the end of the body only if it didn't give a length
+            if (body_start == std::string::npos || content_length != std::string::npos)
+                return TFERROR_NO_FIDELITY_PARAMS;
+            break;
+        }
+        nothing_received = false;
+        data.append(buf, n);
+        if (data.size() > kMaxResponseSize)
+            return TFERROR_NO_FIDELITY_PARAMS;
+        if (body_start != std::string::npos)
+            continue;
+        size_t headers_end = data.find("\r\n\r\n");
+        if (headers_end == std::string::npos)
+            continue;
+        body_start = headers_end + 4;
+        // Status line, e.g. HTTP/1.1 200 OK
+        if (data.compare(0, 5, "HTTP/") != 0)
+            return TFERROR_NO_FIDELITY_PARAMS;
+        keep_alive = data.compare(5, 3, "1.0") != 0;
+        size_t code_start = data.find(' ');
+        if (code_start == std::string::npos || code_start > headers_end)
+            return TFERROR_NO_FIDELITY_PARAMS;
+        response.code = atoi(data.c_str() + code_start + 1);
+        size_t line_start = data.find("\r\n") + 2;
+        while (line_start < body_start - 2) {
+            size_t line_end = data.find("\r\n", line_start);
+            size_t colon = data.find(':', line_start);
+            if (colon < line_end) {
+                auto name = ToLower(data.substr(line_start, colon - line_start));
+                size_t value_start = data.find_first_not_of(' ', colon + 1);
+                auto value = ToLower(data.substr(value_start, line_end - value_start));
+                if (name == "content-length")
+                    content_length = strtoull(value.c_str(), nullptr, 10);
+                else if (name == "connection")
+                    keep_alive = value != "close";
+                else if (name == "transfer-encoding" && value != "identity") {
+                    ALOGW("Unsupported transfer encoding %s", value.c_str());
+                    return TFERROR_NO_FIDELITY_PARAMS;
+                }
+            }
+            line_start = line_end + 2;
+        }
+    }
+    if (content_length == std::string::npos)
+        keep_alive = false;
+    else if (data.size() > body_start + content_length)
+        return TFERROR_NO_FIDELITY_PARAMS; // More than we asked for
+    response.body = data.substr(body_start);
+    if (!keep_alive)
+        Close();
+    return TFERROR_OK;
+}
+
+TFErrorCode SocketHttpTransport::Post(const HttpRequest& request, HttpResponse& response) {
+    std::string host, port, path;
+    if (!ParseUrl(request.url, host, port, path)) {
+        ALOGE("Can't make a request to %s", request.url.c_str());
+        return TFERROR_BAD_PARAMETER;
+    }
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::milliseconds(request.timeout_ms);
+    std::stringstream message;
+    message << "POST " << path << " HTTP/1.1\r\n"
+            << "Host: " << host << ":" << port << "\r\n"
+            << "Content-Type: application/json\r\n"
+            << "Content-Length: " << request.body.size() << "\r\n";
+    if (!request.api_key.empty())
+        message << "X-Goog-Api-Key: " << request.api_key << "\r\n";
+    message << "\r\n" << request.body;
+    TFErrorCode ret = TFERROR_DOWNLOAD_CANCELLED;
+    // Waits notice a cancellation, but a request may not need to wait at all
+    pollfd cancel = {cancel_pipe_[0], POLLIN, 0};
+    bool cancelled = poll(&cancel, 1, 0) > 0;
+    while (!cancelled) {
+        bool reusing = fd_ != -1 && host == host_ && port == port_;
+        if (!reusing) {
+            Close();
+            ret = Connect(host, port, deadline);
+            if (ret != TFERROR_OK)
+                break;
+        }
+        bool nothing_received;
+        ret = Exchange(message.str(), deadline, response, nothing_received);
+        if (ret == TFERROR_OK)
+            break;
+        Close();
+        // The server may have closed an idle connection before it saw the request, so make
+        //  one more try on a new connection.
+        if (!reusing || !nothing_received || ret != TFERROR_NO_FIDELITY_PARAMS)
+            break;
+    }
+    // Consume any cancellation, now that this request is over
+    char buf[16];
+    while (read(cancel_pipe_[0], buf, sizeof(buf)) > 0) {}
+    return ret;
+}
+
+} // namespace tuningfork
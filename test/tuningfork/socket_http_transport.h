@@ -0,0 +1,52 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tuningfork/fpdownload.h"
+
+#include <chrono>
+#include <string>
+
+namespace tuningfork {
+
+// HTTP/1.1 straight over a socket, for http:// URLs only, as there is no TLS. It's only built
+//  into the tests, to talk to a local stand-in for the server. The connection is kept open
+//  between requests to the same host and port.
+class SocketHttpTransport : public HttpTransport {
+public:
+    SocketHttpTransport();
+    ~SocketHttpTransport() override;
+    TFErrorCode Post(const HttpRequest& request, HttpResponse& response) override;
+    void Cancel() override;
+    // Connections opened, including reconnections after the server closed one
+    int NumConnections() const { return num_connections_; }
+private:
+    TFErrorCode Connect(const std::string& host, const std::string& port,
+                        std::chrono::steady_clock::time_point deadline);
+    TFErrorCode Exchange(const std::string& message, std::chrono::steady_clock::time_point deadline,
+                         HttpResponse& response, bool& nothing_received);
+    TFErrorCode Wait(short events, std::chrono::steady_clock::time_point deadline);
+    void Close();
+    int fd_;
+    std::string host_;
+    std::string port_;
+    // Cancel writes to this, waking any Post that is waiting on the socket
+    int cancel_pipe_[2];
+    int num_connections_;
+};
+
+} // namespace tuningfork
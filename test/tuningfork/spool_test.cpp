@@ -0,0 +1,176 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/spool.h"
+#include "tuningfork/tuningfork_utils.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace spool_test {
+
+using namespace tuningfork;
+
+std::string SpoolPath() {
+    const char* dir = getenv("TMPDIR");
+    std::string path = dir ? dir : (file_utils::FileExists("/data/local/tmp")
+                                    ? "/data/local/tmp" : "/tmp");
+    path += "/tuningfork_spool_test.bin";
+    file_utils::DeleteFile(path);
+    return path;
+}
+
+ProtobufSerialization Record(int i, size_t size = 100) {
+    return ProtobufSerialization(size, static_cast<uint8_t>(i));
+}
+
+std::vector<ProtobufSerialization> ReplayAll(Spool& spool) {
+    std::vector<ProtobufSerialization> records;
+    spool.Replay([&](const ProtobufSerialization& r) {
+        records.push_back(r);
+        return true;
+    }, SIZE_MAX);
+    return records;
+}
+
+// Stand-in for Clearcut that can be told to fail
+class TestBackend : public Backend {
+public:
+    bool fail = false;
+    std::vector<ProtobufSerialization> uploaded;
+    TFErrorCode Process(const ProtobufSerialization &evt_ser) override {
+        if (fail) return TFERROR_JNI_EXCEPTION;
+        uploaded.push_back(evt_ser);
+        return TFERROR_OK;
+    }
+};
+
+TEST(SpoolTest, Crc32) {
+    const char* s = "123456789";
+    EXPECT_EQ(Crc32(reinterpret_cast<const uint8_t*>(s), 9), 0xCBF43926u);
+    uint32_t crc = Crc32(reinterpret_cast<const uint8_t*>(s), 4);
+    EXPECT_EQ(Crc32(reinterpret_cast<const uint8_t*>(s) + 4, 5, crc), 0xCBF43926u);
+}
+
+TEST(SpoolTest, SurvivesProcessDeath) {
+    auto path = SpoolPath();
+    pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        // Child: spool two records and exit without closing anything
+        Spool spool;
+        bool ok = spool.Open(path, 4096) && spool.Append(Record(1))
+                  && spool.Append(Record(2, 7));
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    Spool spool;
+    ASSERT_TRUE(spool.Open(path, 4096));
+    EXPECT_EQ(spool.NumRecords(), 2);
+    std::vector<ProtobufSerialization> expected = {Record(1), Record(2, 7)};
+    EXPECT_EQ(ReplayAll(spool), expected);
+    EXPECT_EQ(spool.NumRecords(), 0);
+}
+
+TEST(SpoolTest, TornRecordIsDiscarded) {
+    auto path = SpoolPath();
+    {
+        Spool spool;
+        ASSERT_TRUE(spool.Open(path, 4096));
+        spool.Append(Record(1));
+        spool.Append(Record(2));
+    }
+    {
+        // Corrupt the last byte of the second record's payload
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(64 + 112 + 8 + 99);
+        f.put(0);
+    }
+    Spool spool;
+    ASSERT_TRUE(spool.Open(path, 4096));
+    EXPECT_EQ(spool.NumRecords(), 1);
+    std::vector<ProtobufSerialization> expected = {Record(1)};
+    EXPECT_EQ(ReplayAll(spool), expected);
+}
+
+TEST(SpoolTest, EvictsOldestWhenFull) {
+    Spool spool;
+    // Room for 4 records of 112 bytes each, framing included
+    ASSERT_TRUE(spool.Open(SpoolPath(), 64 + 4 * 112));
+    for (int i = 0; i < 10; ++i)
+        EXPECT_TRUE(spool.Append(Record(i)));
+    EXPECT_EQ(spool.NumRecords(), 4);
+    EXPECT_EQ(spool.NumEvicted(), 6);
+    std::vector<ProtobufSerialization> expected = {Record(6), Record(7), Record(8), Record(9)};
+    EXPECT_EQ(ReplayAll(spool), expected);
+    EXPECT_FALSE(spool.Append(Record(0, 1000))) << "Larger than the spool";
+}
+
+TEST(SpoolTest, AppendsDuringReplay) {
+    Spool spool;
+    // Room for 4 records of 112 bytes each, framing included
+    ASSERT_TRUE(spool.Open(SpoolPath(), 64 + 4 * 112));
+    for (int i = 0; i < 4; ++i)
+        EXPECT_TRUE(spool.Append(Record(i)));
+    std::vector<ProtobufSerialization> replayed;
+    // Appending from f would deadlock if the spool were locked. The first append evicts
+    //  record 0, which has already been passed to f, and the second evicts record 1.
+    size_t n = spool.Replay([&](const ProtobufSerialization& r) {
+        replayed.push_back(r);
+        if (replayed.size() == 1) {
+            EXPECT_TRUE(spool.Append(Record(4)));
+            EXPECT_TRUE(spool.Append(Record(5)));
+        }
+        return replayed.size() < 4;
+    }, 3);
+    std::vector<ProtobufSerialization> expected = {Record(0), Record(1), Record(2)};
+    EXPECT_EQ(replayed, expected);
+    // Only record 2 was left to remove
+    EXPECT_EQ(n, 1);
+    expected = {Record(3), Record(4), Record(5)};
+    EXPECT_EQ(ReplayAll(spool), expected);
+}
+
+TEST(SpoolTest, BackendReplaysAfterSuccess) {
+    Spool spool;
+    ASSERT_TRUE(spool.Open(SpoolPath(), 64 * 1024));
+    TestBackend clearcut;
+    SpoolingBackend backend(&clearcut, &spool);
+    clearcut.fail = true;
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(backend.Process(Record(i)), TFERROR_JNI_EXCEPTION);
+    EXPECT_EQ(spool.NumRecords(), 10);
+    clearcut.fail = false;
+    EXPECT_EQ(backend.Process(Record(10)), TFERROR_OK);
+    // The new event, then a batch of the spooled ones, oldest first
+    ASSERT_EQ(clearcut.uploaded.size(), 1 + SpoolingBackend::kReplayBatchSize);
+    EXPECT_EQ(clearcut.uploaded[0], Record(10));
+    EXPECT_EQ(clearcut.uploaded[1], Record(0));
+    EXPECT_EQ(spool.NumRecords(), 10 - SpoolingBackend::kReplayBatchSize);
+    EXPECT_EQ(backend.Process(Record(11)), TFERROR_OK);
+    EXPECT_EQ(spool.NumRecords(), 0);
+    EXPECT_EQ(clearcut.uploaded.back(), Record(9));
+}
+
+} // namespace spool_test
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/tickbuffer.h"
+
+#include "gtest/gtest.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tickbuffer_test {
+
+using namespace tuningfork;
+
+TEST(TickBufferTest, DrainInOrder) {
+    TickBuffer b;
+    for (int i = 0; i < 10; ++i)
+        EXPECT_TRUE(b.Push({1, i, 0, TickRecord::TICK}));
+    std::vector<int64_t> times;
+    EXPECT_EQ(b.Drain([&](const TickRecord& r) { times.push_back(r.time_ns); }), 10);
+    ASSERT_EQ(times.size(), 10);
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(times[i], i);
+    EXPECT_TRUE(b.Empty());
+}
+
+TEST(TickBufferTest, DropsWhenFull) {
+    std::unique_ptr<TickBuffer> b = std::make_unique<TickBuffer>();
+    for (size_t i = 0; i < TickBuffer::kCapacity; ++i)
+        EXPECT_TRUE(b->Push({1, 0, 0, TickRecord::TICK}));
+    EXPECT_FALSE(b->Push({1, 0, 0, TickRecord::TICK}));
+    EXPECT_EQ(b->TakeDropped(), 1);
+    EXPECT_EQ(b->Drain([](const TickRecord&) {}), TickBuffer::kCapacity);
+    EXPECT_TRUE(b->Push({1, 0, 0, TickRecord::TICK}));
+}
+
+TEST(TickAggregatorTest, CollectsFromAllThreads) {
+    const int kThreads = 3;
+    const int kTicksPerThread = 5000;
+    std::vector<int> counts(kThreads);
+    TickAggregator aggregator([&](const TickRecord& r) { ++counts[r.compound_id]; });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&aggregator, t] {
+            for (int i = 0; i < kTicksPerThread; ++i) {
+                aggregator.Record({static_cast<uint64_t>(t), i, 0, TickRecord::TICK});
+                // Give the aggregator a chance to keep up so that nothing is dropped
+                if (i % 256 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    for (auto& t: threads) t.join();
+    aggregator.Drain();
+    for (int t = 0; t < kThreads; ++t)
+        EXPECT_EQ(counts[t], kTicksPerThread) << "Thread " << t;
+}
+
+TEST(TickAggregatorTest, FreesBuffersOfExitedThreads) {
+    int count = 0;
+    TickAggregator aggregator([&](const TickRecord&) { ++count; });
+    for (int i = 0; i < 20; ++i) {
+        std::thread t([&] { aggregator.Record({0, i, 0, TickRecord::TICK}); });
+        t.join();
+    }
+    aggregator.Drain();
+    EXPECT_EQ(count, 20) << "Records from exited threads are still drained";
+    EXPECT_EQ(aggregator.NumBuffers(), 0);
+}
+
+TEST(TickAggregatorTest, ThreadOutlivesAggregator) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool recorded = false, aggregator_gone = false;
+    std::thread t;
+    {
+        TickAggregator aggregator([](const TickRecord&) {});
+        t = std::thread([&] {
+            aggregator.Record({0, 0, 0, TickRecord::TICK});
+            std::unique_lock<std::mutex> lock(mutex);
+            recorded = true;
+            cv.notify_all();
+            // The buffer is retired on exit, after the aggregator has gone
+            cv.wait(lock, [&] { return aggregator_gone; });
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return recorded; });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        aggregator_gone = true;
+        cv.notify_all();
+    }
+    t.join();
+}
+
+TEST(TickAggregatorTest, TryDrainSkipsWhenBusy) {
+    int count = 0;
+    TickAggregator aggregator([&](const TickRecord&) { ++count; });
+    aggregator.Record({0, 0, 0, TickRecord::TICK});
+    bool drained_while_busy = true;
+    aggregator.Drain([&] {
+        aggregator.Record({0, 1, 0, TickRecord::TICK});
+        std::thread other([&] { drained_while_busy = aggregator.TryDrain(); });
+        other.join();
+    });
+    EXPECT_FALSE(drained_while_busy);
+    EXPECT_TRUE(aggregator.TryDrain());
+    EXPECT_EQ(count, 2);
+}
+
+} // namespace tickbuffer_test
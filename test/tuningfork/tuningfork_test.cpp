@@ -25,6 +25,7 @@
 
 #include <vector>
 #include <mutex>
+#include <thread>
 
 #define LOG_TAG "TFTest"
 #include "Log.h"
@@ -102,6 +103,8 @@ TFSettings TestSettings(TFAggregationStrategy::TFSubmissionPolicy method, int n_
     s.aggregation_strategy.method = method;
     s.aggregation_strategy.intervalms_or_count = n_ticks;
     s.aggregation_strategy.max_instrumentation_keys = n_keys;
+    s.aggregation_strategy.n_windows = 0;
+    s.aggregation_strategy.full_window_policy = TFAggregationStrategy::MERGE_WINDOW;
     s.aggregation_strategy.n_annotation_enum_size = annotation_size.size();
     auto n_ann_bytes = sizeof(uint32_t)*annotation_size.size();
     s.aggregation_strategy.annotation_enum_size = (uint32_t*)malloc(n_ann_bytes);
@@ -143,6 +146,39 @@ const TuningForkLogEvent& TestEndToEndWithAnnotation() {
     return testBackend.result;
 }
 
+const TuningForkLogEvent& TestEndToEndWithRegisteredAnnotations() {
+    testBackend.clear();
+    const int NTICKS = 101; // note the first tick doesn't add anything to the histogram
+    auto settings = TestSettings(TFAggregationStrategy::TICK_BASED, NTICKS - 1, 2, {3});
+    tuningfork::Init(settings, extra_upload_info, &testBackend, &paramsLoader, &timeProvider);
+    Annotation ann;
+    ann.set_level(com::google::tuningfork::LEVEL_1);
+    TFAnnotationHandle level1, level2, bad;
+    EXPECT_EQ(tuningfork::RegisterAnnotation(Serialize(ann), level1), TFERROR_OK);
+    ann.set_level(com::google::tuningfork::LEVEL_2);
+    EXPECT_EQ(tuningfork::RegisterAnnotation(Serialize(ann), level2), TFERROR_OK);
+    EXPECT_EQ(tuningfork::RegisterAnnotation({010, 5}, bad), TFERROR_INVALID_ANNOTATION);
+    EXPECT_EQ(bad, TFANNOTATION_HANDLE_NONE);
+    EXPECT_EQ(tuningfork::SetCurrentAnnotation({010, 5}), TFERROR_INVALID_ANNOTATION);
+    EXPECT_EQ(tuningfork::SetCurrentAnnotation(level1 + 1), TFERROR_INVALID_ANNOTATION);
+    EXPECT_EQ(tuningfork::SetCurrentAnnotation(level2), TFERROR_OK);
+    std::unique_lock<std::mutex> lock(*rmutex);
+    // Ticks from another thread use the current annotation...
+    std::thread other([&] {
+        for (int i = 0; i < NTICKS / 2; ++i)
+            tuningfork::FrameTick(TFTICK_SYSCPU);
+    });
+    other.join();
+    // ...while this thread's override applies to its own ticks
+    EXPECT_EQ(tuningfork::SetThreadAnnotation(level1), TFERROR_OK);
+    for (int i = 0; i < NTICKS; ++i)
+        tuningfork::FrameTick(TFTICK_SYSGPU);
+    EXPECT_EQ(tuningfork::SetThreadAnnotation(TFANNOTATION_HANDLE_NONE), TFERROR_OK);
+    // Wait for the upload thread to complete writing the string
+    EXPECT_TRUE(cv->wait_for(lock, test_wait_time)==std::cv_status::no_timeout) << "Timeout";
+    return testBackend.result;
+}
+
 const TuningForkLogEvent& TestEndToEndTimeBased() {
     testBackend.clear();
     const int NTICKS = 101; // note the first tick doesn't add anything to the histogram
@@ -158,6 +194,19 @@ const TuningForkLogEvent& TestEndToEndTimeBased() {
     return testBackend.result;
 }
 
+// Counts from either the counts or sparse_counts field
+std::vector<int> DenseCounts(const TuningForkHistogram& h) {
+    if (h.sparse_counts_size() == 0)
+        return std::vector<int>(h.counts().begin(), h.counts().end());
+    std::vector<int> counts;
+    for (int i = 0; i + 1 < h.sparse_counts_size(); i += 2) {
+        counts.insert(counts.end(), h.sparse_counts(i), 0);
+        counts.push_back(h.sparse_counts(i + 1));
+    }
+    counts.resize(h.num_buckets(), 0);
+    return counts;
+}
+
 void CheckEvent(const std::string& name, const TuningForkLogEvent& result,
                 const TuningForkLogEvent& expected) {
     EXPECT_EQ(result.histograms_size(), expected.histograms_size()) << name << ": N histograms";
@@ -166,9 +215,11 @@ void CheckEvent(const std::string& name, const TuningForkLogEvent& result,
         auto& a = result.histograms(i);
         auto& b = expected.histograms(i);
         EXPECT_EQ(a.instrument_id(), b.instrument_id()) << name << ": histogram " << i << " id";
-        ASSERT_EQ(a.counts_size(), b.counts_size()) << name << ": histogram " << i << " counts";
-        for(int c=0;c<a.counts_size(); ++c) {
-            EXPECT_EQ(a.counts(c), b.counts(c)) << name << ": histogram " << i << " count " << c;
+        auto a_counts = DenseCounts(a);
+        auto b_counts = DenseCounts(b);
+        ASSERT_EQ(a_counts.size(), b_counts.size()) << name << ": histogram " << i << " counts";
+        for(int c=0;c<a_counts.size(); ++c) {
+            EXPECT_EQ(a_counts[c], b_counts[c]) << name << ": histogram " << i << " count " << c;
         }
         ASSERT_EQ(a.has_annotation(), b.has_annotation()) << name << ": annotation";
         if(a.has_annotation()) {
@@ -199,6 +250,55 @@ TEST(TuningForkTest, TestEndToEndWithAnnotation) {
     CheckEvent("Annotation", result, expected);
 }
 
+TEST(TuningForkTest, SessionHistograms) {
+    TestEndToEnd();
+    TFSessionHistograms view;
+    ASSERT_EQ(tuningfork::GetSessionHistograms(view), TFERROR_OK);
+    EXPECT_EQ(view.n_windows, 1);
+    ASSERT_EQ(view.n_histograms, 1);
+    EXPECT_EQ(view.histograms[0].instrument_key, TFTICK_SYSCPU);
+    EXPECT_EQ(view.histograms[0].count, 100);
+    EXPECT_EQ(view.histograms[0].counts[11], 100);
+    EXPECT_EQ(tuningfork::ReleaseSessionHistograms(view), TFERROR_OK);
+    EXPECT_EQ(view.histograms, nullptr);
+    EXPECT_EQ(tuningfork::ReleaseSessionHistograms(view), TFERROR_BAD_PARAMETER);
+}
+
+TEST(TuningForkTest, TestEndToEndWithRegisteredAnnotations) {
+    auto& result = TestEndToEndWithRegisteredAnnotations();
+    TuningForkLogEvent expected = {};
+    auto h = expected.add_histograms();
+    h->set_instrument_id(TFTICK_SYSCPU);
+    for(int i=0;i<32;++i)
+        h->add_counts(i==11?49:0);
+    h->set_annotation("\010\002");
+    h = expected.add_histograms();
+    h->set_instrument_id(TFTICK_SYSGPU);
+    for(int i=0;i<32;++i)
+        h->add_counts(i==11?100:0);
+    h->set_annotation("\010\001");
+    CheckEvent("RegisteredAnnotations", result, expected);
+}
+
+TEST(TuningForkTest, ThreadAnnotationFromEarlierInit) {
+    auto settings = TestSettings(TFAggregationStrategy::TICK_BASED, 100, 2, {3});
+    tuningfork::Init(settings, extra_upload_info, &testBackend, &paramsLoader, &timeProvider);
+    Annotation ann;
+    ann.set_level(com::google::tuningfork::LEVEL_2);
+    TFAnnotationHandle level2;
+    ASSERT_EQ(tuningfork::RegisterAnnotation(Serialize(ann), level2), TFERROR_OK);
+    ASSERT_EQ(tuningfork::SetThreadAnnotation(level2), TFERROR_OK);
+    // Initializing again without annotations invalidates the handle, so ticks from this thread
+    //  go to the default annotation rather than to a stale histogram.
+    auto& result = TestEndToEnd();
+    TuningForkLogEvent expected = {};
+    auto h = expected.add_histograms();
+    h->set_instrument_id(TFTICK_SYSCPU);
+    for(int i=0;i<32;++i)
+        h->add_counts(i==11?100:0);
+    CheckEvent("StaleThreadAnnotation", result, expected);
+}
+
 TEST(TuningForkTest, TestEndToEndTimeBased) {
     auto& result = TestEndToEndTimeBased();
     TuningForkLogEvent expected = {};
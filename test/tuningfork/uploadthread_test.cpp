@@ -0,0 +1,129 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/uploadthread.h"
+
+#include "gtest/gtest.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace uploadthread_test {
+
+using namespace tuningfork;
+
+// Counts uploads and can hold the upload thread inside Process until released
+class BlockingBackend : public Backend {
+public:
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool blocked = false;
+    bool in_process = false;
+    int n_processed = 0;
+    TFErrorCode Process(const ProtobufSerialization &evt_ser) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        in_process = true;
+        cv.notify_all();
+        cv.wait(lock, [this] { return !blocked; });
+        in_process = false;
+        ++n_processed;
+        return TFERROR_OK;
+    }
+    void Block() {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocked = true;
+    }
+    void WaitUntilInProcess() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return in_process; });
+    }
+    void Unblock() {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocked = false;
+        cv.notify_all();
+    }
+};
+
+std::unique_ptr<ProngCache> TestCache() {
+    return std::make_unique<ProngCache>(10, 1, std::vector<TFHistogram>{},
+                                        [](uint64_t) { return SerializedAnnotation {}; });
+}
+
+TEST(UploadThreadTest, WakesOnlyForWork) {
+    BlockingBackend backend;
+    std::mutex mutex;
+    std::condition_variable cv;
+    int n_released = 0;
+    auto a = TestCache();
+    UploadThread thread(&backend, ExtraUploadInfo {}, [&](const ProngCache*) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++n_released;
+        cv.notify_all();
+    });
+    // Each upload is waited for, so the thread goes back to waiting between them. The previous
+    //  implementation also woke on a timer.
+    for (int i = 1; i <= 3; ++i) {
+        EXPECT_TRUE(thread.Submit(a.get()));
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return n_released == i; });
+        EXPECT_LE(thread.Wakeups(), i);
+    }
+    thread.Stop();
+    EXPECT_LE(thread.Wakeups(), 4) << "At most the wakeup for Stop";
+}
+
+TEST(UploadThreadTest, NoWakeupsWhileIdle) {
+    BlockingBackend backend;
+    UploadThread thread(&backend, ExtraUploadInfo {});
+    while (!thread.Waiting())
+        std::this_thread::yield();
+    // Long enough for any periodic wakeup to show up, without holding up the test suite
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(thread.Wakeups(), 0);
+    EXPECT_TRUE(thread.Waiting());
+    EXPECT_EQ(backend.n_processed, 0);
+}
+
+TEST(UploadThreadTest, InOrder) {
+    BlockingBackend backend;
+    std::vector<const ProngCache*> released;
+    auto a = TestCache(), b = TestCache(), c = TestCache(), d = TestCache();
+    {
+        UploadThread thread(&backend, ExtraUploadInfo {},
+                            [&](const ProngCache* pc) { released.push_back(pc); });
+        backend.Block();
+        EXPECT_TRUE(thread.Submit(a.get()));
+        backend.WaitUntilInProcess();
+        // These all queue up while a is being uploaded, and the backend gets the windows in
+        //  the order they were closed.
+        EXPECT_TRUE(thread.Submit(b.get()));
+        EXPECT_TRUE(thread.Submit(c.get()));
+        EXPECT_TRUE(thread.Submit(d.get()));
+        auto wakeups = thread.Wakeups();
+        backend.Unblock();
+        // Stop uploads everything already submitted
+        thread.Stop();
+        EXPECT_LE(thread.Wakeups(), wakeups + 1) << "At most the wakeup for Stop";
+        EXPECT_FALSE(thread.Submit(a.get()));
+    }
+    EXPECT_EQ(backend.n_processed, 4);
+    std::vector<const ProngCache*> expected = {a.get(), b.get(), c.get(), d.get()};
+    EXPECT_EQ(released, expected);
+}
+
+} // namespace uploadthread_test
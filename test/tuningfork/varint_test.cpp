@@ -0,0 +1,129 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tuningfork/annotation_util.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace varint_test {
+
+using namespace annotation_util;
+
+void Encode(uint64_t v, std::vector<uint8_t>& out) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Values of every encoded length from 1 to 10 bytes
+uint64_t RandomValue(std::mt19937_64& gen) {
+    int bits = gen() % 65;
+    return bits == 64 ? gen() : gen() & ((uint64_t(1) << bits) - 1);
+}
+
+TEST(VarintTest, Lengths) {
+    for (int bits = 0; bits <= 64; ++bits) {
+        uint64_t v = bits == 64 ? UINT64_MAX : (uint64_t(1) << bits) - 1;
+        std::vector<uint8_t> bytes;
+        Encode(v, bytes);
+        size_t n = bytes.size();
+        // With and without enough bytes after it for the word-at-a-time path
+        for (size_t padding: {0, 16}) {
+            bytes.resize(n + padding, 0);
+            uint64_t value;
+            auto next = DecodeVarint(bytes.data(), bytes.data() + bytes.size(), value);
+            ASSERT_EQ(next, bytes.data() + n) << bits << " bits";
+            EXPECT_EQ(value, v) << bits << " bits";
+        }
+    }
+}
+
+TEST(VarintTest, Malformed) {
+    uint64_t value;
+    std::vector<uint8_t> truncated {0x80, 0x80};
+    EXPECT_EQ(DecodeVarint(truncated.data(), truncated.data() + 2, value), nullptr);
+    std::vector<uint8_t> too_long(16, 0x80);
+    EXPECT_EQ(DecodeVarint(too_long.data(), too_long.data() + 16, value), nullptr);
+    // A varint running off the end of the range, even though there are bytes after it
+    std::vector<uint8_t> split {0x80, 0x80, 0x01, 0, 0, 0, 0, 0, 0, 0};
+    EXPECT_EQ(DecodeVarint(split.data(), split.data() + 2, value), nullptr);
+}
+
+TEST(VarintTest, FuzzAgainstScalar) {
+    std::mt19937_64 gen(1234);
+    std::vector<uint8_t> bytes(64);
+    for (int i = 0; i < 100000; ++i) {
+        // Random bytes, biased towards continuation bits so that long varints are common
+        for (auto& b: bytes)
+            b = gen() % 4 == 0 ? gen() & 0x7f : gen() | 0x80;
+        size_t n = gen() % bytes.size();
+        auto end = bytes.data() + n;
+        for (auto p = bytes.data(); p < end; ++p) {
+            uint64_t a = 0, b = 0;
+            auto next_a = DecodeVarint(p, end, a);
+            auto next_b = DecodeVarintScalar(p, end, b);
+            ASSERT_EQ(next_a, next_b) << "Iteration " << i;
+            if (next_a != nullptr)
+                ASSERT_EQ(a, b) << "Iteration " << i;
+        }
+    }
+}
+
+template<typename F>
+double MBPerSecond(const std::vector<uint8_t>& bytes, F decode) {
+    const int kIterations = 200;
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i)
+        sum += decode(bytes.data(), bytes.data() + bytes.size());
+    auto dt = std::chrono::steady_clock::now() - start;
+    EXPECT_NE(sum, 0);
+    return double(bytes.size()) * kIterations
+        / std::chrono::duration_cast<std::chrono::microseconds>(dt).count();
+}
+
+// Not a pass/fail test: prints throughput for comparison
+TEST(VarintTest, Benchmark) {
+    std::mt19937_64 gen(7);
+    std::vector<uint8_t> small, mixed;
+    for (int i = 0; i < 100000; ++i) {
+        Encode(gen() % 100, small);
+        Encode(RandomValue(gen), mixed);
+    }
+    auto scalar = [](const uint8_t* p, const uint8_t* end) {
+        uint64_t sum = 0, v;
+        while (p < end && (p = DecodeVarintScalar(p, end, v)) != nullptr) sum += v;
+        return sum;
+    };
+    auto word = [](const uint8_t* p, const uint8_t* end) {
+        uint64_t sum = 0, v;
+        while (p < end && (p = DecodeVarint(p, end, v)) != nullptr) sum += v;
+        return sum;
+    };
+    for (auto data: {&small, &mixed}) {
+        std::cout << (data == &small ? "1-byte" : "mixed") << " varints: scalar "
+                  << MBPerSecond(*data, scalar) << " MB/s, word-at-a-time "
+                  << MBPerSecond(*data, word) << " MB/s" << std::endl;
+    }
+}
+
+} // namespace varint_test